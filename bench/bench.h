@@ -0,0 +1,130 @@
+/* vim:set ft=cpp ts=4 sw=4 sts=4 et cindent: */
+#ifndef BENCH_H
+#define BENCH_H
+/*
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MIT
+ *
+ * Copyright (c) 2010-2013 Alan Antonuk
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include <SimpleAmqpClient/SimpleAmqpClient.h>
+
+#include <boost/chrono.hpp>
+#include <boost/cstdint.hpp>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace bench
+{
+
+/**
+ * Times the operations of one benchmark
+ *
+ * A benchmark does its operation Iterations() times, calling Start just
+ * before and Stop just after each, so setup such as filling a queue is not
+ * counted. Each operation's time is kept to report the latency
+ * distribution, throughput is worked out from their total.
+ */
+class Run
+{
+public:
+    typedef boost::chrono::steady_clock clock;
+
+    Run(const std::string &broker, int port, std::size_t iterations);
+
+    /// The broker host for benchmarks that need one
+    const std::string &Broker() const
+    {
+        return m_broker;
+    }
+
+    /// The broker port
+    int Port() const
+    {
+        return m_port;
+    }
+
+    /// The number of operations to time
+    std::size_t Iterations() const
+    {
+        return m_iterations;
+    }
+
+    void Start()
+    {
+        m_start = clock::now();
+    }
+
+    void Stop()
+    {
+        m_latencies.push_back(boost::chrono::duration_cast<boost::chrono::nanoseconds>(clock::now() - m_start).count());
+    }
+
+    /// Counts bytes moved by the operations, to report bytes per second
+    void AddBytes(boost::uint64_t bytes)
+    {
+        m_bytes += bytes;
+    }
+
+    /// Appends the results as a JSON object to out
+    void WriteJson(const std::string &name, std::string &out);
+
+private:
+    const std::string m_broker;
+    const int m_port;
+    const std::size_t m_iterations;
+    clock::time_point m_start;
+    std::vector<boost::int64_t> m_latencies;
+    boost::uint64_t m_bytes;
+};
+
+typedef void (*function_t)(Run &run, std::size_t argument);
+
+struct Benchmark
+{
+    Benchmark(const std::string &name, function_t function, std::size_t argument,
+              bool needs_broker, std::size_t iterations);
+
+    /// The name results are reported under, with the argument if not 0
+    std::string name;
+    function_t function;
+    /// Passed to function, usually a body size
+    std::size_t argument;
+    bool needs_broker;
+    /// Operations to time unless overridden on the command line
+    std::size_t iterations;
+};
+
+/// BasicMessage, Table and other benchmarks that don't need a broker
+void RegisterMessageBenchmarks(std::vector<Benchmark> &benchmarks);
+
+/// Publish, consume, get and acknowledge benchmarks against a broker
+void RegisterChannelBenchmarks(std::vector<Benchmark> &benchmarks);
+
+} // namespace bench
+
+#endif // BENCH_H
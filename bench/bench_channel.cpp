@@ -0,0 +1,271 @@
+/* vim:set ft=cpp ts=4 sw=4 sts=4 et cindent: */
+/*
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MIT
+ *
+ * Copyright (c) 2010-2013 Alan Antonuk
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "bench.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace AmqpClient;
+
+namespace bench
+{
+
+namespace
+{
+
+// A channel with a private queue to benchmark against, deleted afterwards
+class BrokerFixture
+{
+public:
+    explicit BrokerFixture(const Run &run)
+        : channel(Channel::Create(run.Broker(), run.Port()))
+        , queue(channel->DeclareQueue(""))
+    {}
+
+    ~BrokerFixture()
+    {
+        try
+        {
+            channel->DeleteQueue(queue);
+        }
+        catch (std::exception &)
+        {
+            // The queue is exclusive, so goes with the connection anyway
+        }
+    }
+
+    // Puts count messages on the queue, untimed
+    void Fill(std::size_t count, const BasicMessage::ptr_t &message)
+    {
+        const std::size_t batch_size = 1000;
+        std::vector<std::string> routing_keys(std::min(count, batch_size), queue);
+        while (count > 0)
+        {
+            routing_keys.resize(std::min(count, batch_size));
+            channel->BasicPublishMulti("", routing_keys, message);
+            count -= routing_keys.size();
+        }
+    }
+
+    Channel::ptr_t channel;
+    const std::string queue;
+};
+
+void Publish(Run &run, std::size_t body_size)
+{
+    BrokerFixture fixture(run);
+    BasicMessage::ptr_t message = BasicMessage::Create(std::string(body_size, 'x'));
+    for (std::size_t i = 0; i < run.Iterations(); ++i)
+    {
+        run.Start();
+        fixture.channel->BasicPublish("", fixture.queue, message);
+        run.Stop();
+    }
+    run.AddBytes(static_cast<boost::uint64_t>(body_size) * run.Iterations());
+}
+
+void PublishMulti(Run &run, std::size_t body_size)
+{
+    // Each operation publishes to 100 routing keys, in one round trip
+    BrokerFixture fixture(run);
+    BasicMessage::ptr_t message = BasicMessage::Create(std::string(body_size, 'x'));
+    const std::vector<std::string> routing_keys(100, fixture.queue);
+    for (std::size_t i = 0; i < run.Iterations(); ++i)
+    {
+        run.Start();
+        fixture.channel->BasicPublishMulti("", routing_keys, message);
+        run.Stop();
+        if (0 == i % 100)
+        {
+            fixture.channel->PurgeQueue(fixture.queue);
+        }
+    }
+    run.AddBytes(static_cast<boost::uint64_t>(body_size) * routing_keys.size() * run.Iterations());
+}
+
+// Bodies are received into allocator's buffers, or malloc'd if it is empty
+void ConsumeWith(Run &run, std::size_t body_size, const BodyAllocator::ptr_t &allocator)
+{
+    BrokerFixture fixture(run);
+    fixture.channel->SetBodyAllocator(allocator);
+    fixture.Fill(run.Iterations(), BasicMessage::Create(std::string(body_size, 'x')));
+    const std::string consumer = fixture.channel->BasicConsume(fixture.queue, "", true, true, true, 0);
+    for (std::size_t i = 0; i < run.Iterations(); ++i)
+    {
+        Envelope::ptr_t envelope;
+        run.Start();
+        const bool received = fixture.channel->BasicConsumeMessage(consumer, envelope, 10000);
+        run.Stop();
+        if (!received)
+        {
+            throw std::runtime_error("Consume: timed out waiting for a message");
+        }
+    }
+    run.AddBytes(static_cast<boost::uint64_t>(body_size) * run.Iterations());
+}
+
+void Consume(Run &run, std::size_t body_size)
+{
+    ConsumeWith(run, body_size, BodyAllocator::ptr_t());
+}
+
+void ConsumePooled(Run &run, std::size_t body_size)
+{
+    ConsumeWith(run, body_size, PooledBodyAllocator::Create());
+}
+
+void ConsumeAndAck(Run &run, std::size_t body_size)
+{
+    BrokerFixture fixture(run);
+    fixture.Fill(run.Iterations(), BasicMessage::Create(std::string(body_size, 'x')));
+    const std::string consumer = fixture.channel->BasicConsume(fixture.queue, "", true, false, true, 100);
+    for (std::size_t i = 0; i < run.Iterations(); ++i)
+    {
+        Envelope::ptr_t envelope;
+        run.Start();
+        if (!fixture.channel->BasicConsumeMessage(consumer, envelope, 10000))
+        {
+            throw std::runtime_error("ConsumeAndAck: timed out waiting for a message");
+        }
+        fixture.channel->BasicAck(envelope);
+        run.Stop();
+    }
+    run.AddBytes(static_cast<boost::uint64_t>(body_size) * run.Iterations());
+}
+
+void Ack(Run &run, std::size_t)
+{
+    // Only the acknowledgement is timed, with no prefetch limit so
+    // deliveries are never waiting on one
+    BrokerFixture fixture(run);
+    fixture.Fill(run.Iterations(), BasicMessage::Create("x"));
+    const std::string consumer = fixture.channel->BasicConsume(fixture.queue, "", true, false, true, 0);
+    for (std::size_t i = 0; i < run.Iterations(); ++i)
+    {
+        Envelope::ptr_t envelope;
+        if (!fixture.channel->BasicConsumeMessage(consumer, envelope, 10000))
+        {
+            throw std::runtime_error("Ack: timed out waiting for a message");
+        }
+        run.Start();
+        fixture.channel->BasicAck(envelope);
+        run.Stop();
+    }
+}
+
+void GetWith(Run &run, std::size_t body_size, const BodyAllocator::ptr_t &allocator)
+{
+    BrokerFixture fixture(run);
+    fixture.channel->SetBodyAllocator(allocator);
+    fixture.Fill(run.Iterations(), BasicMessage::Create(std::string(body_size, 'x')));
+    for (std::size_t i = 0; i < run.Iterations(); ++i)
+    {
+        Envelope::ptr_t envelope;
+        run.Start();
+        const bool received = fixture.channel->BasicGet(envelope, fixture.queue);
+        run.Stop();
+        if (!received)
+        {
+            throw std::runtime_error("Get: the queue is unexpectedly empty");
+        }
+    }
+    run.AddBytes(static_cast<boost::uint64_t>(body_size) * run.Iterations());
+}
+
+void Get(Run &run, std::size_t body_size)
+{
+    GetWith(run, body_size, BodyAllocator::ptr_t());
+}
+
+void GetPooled(Run &run, std::size_t body_size)
+{
+    GetWith(run, body_size, PooledBodyAllocator::Create());
+}
+
+void GetAndAck(Run &run, std::size_t body_size)
+{
+    BrokerFixture fixture(run);
+    fixture.Fill(run.Iterations(), BasicMessage::Create(std::string(body_size, 'x')));
+    for (std::size_t i = 0; i < run.Iterations(); ++i)
+    {
+        Envelope::ptr_t envelope;
+        run.Start();
+        if (!fixture.channel->BasicGet(envelope, fixture.queue, false))
+        {
+            throw std::runtime_error("GetAndAck: the queue is unexpectedly empty");
+        }
+        fixture.channel->BasicAck(envelope);
+        run.Stop();
+    }
+    run.AddBytes(static_cast<boost::uint64_t>(body_size) * run.Iterations());
+}
+
+void RoundTrip(Run &run, std::size_t body_size)
+{
+    // Publish to consume latency of a single message through the broker
+    BrokerFixture fixture(run);
+    BasicMessage::ptr_t message = BasicMessage::Create(std::string(body_size, 'x'));
+    const std::string consumer = fixture.channel->BasicConsume(fixture.queue);
+    for (std::size_t i = 0; i < run.Iterations(); ++i)
+    {
+        Envelope::ptr_t envelope;
+        run.Start();
+        fixture.channel->BasicPublish("", fixture.queue, message);
+        const bool received = fixture.channel->BasicConsumeMessage(consumer, envelope, 10000);
+        run.Stop();
+        if (!received)
+        {
+            throw std::runtime_error("RoundTrip: timed out waiting for the message");
+        }
+    }
+    run.AddBytes(static_cast<boost::uint64_t>(body_size) * run.Iterations());
+}
+
+} // namespace
+
+void RegisterChannelBenchmarks(std::vector<Benchmark> &benchmarks)
+{
+    const std::size_t sizes[] = { 16, 1024, 65536 };
+    for (std::size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+    {
+        benchmarks.push_back(Benchmark("Channel/BasicPublish", &Publish, sizes[i], true, 10000));
+        benchmarks.push_back(Benchmark("Channel/BasicConsumeMessage", &Consume, sizes[i], true, 20000));
+        benchmarks.push_back(Benchmark("Channel/BasicConsumeMessage+PooledBodyAllocator", &ConsumePooled, sizes[i], true, 20000));
+        benchmarks.push_back(Benchmark("Channel/BasicGet", &Get, sizes[i], true, 5000));
+        benchmarks.push_back(Benchmark("Channel/BasicGet+PooledBodyAllocator", &GetPooled, sizes[i], true, 5000));
+    }
+    benchmarks.push_back(Benchmark("Channel/BasicPublishMulti", &PublishMulti, 16, true, 1000));
+    benchmarks.push_back(Benchmark("Channel/BasicConsumeMessage+BasicAck", &ConsumeAndAck, 16, true, 20000));
+    benchmarks.push_back(Benchmark("Channel/BasicGet+BasicAck", &GetAndAck, 16, true, 5000));
+    benchmarks.push_back(Benchmark("Channel/BasicAck", &Ack, 0, true, 20000));
+    benchmarks.push_back(Benchmark("Channel/RoundTrip", &RoundTrip, 16, true, 5000));
+}
+
+} // namespace bench
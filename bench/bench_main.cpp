@@ -0,0 +1,311 @@
+/* vim:set ft=cpp ts=4 sw=4 sts=4 et cindent: */
+/*
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MIT
+ *
+ * Copyright (c) 2010-2013 Alan Antonuk
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "bench.h"
+#include "loopback_broker.h"
+
+#include <boost/lexical_cast.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+namespace bench
+{
+
+namespace
+{
+
+void AppendJsonString(std::string &out, const std::string &value)
+{
+    out += '"';
+    for (std::string::const_iterator it = value.begin(); it != value.end(); ++it)
+    {
+        const unsigned char c = static_cast<unsigned char>(*it);
+        if ('"' == c || '\\' == c)
+        {
+            out += '\\';
+            out += *it;
+        }
+        else if (c < 0x20)
+        {
+            char escaped[8];
+            std::sprintf(escaped, "\\u%04x", c);
+            out += escaped;
+        }
+        else
+        {
+            out += *it;
+        }
+    }
+    out += '"';
+}
+
+template <typename T>
+void AppendField(std::string &out, const char *name, const T &value, bool last = false)
+{
+    out += '"';
+    out += name;
+    out += "\": ";
+    out += boost::lexical_cast<std::string>(value);
+    if (!last)
+    {
+        out += ", ";
+    }
+}
+
+// The latency below which the given fraction of operations completed
+boost::int64_t Percentile(const std::vector<boost::int64_t> &sorted, double fraction)
+{
+    const std::size_t index = static_cast<std::size_t>(fraction * (sorted.size() - 1) + 0.5);
+    return sorted[index];
+}
+
+void Usage(const char *program)
+{
+    std::cerr << "Usage: " << program << " [options]\n"
+              << "  --broker HOST     broker to benchmark against, default $AMQP_BROKER or 127.0.0.1\n"
+              << "  --port PORT       the broker's port, default 5672\n"
+              << "  --loopback        benchmark against an in-process loopback broker\n"
+              << "  --latency-us N    with --loopback, microseconds added to each round trip\n"
+              << "  --bandwidth N     with --loopback, bytes per second each way, default unlimited\n"
+              << "  --offline         only run benchmarks that don't need a broker\n"
+              << "  --filter TEXT     only run benchmarks whose name contains TEXT\n"
+              << "  --iterations N    operations to time in each benchmark\n"
+              << "  --output FILE     write the JSON results to FILE rather than stdout\n"
+              << "  --list            list the benchmarks and exit\n";
+}
+
+} // namespace
+
+Run::Run(const std::string &broker, int port, std::size_t iterations) :
+    m_broker(broker),
+    m_port(port),
+    m_iterations(iterations),
+    m_bytes(0)
+{
+    m_latencies.reserve(iterations);
+}
+
+void Run::WriteJson(const std::string &name, std::string &out)
+{
+    std::vector<boost::int64_t> sorted(m_latencies);
+    std::sort(sorted.begin(), sorted.end());
+    boost::int64_t total = 0;
+    for (std::vector<boost::int64_t>::const_iterator it = sorted.begin(); it != sorted.end(); ++it)
+    {
+        total += *it;
+    }
+    const double seconds = total / 1e9;
+
+    out += "    {\"name\": ";
+    AppendJsonString(out, name);
+    out += ", ";
+    AppendField(out, "iterations", sorted.size());
+    AppendField(out, "seconds", seconds);
+    AppendField(out, "ops_per_second", seconds > 0 ? sorted.size() / seconds : 0.0);
+    AppendField(out, "bytes_per_second", seconds > 0 ? m_bytes / seconds : 0.0);
+    out += "\"latency_ns\": {";
+    if (!sorted.empty())
+    {
+        AppendField(out, "min", sorted.front());
+        AppendField(out, "mean", total / static_cast<boost::int64_t>(sorted.size()));
+        AppendField(out, "p50", Percentile(sorted, 0.5));
+        AppendField(out, "p90", Percentile(sorted, 0.9));
+        AppendField(out, "p99", Percentile(sorted, 0.99));
+        AppendField(out, "p999", Percentile(sorted, 0.999));
+        AppendField(out, "max", sorted.back(), true);
+    }
+    out += "}}";
+}
+
+Benchmark::Benchmark(const std::string &name, function_t function, std::size_t argument,
+                     bool needs_broker, std::size_t iterations) :
+    name(0 == argument ? name : name + "/" + boost::lexical_cast<std::string>(argument)),
+    function(function),
+    argument(argument),
+    needs_broker(needs_broker),
+    iterations(iterations)
+{
+}
+
+} // namespace bench
+
+int main(int argc, char *argv[])
+{
+    using namespace bench;
+
+    const char *env_broker = std::getenv("AMQP_BROKER");
+    std::string broker = NULL != env_broker ? env_broker : "127.0.0.1";
+    int port = 5672;
+    bool loopback = false;
+    boost::uint32_t latency = 0;
+    boost::uint64_t bandwidth = 0;
+    bool offline = false;
+    bool list = false;
+    std::string filter;
+    std::size_t iterations = 0;
+    std::string output;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if ("--broker" == arg && has_value)
+        {
+            broker = argv[++i];
+        }
+        else if ("--port" == arg && has_value)
+        {
+            port = std::atoi(argv[++i]);
+        }
+        else if ("--loopback" == arg)
+        {
+            loopback = true;
+        }
+        else if ("--latency-us" == arg && has_value)
+        {
+            latency = static_cast<boost::uint32_t>(std::strtoul(argv[++i], NULL, 10));
+        }
+        else if ("--bandwidth" == arg && has_value)
+        {
+            bandwidth = std::strtoul(argv[++i], NULL, 10);
+        }
+        else if ("--offline" == arg)
+        {
+            offline = true;
+        }
+        else if ("--filter" == arg && has_value)
+        {
+            filter = argv[++i];
+        }
+        else if ("--iterations" == arg && has_value)
+        {
+            iterations = std::strtoul(argv[++i], NULL, 10);
+        }
+        else if ("--output" == arg && has_value)
+        {
+            output = argv[++i];
+        }
+        else if ("--list" == arg)
+        {
+            list = true;
+        }
+        else
+        {
+            Usage(argv[0]);
+            return 2;
+        }
+    }
+
+    // Deterministic timing without a network: every benchmark connects to
+    // the same in-process broker
+    boost::scoped_ptr<LoopbackBroker> loopback_broker;
+    if (loopback && !offline && !list)
+    {
+        loopback_broker.reset(new LoopbackBroker(latency, bandwidth));
+        broker = loopback_broker->Host();
+        port = loopback_broker->Port();
+    }
+
+    std::vector<Benchmark> benchmarks;
+    RegisterMessageBenchmarks(benchmarks);
+    RegisterChannelBenchmarks(benchmarks);
+
+    std::string json = "{\n  \"library_version\": \"";
+    json += boost::lexical_cast<std::string>(SIMPLEAMQPCLIENT_VERSION_MAJOR) + "." +
+            boost::lexical_cast<std::string>(SIMPLEAMQPCLIENT_VERSION_MINOR) + "." +
+            boost::lexical_cast<std::string>(SIMPLEAMQPCLIENT_VERSION_PATCH);
+    json += "\",\n  \"benchmarks\": [\n";
+
+    bool first = true;
+    int failures = 0;
+    for (std::vector<Benchmark>::const_iterator it = benchmarks.begin(); it != benchmarks.end(); ++it)
+    {
+        if ((offline && it->needs_broker) ||
+                (!filter.empty() && std::string::npos == it->name.find(filter)))
+        {
+            continue;
+        }
+        if (list)
+        {
+            std::cout << it->name << '\n';
+            continue;
+        }
+
+        const std::size_t to_time = 0 != iterations ? iterations : it->iterations;
+        try
+        {
+            // Warm up caches, allocators and the broker before timing
+            Run warm_up(broker, port, std::max<std::size_t>(to_time / 10, 1));
+            it->function(warm_up, it->argument);
+
+            Run run(broker, port, to_time);
+            it->function(run, it->argument);
+
+            if (!first)
+            {
+                json += ",\n";
+            }
+            first = false;
+            run.WriteJson(it->name, json);
+            std::cerr << it->name << " done" << std::endl;
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << it->name << " failed: " << e.what() << std::endl;
+            ++failures;
+        }
+    }
+    json += "\n  ]\n}\n";
+
+    if (list)
+    {
+        return 0;
+    }
+    if (output.empty())
+    {
+        std::cout << json;
+    }
+    else
+    {
+        std::ofstream file(output.c_str());
+        file << json;
+        if (!file)
+        {
+            std::cerr << "Could not write " << output << std::endl;
+            return 1;
+        }
+    }
+    return 0 == failures ? 0 : 1;
+}
@@ -0,0 +1,182 @@
+/* vim:set ft=cpp ts=4 sw=4 sts=4 et cindent: */
+/*
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MIT
+ *
+ * Copyright (c) 2010-2013 Alan Antonuk
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "bench.h"
+
+#include <SimpleAmqpClient/EncodedTable.h>
+
+#include <stdexcept>
+
+using namespace AmqpClient;
+
+namespace bench
+{
+
+namespace
+{
+
+// Headers of the sort applications set: ids, flags, counters and a nested
+// table of tracing context
+Table SampleHeaders()
+{
+    Table trace;
+    trace.insert(TableEntry(TableKey("trace_id"), "4bf92f3577b34da6a3ce929d0e0e4736"));
+    trace.insert(TableEntry(TableKey("span_id"), "00f067aa0ba902b7"));
+    trace.insert(TableEntry(TableKey("sampled"), true));
+
+    std::vector<TableValue> tags;
+    tags.push_back(TableValue("billing"));
+    tags.push_back(TableValue("eu-west"));
+
+    Table headers;
+    headers.insert(TableEntry(TableKey("message_type"), "order.created"));
+    headers.insert(TableEntry(TableKey("tenant"), "customer-4711"));
+    headers.insert(TableEntry(TableKey("attempt"), static_cast<boost::int32_t>(1)));
+    headers.insert(TableEntry(TableKey("sequence"), static_cast<boost::int64_t>(1234567890123LL)));
+    headers.insert(TableEntry(TableKey("priority_boost"), 0.25));
+    headers.insert(TableEntry(TableKey("replayed"), false));
+    headers.insert(TableEntry(TableKey("tags"), tags));
+    headers.insert(TableEntry(TableKey("trace"), trace));
+    return headers;
+}
+
+void MessageCreate(Run &run, std::size_t body_size)
+{
+    const std::string body(body_size, 'x');
+    for (std::size_t i = 0; i < run.Iterations(); ++i)
+    {
+        run.Start();
+        BasicMessage::ptr_t message = BasicMessage::Create(body);
+        run.Stop();
+    }
+    run.AddBytes(static_cast<boost::uint64_t>(body_size) * run.Iterations());
+}
+
+void MessageProperties(Run &run, std::size_t)
+{
+    for (std::size_t i = 0; i < run.Iterations(); ++i)
+    {
+        run.Start();
+        BasicMessage::ptr_t message = BasicMessage::Create("body");
+        message->ContentType("application/json");
+        message->DeliveryMode(BasicMessage::dm_persistent);
+        message->CorrelationId("4bf92f3577b34da6");
+        message->ReplyTo("amq.rabbitmq.reply-to");
+        message->MessageId("00f067aa0ba902b7");
+        message->Timestamp(1500000000);
+        run.Stop();
+    }
+}
+
+void MessageClone(Run &run, std::size_t body_size)
+{
+    BasicMessage::ptr_t message = BasicMessage::Create(std::string(body_size, 'x'));
+    message->ContentType("application/json");
+    message->CorrelationId("4bf92f3577b34da6");
+    message->HeaderTable(SampleHeaders());
+    for (std::size_t i = 0; i < run.Iterations(); ++i)
+    {
+        run.Start();
+        BasicMessage::ptr_t clone = message->Clone();
+        run.Stop();
+    }
+}
+
+void TableEncode(Run &run, std::size_t)
+{
+    const Table headers = SampleHeaders();
+    for (std::size_t i = 0; i < run.Iterations(); ++i)
+    {
+        run.Start();
+        EncodedTable::ptr_t encoded = EncodedTable::Create(headers);
+        run.Stop();
+        run.AddBytes(encoded->WireBytes().size());
+    }
+}
+
+void TableDecode(Run &run, std::size_t)
+{
+    const std::string wire_bytes = EncodedTable::Create(SampleHeaders())->WireBytes();
+    for (std::size_t i = 0; i < run.Iterations(); ++i)
+    {
+        run.Start();
+        Table headers = EncodedTable::CreateFromWireBytes(wire_bytes)->ToTable();
+        run.Stop();
+    }
+    run.AddBytes(static_cast<boost::uint64_t>(wire_bytes.size()) * run.Iterations());
+}
+
+void HeaderTableSet(Run &run, std::size_t)
+{
+    const Table headers = SampleHeaders();
+    for (std::size_t i = 0; i < run.Iterations(); ++i)
+    {
+        BasicMessage::ptr_t message = BasicMessage::Create();
+        run.Start();
+        message->HeaderTable(headers);
+        run.Stop();
+    }
+}
+
+void HeaderViewLookup(Run &run, std::size_t)
+{
+    BasicMessage::ptr_t message = BasicMessage::Create();
+    message->HeaderTable(SampleHeaders());
+    boost::int64_t sum = 0;
+    for (std::size_t i = 0; i < run.Iterations(); ++i)
+    {
+        run.Start();
+        sum += message->HeaderTableView().GetInteger("sequence");
+        run.Stop();
+    }
+    // Keep the lookups from being optimised away
+    if (0 == sum)
+    {
+        throw std::runtime_error("HeaderViewLookup: unexpected header value");
+    }
+}
+
+} // namespace
+
+void RegisterMessageBenchmarks(std::vector<Benchmark> &benchmarks)
+{
+    const std::size_t sizes[] = { 16, 1024, 65536 };
+    for (std::size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+    {
+        benchmarks.push_back(Benchmark("BasicMessage/Create", &MessageCreate, sizes[i], false, 200000));
+    }
+    benchmarks.push_back(Benchmark("BasicMessage/Properties", &MessageProperties, 0, false, 200000));
+    benchmarks.push_back(Benchmark("BasicMessage/Clone", &MessageClone, 1024, false, 200000));
+    benchmarks.push_back(Benchmark("Table/Encode", &TableEncode, 0, false, 100000));
+    benchmarks.push_back(Benchmark("Table/Decode", &TableDecode, 0, false, 100000));
+    benchmarks.push_back(Benchmark("BasicMessage/HeaderTable", &HeaderTableSet, 0, false, 100000));
+    benchmarks.push_back(Benchmark("HeaderView/GetInteger", &HeaderViewLookup, 0, false, 500000));
+}
+
+} // namespace bench
@@ -32,29 +32,74 @@
 #include <amqp_framing.h>
 
 #include "SimpleAmqpClient/BasicMessage.h"
+#include "SimpleAmqpClient/BasicMessageImpl.h"
+#include "SimpleAmqpClient/EncodedTable.h"
+#include "SimpleAmqpClient/MappedFile.h"
 #include "SimpleAmqpClient/TableImpl.h"
 
 
 #include <cstring>
+#include <new>
 
 namespace AmqpClient
 {
 
-namespace Detail
+namespace
 {
 
-class BasicMessageImpl
+void free_body(void *bytes)
 {
-public:
-    BasicMessageImpl()
-        : m_properties()
-        , m_body()
-    {}
-    amqp_basic_properties_t m_properties;
-    amqp_bytes_t m_body;
-    amqp_pool_ptr_t m_table_pool;
-};
+    amqp_bytes_t body;
+    body.len = 0;
+    body.bytes = bytes;
+    amqp_bytes_free(body);
+}
+
+// Gives the message its own copy of the string properties in properties
+void DuplicateProperties(amqp_basic_properties_t &properties)
+{
+    if (properties._flags & AMQP_BASIC_CONTENT_TYPE_FLAG) properties.content_type = amqp_bytes_malloc_dup(properties.content_type);
+    if (properties._flags & AMQP_BASIC_CONTENT_ENCODING_FLAG) properties.content_encoding = amqp_bytes_malloc_dup(properties.content_encoding);
+    if (properties._flags & AMQP_BASIC_CORRELATION_ID_FLAG) properties.correlation_id = amqp_bytes_malloc_dup(properties.correlation_id);
+    if (properties._flags & AMQP_BASIC_REPLY_TO_FLAG) properties.reply_to = amqp_bytes_malloc_dup(properties.reply_to);
+    if (properties._flags & AMQP_BASIC_EXPIRATION_FLAG) properties.expiration = amqp_bytes_malloc_dup(properties.expiration);
+    if (properties._flags & AMQP_BASIC_MESSAGE_ID_FLAG) properties.message_id = amqp_bytes_malloc_dup(properties.message_id);
+    if (properties._flags & AMQP_BASIC_TYPE_FLAG) properties.type = amqp_bytes_malloc_dup(properties.type);
+    if (properties._flags & AMQP_BASIC_USER_ID_FLAG) properties.user_id = amqp_bytes_malloc_dup(properties.user_id);
+    if (properties._flags & AMQP_BASIC_APP_ID_FLAG) properties.app_id = amqp_bytes_malloc_dup(properties.app_id);
+    if (properties._flags & AMQP_BASIC_CLUSTER_ID_FLAG) properties.cluster_id = amqp_bytes_malloc_dup(properties.cluster_id);
+}
+
+boost::string_ref BytesView(const amqp_bytes_t &bytes)
+{
+    return boost::string_ref(static_cast<const char *>(bytes.bytes), bytes.len);
+}
+
+} // namespace
+
+BasicMessage::ptr_t BasicMessage::CreateFromFile(const std::string &path, boost::uint64_t offset, std::size_t length)
+{
+    ptr_t message = Create();
+    const void *data;
+    message->m_impl->m_body_owner = Detail::MapPathRange(path, offset, length, data);
+    message->m_impl->m_body.bytes = const_cast<void *>(data);
+    message->m_impl->m_body.len = length;
+    return message;
+}
+
+BasicMessage::ptr_t BasicMessage::CreateFromFile(const std::string &path)
+{
+    return CreateFromFile(path, 0, Detail::MAP_TO_END);
+}
 
+BasicMessage::ptr_t BasicMessage::CreateFromFile(int fd, boost::uint64_t offset, std::size_t length)
+{
+    ptr_t message = Create();
+    const void *data;
+    message->m_impl->m_body_owner = Detail::MapFdRange(fd, offset, length, data);
+    message->m_impl->m_body.bytes = const_cast<void *>(data);
+    message->m_impl->m_body.len = length;
+    return message;
 }
 
 BasicMessage::BasicMessage() :
@@ -76,23 +121,28 @@ BasicMessage::BasicMessage(const amqp_bytes_t &body, const amqp_basic_properties
     m_impl(new Detail::BasicMessageImpl)
 {
     m_impl->m_body = body;
+    if (NULL != body.bytes)
+    {
+        m_impl->m_body_owner.reset(body.bytes, free_body);
+    }
+    m_impl->m_properties = *properties;
+    DuplicateProperties(m_impl->m_properties);
+    if (HeaderTableIsSet()) m_impl->m_properties.headers = Detail::TableValueImpl::CopyTable(m_impl->m_properties.headers, m_impl->m_table_pool);
+}
+
+BasicMessage::BasicMessage(const amqp_bytes_t &body, const boost::shared_ptr<const void> &body_owner,
+                           const amqp_basic_properties_t *properties) :
+    m_impl(new Detail::BasicMessageImpl)
+{
+    m_impl->m_body = body;
+    m_impl->m_body_owner = body_owner;
     m_impl->m_properties = *properties;
-    if (ContentTypeIsSet()) m_impl->m_properties.content_type = amqp_bytes_malloc_dup(m_impl->m_properties.content_type);
-    if (ContentEncodingIsSet()) m_impl->m_properties.content_encoding = amqp_bytes_malloc_dup(m_impl->m_properties.content_encoding);
-    if (CorrelationIdIsSet()) m_impl->m_properties.correlation_id = amqp_bytes_malloc_dup(m_impl->m_properties.correlation_id);
-    if (ReplyToIsSet()) m_impl->m_properties.reply_to = amqp_bytes_malloc_dup(m_impl->m_properties.reply_to);
-    if (ExpirationIsSet()) m_impl->m_properties.expiration = amqp_bytes_malloc_dup(m_impl->m_properties.expiration);
-    if (MessageIdIsSet()) m_impl->m_properties.message_id = amqp_bytes_malloc_dup(m_impl->m_properties.message_id);
-    if (TypeIsSet()) m_impl->m_properties.type = amqp_bytes_malloc_dup(m_impl->m_properties.type);
-    if (UserIdIsSet()) m_impl->m_properties.user_id = amqp_bytes_malloc_dup(m_impl->m_properties.user_id);
-    if (AppIdIsSet()) m_impl->m_properties.app_id = amqp_bytes_malloc_dup(m_impl->m_properties.app_id);
-    if (ClusterIdIsSet()) m_impl->m_properties.cluster_id = amqp_bytes_malloc_dup(m_impl->m_properties.cluster_id);
+    DuplicateProperties(m_impl->m_properties);
     if (HeaderTableIsSet()) m_impl->m_properties.headers = Detail::TableValueImpl::CopyTable(m_impl->m_properties.headers, m_impl->m_table_pool);
 }
 
 BasicMessage::~BasicMessage()
 {
-    amqp_bytes_free(m_impl->m_body);
     if (ContentTypeIsSet()) amqp_bytes_free(m_impl->m_properties.content_type);
     if (ContentEncodingIsSet()) amqp_bytes_free(m_impl->m_properties.content_encoding);
     if (CorrelationIdIsSet()) amqp_bytes_free(m_impl->m_properties.correlation_id);
@@ -112,26 +162,108 @@ const amqp_basic_properties_t *BasicMessage::getAmqpProperties() const
 
 const amqp_bytes_t &BasicMessage::getAmqpBody() const
 {
+    if (!m_impl->m_body_segments.empty() && NULL == m_impl->m_body.bytes)
+    {
+        std::size_t len = 0;
+        for (std::vector<BodySegment>::const_iterator it = m_impl->m_body_segments.begin();
+                it != m_impl->m_body_segments.end(); ++it)
+        {
+            len += it->Length();
+        }
+
+        if (0 != len)
+        {
+            m_impl->m_body = amqp_bytes_malloc(len);
+            if (NULL == m_impl->m_body.bytes)
+            {
+                throw std::bad_alloc();
+            }
+            m_impl->m_body_owner.reset(m_impl->m_body.bytes, free_body);
+
+            char *out = static_cast<char *>(m_impl->m_body.bytes);
+            for (std::vector<BodySegment>::const_iterator it = m_impl->m_body_segments.begin();
+                    it != m_impl->m_body_segments.end(); ++it)
+            {
+                std::memcpy(out, it->Data(), it->Length());
+                out += it->Length();
+            }
+        }
+    }
     return m_impl->m_body;
 }
 
+const std::vector<BodySegment> &BasicMessage::getBodySegments() const
+{
+    return m_impl->m_body_segments;
+}
+
 std::string BasicMessage::Body() const
 {
+    if (!m_impl->m_body_segments.empty())
+    {
+        std::string body;
+        for (std::vector<BodySegment>::const_iterator it = m_impl->m_body_segments.begin();
+                it != m_impl->m_body_segments.end(); ++it)
+        {
+            body.append(static_cast<const char *>(it->Data()), it->Length());
+        }
+        return body;
+    }
     if (m_impl->m_body.bytes == NULL)
         return std::string();
     else
         return std::string((char *)m_impl->m_body.bytes, m_impl->m_body.len);
 }
+boost::string_ref BasicMessage::BodyView() const
+{
+    const amqp_bytes_t &body = getAmqpBody();
+    if (NULL == body.bytes)
+        return boost::string_ref();
+    else
+        return BytesView(body);
+}
+
 void BasicMessage::Body(const std::string &body)
 {
-    if (NULL != m_impl->m_body.bytes)
-    {
-        amqp_bytes_free(m_impl->m_body);
-    }
     amqp_bytes_t body_bytes;
     body_bytes.bytes = const_cast<char *>(body.data());
     body_bytes.len = body.length();
     m_impl->m_body = amqp_bytes_malloc_dup(body_bytes);
+    m_impl->m_body_owner.reset(m_impl->m_body.bytes, free_body);
+    m_impl->m_body_segments.clear();
+}
+
+void BasicMessage::Body(const boost::shared_ptr<const std::string> &body)
+{
+    m_impl->m_body.bytes = const_cast<char *>(body->data());
+    m_impl->m_body.len = body->length();
+    m_impl->m_body_owner = body;
+    m_impl->m_body_segments.clear();
+}
+
+void BasicMessage::BodySegments(const std::vector<BodySegment> &segments)
+{
+    m_impl->m_body.bytes = NULL;
+    m_impl->m_body.len = 0;
+    m_impl->m_body_owner.reset();
+    m_impl->m_body_segments = segments;
+}
+
+BasicMessage::ptr_t BasicMessage::Clone() const
+{
+    ptr_t clone = Create();
+    Detail::BasicMessageImpl &clone_impl = *clone->m_impl;
+
+    // The body and header table are never modified in place, setting
+    // either on one message replaces it, so they can be shared
+    clone_impl.m_body = m_impl->m_body;
+    clone_impl.m_body_owner = m_impl->m_body_owner;
+    clone_impl.m_body_segments = m_impl->m_body_segments;
+    clone_impl.m_table_pool = m_impl->m_table_pool;
+
+    clone_impl.m_properties = m_impl->m_properties;
+    DuplicateProperties(clone_impl.m_properties);
+    return clone;
 }
 
 std::string BasicMessage::ContentType() const
@@ -142,6 +274,14 @@ std::string BasicMessage::ContentType() const
         return std::string();
 }
 
+boost::string_ref BasicMessage::ContentTypeView() const
+{
+    if (ContentTypeIsSet())
+        return BytesView(m_impl->m_properties.content_type);
+    else
+        return boost::string_ref();
+}
+
 void BasicMessage::ContentType(const std::string &content_type)
 {
     if (ContentTypeIsSet()) amqp_bytes_free(m_impl->m_properties.content_type);
@@ -168,6 +308,14 @@ std::string BasicMessage::ContentEncoding() const
         return std::string();
 }
 
+boost::string_ref BasicMessage::ContentEncodingView() const
+{
+    if (ContentEncodingIsSet())
+        return BytesView(m_impl->m_properties.content_encoding);
+    else
+        return boost::string_ref();
+}
+
 void BasicMessage::ContentEncoding(const std::string &content_encoding)
 {
     if (ContentEncodingIsSet()) amqp_bytes_free(m_impl->m_properties.content_encoding);
@@ -241,6 +389,14 @@ std::string BasicMessage::CorrelationId() const
         return std::string();
 }
 
+boost::string_ref BasicMessage::CorrelationIdView() const
+{
+    if (CorrelationIdIsSet())
+        return BytesView(m_impl->m_properties.correlation_id);
+    else
+        return boost::string_ref();
+}
+
 void BasicMessage::CorrelationId(const std::string &correlation_id)
 {
     if (CorrelationIdIsSet()) amqp_bytes_free(m_impl->m_properties.correlation_id);
@@ -266,6 +422,14 @@ std::string BasicMessage::ReplyTo() const
     else
         return std::string();
 }
+
+boost::string_ref BasicMessage::ReplyToView() const
+{
+    if (ReplyToIsSet())
+        return BytesView(m_impl->m_properties.reply_to);
+    else
+        return boost::string_ref();
+}
 void BasicMessage::ReplyTo(const std::string &reply_to)
 {
     if (ReplyToIsSet()) amqp_bytes_free(m_impl->m_properties.reply_to);
@@ -291,6 +455,14 @@ std::string BasicMessage::Expiration() const
     else
         return std::string();
 }
+
+boost::string_ref BasicMessage::ExpirationView() const
+{
+    if (ExpirationIsSet())
+        return BytesView(m_impl->m_properties.expiration);
+    else
+        return boost::string_ref();
+}
 void BasicMessage::Expiration(const std::string &expiration)
 {
     if (ExpirationIsSet()) amqp_bytes_free(m_impl->m_properties.expiration);
@@ -316,6 +488,14 @@ std::string BasicMessage::MessageId() const
     else
         return std::string();
 }
+
+boost::string_ref BasicMessage::MessageIdView() const
+{
+    if (MessageIdIsSet())
+        return BytesView(m_impl->m_properties.message_id);
+    else
+        return boost::string_ref();
+}
 void BasicMessage::MessageId(const std::string &message_id)
 {
     if (MessageIdIsSet()) amqp_bytes_free(m_impl->m_properties.message_id);
@@ -364,6 +544,14 @@ std::string BasicMessage::Type() const
     else
         return std::string();
 }
+
+boost::string_ref BasicMessage::TypeView() const
+{
+    if (TypeIsSet())
+        return BytesView(m_impl->m_properties.type);
+    else
+        return boost::string_ref();
+}
 void BasicMessage::Type(const std::string &type)
 {
     if (TypeIsSet()) amqp_bytes_free(m_impl->m_properties.type);
@@ -390,6 +578,14 @@ std::string BasicMessage::UserId() const
         return std::string();
 }
 
+boost::string_ref BasicMessage::UserIdView() const
+{
+    if (UserIdIsSet())
+        return BytesView(m_impl->m_properties.user_id);
+    else
+        return boost::string_ref();
+}
+
 void BasicMessage::UserId(const std::string &user_id)
 {
     if (UserIdIsSet()) amqp_bytes_free(m_impl->m_properties.user_id);
@@ -415,6 +611,14 @@ std::string BasicMessage::AppId() const
     else
         return std::string();
 }
+
+boost::string_ref BasicMessage::AppIdView() const
+{
+    if (AppIdIsSet())
+        return BytesView(m_impl->m_properties.app_id);
+    else
+        return boost::string_ref();
+}
 void BasicMessage::AppId(const std::string &app_id)
 {
     if (AppIdIsSet()) amqp_bytes_free(m_impl->m_properties.app_id);
@@ -440,6 +644,14 @@ std::string BasicMessage::ClusterId() const
     else
         return std::string();
 }
+
+boost::string_ref BasicMessage::ClusterIdView() const
+{
+    if (ClusterIdIsSet())
+        return BytesView(m_impl->m_properties.cluster_id);
+    else
+        return boost::string_ref();
+}
 void BasicMessage::ClusterId(const std::string &cluster_id)
 {
     if (AppIdIsSet()) amqp_bytes_free(m_impl->m_properties.cluster_id);
@@ -468,10 +680,36 @@ Table BasicMessage::HeaderTable() const
 
 void BasicMessage::HeaderTable(const Table &header_table)
 {
+    if (HeaderTableIsSet() &&
+            Detail::TableValueImpl::IsEqual(header_table, m_impl->m_properties.headers))
+    {
+        // The same headers are already encoded, nothing to do
+        return;
+    }
+
+    // Encoding may recycle the pool the current headers live in
+    m_impl->m_properties._flags &= ~AMQP_BASIC_HEADERS_FLAG;
     m_impl->m_properties.headers = Detail::TableValueImpl::CreateAmqpTable(header_table, m_impl->m_table_pool);
     m_impl->m_properties._flags |= AMQP_BASIC_HEADERS_FLAG;
 }
 
+void BasicMessage::HeaderTable(const EncodedTable &header_table)
+{
+    // The encoded table is never modified in place, so the message can
+    // share its pool
+    m_impl->m_table_pool = header_table.getAmqpPool();
+    m_impl->m_properties.headers = header_table.getAmqpTable();
+    m_impl->m_properties._flags |= AMQP_BASIC_HEADERS_FLAG;
+}
+
+HeaderView BasicMessage::HeaderTableView() const
+{
+    if (HeaderTableIsSet())
+        return HeaderView(m_impl->m_table_pool, m_impl->m_properties.headers);
+    else
+        return HeaderView();
+}
+
 bool BasicMessage::HeaderTableIsSet() const
 {
     return AMQP_BASIC_HEADERS_FLAG == (m_impl->m_properties._flags & AMQP_BASIC_HEADERS_FLAG);
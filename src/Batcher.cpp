@@ -0,0 +1,280 @@
+/* vim:set ft=cpp ts=4 sw=4 sts=4 et cindent: */
+/*
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MIT
+ *
+ * Copyright (c) 2010-2013 Alan Antonuk
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "SimpleAmqpClient/Batcher.h"
+#include "SimpleAmqpClient/HeaderView.h"
+#include "SimpleAmqpClient/Table.h"
+
+#include <boost/cstdint.hpp>
+
+#include <stdexcept>
+
+namespace AmqpClient
+{
+
+const std::string Batcher::BATCH_HEADER("x-batch-count");
+
+namespace
+{
+
+// Each body in a batch is preceded by its length as an unsigned LEB128
+// varint: seven bits a byte, least significant first, the top bit set on
+// all but the last byte. Tiny bodies cost a single byte of framing
+void AppendLength(std::string &batch, boost::uint64_t length)
+{
+    while (length >= 0x80)
+    {
+        batch += static_cast<char>((length & 0x7f) | 0x80);
+        length >>= 7;
+    }
+    batch += static_cast<char>(length);
+}
+
+std::size_t LengthSize(boost::uint64_t length)
+{
+    std::size_t size = 1;
+    while (length >= 0x80)
+    {
+        length >>= 7;
+        ++size;
+    }
+    return size;
+}
+
+// Reads a length from the front of data, false if data is truncated
+bool ReadLength(boost::string_ref &data, boost::uint64_t &length)
+{
+    length = 0;
+    for (int shift = 0; shift < 64 && !data.empty(); shift += 7)
+    {
+        const boost::uint8_t byte = static_cast<boost::uint8_t>(data[0]);
+        data.remove_prefix(1);
+        length |= static_cast<boost::uint64_t>(byte & 0x7f) << shift;
+        if (0 == (byte & 0x80))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace
+
+Batcher::Batcher(const Channel::ptr_t &channel,
+                 const std::string &exchange,
+                 const std::string &routing_key,
+                 std::size_t max_bytes,
+                 std::size_t max_messages,
+                 int linger) :
+    m_channel(channel),
+    m_exchange(exchange),
+    m_routing_key(routing_key),
+    m_max_bytes(max_bytes),
+    m_max_messages(max_messages),
+    m_linger(linger),
+    m_batch(boost::make_shared<std::string>()),
+    m_count(0)
+{
+}
+
+Batcher::~Batcher()
+{
+}
+
+void Batcher::SetProperties(const BasicMessage::ptr_t &properties)
+{
+    m_properties = properties;
+}
+
+void Batcher::Add(boost::string_ref body)
+{
+    const std::size_t framed_size = LengthSize(body.size()) + body.size();
+    if (0 != m_count && m_batch->size() + framed_size > m_max_bytes)
+    {
+        Flush();
+    }
+
+    if (0 == m_count)
+    {
+        m_first_added = boost::chrono::steady_clock::now();
+    }
+    AppendLength(*m_batch, body.size());
+    m_batch->append(body.data(), body.size());
+    ++m_count;
+
+    if (m_count >= m_max_messages || m_batch->size() >= m_max_bytes)
+    {
+        Flush();
+    }
+    else
+    {
+        FlushIfDue();
+    }
+}
+
+bool Batcher::FlushIfDue()
+{
+    if (0 != MillisecondsUntilDue())
+    {
+        return false;
+    }
+    Flush();
+    return true;
+}
+
+void Batcher::Flush()
+{
+    if (0 == m_count)
+    {
+        return;
+    }
+
+    BasicMessage::ptr_t message = m_properties ? m_properties->Clone() : BasicMessage::Create();
+    message->Body(boost::shared_ptr<const std::string>(m_batch));
+    Table headers;
+    if (message->HeaderTableIsSet())
+    {
+        headers = message->HeaderTable();
+        headers.erase(BATCH_HEADER);
+    }
+    headers.insert(TableEntry(BATCH_HEADER, static_cast<boost::int64_t>(m_count)));
+    message->HeaderTable(headers);
+
+    // The batch is kept if publishing fails, so it can be tried again
+    m_channel->BasicPublish(m_exchange, m_routing_key, message);
+
+    m_count = 0;
+    message.reset();
+    // Reuse the buffer unless something is still holding on to the message
+    if (m_batch.unique())
+    {
+        m_batch->clear();
+    }
+    else
+    {
+        m_batch = boost::make_shared<std::string>();
+    }
+}
+
+int Batcher::MillisecondsUntilDue() const
+{
+    if (0 == m_count)
+    {
+        return -1;
+    }
+    const boost::chrono::milliseconds waited =
+        boost::chrono::duration_cast<boost::chrono::milliseconds>(boost::chrono::steady_clock::now() - m_first_added);
+    return waited >= m_linger ? 0 : static_cast<int>((m_linger - waited).count());
+}
+
+BatchReader::BatchReader(const BasicMessage::ptr_t &message) :
+    m_message(message),
+    m_batched(IsBatch(message)),
+    m_remaining(message->BodyView()),
+    m_count(1),
+    m_read(0)
+{
+    if (!m_batched)
+    {
+        return;
+    }
+
+    const boost::int64_t count = message->HeaderTableView().GetInteger(Batcher::BATCH_HEADER);
+    if (count < 0)
+    {
+        throw std::runtime_error("BatchReader: invalid message count");
+    }
+    m_count = static_cast<std::size_t>(count);
+
+    // Check the framing up front, so Next can't fail part way through
+    boost::string_ref data = m_remaining;
+    for (std::size_t i = 0; i < m_count; ++i)
+    {
+        boost::uint64_t length;
+        if (!ReadLength(data, length) || length > data.size())
+        {
+            throw std::runtime_error("BatchReader: batch is truncated");
+        }
+        data.remove_prefix(static_cast<std::size_t>(length));
+    }
+    if (!data.empty())
+    {
+        throw std::runtime_error("BatchReader: batch has trailing data");
+    }
+}
+
+BatchReader::~BatchReader()
+{
+}
+
+bool BatchReader::IsBatch(const BasicMessage::ptr_t &message)
+{
+    if (!message->HeaderTableIsSet())
+    {
+        return false;
+    }
+    HeaderView headers = message->HeaderTableView();
+    if (!headers.IsSet(Batcher::BATCH_HEADER))
+    {
+        return false;
+    }
+    switch (headers.GetType(Batcher::BATCH_HEADER))
+    {
+    case TableValue::VT_int8:
+    case TableValue::VT_int16:
+    case TableValue::VT_int32:
+    case TableValue::VT_int64:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool BatchReader::Next(boost::string_ref &body)
+{
+    if (m_read == m_count)
+    {
+        return false;
+    }
+    ++m_read;
+
+    if (!m_batched)
+    {
+        body = m_remaining;
+        return true;
+    }
+
+    boost::uint64_t length;
+    ReadLength(m_remaining, length);
+    body = m_remaining.substr(0, static_cast<std::size_t>(length));
+    m_remaining.remove_prefix(static_cast<std::size_t>(length));
+    return true;
+}
+
+} // namespace AmqpClient
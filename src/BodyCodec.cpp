@@ -0,0 +1,190 @@
+/* vim:set ft=cpp ts=4 sw=4 sts=4 et cindent: */
+/*
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MIT
+ *
+ * Copyright (c) 2010-2013 Alan Antonuk
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "SimpleAmqpClient/BodyCodec.h"
+
+#ifdef SAC_ZLIB_CODEC_ENABLED
+# include <zlib.h>
+#endif
+
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+namespace AmqpClient
+{
+
+const char *const DeflateBodyCodec::CONTENT_ENCODING = "deflate";
+const std::size_t DeflateBodyCodec::DEFAULT_MAX_DECODED_SIZE;
+
+#ifdef SAC_ZLIB_CODEC_ENABLED
+
+namespace
+{
+
+void ThrowZlibError(const std::string &what, const z_stream &stream, int status)
+{
+    throw std::runtime_error(what + ": " + (NULL != stream.msg ? stream.msg :
+                             boost::lexical_cast<std::string>(status)));
+}
+
+void CheckBodySize(std::size_t len)
+{
+    if (len > std::numeric_limits<uInt>::max())
+    {
+        throw std::runtime_error("DeflateBodyCodec: body too large");
+    }
+}
+
+} // namespace
+
+DeflateBodyCodec::DeflateBodyCodec(int level, std::size_t max_decoded_size) :
+    m_level(level),
+    m_max_decoded_size(max_decoded_size)
+{
+}
+
+DeflateBodyCodec::~DeflateBodyCodec()
+{
+}
+
+std::string DeflateBodyCodec::Name() const
+{
+    return CONTENT_ENCODING;
+}
+
+void DeflateBodyCodec::Encode(const void *body, std::size_t len, std::string &out) const
+{
+    CheckBodySize(len);
+
+    z_stream stream = z_stream();
+    int status = deflateInit(&stream, m_level);
+    if (Z_OK != status)
+    {
+        ThrowZlibError("DeflateBodyCodec: deflateInit failed", stream, status);
+    }
+
+    // deflateBound is big enough to compress the whole body in one call
+    out.resize(deflateBound(&stream, static_cast<uLong>(len)));
+    stream.next_in = static_cast<Bytef *>(const_cast<void *>(body));
+    stream.avail_in = static_cast<uInt>(len);
+    stream.next_out = reinterpret_cast<Bytef *>(&out[0]);
+    stream.avail_out = static_cast<uInt>(out.size());
+
+    status = deflate(&stream, Z_FINISH);
+    const std::size_t encoded_size = stream.total_out;
+    if (Z_STREAM_END != status)
+    {
+        deflateEnd(&stream);
+        ThrowZlibError("DeflateBodyCodec: deflate failed", stream, status);
+    }
+    deflateEnd(&stream);
+    out.resize(encoded_size);
+}
+
+void DeflateBodyCodec::Decode(const void *body, std::size_t len, std::string &out) const
+{
+    CheckBodySize(len);
+
+    z_stream stream = z_stream();
+    int status = inflateInit(&stream);
+    if (Z_OK != status)
+    {
+        ThrowZlibError("DeflateBodyCodec: inflateInit failed", stream, status);
+    }
+
+    stream.next_in = static_cast<Bytef *>(const_cast<void *>(body));
+    stream.avail_in = static_cast<uInt>(len);
+
+    // The decoded size isn't recorded, start with room for a typical ratio
+    // and double it whenever it fills up, up to the limit
+    out.resize(std::min(std::max<std::size_t>(len * 4, 256), m_max_decoded_size));
+    do
+    {
+        if (stream.total_out == out.size())
+        {
+            if (out.size() >= m_max_decoded_size)
+            {
+                inflateEnd(&stream);
+                out.clear();
+                throw std::runtime_error("DeflateBodyCodec: body decodes to more than " +
+                                         boost::lexical_cast<std::string>(m_max_decoded_size) + " bytes");
+            }
+            out.resize(std::min(out.size() * 2, m_max_decoded_size));
+        }
+        stream.next_out = reinterpret_cast<Bytef *>(&out[stream.total_out]);
+        stream.avail_out = static_cast<uInt>(std::min<std::size_t>(out.size() - stream.total_out,
+                                             std::numeric_limits<uInt>::max()));
+        status = inflate(&stream, Z_NO_FLUSH);
+    }
+    while (Z_OK == status);
+
+    const std::size_t decoded_size = stream.total_out;
+    if (Z_STREAM_END != status || 0 != stream.avail_in)
+    {
+        inflateEnd(&stream);
+        ThrowZlibError("DeflateBodyCodec: invalid body", stream, Z_STREAM_END == status ? Z_DATA_ERROR : status);
+    }
+    inflateEnd(&stream);
+    out.resize(decoded_size);
+}
+
+#else
+
+DeflateBodyCodec::DeflateBodyCodec(int level, std::size_t max_decoded_size) :
+    m_level(level),
+    m_max_decoded_size(max_decoded_size)
+{
+    throw std::runtime_error("DeflateBodyCodec: SimpleAmqpClient was built without zlib");
+}
+
+DeflateBodyCodec::~DeflateBodyCodec()
+{
+}
+
+std::string DeflateBodyCodec::Name() const
+{
+    return CONTENT_ENCODING;
+}
+
+void DeflateBodyCodec::Encode(const void *, std::size_t, std::string &) const
+{
+    throw std::runtime_error("DeflateBodyCodec: SimpleAmqpClient was built without zlib");
+}
+
+void DeflateBodyCodec::Decode(const void *, std::size_t, std::string &) const
+{
+    throw std::runtime_error("DeflateBodyCodec: SimpleAmqpClient was built without zlib");
+}
+
+#endif
+
+} // namespace AmqpClient
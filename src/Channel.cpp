@@ -45,8 +45,10 @@
 #include "SimpleAmqpClient/MessageReturnedException.h"
 #include "SimpleAmqpClient/Util.h"
 #include "SimpleAmqpClient/ChannelImpl.h"
+#include "SimpleAmqpClient/SpillFile.h"
 #include "SimpleAmqpClient/TableImpl.h"
 
+#include <algorithm>
 #include <map>
 #include <new>
 #include <queue>
@@ -60,6 +62,8 @@
 #include <boost/chrono.hpp>
 #include <boost/cstdint.hpp>
 #include <boost/limits.hpp>
+#include <boost/move/move.hpp>
+#include <boost/scoped_ptr.hpp>
 
 #include <string.h>
 
@@ -70,6 +74,8 @@ namespace AmqpClient
 const std::string Channel::EXCHANGE_TYPE_DIRECT("direct");
 const std::string Channel::EXCHANGE_TYPE_FANOUT("fanout");
 const std::string Channel::EXCHANGE_TYPE_TOPIC("topic");
+const std::string Channel::CLAIM_CHECK_HEADER("x-claim-check");
+const std::string Channel::DIRECT_REPLY_TO_QUEUE("amq.rabbitmq.reply-to");
 
 Channel::ptr_t Channel::CreateFromUri(const std::string &uri, int frame_max)
 {
@@ -269,8 +275,7 @@ void Channel::DeclareExchange(const std::string &exchange_name,
     declare.internal = false;
     declare.nowait = false;
 
-    Detail::amqp_pool_ptr_t table_pool;
-    declare.arguments = Detail::TableValueImpl::CreateAmqpTable(arguments, table_pool);
+    declare.arguments = m_impl->CreateAmqpTable(arguments);
 
     amqp_frame_t frame = m_impl->DoRpc(AMQP_EXCHANGE_DECLARE_METHOD, &declare, DECLARE_OK);
     m_impl->MaybeReleaseBuffersOnChannel(frame.channel);
@@ -312,8 +317,7 @@ void Channel::BindExchange(const std::string &destination,
     bind.routing_key = amqp_cstring_bytes(routing_key.c_str());
     bind.nowait = false;
 
-    Detail::amqp_pool_ptr_t table_pool;
-    bind.arguments = Detail::TableValueImpl::CreateAmqpTable(arguments, table_pool);
+    bind.arguments = m_impl->CreateAmqpTable(arguments);
 
     amqp_frame_t frame = m_impl->DoRpc(AMQP_EXCHANGE_BIND_METHOD, &bind, BIND_OK);
     m_impl->MaybeReleaseBuffersOnChannel(frame.channel);
@@ -340,8 +344,7 @@ void Channel::UnbindExchange(const std::string &destination,
     unbind.routing_key = amqp_cstring_bytes(routing_key.c_str());
     unbind.nowait = false;
 
-    Detail::amqp_pool_ptr_t table_pool;
-    unbind.arguments = Detail::TableValueImpl::CreateAmqpTable(arguments, table_pool);
+    unbind.arguments = m_impl->CreateAmqpTable(arguments);
 
     amqp_frame_t frame = m_impl->DoRpc(AMQP_EXCHANGE_UNBIND_METHOD, &unbind, UNBIND_OK);
     m_impl->MaybeReleaseBuffersOnChannel(frame.channel);
@@ -399,8 +402,7 @@ std::string Channel::DeclareQueueWithCounts(const std::string &queue_name,
     declare.auto_delete = auto_delete;
     declare.nowait = false;
 
-    Detail::amqp_pool_ptr_t table_pool;
-    declare.arguments = Detail::TableValueImpl::CreateAmqpTable(arguments, table_pool);
+    declare.arguments = m_impl->CreateAmqpTable(arguments);
 
     amqp_frame_t response = m_impl->DoRpc(AMQP_QUEUE_DECLARE_METHOD, &declare, DECLARE_OK);
 
@@ -454,8 +456,7 @@ void Channel::BindQueue(const std::string &queue_name,
     bind.routing_key = amqp_cstring_bytes(routing_key.c_str());
     bind.nowait = false;
 
-    Detail::amqp_pool_ptr_t table_pool;
-    bind.arguments = Detail::TableValueImpl::CreateAmqpTable(arguments, table_pool);
+    bind.arguments = m_impl->CreateAmqpTable(arguments);
 
     amqp_frame_t frame = m_impl->DoRpc(AMQP_QUEUE_BIND_METHOD, &bind, BIND_OK);
     m_impl->MaybeReleaseBuffersOnChannel(frame.channel);
@@ -481,8 +482,7 @@ void Channel::UnbindQueue(const std::string &queue_name,
     unbind.exchange = amqp_cstring_bytes(exchange_name.c_str());
     unbind.routing_key = amqp_cstring_bytes(routing_key.c_str());
 
-    Detail::amqp_pool_ptr_t table_pool;
-    unbind.arguments = Detail::TableValueImpl::CreateAmqpTable(arguments, table_pool);
+    unbind.arguments = m_impl->CreateAmqpTable(arguments);
 
     amqp_frame_t frame = m_impl->DoRpc(AMQP_QUEUE_UNBIND_METHOD, &unbind, UNBIND_OK);
     m_impl->MaybeReleaseBuffersOnChannel(frame.channel);
@@ -519,8 +519,11 @@ void Channel::BasicAck(const Envelope::DeliveryInfo &info)
         throw std::runtime_error("The channel that the message was delivered on has been closed");
     }
 
+    const Detail::ChannelImpl::timing_t start = m_impl->StartTiming();
     m_impl->CheckForError(amqp_basic_ack(m_impl->m_connection, channel,
                                          info.delivery_tag, false));
+    m_impl->RecordTiming(m_impl->m_ack_latency, start);
+    m_impl->SettleClaims(channel, info.delivery_tag, false, true);
 }
 
 void Channel::BasicReject(const Envelope::ptr_t &message, bool requeue, bool multiple)
@@ -546,6 +549,8 @@ void Channel::BasicReject(const Envelope::DeliveryInfo &info, bool requeue, bool
     req.requeue = requeue;
 
     m_impl->CheckForError(amqp_send_method(m_impl->m_connection, channel, AMQP_BASIC_NACK_METHOD, &req));
+    // A requeued message keeps its claimed file for the redelivery
+    m_impl->SettleClaims(channel, info.delivery_tag, multiple, !requeue);
 }
 
 void Channel::BasicPublish(const std::string &exchange_name,
@@ -555,38 +560,132 @@ void Channel::BasicPublish(const std::string &exchange_name,
                            bool immediate)
 {
     m_impl->CheckIsConnected();
+    const BasicMessage::ptr_t to_publish = m_impl->CheckInBody(m_impl->EncodeBody(message));
     amqp_channel_t channel = m_impl->GetChannel();
 
-    m_impl->CheckForError(amqp_basic_publish(m_impl->m_connection, channel,
-                          amqp_cstring_bytes(exchange_name.c_str()),
-                          amqp_cstring_bytes(routing_key.c_str()),
-                          mandatory,
-                          immediate,
-                          message->getAmqpProperties(),
-                          message->getAmqpBody()));
-
-    // If we've done things correctly we can get one of 4 things back from the broker
-    // - basic.ack - our channel is in confirm mode, messsage was 'dealt with' by the broker
-    // - basic.return then basic.ack - the message wasn't delievered, but was dealt with
-    // - channel.close - probably tried to publish to a non-existant exchange, in any case error!
-    // - connection.clsoe - something really bad happened
-    const boost::array<boost::uint32_t, 2> PUBLISH_ACK = { { AMQP_BASIC_ACK_METHOD, AMQP_BASIC_RETURN_METHOD } };
-    amqp_frame_t response;
-    boost::array<amqp_channel_t, 1> channels = {{ channel }};
-    m_impl->GetMethodOnChannel(channels, response, PUBLISH_ACK);
+    try
+    {
+        m_impl->PublishOnChannel(channel, exchange_name, routing_key, to_publish, mandatory, immediate);
+    }
+    catch (MessageReturnedException &)
+    {
+        m_impl->ReturnChannel(channel);
+        throw;
+    }
+    m_impl->ReturnChannel(channel);
+}
 
-    if (AMQP_BASIC_RETURN_METHOD == response.payload.method.id)
+void Channel::BasicPublishOnConsumerChannel(const std::string &consumer_tag,
+                                            const std::string &exchange_name,
+                                            const std::string &routing_key,
+                                            const BasicMessage::ptr_t message,
+                                            bool mandatory,
+                                            bool immediate)
+{
+    m_impl->CheckIsConnected();
+    amqp_channel_t channel = m_impl->GetConsumerChannel(consumer_tag);
+    const BasicMessage::ptr_t to_publish = m_impl->CheckInBody(m_impl->EncodeBody(message));
+
+    m_impl->PublishOnChannel(channel, exchange_name, routing_key, to_publish, mandatory, immediate);
+}
+
+void Channel::BasicPublishMulti(const std::string &exchange_name,
+                                const std::vector<std::string> &routing_keys,
+                                const BasicMessage::ptr_t message,
+                                bool mandatory,
+                                bool immediate)
+{
+    m_impl->CheckIsConnected();
+    if (routing_keys.empty())
+    {
+        return;
+    }
+    const BasicMessage::ptr_t to_publish = m_impl->EncodeBody(message);
+    amqp_channel_t channel = m_impl->GetChannel();
+
+    std::vector<BodySegment> segments = to_publish->getBodySegments();
+    if (segments.empty())
     {
-        MessageReturnedException message_returned =
-            m_impl->CreateMessageReturnedException(*(reinterpret_cast<amqp_basic_return_t *>(response.payload.method.decoded)), channel);
+        const amqp_bytes_t &body = to_publish->getAmqpBody();
+        segments.push_back(BodySegment(body.bytes, body.len));
+    }
+
+    amqp_basic_publish_t publish = {};
+    publish.exchange = amqp_cstring_bytes(exchange_name.c_str());
+    publish.mandatory = mandatory;
+    publish.immediate = immediate;
 
-        const boost::array<boost::uint32_t, 1> BASIC_ACK = { { AMQP_BASIC_ACK_METHOD } };
-        m_impl->GetMethodOnChannel(channels, response, BASIC_ACK);
+    const Detail::ChannelImpl::timing_t start = m_impl->StartTiming();
+    // Only the routing key in the basic.publish method differs, the same
+    // properties and body are sent after each of them
+    for (std::vector<std::string>::const_iterator it = routing_keys.begin();
+            it != routing_keys.end(); ++it)
+    {
+        publish.routing_key = amqp_cstring_bytes(it->c_str());
+        m_impl->CheckForError(amqp_send_method(m_impl->m_connection, channel, AMQP_BASIC_PUBLISH_METHOD, &publish));
+        m_impl->CheckForError(m_impl->SendContent(channel, to_publish->getAmqpProperties(), segments));
+    }
+    const boost::uint64_t first_tag = m_impl->TakePublishTags(channel, routing_keys.size());
+
+    try
+    {
+        m_impl->WaitForConfirms(channel, first_tag, routing_keys.size());
+    }
+    catch (MessageReturnedException &)
+    {
+        m_impl->RecordTiming(m_impl->m_publish_confirm_latency, start);
         m_impl->ReturnChannel(channel);
         m_impl->MaybeReleaseBuffersOnChannel(channel);
-        throw message_returned;
+        throw;
+    }
+    m_impl->RecordTiming(m_impl->m_publish_confirm_latency, start);
+    m_impl->ReturnChannel(channel);
+    m_impl->MaybeReleaseBuffersOnChannel(channel);
+}
+
+void Channel::BasicPublishMulti(const std::string &exchange_name,
+                                const std::vector<std::string> &routing_keys,
+                                const std::vector<BasicMessage::ptr_t> &messages,
+                                bool mandatory,
+                                bool immediate)
+{
+    m_impl->CheckIsConnected();
+    if (routing_keys.size() != messages.size())
+    {
+        throw std::invalid_argument("Channel::BasicPublishMulti: there must be a routing key for each message");
+    }
+    if (messages.empty())
+    {
+        return;
+    }
+    std::vector<BasicMessage::ptr_t> to_publish;
+    to_publish.reserve(messages.size());
+    for (std::vector<BasicMessage::ptr_t>::const_iterator it = messages.begin();
+            it != messages.end(); ++it)
+    {
+        to_publish.push_back(m_impl->EncodeBody(*it));
+    }
+    amqp_channel_t channel = m_impl->GetChannel();
+
+    const Detail::ChannelImpl::timing_t start = m_impl->StartTiming();
+    for (std::size_t i = 0; i < to_publish.size(); ++i)
+    {
+        m_impl->CheckForError(m_impl->SendPublish(channel, exchange_name, routing_keys[i], to_publish[i], mandatory, immediate));
     }
+    const boost::uint64_t first_tag = m_impl->TakePublishTags(channel, to_publish.size());
 
+    try
+    {
+        m_impl->WaitForConfirms(channel, first_tag, to_publish.size());
+    }
+    catch (MessageReturnedException &)
+    {
+        m_impl->RecordTiming(m_impl->m_publish_confirm_latency, start);
+        m_impl->ReturnChannel(channel);
+        m_impl->MaybeReleaseBuffersOnChannel(channel);
+        throw;
+    }
+    m_impl->RecordTiming(m_impl->m_publish_confirm_latency, start);
     m_impl->ReturnChannel(channel);
     m_impl->MaybeReleaseBuffersOnChannel(channel);
 }
@@ -616,8 +715,10 @@ bool Channel::BasicGet(Envelope::ptr_t &envelope, const std::string &queue, bool
     std::string exchange((char *)get_ok->exchange.bytes, get_ok->exchange.len);
     std::string routing_key((char *)get_ok->routing_key.bytes, get_ok->routing_key.len);
 
-    BasicMessage::ptr_t message = m_impl->ReadContent(channel);
-    envelope = Envelope::Create(message, "", delivery_tag, exchange, redelivered, routing_key, channel);
+    std::string claimed_path;
+    BasicMessage::ptr_t message = m_impl->ReadContent(channel, claimed_path);
+    m_impl->ClaimDelivered(channel, delivery_tag, no_ack, claimed_path);
+    envelope = Envelope::Create(message, std::string(), delivery_tag, boost::move(exchange), redelivered, boost::move(routing_key), channel);
 
     m_impl->ReturnChannel(channel);
     m_impl->MaybeReleaseBuffersOnChannel(channel);
@@ -636,6 +737,8 @@ void Channel::BasicRecover(const std::string &consumer)
 
     m_impl->DoRpcOnChannel(channel, AMQP_BASIC_RECOVER_METHOD, &recover, RECOVER_OK);
     m_impl->MaybeReleaseBuffersOnChannel(channel);
+    // Everything unacknowledged on the channel is redelivered
+    m_impl->ForgetClaims(channel);
 }
 
 std::string Channel::BasicConsume(const std::string &queue,
@@ -679,8 +782,7 @@ std::string Channel::BasicConsume(const std::string &queue,
     consume.exclusive = exclusive;
     consume.nowait = false;
 
-    Detail::amqp_pool_ptr_t table_pool;
-    consume.arguments = Detail::TableValueImpl::CreateAmqpTable(arguments, table_pool);
+    consume.arguments = m_impl->CreateAmqpTable(arguments);
 
     amqp_frame_t response = m_impl->DoRpcOnChannel(channel, AMQP_BASIC_CONSUME_METHOD, &consume, CONSUME_OK);
 
@@ -688,7 +790,7 @@ std::string Channel::BasicConsume(const std::string &queue,
     std::string tag((char *)consume_ok->consumer_tag.bytes, consume_ok->consumer_tag.len);
     m_impl->MaybeReleaseBuffersOnChannel(channel);
 
-    m_impl->AddConsumer(tag, channel);
+    m_impl->AddConsumer(tag, channel, no_ack);
 
     return tag;
 }
@@ -760,7 +862,7 @@ bool Channel::BasicConsumeMessage(const std::string &consumer_tag, Envelope::ptr
 
     boost::array<amqp_channel_t, 1> channels = {{ channel }};
 
-    return m_impl->ConsumeMessageOnChannel(channels, message, timeout);
+    return m_impl->ConsumeMessageRunningTimers(channels, message, timeout);
 }
 
 
@@ -778,7 +880,7 @@ bool Channel::BasicConsumeMessage(const std::vector<std::string> &consumer_tags,
         channels.push_back(m_impl->GetConsumerChannel(*it));
     }
 
-    return m_impl->ConsumeMessageOnChannel(channels, message, timeout);
+    return m_impl->ConsumeMessageRunningTimers(channels, message, timeout);
 }
 
 bool Channel::BasicConsumeMessage(Envelope::ptr_t &message, int timeout)
@@ -792,7 +894,93 @@ bool Channel::BasicConsumeMessage(Envelope::ptr_t &message, int timeout)
         throw ConsumerTagNotFoundException();
     }
 
-    return m_impl->ConsumeMessageOnChannel(channels, message, timeout);
+    return m_impl->ConsumeMessageRunningTimers(channels, message, timeout);
+}
+
+TimerWheel &Channel::Timers()
+{
+    return m_impl->m_timers;
+}
+
+void Channel::SetBodyAllocator(const BodyAllocator::ptr_t &allocator)
+{
+    m_impl->m_body_allocator = allocator;
+}
+
+void Channel::SetBodySpillThreshold(std::size_t threshold, const std::string &directory)
+{
+    m_impl->m_spill_threshold = threshold;
+    m_impl->m_spill_directory = directory;
+}
+
+void Channel::EnableClaimCheck(std::size_t threshold, const std::string &directory)
+{
+    std::string claim_check_directory = directory;
+    if (claim_check_directory.empty())
+    {
+#ifdef __linux__
+        claim_check_directory = "/dev/shm";
+#else
+        claim_check_directory = Detail::TemporaryDirectory();
+#endif
+    }
+    m_impl->m_claim_check_enabled = true;
+    m_impl->m_claim_check_threshold = threshold;
+    m_impl->m_claim_check_directory = claim_check_directory;
+}
+
+void Channel::DisableClaimCheck()
+{
+    m_impl->m_claim_check_enabled = false;
+}
+
+std::size_t Channel::SweepClaimChecks(unsigned int max_age)
+{
+    if (!m_impl->m_claim_check_enabled)
+    {
+        return 0;
+    }
+    return Detail::RemoveSpillFilesOlderThan(m_impl->m_claim_check_directory, max_age);
+}
+
+void Channel::SetPublishCodec(const BodyCodec::ptr_t &codec, std::size_t threshold)
+{
+    m_impl->m_publish_codec = codec;
+    m_impl->m_publish_codec_threshold = threshold;
+    if (codec)
+    {
+        RegisterBodyCodec(codec);
+    }
+}
+
+void Channel::RegisterBodyCodec(const BodyCodec::ptr_t &codec)
+{
+    m_impl->m_body_codecs[codec->Name()] = codec;
+}
+
+void Channel::EnableStats(bool enable)
+{
+    m_impl->m_stats_enabled = enable;
+}
+
+Channel::Stats Channel::GetStats() const
+{
+    Stats stats;
+    stats.publish_confirm = m_impl->m_publish_confirm_latency;
+    stats.rpc = m_impl->m_rpc_latency;
+    stats.consume_wait = m_impl->m_consume_wait_latency;
+    stats.read_content = m_impl->m_read_content_latency;
+    stats.ack = m_impl->m_ack_latency;
+    return stats;
+}
+
+void Channel::ResetStats()
+{
+    m_impl->m_publish_confirm_latency.Reset();
+    m_impl->m_rpc_latency.Reset();
+    m_impl->m_consume_wait_latency.Reset();
+    m_impl->m_read_content_latency.Reset();
+    m_impl->m_ack_latency.Reset();
 }
 
 } // namespace AmqpClient
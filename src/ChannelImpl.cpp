@@ -39,17 +39,24 @@
 #endif
 
 #include "SimpleAmqpClient/ChannelImpl.h"
+#include "SimpleAmqpClient/Channel.h"
 #include "SimpleAmqpClient/AmqpLibraryException.h"
 #include "SimpleAmqpClient/AmqpResponseLibraryException.h"
 #include "SimpleAmqpClient/AmqpException.h"
 #include "SimpleAmqpClient/ConnectionClosedException.h"
 #include "SimpleAmqpClient/ConsumerTagNotFoundException.h"
+#include "SimpleAmqpClient/MappedFile.h"
+#include "SimpleAmqpClient/SpillFile.h"
+#include "SimpleAmqpClient/TableImpl.h"
 
 #include <boost/algorithm/string/classification.hpp>
 #include <boost/algorithm/string/split.hpp>
 #include <boost/array.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/scoped_ptr.hpp>
 
+#include <algorithm>
+#include <cstdio>
 #include <string.h>
 
 #define BROKER_HEARTBEAT 580
@@ -59,15 +66,48 @@ namespace AmqpClient
 namespace Detail
 {
 
+namespace
+{
+
+// Returns a body to the BodyAllocator it came from, keeping the allocator
+// alive for as long as the body is
+class BodyDeleter
+{
+public:
+    BodyDeleter(const BodyAllocator::ptr_t &allocator, size_t size)
+        : m_allocator(allocator)
+        , m_size(size)
+    {}
+
+    void operator()(void *body) const
+    {
+        m_allocator->Deallocate(body, m_size);
+    }
+
+private:
+    BodyAllocator::ptr_t m_allocator;
+    size_t m_size;
+};
+
+} // namespace
+
 ChannelImpl::ChannelImpl() :
-      m_last_used_channel(0)
+      m_spill_threshold(0)
+    , m_claim_check_enabled(false)
+    , m_claim_check_threshold(0)
+    , m_publish_codec_threshold(0)
+    , m_stats_enabled(false)
+    , m_last_table(AMQP_EMPTY_TABLE)
+    , m_last_used_channel(0)
     , m_is_connected(false)
 {
     m_channels.push_back(CS_Used);
+    init_amqp_pool(&m_table_pool, 1024);
 }
 
 ChannelImpl::~ChannelImpl()
 {
+    empty_amqp_pool(&m_table_pool);
 }
 
 void ChannelImpl::DoLogin(const std::string &username,
@@ -133,10 +173,22 @@ amqp_channel_t ChannelImpl::CreateNewChannel()
     DoRpcOnChannel<boost::array<boost::uint32_t, 1> >(new_channel, AMQP_CONFIRM_SELECT_METHOD, &confirm_select, CONFIRM_OK);
 
     m_channels.at(new_channel) = CS_Open;
+    if (m_next_publish_tag.size() <= new_channel)
+    {
+        m_next_publish_tag.resize(new_channel + 1);
+    }
+    m_next_publish_tag[new_channel] = 1;
 
     return new_channel;
 }
 
+boost::uint64_t ChannelImpl::TakePublishTags(amqp_channel_t channel, boost::uint64_t count)
+{
+    const boost::uint64_t first = m_next_publish_tag.at(channel);
+    m_next_publish_tag[channel] += count;
+    return first;
+}
+
 amqp_channel_t ChannelImpl::GetChannel()
 {
     if (CS_Open == m_channels.at(m_last_used_channel))
@@ -172,6 +224,8 @@ bool ChannelImpl::IsChannelOpen(amqp_channel_t channel)
 void ChannelImpl::FinishCloseChannel(amqp_channel_t channel)
 {
     m_channels.at(channel) = CS_Closed;
+    // The broker requeues whatever was unacknowledged on the channel
+    ForgetClaims(channel);
 
     amqp_channel_close_ok_t close_ok;
     CheckForError(amqp_send_method(m_connection, channel, AMQP_CHANNEL_CLOSE_OK_METHOD, &close_ok));
@@ -180,6 +234,7 @@ void ChannelImpl::FinishCloseChannel(amqp_channel_t channel)
 void ChannelImpl::FinishCloseConnection()
 {
     SetIsConnected(false);
+    m_claimed_files.clear();
     amqp_connection_close_ok_t close_ok;
     amqp_send_method(m_connection, 0, AMQP_CONNECTION_CLOSE_OK_METHOD, &close_ok);
 }
@@ -222,17 +277,234 @@ void ChannelImpl::CheckForError(int ret)
     }
 }
 
+amqp_table_t ChannelImpl::CreateAmqpTable(const Table &table)
+{
+    if (TableValueImpl::IsEqual(table, m_last_table))
+    {
+        return m_last_table;
+    }
+
+    m_last_table = AMQP_EMPTY_TABLE;
+    recycle_amqp_pool(&m_table_pool);
+    m_last_table = TableValueImpl::CreateAmqpTable(table, m_table_pool);
+    return m_last_table;
+}
+
+int ChannelImpl::BasicPublishSegments(amqp_channel_t channel, amqp_bytes_t exchange,
+        amqp_bytes_t routing_key, bool mandatory, bool immediate,
+        const amqp_basic_properties_t *properties,
+        const std::vector<BodySegment> &segments)
+{
+    amqp_basic_publish_t publish = {};
+    publish.exchange = exchange;
+    publish.routing_key = routing_key;
+    publish.mandatory = mandatory;
+    publish.immediate = immediate;
+
+    int ret = amqp_send_method(m_connection, channel, AMQP_BASIC_PUBLISH_METHOD, &publish);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    return SendContent(channel, properties, segments);
+}
+
+int ChannelImpl::SendContent(amqp_channel_t channel,
+        const amqp_basic_properties_t *properties,
+        const std::vector<BodySegment> &segments)
+{
+    // Each body frame carries a 7 byte header and a frame-end octet
+    const size_t FRAME_OVERHEAD = 8;
+    const size_t max_fragment = amqp_get_frame_max(m_connection) - FRAME_OVERHEAD;
+
+    uint64_t body_size = 0;
+    for (std::vector<BodySegment>::const_iterator it = segments.begin();
+            it != segments.end(); ++it)
+    {
+        body_size += it->Length();
+    }
+
+    amqp_frame_t frame;
+    frame.frame_type = AMQP_FRAME_HEADER;
+    frame.channel = channel;
+    frame.payload.properties.class_id = AMQP_BASIC_CLASS;
+    frame.payload.properties.body_size = body_size;
+    frame.payload.properties.decoded = const_cast<amqp_basic_properties_t *>(properties);
+
+    int ret = amqp_send_frame(m_connection, &frame);
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    // Body frames are written straight from the segment with a vectored
+    // write, a segment larger than a frame is split over several frames
+    frame.frame_type = AMQP_FRAME_BODY;
+    for (std::vector<BodySegment>::const_iterator it = segments.begin();
+            it != segments.end(); ++it)
+    {
+        const char *data = static_cast<const char *>(it->Data());
+        size_t remaining = it->Length();
+        while (remaining > 0)
+        {
+            const size_t fragment_len = std::min(remaining, max_fragment);
+            frame.payload.body_fragment.bytes = const_cast<char *>(data);
+            frame.payload.body_fragment.len = fragment_len;
+
+            ret = amqp_send_frame(m_connection, &frame);
+            if (ret < 0)
+            {
+                return ret;
+            }
+            data += fragment_len;
+            remaining -= fragment_len;
+        }
+    }
+    return AMQP_STATUS_OK;
+}
+
+int ChannelImpl::SendPublish(amqp_channel_t channel,
+                             const std::string &exchange_name,
+                             const std::string &routing_key,
+                             const BasicMessage::ptr_t &to_publish,
+                             bool mandatory,
+                             bool immediate)
+{
+    if (to_publish->getBodySegments().empty())
+    {
+        return amqp_basic_publish(m_connection, channel,
+                                  amqp_cstring_bytes(exchange_name.c_str()),
+                                  amqp_cstring_bytes(routing_key.c_str()),
+                                  mandatory,
+                                  immediate,
+                                  to_publish->getAmqpProperties(),
+                                  to_publish->getAmqpBody());
+    }
+    return BasicPublishSegments(channel,
+                                amqp_cstring_bytes(exchange_name.c_str()),
+                                amqp_cstring_bytes(routing_key.c_str()),
+                                mandatory,
+                                immediate,
+                                to_publish->getAmqpProperties(),
+                                to_publish->getBodySegments());
+}
+
+void ChannelImpl::PublishOnChannel(amqp_channel_t channel,
+                                   const std::string &exchange_name,
+                                   const std::string &routing_key,
+                                   const BasicMessage::ptr_t &to_publish,
+                                   bool mandatory,
+                                   bool immediate)
+{
+    const timing_t start = StartTiming();
+    CheckForError(SendPublish(channel, exchange_name, routing_key, to_publish, mandatory, immediate));
+    TakePublishTags(channel);
+
+    // If we've done things correctly we can get one of 4 things back from the broker
+    // - basic.ack - our channel is in confirm mode, messsage was 'dealt with' by the broker
+    // - basic.return then basic.ack - the message wasn't delievered, but was dealt with
+    // - channel.close - probably tried to publish to a non-existant exchange, in any case error!
+    // - connection.clsoe - something really bad happened
+    const boost::array<boost::uint32_t, 2> PUBLISH_ACK = { { AMQP_BASIC_ACK_METHOD, AMQP_BASIC_RETURN_METHOD } };
+    amqp_frame_t response;
+    boost::array<amqp_channel_t, 1> channels = {{ channel }};
+    GetMethodOnChannel(channels, response, PUBLISH_ACK);
+
+    if (AMQP_BASIC_RETURN_METHOD == response.payload.method.id)
+    {
+        MessageReturnedException message_returned =
+            CreateMessageReturnedException(*(reinterpret_cast<amqp_basic_return_t *>(response.payload.method.decoded)), channel);
+
+        const boost::array<boost::uint32_t, 1> BASIC_ACK = { { AMQP_BASIC_ACK_METHOD } };
+        GetMethodOnChannel(channels, response, BASIC_ACK);
+        RecordTiming(m_publish_confirm_latency, start);
+        MaybeReleaseBuffersOnChannel(channel);
+        throw message_returned;
+    }
+
+    RecordTiming(m_publish_confirm_latency, start);
+    MaybeReleaseBuffersOnChannel(channel);
+}
+
+void ChannelImpl::WaitForConfirms(amqp_channel_t channel, boost::uint64_t first_tag, boost::uint64_t count)
+{
+    const boost::array<boost::uint32_t, 2> PUBLISH_ACK = { { AMQP_BASIC_ACK_METHOD, AMQP_BASIC_RETURN_METHOD } };
+    boost::array<amqp_channel_t, 1> channels = {{ channel }};
+    const boost::uint64_t last_tag = first_tag + count - 1;
+    std::vector<bool> confirmed(count, false);
+    boost::uint64_t unconfirmed = count;
+    boost::scoped_ptr<MessageReturnedException> message_returned;
+
+    while (unconfirmed > 0)
+    {
+        amqp_frame_t response;
+        GetMethodOnChannel(channels, response, PUBLISH_ACK);
+
+        if (AMQP_BASIC_RETURN_METHOD == response.payload.method.id)
+        {
+            MessageReturnedException returned =
+                CreateMessageReturnedException(*(reinterpret_cast<amqp_basic_return_t *>(response.payload.method.decoded)), channel);
+            if (!message_returned)
+            {
+                message_returned.reset(new MessageReturnedException(returned));
+            }
+            continue;
+        }
+
+        const amqp_basic_ack_t *ack = reinterpret_cast<amqp_basic_ack_t *>(response.payload.method.decoded);
+        const boost::uint64_t from = ack->multiple ? first_tag : std::max(first_tag, ack->delivery_tag);
+        const boost::uint64_t to = std::min(last_tag, ack->delivery_tag);
+        for (boost::uint64_t tag = from; tag <= to; ++tag)
+        {
+            if (!confirmed[tag - first_tag])
+            {
+                confirmed[tag - first_tag] = true;
+                --unconfirmed;
+            }
+        }
+    }
+
+    if (message_returned)
+    {
+        throw *message_returned;
+    }
+}
+
 MessageReturnedException ChannelImpl::CreateMessageReturnedException(amqp_basic_return_t &return_method, amqp_channel_t channel)
 {
     const int reply_code = return_method.reply_code;
     const std::string reply_text((char *)return_method.reply_text.bytes, return_method.reply_text.len);
     const std::string exchange((char *)return_method.exchange.bytes, return_method.exchange.len);
     const std::string routing_key((char *)return_method.routing_key.bytes, return_method.routing_key.len);
-    BasicMessage::ptr_t content = ReadContent(channel);
+    // A returned message was routed nowhere, so its claimed file is finished
+    // with as soon as it is read
+    std::string claimed_path;
+    BasicMessage::ptr_t content = ReadContent(channel, claimed_path);
+    if (!claimed_path.empty())
+    {
+        std::remove(claimed_path.c_str());
+    }
     return MessageReturnedException(content, reply_code, reply_text, exchange, routing_key);
 }
 
-BasicMessage::ptr_t ChannelImpl::ReadContent(amqp_channel_t channel)
+BasicMessage::ptr_t ChannelImpl::ReadContent(amqp_channel_t channel, std::string &claimed_path)
+{
+    const timing_t start = StartTiming();
+    BasicMessage::ptr_t message = AssembleContent(channel, claimed_path);
+    RecordTiming(m_read_content_latency, start);
+    return message;
+}
+
+void ChannelImpl::GetBodyFrame(amqp_channel_t channel, amqp_frame_t &frame)
+{
+    GetNextFrameOnChannel(channel, frame);
+
+    if (frame.frame_type != AMQP_FRAME_BODY)
+        // TODO: we should connection.close here
+        throw std::runtime_error("Channel::BasicConsumeMessage: received unexpected frame type (was expecting AMQP_FRAME_BODY)");
+}
+
+BasicMessage::ptr_t ChannelImpl::AssembleContent(amqp_channel_t channel, std::string &claimed_path)
 {
     amqp_frame_t frame;
 
@@ -252,22 +524,280 @@ BasicMessage::ptr_t ChannelImpl::ReadContent(amqp_channel_t channel)
     size_t body_size = static_cast<size_t>(frame.payload.properties.body_size);
     size_t received_size = 0;
 
-    amqp_bytes_t body = amqp_bytes_malloc(body_size);
+    if (0 != m_spill_threshold && body_size >= m_spill_threshold)
+    {
+        return DecodeBody(ReadSpilledContent(channel, properties, body_size));
+    }
+
+    amqp_bytes_t body;
+    body.len = body_size;
+    body.bytes = NULL;
+    boost::shared_ptr<const void> body_owner;
+    if (!m_body_allocator)
+    {
+        body = amqp_bytes_malloc(body_size);
+    }
+    else if (0 != body_size)
+    {
+        body.bytes = m_body_allocator->Allocate(body_size);
+        body_owner.reset(body.bytes, BodyDeleter(m_body_allocator, body_size));
+    }
 
     // frame #3 and up:
     while (received_size < body_size)
     {
-        GetNextFrameOnChannel(channel, frame);
-
-        if (frame.frame_type != AMQP_FRAME_BODY)
-            // TODO: we should connection.close here
-            throw std::runtime_error("Channel::BasicConsumeMessage: received unexpected frame type (was expecting AMQP_FRAME_BODY)");
-
+        GetBodyFrame(channel, frame);
         void *body_ptr = reinterpret_cast<char *>(body.bytes) + received_size;
         memcpy(body_ptr, frame.payload.body_fragment.bytes, frame.payload.body_fragment.len);
         received_size += frame.payload.body_fragment.len;
     }
-    return BasicMessage::Create(body, properties);
+    if (!m_body_allocator)
+    {
+        return DecodeBody(ClaimBody(BasicMessage::Create(body, properties), claimed_path));
+    }
+    return DecodeBody(ClaimBody(BasicMessage::Create(body, body_owner, properties), claimed_path));
+}
+
+BasicMessage::ptr_t ChannelImpl::ReadSpilledContent(amqp_channel_t channel,
+        const amqp_basic_properties_t *properties, size_t body_size)
+{
+    SpillFile file(m_spill_directory, body_size);
+
+    // The properties live in the channel's buffers, which are released as
+    // the body is received, so copy them first
+    amqp_bytes_t no_body;
+    no_body.len = 0;
+    no_body.bytes = NULL;
+    BasicMessage::ptr_t header = BasicMessage::Create(no_body, const_cast<amqp_basic_properties_t *>(properties));
+
+    amqp_frame_t frame;
+    size_t received_size = 0;
+    while (received_size < body_size)
+    {
+        GetBodyFrame(channel, frame);
+        file.Write(frame.payload.body_fragment.bytes, frame.payload.body_fragment.len);
+        received_size += frame.payload.body_fragment.len;
+        // Each fragment is finished with once written, don't let them pile
+        // up in the connection's buffers
+        MaybeReleaseBuffersOnChannel(channel);
+    }
+
+    boost::shared_ptr<const void> mapping = file.Map();
+    amqp_bytes_t body;
+    body.len = body_size;
+    body.bytes = const_cast<void *>(mapping.get());
+    return BasicMessage::Create(body, mapping, header->getAmqpProperties());
+}
+
+BasicMessage::ptr_t ChannelImpl::CheckInBody(const BasicMessage::ptr_t &message)
+{
+    if (!m_claim_check_enabled)
+    {
+        return message;
+    }
+
+    const std::vector<BodySegment> &segments = message->getBodySegments();
+    size_t body_size = 0;
+    if (segments.empty())
+    {
+        body_size = message->getAmqpBody().len;
+    }
+    for (std::vector<BodySegment>::const_iterator it = segments.begin(); it != segments.end(); ++it)
+    {
+        body_size += it->Length();
+    }
+    if (body_size < m_claim_check_threshold)
+    {
+        return message;
+    }
+
+    SpillFile file(m_claim_check_directory, body_size, true);
+    if (segments.empty())
+    {
+        file.Write(message->getAmqpBody().bytes, body_size);
+    }
+    for (std::vector<BodySegment>::const_iterator it = segments.begin(); it != segments.end(); ++it)
+    {
+        file.Write(it->Data(), it->Length());
+    }
+
+    // The claim check shares everything but the body with the original
+    BasicMessage::ptr_t claim_check = message->Clone();
+    Table headers = claim_check->HeaderTable();
+    headers.erase(Channel::CLAIM_CHECK_HEADER);
+    headers.insert(TableEntry(Channel::CLAIM_CHECK_HEADER, file.Keep()));
+    claim_check->HeaderTable(headers);
+    claim_check->Body(std::string());
+    return claim_check;
+}
+
+BasicMessage::ptr_t ChannelImpl::ClaimBody(const BasicMessage::ptr_t &message, std::string &claimed_path)
+{
+    if (!m_claim_check_enabled || !message->HeaderTableIsSet())
+    {
+        return message;
+    }
+
+    HeaderView headers = message->HeaderTableView();
+    if (!headers.IsSet(Channel::CLAIM_CHECK_HEADER) ||
+            TableValue::VT_string != headers.GetType(Channel::CLAIM_CHECK_HEADER))
+    {
+        return message;
+    }
+
+    // Only accept names BasicPublish could have written, so a message can't
+    // claim any other file, in the claim check directory or outside it
+    const std::string name = headers.GetString(Channel::CLAIM_CHECK_HEADER).to_string();
+    if (!IsSpillFileName(name))
+    {
+        return message;
+    }
+
+    // Messages whose body can't be found are delivered as they are, so the
+    // application can still see (and ack or reject) them
+    const std::string path = m_claim_check_directory + "/" + name;
+    size_t body_size = MAP_TO_END;
+    const void *data;
+    boost::shared_ptr<const void> mapping;
+    try
+    {
+        mapping = MapPathRange(path, 0, body_size, data);
+    }
+    catch (std::runtime_error &)
+    {
+        return message;
+    }
+    // The file is removed once the delivery is settled, the mapping stays
+    // valid after that
+    claimed_path = path;
+
+    amqp_bytes_t body;
+    body.len = body_size;
+    body.bytes = const_cast<void *>(data);
+    BasicMessage::ptr_t claimed = BasicMessage::Create(body, mapping, message->getAmqpProperties());
+
+    Table claimed_headers = claimed->HeaderTable();
+    claimed_headers.erase(Channel::CLAIM_CHECK_HEADER);
+    if (claimed_headers.empty())
+    {
+        claimed->HeaderTableClear();
+    }
+    else
+    {
+        claimed->HeaderTable(claimed_headers);
+    }
+    return claimed;
+}
+
+void ChannelImpl::ClaimDelivered(amqp_channel_t channel, boost::uint64_t delivery_tag, bool no_ack,
+                                 const std::string &claimed_path)
+{
+    if (claimed_path.empty())
+    {
+        return;
+    }
+    if (no_ack)
+    {
+        std::remove(claimed_path.c_str());
+        return;
+    }
+    m_claimed_files[channel][delivery_tag] = claimed_path;
+}
+
+void ChannelImpl::SettleClaims(amqp_channel_t channel, boost::uint64_t delivery_tag, bool multiple, bool remove)
+{
+    std::map<amqp_channel_t, claimed_files_t>::iterator files = m_claimed_files.find(channel);
+    if (m_claimed_files.end() == files)
+    {
+        return;
+    }
+    // With multiple, every delivery up to and including delivery_tag is
+    // settled, as the broker treats it
+    claimed_files_t::iterator first = multiple ? files->second.begin() : files->second.find(delivery_tag);
+    claimed_files_t::iterator last = files->second.upper_bound(delivery_tag);
+    if (files->second.end() == first)
+    {
+        return;
+    }
+    if (remove)
+    {
+        for (claimed_files_t::const_iterator it = first; it != last; ++it)
+        {
+            std::remove(it->second.c_str());
+        }
+    }
+    files->second.erase(first, last);
+    if (files->second.empty())
+    {
+        m_claimed_files.erase(files);
+    }
+}
+
+void ChannelImpl::ForgetClaims(amqp_channel_t channel)
+{
+    m_claimed_files.erase(channel);
+}
+
+BasicMessage::ptr_t ChannelImpl::EncodeBody(const BasicMessage::ptr_t &message)
+{
+    // A body that already has a content encoding is left alone, it can't be
+    // given two
+    if (!m_publish_codec || message->ContentEncodingIsSet())
+    {
+        return message;
+    }
+
+    const boost::string_ref body = message->BodyView();
+    if (body.size() < m_publish_codec_threshold)
+    {
+        return message;
+    }
+
+    boost::shared_ptr<std::string> encoded_body = boost::make_shared<std::string>();
+    m_publish_codec->Encode(body.data(), body.size(), *encoded_body);
+    // Not worth making consumers decode a body that didn't get any smaller
+    if (encoded_body->size() >= body.size())
+    {
+        return message;
+    }
+
+    BasicMessage::ptr_t encoded = message->Clone();
+    encoded->Body(boost::shared_ptr<const std::string>(encoded_body));
+    encoded->ContentEncoding(m_publish_codec->Name());
+    return encoded;
+}
+
+BasicMessage::ptr_t ChannelImpl::DecodeBody(const BasicMessage::ptr_t &message)
+{
+    if (m_body_codecs.empty() || !message->ContentEncodingIsSet())
+    {
+        return message;
+    }
+
+    std::map<std::string, BodyCodec::ptr_t>::const_iterator codec =
+        m_body_codecs.find(message->ContentEncoding());
+    if (codec == m_body_codecs.end())
+    {
+        return message;
+    }
+
+    // Like claim checks, messages that can't be decoded are delivered as
+    // they are, content encoding and all
+    const boost::string_ref body = message->BodyView();
+    boost::shared_ptr<std::string> decoded_body = boost::make_shared<std::string>();
+    try
+    {
+        codec->second->Decode(body.data(), body.size(), *decoded_body);
+    }
+    catch (std::runtime_error &)
+    {
+        return message;
+    }
+
+    BasicMessage::ptr_t decoded = message->Clone();
+    decoded->Body(boost::shared_ptr<const std::string>(decoded_body));
+    decoded->ContentEncodingClear();
+    return decoded;
 }
 
 void ChannelImpl::CheckFrameForClose(amqp_frame_t &frame, amqp_channel_t channel)
@@ -289,9 +819,13 @@ void ChannelImpl::CheckFrameForClose(amqp_frame_t &frame, amqp_channel_t channel
     }
 }
 
-void ChannelImpl::AddConsumer(const std::string &consumer_tag, amqp_channel_t channel)
+void ChannelImpl::AddConsumer(const std::string &consumer_tag, amqp_channel_t channel, bool no_ack)
 {
     m_consumer_channel_map.insert(std::make_pair(consumer_tag, channel));
+    if (no_ack)
+    {
+        m_no_ack_consumers.insert(consumer_tag);
+    }
 }
 
 amqp_channel_t ChannelImpl::RemoveConsumer(const std::string &consumer_tag)
@@ -305,6 +839,7 @@ amqp_channel_t ChannelImpl::RemoveConsumer(const std::string &consumer_tag)
     amqp_channel_t result = it->second;
 
     m_consumer_channel_map.erase(it);
+    m_no_ack_consumers.erase(consumer_tag);
 
     return result;
 }
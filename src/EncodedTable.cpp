@@ -0,0 +1,158 @@
+/* vim:set ft=cpp ts=4 sw=4 sts=4 et cindent: */
+/*
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MIT
+ *
+ * Copyright (c) 2010-2013 Alan Antonuk
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * ***** END LICENSE BLOCK *****
+ */
+
+// Put these first to avoid warnings about INT#_C macro redefinition
+#include <amqp.h>
+
+#include "SimpleAmqpClient/EncodedTable.h"
+#include "SimpleAmqpClient/AmqpLibraryException.h"
+#include "SimpleAmqpClient/TableImpl.h"
+
+#include <boost/cstdint.hpp>
+
+#include <algorithm>
+#include <vector>
+
+namespace AmqpClient
+{
+
+namespace Detail
+{
+
+class EncodedTableImpl
+{
+public:
+    EncodedTableImpl() : m_table(AMQP_EMPTY_TABLE) {}
+
+    amqp_pool_ptr_t m_pool;
+    amqp_table_t m_table;
+    std::string m_wire_bytes;
+
+    void EncodeWireBytes()
+    {
+        std::vector<char> buffer(1024);
+        for (;;)
+        {
+            amqp_bytes_t encoded;
+            encoded.len = buffer.size();
+            encoded.bytes = &buffer[0];
+            size_t offset = 0;
+
+            int status = amqp_encode_table(encoded, &m_table, &offset);
+            if (AMQP_STATUS_OK == status)
+            {
+                m_wire_bytes.assign(&buffer[0], offset);
+                return;
+            }
+            if (AMQP_STATUS_TABLE_TOO_BIG != status)
+            {
+                throw AmqpLibraryException::CreateException(status, "Encoding field table");
+            }
+            buffer.resize(buffer.size() * 2);
+        }
+    }
+};
+
+} // namespace Detail
+
+EncodedTable::ptr_t EncodedTable::CreateFromWireBytes(const std::string &wire_bytes)
+{
+    ptr_t table(new EncodedTable());
+    Detail::EncodedTableImpl &impl = *table->m_impl;
+
+    // Keep just the table, as given by its length prefix, and decode from
+    // that copy: the decoded keys and strings point in to the bytes decoded,
+    // so they stay valid as long as the table and the views sharing it
+    size_t table_size = wire_bytes.size();
+    if (table_size >= 4)
+    {
+        const unsigned char *prefix = reinterpret_cast<const unsigned char *>(wire_bytes.data());
+        const boost::uint64_t encoded_size = 4 + ((static_cast<boost::uint64_t>(prefix[0]) << 24) |
+                                             (static_cast<boost::uint64_t>(prefix[1]) << 16) |
+                                             (static_cast<boost::uint64_t>(prefix[2]) << 8) |
+                                             static_cast<boost::uint64_t>(prefix[3]));
+        table_size = static_cast<size_t>(std::min<boost::uint64_t>(encoded_size, table_size));
+    }
+    impl.m_wire_bytes.assign(wire_bytes, 0, table_size);
+
+    amqp_bytes_t encoded;
+    encoded.len = impl.m_wire_bytes.size();
+    encoded.bytes = const_cast<char *>(impl.m_wire_bytes.data());
+    size_t offset = 0;
+
+    int status = amqp_decode_table(encoded, &Detail::TableValueImpl::ResetPool(impl.m_pool), &impl.m_table, &offset);
+    if (AMQP_STATUS_OK != status)
+    {
+        throw AmqpLibraryException::CreateException(status, "Decoding field table");
+    }
+    return table;
+}
+
+EncodedTable::EncodedTable()
+    : m_impl(new Detail::EncodedTableImpl)
+{
+}
+
+EncodedTable::EncodedTable(const Table &table)
+    : m_impl(new Detail::EncodedTableImpl)
+{
+    m_impl->m_table = Detail::TableValueImpl::CreateAmqpTable(table, m_impl->m_pool);
+    m_impl->EncodeWireBytes();
+}
+
+EncodedTable::~EncodedTable()
+{
+}
+
+const std::string &EncodedTable::WireBytes() const
+{
+    return m_impl->m_wire_bytes;
+}
+
+HeaderView EncodedTable::View() const
+{
+    return HeaderView(m_impl->m_pool, m_impl->m_table);
+}
+
+Table EncodedTable::ToTable() const
+{
+    return Detail::TableValueImpl::CreateTable(m_impl->m_table);
+}
+
+const amqp_table_t &EncodedTable::getAmqpTable() const
+{
+    return m_impl->m_table;
+}
+
+const boost::shared_ptr<amqp_pool_t> &EncodedTable::getAmqpPool() const
+{
+    return m_impl->m_pool;
+}
+
+} // namespace AmqpClient
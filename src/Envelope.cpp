@@ -45,6 +45,21 @@ Envelope::Envelope(const BasicMessage::ptr_t message, const std::string &consume
 {
 }
 
+#ifndef BOOST_NO_RVALUE_REFERENCES
+Envelope::Envelope(const BasicMessage::ptr_t message, std::string &&consumer_tag,
+                   const boost::uint64_t delivery_tag, std::string &&exchange, bool redelivered, std::string &&routing_key,
+                   const boost::uint16_t delivery_channel)
+    : m_message(message)
+    , m_consumerTag(std::move(consumer_tag))
+    , m_deliveryTag(delivery_tag)
+    , m_exchange(std::move(exchange))
+    , m_redelivered(redelivered)
+    , m_routingKey(std::move(routing_key))
+    , m_deliveryChannel(delivery_channel)
+{
+}
+#endif
+
 Envelope::~Envelope()
 {
 }
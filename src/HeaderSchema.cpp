@@ -0,0 +1,333 @@
+/* vim:set ft=cpp ts=4 sw=4 sts=4 et cindent: */
+/*
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MIT
+ *
+ * Copyright (c) 2010-2013 Alan Antonuk
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * ***** END LICENSE BLOCK *****
+ */
+
+// Put these first to avoid warnings about INT#_C macro redefinition
+#include <amqp.h>
+#include <amqp_framing.h>
+
+#include "SimpleAmqpClient/HeaderSchema.h"
+#include "SimpleAmqpClient/BasicMessageImpl.h"
+#include "SimpleAmqpClient/TableImpl.h"
+
+#include <boost/variant/get.hpp>
+
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+namespace AmqpClient
+{
+namespace Detail
+{
+
+HeaderSchemaWriter::HeaderSchemaWriter(BasicMessage &message, std::size_t size)
+    : m_message(message)
+    , m_pool(NULL)
+    , m_entries(NULL)
+    , m_size(size)
+    , m_position(0)
+{
+    BasicMessageImpl &impl = *m_message.m_impl;
+
+    // Encoding may recycle the pool the current headers live in
+    impl.m_properties._flags &= ~AMQP_BASIC_HEADERS_FLAG;
+    m_pool = &TableValueImpl::ResetPool(impl.m_table_pool);
+
+    if (0 != m_size)
+    {
+        m_entries = (amqp_table_entry_t *)amqp_pool_alloc(m_pool, sizeof(amqp_table_entry_t) * m_size);
+        if (NULL == m_entries)
+        {
+            throw std::bad_alloc();
+        }
+    }
+}
+
+HeaderSchemaWriter &HeaderSchemaWriter::operator()(const char *key, bool value)
+{
+    amqp_field_value_t &v = NextValue(key);
+    v.kind = AMQP_FIELD_KIND_BOOLEAN;
+    v.value.boolean = value;
+    return *this;
+}
+
+HeaderSchemaWriter &HeaderSchemaWriter::operator()(const char *key, boost::int8_t value)
+{
+    amqp_field_value_t &v = NextValue(key);
+    v.kind = AMQP_FIELD_KIND_I8;
+    v.value.i8 = value;
+    return *this;
+}
+
+HeaderSchemaWriter &HeaderSchemaWriter::operator()(const char *key, boost::int16_t value)
+{
+    amqp_field_value_t &v = NextValue(key);
+    v.kind = AMQP_FIELD_KIND_I16;
+    v.value.i16 = value;
+    return *this;
+}
+
+HeaderSchemaWriter &HeaderSchemaWriter::operator()(const char *key, boost::int32_t value)
+{
+    amqp_field_value_t &v = NextValue(key);
+    v.kind = AMQP_FIELD_KIND_I32;
+    v.value.i32 = value;
+    return *this;
+}
+
+HeaderSchemaWriter &HeaderSchemaWriter::operator()(const char *key, boost::int64_t value)
+{
+    amqp_field_value_t &v = NextValue(key);
+    v.kind = AMQP_FIELD_KIND_I64;
+    v.value.i64 = value;
+    return *this;
+}
+
+HeaderSchemaWriter &HeaderSchemaWriter::operator()(const char *key, float value)
+{
+    amqp_field_value_t &v = NextValue(key);
+    v.kind = AMQP_FIELD_KIND_F32;
+    v.value.f32 = value;
+    return *this;
+}
+
+HeaderSchemaWriter &HeaderSchemaWriter::operator()(const char *key, double value)
+{
+    amqp_field_value_t &v = NextValue(key);
+    v.kind = AMQP_FIELD_KIND_F64;
+    v.value.f64 = value;
+    return *this;
+}
+
+HeaderSchemaWriter &HeaderSchemaWriter::operator()(const char *key, const std::string &value)
+{
+    WriteString(key, value.data(), value.size());
+    return *this;
+}
+
+HeaderSchemaWriter &HeaderSchemaWriter::operator()(const char *key, const char *value)
+{
+    WriteString(key, value, std::strlen(value));
+    return *this;
+}
+
+void HeaderSchemaWriter::WriteString(const char *key, const char *value, std::size_t len)
+{
+    amqp_field_value_t &v = NextValue(key);
+    v.kind = AMQP_FIELD_KIND_UTF8;
+    amqp_pool_alloc_bytes(m_pool, len, &v.value.bytes);
+    if (NULL == v.value.bytes.bytes && 0 != len)
+    {
+        throw std::bad_alloc();
+    }
+    std::memcpy(v.value.bytes.bytes, value, len);
+}
+
+void HeaderSchemaWriter::Commit()
+{
+    if (m_position != m_size)
+    {
+        throw std::logic_error("Header schema wrote a different number of fields than it declared");
+    }
+
+    BasicMessageImpl &impl = *m_message.m_impl;
+    impl.m_properties.headers.num_entries = m_size;
+    impl.m_properties.headers.entries = m_entries;
+    impl.m_properties._flags |= AMQP_BASIC_HEADERS_FLAG;
+}
+
+amqp_field_value_t &HeaderSchemaWriter::NextValue(const char *key)
+{
+    if (m_position == m_size)
+    {
+        throw std::logic_error("Header schema wrote a different number of fields than it declared");
+    }
+
+    amqp_table_entry_t &entry = m_entries[m_position++];
+    std::size_t key_len = std::strlen(key);
+    amqp_pool_alloc_bytes(m_pool, key_len, &entry.key);
+    if (NULL == entry.key.bytes && 0 != key_len)
+    {
+        throw std::bad_alloc();
+    }
+    std::memcpy(entry.key.bytes, key, key_len);
+    return entry.value;
+}
+
+HeaderSchemaReader::HeaderSchemaReader(const BasicMessage &message)
+    : m_view(message.HeaderTableView())
+    , m_position(0)
+{
+}
+
+HeaderSchemaReader &HeaderSchemaReader::operator()(const char *key, bool &value)
+{
+    const amqp_field_value_t &v = NextValue(key);
+    if (AMQP_FIELD_KIND_BOOLEAN != v.kind)
+    {
+        throw boost::bad_get();
+    }
+    value = v.value.boolean != 0;
+    return *this;
+}
+
+HeaderSchemaReader &HeaderSchemaReader::operator()(const char *key, boost::int8_t &value)
+{
+    const amqp_field_value_t &v = NextValue(key);
+    if (AMQP_FIELD_KIND_I8 != v.kind)
+    {
+        throw boost::bad_get();
+    }
+    value = v.value.i8;
+    return *this;
+}
+
+HeaderSchemaReader &HeaderSchemaReader::operator()(const char *key, boost::int16_t &value)
+{
+    const amqp_field_value_t &v = NextValue(key);
+    switch (v.kind)
+    {
+    case AMQP_FIELD_KIND_I8:
+        value = v.value.i8;
+        break;
+    case AMQP_FIELD_KIND_I16:
+        value = v.value.i16;
+        break;
+    default:
+        throw boost::bad_get();
+    }
+    return *this;
+}
+
+HeaderSchemaReader &HeaderSchemaReader::operator()(const char *key, boost::int32_t &value)
+{
+    const amqp_field_value_t &v = NextValue(key);
+    switch (v.kind)
+    {
+    case AMQP_FIELD_KIND_I8:
+        value = v.value.i8;
+        break;
+    case AMQP_FIELD_KIND_I16:
+        value = v.value.i16;
+        break;
+    case AMQP_FIELD_KIND_I32:
+        value = v.value.i32;
+        break;
+    default:
+        throw boost::bad_get();
+    }
+    return *this;
+}
+
+HeaderSchemaReader &HeaderSchemaReader::operator()(const char *key, boost::int64_t &value)
+{
+    const amqp_field_value_t &v = NextValue(key);
+    switch (v.kind)
+    {
+    case AMQP_FIELD_KIND_I8:
+        value = v.value.i8;
+        break;
+    case AMQP_FIELD_KIND_I16:
+        value = v.value.i16;
+        break;
+    case AMQP_FIELD_KIND_I32:
+        value = v.value.i32;
+        break;
+    case AMQP_FIELD_KIND_I64:
+    case AMQP_FIELD_KIND_TIMESTAMP:
+        value = v.value.i64;
+        break;
+    default:
+        throw boost::bad_get();
+    }
+    return *this;
+}
+
+HeaderSchemaReader &HeaderSchemaReader::operator()(const char *key, float &value)
+{
+    const amqp_field_value_t &v = NextValue(key);
+    if (AMQP_FIELD_KIND_F32 != v.kind)
+    {
+        throw boost::bad_get();
+    }
+    value = v.value.f32;
+    return *this;
+}
+
+HeaderSchemaReader &HeaderSchemaReader::operator()(const char *key, double &value)
+{
+    const amqp_field_value_t &v = NextValue(key);
+    switch (v.kind)
+    {
+    case AMQP_FIELD_KIND_F32:
+        value = v.value.f32;
+        break;
+    case AMQP_FIELD_KIND_F64:
+        value = v.value.f64;
+        break;
+    default:
+        throw boost::bad_get();
+    }
+    return *this;
+}
+
+HeaderSchemaReader &HeaderSchemaReader::operator()(const char *key, std::string &value)
+{
+    const amqp_field_value_t &v = NextValue(key);
+    if (AMQP_FIELD_KIND_UTF8 != v.kind && AMQP_FIELD_KIND_BYTES != v.kind)
+    {
+        throw boost::bad_get();
+    }
+    value.assign(static_cast<const char *>(v.value.bytes.bytes), v.value.bytes.len);
+    return *this;
+}
+
+const amqp_field_value_t &HeaderSchemaReader::NextValue(const char *key)
+{
+    const boost::string_ref key_ref(key);
+    const int num_entries = m_view.m_num_entries;
+
+    // Headers written with the same schema are in field order, so start
+    // looking where the previous field was found
+    for (int i = 0; i < num_entries; ++i)
+    {
+        const int index = (m_position + i) % num_entries;
+        const amqp_table_entry_t &entry = m_view.m_entries[index];
+        if (entry.key.len == key_ref.size() &&
+                (key_ref.empty() || 0 == std::memcmp(entry.key.bytes, key_ref.data(), key_ref.size())))
+        {
+            m_position = index + 1;
+            return entry.value;
+        }
+    }
+    throw std::out_of_range("Key not found in table: " + key_ref.to_string());
+}
+
+} // namespace Detail
+} // namespace AmqpClient
@@ -0,0 +1,206 @@
+/* vim:set ft=cpp ts=4 sw=4 sts=4 et cindent: */
+/*
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MIT
+ *
+ * Copyright (c) 2010-2013 Alan Antonuk
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * ***** END LICENSE BLOCK *****
+ */
+
+// Put these first to avoid warnings about INT#_C macro redefinition
+#include <amqp.h>
+
+#include "SimpleAmqpClient/HeaderView.h"
+#include "SimpleAmqpClient/TableImpl.h"
+
+#include <boost/variant/get.hpp>
+
+#include <cstring>
+#include <stdexcept>
+
+namespace AmqpClient
+{
+
+HeaderView::HeaderView()
+    : m_num_entries(0)
+    , m_entries(NULL)
+{
+}
+
+HeaderView::HeaderView(const boost::shared_ptr<amqp_pool_t> &owner, const amqp_table_t &table)
+    : m_owner(owner)
+    , m_num_entries(table.num_entries)
+    , m_entries(table.entries)
+{
+}
+
+bool HeaderView::Empty() const
+{
+    return 0 == m_num_entries;
+}
+
+std::size_t HeaderView::Size() const
+{
+    return m_num_entries;
+}
+
+bool HeaderView::IsSet(boost::string_ref key) const
+{
+    return NULL != FindInner(key);
+}
+
+TableValue::ValueType HeaderView::GetType(boost::string_ref key) const
+{
+    switch (Find(key).kind)
+    {
+    case AMQP_FIELD_KIND_BOOLEAN:
+        return TableValue::VT_bool;
+    case AMQP_FIELD_KIND_I8:
+        return TableValue::VT_int8;
+    case AMQP_FIELD_KIND_I16:
+        return TableValue::VT_int16;
+    case AMQP_FIELD_KIND_I32:
+        return TableValue::VT_int32;
+    case AMQP_FIELD_KIND_I64:
+    case AMQP_FIELD_KIND_TIMESTAMP:
+        return TableValue::VT_int64;
+    case AMQP_FIELD_KIND_F32:
+        return TableValue::VT_float;
+    case AMQP_FIELD_KIND_F64:
+        return TableValue::VT_double;
+    case AMQP_FIELD_KIND_UTF8:
+    case AMQP_FIELD_KIND_BYTES:
+        return TableValue::VT_string;
+    case AMQP_FIELD_KIND_ARRAY:
+        return TableValue::VT_array;
+    case AMQP_FIELD_KIND_TABLE:
+        return TableValue::VT_table;
+    case AMQP_FIELD_KIND_VOID:
+    case AMQP_FIELD_KIND_DECIMAL:
+    default:
+        return TableValue::VT_void;
+    }
+}
+
+bool HeaderView::GetBool(boost::string_ref key) const
+{
+    const amqp_field_value_t &value = Find(key);
+    if (AMQP_FIELD_KIND_BOOLEAN != value.kind)
+    {
+        throw boost::bad_get();
+    }
+    return value.value.boolean != 0;
+}
+
+boost::int64_t HeaderView::GetInteger(boost::string_ref key) const
+{
+    const amqp_field_value_t &value = Find(key);
+    switch (value.kind)
+    {
+    case AMQP_FIELD_KIND_I8:
+        return value.value.i8;
+    case AMQP_FIELD_KIND_I16:
+        return value.value.i16;
+    case AMQP_FIELD_KIND_I32:
+        return value.value.i32;
+    case AMQP_FIELD_KIND_I64:
+    case AMQP_FIELD_KIND_TIMESTAMP:
+        return value.value.i64;
+    default:
+        throw boost::bad_get();
+    }
+}
+
+double HeaderView::GetReal(boost::string_ref key) const
+{
+    const amqp_field_value_t &value = Find(key);
+    switch (value.kind)
+    {
+    case AMQP_FIELD_KIND_F32:
+        return value.value.f32;
+    case AMQP_FIELD_KIND_F64:
+        return value.value.f64;
+    default:
+        throw boost::bad_get();
+    }
+}
+
+boost::string_ref HeaderView::GetString(boost::string_ref key) const
+{
+    const amqp_field_value_t &value = Find(key);
+    if (AMQP_FIELD_KIND_UTF8 != value.kind && AMQP_FIELD_KIND_BYTES != value.kind)
+    {
+        throw boost::bad_get();
+    }
+    return boost::string_ref(static_cast<const char *>(value.value.bytes.bytes),
+                             value.value.bytes.len);
+}
+
+HeaderView HeaderView::GetTable(boost::string_ref key) const
+{
+    const amqp_field_value_t &value = Find(key);
+    if (AMQP_FIELD_KIND_TABLE != value.kind)
+    {
+        throw boost::bad_get();
+    }
+    return HeaderView(m_owner, value.value.table);
+}
+
+TableValue HeaderView::GetValue(boost::string_ref key) const
+{
+    return Detail::TableValueImpl::CreateTableValue(Find(key));
+}
+
+Table HeaderView::ToTable() const
+{
+    amqp_table_t table;
+    table.num_entries = m_num_entries;
+    table.entries = const_cast<amqp_table_entry_t *>(m_entries);
+    return Detail::TableValueImpl::CreateTable(table);
+}
+
+const amqp_field_value_t &HeaderView::Find(boost::string_ref key) const
+{
+    const amqp_field_value_t *value = FindInner(key);
+    if (NULL == value)
+    {
+        throw std::out_of_range("Key not found in table: " + key.to_string());
+    }
+    return *value;
+}
+
+const amqp_field_value_t *HeaderView::FindInner(boost::string_ref key) const
+{
+    for (int i = 0; i < m_num_entries; ++i)
+    {
+        const amqp_bytes_t &entry_key = m_entries[i].key;
+        if (entry_key.len == key.size() &&
+                (key.empty() || 0 == std::memcmp(entry_key.bytes, key.data(), key.size())))
+        {
+            return &m_entries[i].value;
+        }
+    }
+    return NULL;
+}
+
+} // namespace AmqpClient
@@ -0,0 +1,160 @@
+/* vim:set ft=cpp ts=4 sw=4 sts=4 et cindent: */
+/*
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MIT
+ *
+ * Copyright (c) 2010-2013 Alan Antonuk
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "SimpleAmqpClient/LatencyHistogram.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace AmqpClient
+{
+
+namespace
+{
+
+// Each power of two from 2^SUB_BUCKET_BITS up is split in to SUB_BUCKETS
+// buckets, below that every value has a bucket of its own
+const int SUB_BUCKET_BITS = 6;
+const boost::uint64_t SUB_BUCKETS = 1u << SUB_BUCKET_BITS;
+// Values are clamped to below 2^MAX_BITS nanoseconds
+const int MAX_BITS = 44;
+const boost::uint64_t MAX_VALUE = (static_cast<boost::uint64_t>(1) << MAX_BITS) - 1;
+const std::size_t BUCKETS = static_cast<std::size_t>((MAX_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS);
+
+int HighestBit(boost::uint64_t value)
+{
+    int bit = 0;
+    while (value >>= 1)
+    {
+        ++bit;
+    }
+    return bit;
+}
+
+std::size_t BucketIndex(boost::uint64_t value)
+{
+    if (value < 2 * SUB_BUCKETS)
+    {
+        return static_cast<std::size_t>(value);
+    }
+    // Keep the top SUB_BUCKET_BITS + 1 bits, the leading one picks the
+    // power of two along with the shift
+    const int shift = HighestBit(value) - SUB_BUCKET_BITS;
+    return static_cast<std::size_t>(shift * SUB_BUCKETS + (value >> shift));
+}
+
+// The largest value counted in a bucket
+boost::uint64_t BucketTop(std::size_t index)
+{
+    if (index < 2 * SUB_BUCKETS)
+    {
+        return index;
+    }
+    const int shift = static_cast<int>(index / SUB_BUCKETS) - 1;
+    const boost::uint64_t sub_bucket = index % SUB_BUCKETS + SUB_BUCKETS;
+    return ((sub_bucket + 1) << shift) - 1;
+}
+
+} // namespace
+
+LatencyHistogram::LatencyHistogram() :
+    m_count(0),
+    m_min(std::numeric_limits<boost::uint64_t>::max()),
+    m_max(0),
+    m_total(0)
+{
+}
+
+void LatencyHistogram::Record(boost::uint64_t nanoseconds)
+{
+    if (m_counts.empty())
+    {
+        m_counts.resize(BUCKETS, 0);
+    }
+    const boost::uint64_t value = std::min(nanoseconds, MAX_VALUE);
+    ++m_counts[BucketIndex(value)];
+    ++m_count;
+    m_min = std::min(m_min, value);
+    m_max = std::max(m_max, value);
+    m_total += value;
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram &other)
+{
+    if (other.m_counts.empty())
+    {
+        return;
+    }
+    if (m_counts.empty())
+    {
+        m_counts.resize(BUCKETS, 0);
+    }
+    for (std::size_t i = 0; i < BUCKETS; ++i)
+    {
+        m_counts[i] += other.m_counts[i];
+    }
+    m_count += other.m_count;
+    m_min = std::min(m_min, other.m_min);
+    m_max = std::max(m_max, other.m_max);
+    m_total += other.m_total;
+}
+
+void LatencyHistogram::Reset()
+{
+    std::fill(m_counts.begin(), m_counts.end(), 0);
+    m_count = 0;
+    m_min = std::numeric_limits<boost::uint64_t>::max();
+    m_max = 0;
+    m_total = 0;
+}
+
+boost::uint64_t LatencyHistogram::Percentile(double percentile) const
+{
+    if (0 == m_count)
+    {
+        return 0;
+    }
+    const double fraction = std::min(std::max(percentile, 0.0), 100.0) / 100.0;
+    const boost::uint64_t rank = std::max<boost::uint64_t>(
+                                     static_cast<boost::uint64_t>(std::ceil(fraction * m_count)), 1);
+
+    boost::uint64_t seen = 0;
+    for (std::size_t i = 0; i < m_counts.size(); ++i)
+    {
+        seen += m_counts[i];
+        if (seen >= rank)
+        {
+            return std::max(std::min(BucketTop(i), m_max), m_min);
+        }
+    }
+    return m_max;
+}
+
+} // namespace AmqpClient
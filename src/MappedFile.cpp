@@ -0,0 +1,269 @@
+/* vim:set ft=cpp ts=4 sw=4 sts=4 et cindent: */
+/*
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MIT
+ *
+ * Copyright (c) 2010-2013 Alan Antonuk
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * ***** END LICENSE BLOCK *****
+ */
+
+#ifdef _WIN32
+# define NOMINMAX
+# ifndef WIN32_LEAN_AND_MEAN
+#  define WIN32_LEAN_AND_MEAN
+# endif
+# include <windows.h>
+# include <io.h>
+#else
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <errno.h>
+# include <fcntl.h>
+# include <string.h>
+# include <unistd.h>
+#endif
+
+#include "SimpleAmqpClient/MappedFile.h"
+
+#include <boost/lexical_cast.hpp>
+
+#include <stdexcept>
+#include <string>
+
+namespace AmqpClient
+{
+namespace Detail
+{
+
+namespace
+{
+
+#ifdef _WIN32
+
+class UnmapView
+{
+public:
+    void operator()(void *view) const
+    {
+        UnmapViewOfFile(view);
+    }
+};
+
+#else
+
+class Unmap
+{
+public:
+    explicit Unmap(std::size_t size) : m_size(size) {}
+
+    void operator()(void *mapping) const
+    {
+        munmap(mapping, m_size);
+    }
+
+private:
+    std::size_t m_size;
+};
+
+#endif
+
+} // namespace
+
+#ifdef _WIN32
+
+boost::shared_ptr<const void> MapFileRange(native_file_t file, boost::uint64_t offset,
+        std::size_t length, const void *&data)
+{
+    if (0 == length)
+    {
+        data = NULL;
+        return boost::shared_ptr<const void>();
+    }
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size))
+    {
+        throw std::runtime_error("MapFileRange: GetFileSizeEx failed: error " +
+                                 boost::lexical_cast<std::string>(GetLastError()));
+    }
+    if (offset > static_cast<boost::uint64_t>(file_size.QuadPart) ||
+            length > static_cast<boost::uint64_t>(file_size.QuadPart) - offset)
+    {
+        throw std::runtime_error("MapFileRange: range is past the end of the file");
+    }
+
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    const boost::uint64_t aligned_offset = offset - offset % info.dwAllocationGranularity;
+    const std::size_t lead = static_cast<std::size_t>(offset - aligned_offset);
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (NULL == mapping)
+    {
+        throw std::runtime_error("MapFileRange: CreateFileMapping failed: error " +
+                                 boost::lexical_cast<std::string>(GetLastError()));
+    }
+    void *view = MapViewOfFile(mapping, FILE_MAP_READ, static_cast<DWORD>(aligned_offset >> 32),
+                               static_cast<DWORD>(aligned_offset), lead + length);
+    // The view keeps the mapping open
+    CloseHandle(mapping);
+    if (NULL == view)
+    {
+        throw std::runtime_error("MapFileRange: MapViewOfFile failed: error " +
+                                 boost::lexical_cast<std::string>(GetLastError()));
+    }
+
+    data = static_cast<const char *>(view) + lead;
+    return boost::shared_ptr<const void>(view, UnmapView());
+}
+
+boost::shared_ptr<const void> MapFdRange(int fd, boost::uint64_t offset,
+        std::size_t length, const void *&data)
+{
+    HANDLE file = reinterpret_cast<HANDLE>(_get_osfhandle(fd));
+    if (INVALID_HANDLE_VALUE == file)
+    {
+        throw std::runtime_error("MapFdRange: not an open file descriptor");
+    }
+    return MapFileRange(file, offset, length, data);
+}
+
+boost::shared_ptr<const void> MapPathRange(const std::string &path, boost::uint64_t offset,
+        std::size_t &length, const void *&data)
+{
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+                              FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (INVALID_HANDLE_VALUE == file)
+    {
+        throw std::runtime_error("MapPathRange: could not open " + path + ": error " +
+                                 boost::lexical_cast<std::string>(GetLastError()));
+    }
+
+    try
+    {
+        if (MAP_TO_END == length)
+        {
+            LARGE_INTEGER file_size;
+            if (!GetFileSizeEx(file, &file_size))
+            {
+                throw std::runtime_error("MapPathRange: GetFileSizeEx failed: error " +
+                                         boost::lexical_cast<std::string>(GetLastError()));
+            }
+            if (offset > static_cast<boost::uint64_t>(file_size.QuadPart))
+            {
+                throw std::runtime_error("MapPathRange: offset is past the end of the file");
+            }
+            length = static_cast<std::size_t>(file_size.QuadPart - offset);
+        }
+        boost::shared_ptr<const void> mapping = MapFileRange(file, offset, length, data);
+        CloseHandle(file);
+        return mapping;
+    }
+    catch (...)
+    {
+        CloseHandle(file);
+        throw;
+    }
+}
+
+#else
+
+boost::shared_ptr<const void> MapFileRange(native_file_t file, boost::uint64_t offset,
+        std::size_t length, const void *&data)
+{
+    if (0 == length)
+    {
+        data = NULL;
+        return boost::shared_ptr<const void>();
+    }
+
+    struct stat file_stat;
+    if (-1 == fstat(file, &file_stat))
+    {
+        throw std::runtime_error(std::string("MapFileRange: fstat failed: ") + strerror(errno));
+    }
+    if (offset > static_cast<boost::uint64_t>(file_stat.st_size) ||
+            length > static_cast<boost::uint64_t>(file_stat.st_size) - offset)
+    {
+        throw std::runtime_error("MapFileRange: range is past the end of the file");
+    }
+
+    const boost::uint64_t page_size = sysconf(_SC_PAGESIZE);
+    const boost::uint64_t aligned_offset = offset - offset % page_size;
+    const std::size_t lead = static_cast<std::size_t>(offset - aligned_offset);
+
+    void *mapping = mmap(NULL, lead + length, PROT_READ, MAP_SHARED, file, static_cast<off_t>(aligned_offset));
+    if (MAP_FAILED == mapping)
+    {
+        throw std::runtime_error(std::string("MapFileRange: mmap failed: ") + strerror(errno));
+    }
+
+    data = static_cast<const char *>(mapping) + lead;
+    return boost::shared_ptr<const void>(mapping, Unmap(lead + length));
+}
+
+boost::shared_ptr<const void> MapFdRange(int fd, boost::uint64_t offset,
+        std::size_t length, const void *&data)
+{
+    return MapFileRange(fd, offset, length, data);
+}
+
+boost::shared_ptr<const void> MapPathRange(const std::string &path, boost::uint64_t offset,
+        std::size_t &length, const void *&data)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (-1 == fd)
+    {
+        throw std::runtime_error("MapPathRange: could not open " + path + ": " + strerror(errno));
+    }
+
+    try
+    {
+        if (MAP_TO_END == length)
+        {
+            struct stat file_stat;
+            if (-1 == fstat(fd, &file_stat))
+            {
+                throw std::runtime_error(std::string("MapPathRange: fstat failed: ") + strerror(errno));
+            }
+            if (offset > static_cast<boost::uint64_t>(file_stat.st_size))
+            {
+                throw std::runtime_error("MapPathRange: offset is past the end of the file");
+            }
+            length = static_cast<std::size_t>(file_stat.st_size - offset);
+        }
+        boost::shared_ptr<const void> mapping = MapFileRange(fd, offset, length, data);
+        close(fd);
+        return mapping;
+    }
+    catch (...)
+    {
+        close(fd);
+        throw;
+    }
+}
+
+#endif
+
+} // namespace Detail
+} // namespace AmqpClient
@@ -0,0 +1,259 @@
+/* vim:set ft=cpp ts=4 sw=4 sts=4 et cindent: */
+/*
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MIT
+ *
+ * Copyright (c) 2010-2013 Alan Antonuk
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "SimpleAmqpClient/PooledBodyAllocator.h"
+
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+namespace AmqpClient
+{
+
+namespace Detail
+{
+
+class PooledBodyAllocatorImpl
+{
+public:
+    // The classes are fixed rather than fitted to the sizes received: the
+    // smallest class and the number of classes between each power of two
+    static const std::size_t MIN_CLASS_SIZE = 64;
+    static const std::size_t MAX_CLASS_SIZE = 1024 * 1024;
+    static const int CLASSES_PER_DOUBLING = 4;
+    // Demand is halved this often, so it reflects recent allocations
+    static const boost::uint64_t DEMAND_DECAY_INTERVAL = 4096;
+
+    struct SizeClass
+    {
+        std::size_t size;
+        boost::uint64_t demand;
+        std::vector<void *> free_list;
+    };
+
+    explicit PooledBodyAllocatorImpl(std::size_t cache_limit)
+        : m_cache_limit(cache_limit)
+        , m_stats()
+    {
+        for (std::size_t base = MIN_CLASS_SIZE; base < MAX_CLASS_SIZE; base *= 2)
+        {
+            for (int step = 0; step < CLASSES_PER_DOUBLING; ++step)
+            {
+                AddClass(base + step * (base / CLASSES_PER_DOUBLING));
+            }
+        }
+        AddClass(MAX_CLASS_SIZE);
+    }
+
+    ~PooledBodyAllocatorImpl()
+    {
+        Trim();
+    }
+
+    void AddClass(std::size_t size)
+    {
+        SizeClass size_class;
+        size_class.size = size;
+        size_class.demand = 0;
+        m_classes.push_back(size_class);
+    }
+
+    // Returns the smallest class that fits size, or NULL if none does
+    SizeClass *FindClass(std::size_t size)
+    {
+        std::vector<SizeClass>::iterator it = std::lower_bound(m_classes.begin(), m_classes.end(), size, ClassSizeLess);
+        return m_classes.end() == it ? NULL : &*it;
+    }
+
+    static bool ClassSizeLess(const SizeClass &size_class, std::size_t size)
+    {
+        return size_class.size < size;
+    }
+
+    void *Allocate(std::size_t size)
+    {
+        ++m_stats.allocations;
+        if (0 == m_stats.allocations % DEMAND_DECAY_INTERVAL)
+        {
+            for (std::vector<SizeClass>::iterator it = m_classes.begin(); it != m_classes.end(); ++it)
+            {
+                it->demand /= 2;
+            }
+        }
+
+        SizeClass *size_class = FindClass(size);
+        if (NULL == size_class)
+        {
+            ++m_stats.oversize;
+            return Malloc(size);
+        }
+
+        ++size_class->demand;
+        if (!size_class->free_list.empty())
+        {
+            ++m_stats.hits;
+            void *body = size_class->free_list.back();
+            size_class->free_list.pop_back();
+            m_stats.cached_bytes -= size_class->size;
+            return body;
+        }
+        return Malloc(size_class->size);
+    }
+
+    void Deallocate(void *body, std::size_t size)
+    {
+        SizeClass *size_class = FindClass(size);
+        if (NULL == size_class)
+        {
+            std::free(body);
+            return;
+        }
+
+        // Make room by evicting buffers of classes in less demand than this
+        // one, if that is not enough the buffer itself is released
+        while (m_stats.cached_bytes + size_class->size > m_cache_limit)
+        {
+            SizeClass *victim = NULL;
+            for (std::vector<SizeClass>::iterator it = m_classes.begin(); it != m_classes.end(); ++it)
+            {
+                if (!it->free_list.empty() && it->demand < size_class->demand &&
+                        (NULL == victim || it->demand < victim->demand))
+                {
+                    victim = &*it;
+                }
+            }
+            if (NULL == victim)
+            {
+                ++m_stats.released;
+                std::free(body);
+                return;
+            }
+            Release(*victim);
+        }
+
+        size_class->free_list.push_back(body);
+        m_stats.cached_bytes += size_class->size;
+    }
+
+    void SetCacheLimit(std::size_t cache_limit)
+    {
+        m_cache_limit = cache_limit;
+        // Largest classes first, they free the most for the fewest buffers
+        for (std::vector<SizeClass>::reverse_iterator it = m_classes.rbegin();
+                it != m_classes.rend() && m_stats.cached_bytes > m_cache_limit; ++it)
+        {
+            while (!it->free_list.empty() && m_stats.cached_bytes > m_cache_limit)
+            {
+                Release(*it);
+            }
+        }
+    }
+
+    void Trim()
+    {
+        for (std::vector<SizeClass>::iterator it = m_classes.begin(); it != m_classes.end(); ++it)
+        {
+            while (!it->free_list.empty())
+            {
+                Release(*it);
+            }
+        }
+    }
+
+    void Release(SizeClass &size_class)
+    {
+        ++m_stats.released;
+        std::free(size_class.free_list.back());
+        size_class.free_list.pop_back();
+        m_stats.cached_bytes -= size_class.size;
+    }
+
+    static void *Malloc(std::size_t size)
+    {
+        void *body = std::malloc(size);
+        if (NULL == body)
+        {
+            throw std::bad_alloc();
+        }
+        return body;
+    }
+
+    // Guards everything below, bodies may be released on any thread
+    mutable boost::mutex m_mutex;
+    std::vector<SizeClass> m_classes;
+    std::size_t m_cache_limit;
+    PooledBodyAllocator::Stats m_stats;
+};
+
+} // namespace Detail
+
+PooledBodyAllocator::PooledBodyAllocator(std::size_t cache_limit) :
+    m_impl(new Detail::PooledBodyAllocatorImpl(cache_limit))
+{
+}
+
+PooledBodyAllocator::~PooledBodyAllocator()
+{
+}
+
+void *PooledBodyAllocator::Allocate(std::size_t size)
+{
+    boost::lock_guard<boost::mutex> lock(m_impl->m_mutex);
+    return m_impl->Allocate(size);
+}
+
+void PooledBodyAllocator::Deallocate(void *body, std::size_t size)
+{
+    boost::lock_guard<boost::mutex> lock(m_impl->m_mutex);
+    m_impl->Deallocate(body, size);
+}
+
+PooledBodyAllocator::Stats PooledBodyAllocator::GetStats() const
+{
+    boost::lock_guard<boost::mutex> lock(m_impl->m_mutex);
+    return m_impl->m_stats;
+}
+
+void PooledBodyAllocator::SetCacheLimit(std::size_t cache_limit)
+{
+    boost::lock_guard<boost::mutex> lock(m_impl->m_mutex);
+    m_impl->SetCacheLimit(cache_limit);
+}
+
+void PooledBodyAllocator::Trim()
+{
+    boost::lock_guard<boost::mutex> lock(m_impl->m_mutex);
+    m_impl->Trim();
+}
+
+} // namespace AmqpClient
@@ -0,0 +1,453 @@
+/* vim:set ft=cpp ts=4 sw=4 sts=4 et cindent: */
+/*
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MIT
+ *
+ * Copyright (c) 2010-2013 Alan Antonuk
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "SimpleAmqpClient/RpcClient.h"
+#include "SimpleAmqpClient/HeaderView.h"
+#include "SimpleAmqpClient/RpcReplyStream.h"
+
+#include <boost/bind.hpp>
+#include <boost/chrono.hpp>
+#include <boost/chrono/ceil.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/unordered_map.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace AmqpClient
+{
+
+namespace Detail
+{
+
+class RpcClientImpl
+{
+public:
+    typedef boost::chrono::steady_clock clock;
+
+    struct PendingCall
+    {
+        RpcCall::ptr_t call;
+        // The call's timeout on the channel's timers, 0 for calls without one
+        TimerWheel::timer_id_t timer;
+        // Restarted by each part of a streaming reply
+        int timeout;
+    };
+    typedef boost::unordered_map<std::string, PendingCall> pending_t;
+
+    RpcClientImpl(const Channel::ptr_t &channel, const std::string &exchange, bool direct_reply_to)
+        : m_channel(channel)
+        , m_exchange(exchange)
+        , m_direct_reply_to(direct_reply_to)
+        , m_next_correlation_id(0)
+        , m_finished_count(0)
+        , m_part_count(0)
+    {
+        if (m_direct_reply_to)
+        {
+            // The broker insists on no_ack, and the reply to property is
+            // rewritten to address this consumer when a request is published
+            // on its channel
+            m_reply_queue = Channel::DIRECT_REPLY_TO_QUEUE;
+            m_consumer_tag = m_channel->BasicConsume(m_reply_queue, "", true, true, false);
+            return;
+        }
+
+        // Replies may be sent through amq.direct as well as the default
+        // exchange, as SimpleRpcServer does
+        m_reply_queue = m_channel->DeclareQueue("", false, false, true, true);
+        m_channel->BindQueue(m_reply_queue, "amq.direct", m_reply_queue);
+        m_consumer_tag = m_channel->BasicConsume(m_reply_queue, "", true, true, true);
+    }
+
+    ~RpcClientImpl()
+    {
+        for (pending_t::iterator it = m_pending.begin(); it != m_pending.end(); ++it)
+        {
+            m_channel->Timers().Cancel(it->second.timer);
+            it->second.call->m_client = NULL;
+            it->second.call->m_status = RpcCall::CANCELLED;
+        }
+        try
+        {
+            m_channel->BasicCancel(m_consumer_tag);
+        }
+        catch (std::exception &)
+        {
+            // The channel may already be unusable, and the queue goes away
+            // with it anyway
+        }
+    }
+
+    RpcCall::ptr_t Call(const std::string &routing_key, const BasicMessage::ptr_t &request,
+                        std::size_t replies, bool streaming, int timeout)
+    {
+        if (0 == replies)
+        {
+            throw std::invalid_argument("A call must expect at least one reply");
+        }
+
+        const std::string correlation_id = boost::lexical_cast<std::string>(m_next_correlation_id++);
+
+        BasicMessage::ptr_t outgoing = request->Clone();
+        outgoing->ReplyTo(m_reply_queue);
+        outgoing->CorrelationId(correlation_id);
+        if (m_direct_reply_to)
+        {
+            m_channel->BasicPublishOnConsumerChannel(m_consumer_tag, m_exchange, routing_key, outgoing);
+        }
+        else
+        {
+            m_channel->BasicPublish(m_exchange, routing_key, outgoing);
+        }
+
+        PendingCall pending;
+        pending.call = boost::make_shared<RpcCall>(this, correlation_id, replies, streaming);
+        pending.timeout = timeout;
+        pending.timer = ScheduleTimeOut(correlation_id, timeout);
+        m_pending.insert(std::make_pair(correlation_id, pending));
+        return pending.call;
+    }
+
+    TimerWheel::timer_id_t ScheduleTimeOut(const std::string &correlation_id, int timeout)
+    {
+        if (timeout < 0)
+        {
+            return 0;
+        }
+        return m_channel->Timers().Schedule(timeout, boost::bind(&RpcClientImpl::TimeOut, this, correlation_id));
+    }
+
+    std::size_t Poll(int timeout)
+    {
+        // Calls finish from timer callbacks as well as here, so count them
+        // all rather than what this function does
+        const boost::uint64_t finished_before = m_finished_count;
+        const boost::uint64_t parts_before = m_part_count;
+        m_channel->Timers().Advance();
+        if (m_pending.empty())
+        {
+            return static_cast<std::size_t>(m_finished_count - finished_before);
+        }
+
+        const clock::time_point until = clock::now() + boost::chrono::milliseconds(std::max(timeout, 0));
+        for (;;)
+        {
+            // Once something has finished, or a part of a stream has arrived
+            // for a reader to take, only replies already received are
+            // handled. Timeouts are run by the channel while it waits, stop
+            // waiting when the next one is due
+            const bool progressed = finished_before != m_finished_count || parts_before != m_part_count;
+            int wait = 0;
+            if (!progressed)
+            {
+                wait = timeout < 0 ? -1 : MillisecondsUntil(until);
+                const int next_timer = m_channel->Timers().MillisecondsUntilNext();
+                if (next_timer >= 0 && (wait < 0 || next_timer < wait))
+                {
+                    wait = next_timer;
+                }
+            }
+
+            Envelope::ptr_t envelope;
+            if (m_channel->BasicConsumeMessage(m_consumer_tag, envelope, wait))
+            {
+                HandleReply(envelope->Message());
+                continue;
+            }
+
+            if (finished_before != m_finished_count || parts_before != m_part_count || m_pending.empty() ||
+                    (timeout >= 0 && clock::now() >= until))
+            {
+                return static_cast<std::size_t>(m_finished_count - finished_before);
+            }
+        }
+    }
+
+    static int MillisecondsUntil(const clock::time_point &when)
+    {
+        const clock::time_point now = clock::now();
+        if (when <= now)
+        {
+            return 0;
+        }
+        // Round up, so a wait doesn't end just before the time it's for
+        return static_cast<int>(boost::chrono::ceil<boost::chrono::milliseconds>(when - now).count());
+    }
+
+    void HandleReply(const BasicMessage::ptr_t &reply)
+    {
+        if (!reply->CorrelationIdIsSet())
+        {
+            return;
+        }
+        pending_t::iterator it = m_pending.find(reply->CorrelationId());
+        if (it == m_pending.end())
+        {
+            // Most likely a late reply to a call that has timed out, or one
+            // more than a scatter-gather call expected
+            return;
+        }
+        RpcCall &call = *it->second.call;
+        if (call.m_streaming)
+        {
+            HandlePart(it, reply);
+            return;
+        }
+        call.m_replies.push_back(reply);
+        if (call.m_replies.size() >= call.m_expected_replies)
+        {
+            m_channel->Timers().Cancel(it->second.timer);
+            Finish(it, RpcCall::REPLIED);
+        }
+    }
+
+    void HandlePart(pending_t::iterator it, const BasicMessage::ptr_t &part)
+    {
+        RpcCall &call = *it->second.call;
+        boost::int64_t sequence;
+        try
+        {
+            sequence = part->HeaderTableView().GetInteger(RpcReplyStream::SEQUENCE_HEADER);
+        }
+        catch (std::exception &)
+        {
+            // Not part of a stream
+            return;
+        }
+        if (sequence < 0 || static_cast<boost::uint64_t>(sequence) < call.m_next_part)
+        {
+            return;
+        }
+        call.m_early_parts.insert(std::make_pair(static_cast<boost::uint64_t>(sequence), part));
+
+        // Hand over every part now in order, the end marker included
+        bool ended = false;
+        while (!ended && !call.m_early_parts.empty() &&
+                call.m_early_parts.begin()->first == call.m_next_part)
+        {
+            BasicMessage::ptr_t next = call.m_early_parts.begin()->second;
+            call.m_early_parts.erase(call.m_early_parts.begin());
+            ++call.m_next_part;
+            if (IsEnd(next))
+            {
+                ended = true;
+            }
+            else
+            {
+                call.m_parts.push_back(next);
+                ++m_part_count;
+            }
+        }
+
+        m_channel->Timers().Cancel(it->second.timer);
+        if (ended)
+        {
+            call.m_early_parts.clear();
+            Finish(it, RpcCall::REPLIED);
+        }
+        else
+        {
+            it->second.timer = ScheduleTimeOut(it->first, it->second.timeout);
+        }
+    }
+
+    static bool IsEnd(const BasicMessage::ptr_t &part)
+    {
+        HeaderView headers = part->HeaderTableView();
+        return headers.IsSet(RpcReplyStream::END_HEADER) &&
+               TableValue::VT_bool == headers.GetType(RpcReplyStream::END_HEADER) &&
+               headers.GetBool(RpcReplyStream::END_HEADER);
+    }
+
+    void TimeOut(const std::string &correlation_id)
+    {
+        pending_t::iterator it = m_pending.find(correlation_id);
+        if (it != m_pending.end())
+        {
+            Finish(it, RpcCall::TIMED_OUT);
+        }
+    }
+
+    void Finish(pending_t::iterator it, RpcCall::Status status)
+    {
+        it->second.call->m_status = status;
+        it->second.call->m_client = NULL;
+        m_pending.erase(it);
+        ++m_finished_count;
+    }
+
+    Channel::ptr_t m_channel;
+    const std::string m_exchange;
+    const bool m_direct_reply_to;
+    std::string m_reply_queue;
+    std::string m_consumer_tag;
+
+    boost::uint64_t m_next_correlation_id;
+    pending_t m_pending;
+    // Calls finished so far, by reply or timeout
+    boost::uint64_t m_finished_count;
+    // Parts of streaming replies received so far
+    boost::uint64_t m_part_count;
+};
+
+} // namespace Detail
+
+RpcCall::RpcCall(Detail::RpcClientImpl *client, const std::string &correlation_id,
+                 std::size_t expected_replies, bool streaming) :
+    m_client(client),
+    m_correlation_id(correlation_id),
+    m_expected_replies(expected_replies),
+    m_streaming(streaming),
+    m_status(PENDING),
+    m_next_part(0)
+{
+}
+
+RpcCall::~RpcCall()
+{
+}
+
+bool RpcCall::Wait(int timeout)
+{
+    typedef boost::chrono::steady_clock clock;
+    const clock::time_point until = clock::now() + boost::chrono::milliseconds(std::max(timeout, 0));
+    while (!IsReady())
+    {
+        int remaining = -1;
+        if (timeout >= 0)
+        {
+            remaining = Detail::RpcClientImpl::MillisecondsUntil(until);
+        }
+        m_client->Poll(remaining);
+        if (0 == remaining)
+        {
+            break;
+        }
+    }
+    return IsReady();
+}
+
+BasicMessage::ptr_t RpcCall::Get()
+{
+    if (m_streaming)
+    {
+        throw std::logic_error("RpcCall: the reply to a streaming call is read with NextReply");
+    }
+    Wait();
+    switch (m_status)
+    {
+    case TIMED_OUT:
+        throw RpcTimeoutException();
+    case CANCELLED:
+        throw std::runtime_error("The RPC call was cancelled by destroying its RpcClient");
+    default:
+        return Reply();
+    }
+}
+
+bool RpcCall::NextReply(BasicMessage::ptr_t &part, int timeout)
+{
+    if (!m_streaming)
+    {
+        throw std::logic_error("RpcCall: NextReply is only for streaming calls");
+    }
+
+    typedef boost::chrono::steady_clock clock;
+    const clock::time_point until = clock::now() + boost::chrono::milliseconds(std::max(timeout, 0));
+    while (m_parts.empty() && !IsReady())
+    {
+        int remaining = -1;
+        if (timeout >= 0)
+        {
+            remaining = Detail::RpcClientImpl::MillisecondsUntil(until);
+        }
+        m_client->Poll(remaining);
+        if (0 == remaining)
+        {
+            break;
+        }
+    }
+
+    if (m_parts.empty())
+    {
+        return false;
+    }
+    part = m_parts.front();
+    m_parts.pop_front();
+    return true;
+}
+
+RpcClient::RpcClient(const Channel::ptr_t &channel, const std::string &exchange, bool direct_reply_to) :
+    m_impl(new Detail::RpcClientImpl(channel, exchange, direct_reply_to))
+{
+}
+
+RpcClient::~RpcClient()
+{
+}
+
+std::string RpcClient::ReplyQueue() const
+{
+    return m_impl->m_reply_queue;
+}
+
+RpcCall::ptr_t RpcClient::Call(const std::string &routing_key,
+                               const BasicMessage::ptr_t &request,
+                               int timeout)
+{
+    return m_impl->Call(routing_key, request, 1, false, timeout);
+}
+
+RpcCall::ptr_t RpcClient::ScatterGather(const std::string &routing_key,
+                                        const BasicMessage::ptr_t &request,
+                                        std::size_t replies,
+                                        int timeout)
+{
+    return m_impl->Call(routing_key, request, replies, false, timeout);
+}
+
+RpcCall::ptr_t RpcClient::CallStreaming(const std::string &routing_key,
+                                        const BasicMessage::ptr_t &request,
+                                        int timeout)
+{
+    return m_impl->Call(routing_key, request, 1, true, timeout);
+}
+
+std::size_t RpcClient::Poll(int timeout)
+{
+    return m_impl->Poll(timeout);
+}
+
+std::size_t RpcClient::Outstanding() const
+{
+    return m_impl->m_pending.size();
+}
+
+} // namespace AmqpClient
@@ -0,0 +1,111 @@
+/* vim:set ft=cpp ts=4 sw=4 sts=4 et cindent: */
+/*
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MIT
+ *
+ * Copyright (c) 2010-2013 Alan Antonuk
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "SimpleAmqpClient/RpcReplyStream.h"
+
+#include <stdexcept>
+
+namespace AmqpClient
+{
+
+const std::string RpcReplyStream::SEQUENCE_HEADER("x-stream-sequence");
+const std::string RpcReplyStream::END_HEADER("x-stream-end");
+
+namespace
+{
+
+std::string ReplyTo(const BasicMessage::ptr_t &request)
+{
+    if (!request->ReplyToIsSet())
+    {
+        throw std::invalid_argument("RpcReplyStream: the request has no reply to queue");
+    }
+    return request->ReplyTo();
+}
+
+} // namespace
+
+RpcReplyStream::RpcReplyStream(const Channel::ptr_t &channel, const BasicMessage::ptr_t &request) :
+    m_channel(channel),
+    m_reply_to(ReplyTo(request)),
+    m_correlation_id(request->CorrelationIdIsSet() ? request->CorrelationId() : std::string()),
+    m_sequence(0),
+    m_ended(false)
+{
+}
+
+RpcReplyStream::~RpcReplyStream()
+{
+}
+
+void RpcReplyStream::Send(const BasicMessage::ptr_t &part)
+{
+    if (m_ended)
+    {
+        throw std::logic_error("RpcReplyStream: the stream has ended");
+    }
+    Publish(part, TableEntry(SEQUENCE_HEADER, static_cast<boost::int64_t>(m_sequence)));
+    ++m_sequence;
+}
+
+void RpcReplyStream::End()
+{
+    if (m_ended)
+    {
+        throw std::logic_error("RpcReplyStream: the stream has already ended");
+    }
+    // The end marker takes the sequence number after the last part, so a
+    // client that receives parts out of order only ends the stream once it
+    // has them all
+    BasicMessage::ptr_t end = BasicMessage::Create();
+    Table headers;
+    headers.insert(TableEntry(SEQUENCE_HEADER, static_cast<boost::int64_t>(m_sequence)));
+    end->HeaderTable(headers);
+    Publish(end, TableEntry(END_HEADER, true));
+    m_ended = true;
+}
+
+void RpcReplyStream::Publish(const BasicMessage::ptr_t &message, const TableEntry &marker)
+{
+    Table headers;
+    if (message->HeaderTableIsSet())
+    {
+        headers = message->HeaderTable();
+        headers.erase(marker.first);
+    }
+    headers.insert(marker);
+    message->HeaderTable(headers);
+    if (!m_correlation_id.empty())
+    {
+        message->CorrelationId(m_correlation_id);
+    }
+    m_channel->BasicPublish("", m_reply_to, message);
+}
+
+} // namespace AmqpClient
@@ -0,0 +1,395 @@
+/* vim:set ft=cpp ts=4 sw=4 sts=4 et cindent: */
+/*
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MIT
+ *
+ * Copyright (c) 2010-2013 Alan Antonuk
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "SimpleAmqpClient/RpcServer.h"
+
+#include <boost/bind.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <algorithm>
+#include <deque>
+#include <stdexcept>
+#include <vector>
+
+namespace AmqpClient
+{
+
+namespace Detail
+{
+
+class RpcServerImpl
+{
+public:
+    // How long to wait for a request before acknowledging finished ones
+    static const int POLL_INTERVAL = 10;
+
+    struct Finished
+    {
+        Finished(const Envelope::ptr_t &request, bool handled)
+            : request(request), handled(handled)
+        {}
+
+        Envelope::ptr_t request;
+        // Acknowledge the request if true, otherwise reject it
+        bool handled;
+    };
+
+    struct Reply
+    {
+        Envelope::ptr_t request;
+        BasicMessage::ptr_t reply;
+    };
+
+    RpcServerImpl(const Channel::ptr_t &channel,
+                  const Channel::ptr_t &reply_channel,
+                  const std::string &queue,
+                  const RpcServer::handler_t &handler,
+                  unsigned int workers,
+                  boost::uint16_t prefetch)
+        : m_channel(channel)
+        , m_reply_channel(reply_channel)
+        , m_queue(queue)
+        , m_handler(handler)
+        , m_workers(std::max(workers, 1u))
+        , m_prefetch(0 != prefetch ? prefetch : static_cast<boost::uint16_t>(std::min(m_workers * 2, 0xffffu)))
+        , m_stop_requested(false)
+        , m_shutting_down(false)
+        , m_publish_failed(false)
+    {
+        if (m_channel == m_reply_channel)
+        {
+            throw std::invalid_argument("RpcServer: the reply channel must be a different Channel");
+        }
+    }
+
+    void Run()
+    {
+        {
+            // m_stop_requested is left alone so a Stop made before Run
+            // started isn't lost, StopThreads clears it once Run is done
+            boost::lock_guard<boost::mutex> lock(m_mutex);
+            m_shutting_down = false;
+            m_publish_failed = false;
+            m_work.clear();
+            m_replies.clear();
+            m_finished.clear();
+        }
+
+        boost::thread_group threads;
+        try
+        {
+            for (unsigned int i = 0; i < m_workers; ++i)
+            {
+                threads.create_thread(boost::bind(&RpcServerImpl::WorkerLoop, this));
+            }
+            threads.create_thread(boost::bind(&RpcServerImpl::PublisherLoop, this));
+
+            ConsumeLoop();
+        }
+        catch (...)
+        {
+            StopThreads(threads);
+            throw;
+        }
+        StopThreads(threads);
+    }
+
+    void Stop()
+    {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        m_stop_requested = true;
+        m_finished_ready.notify_all();
+    }
+
+    void ConsumeLoop()
+    {
+        const std::string consumer_tag = m_channel->BasicConsume(m_queue, "", true, false, false, m_prefetch);
+        bool consuming = true;
+        std::size_t in_progress = 0;
+        try
+        {
+            for (;;)
+            {
+                std::vector<Finished> finished;
+                bool stop_requested;
+                {
+                    boost::unique_lock<boost::mutex> lock(m_mutex);
+                    // With nothing more to be delivered until some requests
+                    // finish, wait for them rather than the broker
+                    while (m_finished.empty() && !m_publish_failed &&
+                            0 != in_progress &&
+                            (!consuming || (in_progress >= m_prefetch && !m_stop_requested)))
+                    {
+                        m_finished_ready.wait(lock);
+                    }
+                    finished.swap(m_finished);
+                    stop_requested = m_stop_requested;
+                    if (m_publish_failed)
+                    {
+                        throw std::runtime_error("RpcServer: could not publish a reply: " + m_publish_error);
+                    }
+                }
+
+                for (std::vector<Finished>::const_iterator it = finished.begin(); it != finished.end(); ++it)
+                {
+                    if (it->handled)
+                    {
+                        m_channel->BasicAck(it->request);
+                    }
+                    else
+                    {
+                        m_channel->BasicReject(it->request, false);
+                    }
+                }
+                in_progress -= finished.size();
+
+                if (stop_requested && consuming)
+                {
+                    consuming = false;
+                    m_channel->BasicCancel(consumer_tag);
+                }
+                if (!consuming)
+                {
+                    if (0 == in_progress)
+                    {
+                        return;
+                    }
+                    continue;
+                }
+
+                Envelope::ptr_t request;
+                if (m_channel->BasicConsumeMessage(consumer_tag, request, POLL_INTERVAL))
+                {
+                    ++in_progress;
+                    boost::lock_guard<boost::mutex> lock(m_mutex);
+                    m_work.push_back(request);
+                    m_work_ready.notify_one();
+                }
+            }
+        }
+        catch (...)
+        {
+            if (consuming)
+            {
+                try
+                {
+                    m_channel->BasicCancel(consumer_tag);
+                }
+                catch (std::exception &)
+                {
+                    // Most likely the channel is what failed
+                }
+            }
+            throw;
+        }
+    }
+
+    void WorkerLoop()
+    {
+        for (;;)
+        {
+            Envelope::ptr_t request;
+            {
+                boost::unique_lock<boost::mutex> lock(m_mutex);
+                while (m_work.empty() && !m_shutting_down)
+                {
+                    m_work_ready.wait(lock);
+                }
+                if (m_shutting_down)
+                {
+                    return;
+                }
+                request = m_work.front();
+                m_work.pop_front();
+            }
+
+            BasicMessage::ptr_t reply;
+            bool handled = true;
+            try
+            {
+                reply = m_handler(request);
+            }
+            catch (...)
+            {
+                handled = false;
+            }
+
+            const BasicMessage::ptr_t message = request->Message();
+            if (handled && reply && message->ReplyToIsSet())
+            {
+                if (message->CorrelationIdIsSet() && !reply->CorrelationIdIsSet())
+                {
+                    reply->CorrelationId(message->CorrelationId());
+                }
+                Reply pending;
+                pending.request = request;
+                pending.reply = reply;
+
+                boost::lock_guard<boost::mutex> lock(m_mutex);
+                m_replies.push_back(pending);
+                m_reply_ready.notify_one();
+            }
+            else
+            {
+                AddFinished(Finished(request, handled));
+            }
+        }
+    }
+
+    void PublisherLoop()
+    {
+        std::vector<std::string> reply_tos;
+        std::vector<BasicMessage::ptr_t> replies;
+        for (;;)
+        {
+            std::vector<Reply> pending;
+            {
+                boost::unique_lock<boost::mutex> lock(m_mutex);
+                while (m_replies.empty() && !m_shutting_down)
+                {
+                    m_reply_ready.wait(lock);
+                }
+                if (m_shutting_down)
+                {
+                    return;
+                }
+                // Take every reply waiting, so replies that queued up while
+                // the last batch was being confirmed go out together
+                pending.assign(m_replies.begin(), m_replies.end());
+                m_replies.clear();
+            }
+
+            reply_tos.clear();
+            replies.clear();
+            for (std::vector<Reply>::const_iterator it = pending.begin(); it != pending.end(); ++it)
+            {
+                reply_tos.push_back(it->request->Message()->ReplyTo());
+                replies.push_back(it->reply);
+            }
+
+            try
+            {
+                // BasicPublishMulti returns once the broker has confirmed
+                // every reply in the batch
+                m_reply_channel->BasicPublishMulti("", reply_tos, replies);
+            }
+            catch (std::exception &e)
+            {
+                boost::lock_guard<boost::mutex> lock(m_mutex);
+                m_publish_failed = true;
+                m_publish_error = e.what();
+                m_finished_ready.notify_all();
+                return;
+            }
+            replies.clear();
+
+            boost::lock_guard<boost::mutex> lock(m_mutex);
+            for (std::vector<Reply>::const_iterator it = pending.begin(); it != pending.end(); ++it)
+            {
+                m_finished.push_back(Finished(it->request, true));
+            }
+            m_finished_ready.notify_all();
+        }
+    }
+
+    void AddFinished(const Finished &finished)
+    {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        m_finished.push_back(finished);
+        m_finished_ready.notify_all();
+    }
+
+    void StopThreads(boost::thread_group &threads)
+    {
+        {
+            boost::lock_guard<boost::mutex> lock(m_mutex);
+            m_shutting_down = true;
+            m_stop_requested = false;
+            m_work_ready.notify_all();
+            m_reply_ready.notify_all();
+        }
+        threads.join_all();
+    }
+
+    const Channel::ptr_t m_channel;
+    const Channel::ptr_t m_reply_channel;
+    const std::string m_queue;
+    const RpcServer::handler_t m_handler;
+    const unsigned int m_workers;
+    const boost::uint16_t m_prefetch;
+
+    // Guards everything below, shared by the consuming thread, the workers
+    // and the publisher
+    boost::mutex m_mutex;
+    // Requests waiting for a worker
+    std::deque<Envelope::ptr_t> m_work;
+    boost::condition_variable m_work_ready;
+    // Replies waiting to be published
+    std::deque<Reply> m_replies;
+    boost::condition_variable m_reply_ready;
+    // Requests waiting to be acknowledged or rejected
+    std::vector<Finished> m_finished;
+    boost::condition_variable m_finished_ready;
+
+    bool m_stop_requested;
+    bool m_shutting_down;
+    bool m_publish_failed;
+    std::string m_publish_error;
+};
+
+} // namespace Detail
+
+RpcServer::RpcServer(const Channel::ptr_t &channel,
+                     const Channel::ptr_t &reply_channel,
+                     const std::string &queue,
+                     const handler_t &handler,
+                     unsigned int workers,
+                     boost::uint16_t prefetch) :
+    m_impl(new Detail::RpcServerImpl(channel, reply_channel, queue, handler, workers, prefetch))
+{
+}
+
+RpcServer::~RpcServer()
+{
+}
+
+void RpcServer::Run()
+{
+    m_impl->Run();
+}
+
+void RpcServer::Stop()
+{
+    m_impl->Stop();
+}
+
+} // namespace AmqpClient
@@ -30,6 +30,7 @@
  */
 
 
+#include "SimpleAmqpClient/HeaderView.h"
 #include "SimpleAmqpClient/Table.h"
 #include "SimpleAmqpClient/Util.h"
 
@@ -38,7 +39,10 @@
 #include <boost/make_shared.hpp>
 #include <boost/scoped_ptr.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/utility/string_ref.hpp>
+#include <cstddef>
 #include <string>
+#include <vector>
 
 #ifdef _MSC_VER
 # pragma warning ( push )
@@ -51,14 +55,71 @@ struct amqp_basic_properties_t_;
 namespace AmqpClient
 {
 
+class EncodedTable;
+
 namespace Detail
 {
 class BasicMessageImpl;
+class HeaderSchemaWriter;
 }
 
+/**
+  * A piece of a message body, see BasicMessage::BodySegments
+  */
+class BodySegment
+{
+public:
+    /**
+      * Borrows a piece of memory, which is not copied
+      *
+      * The memory must remain valid and unchanged for as long as a message
+      * refers to it
+      * @param data the start of the segment
+      * @param len the length of the segment in bytes
+      */
+    BodySegment(const void *data, std::size_t len)
+        : m_data(data)
+        , m_len(len)
+    {}
+
+    /**
+      * Shares a string, which is not copied
+      *
+      * The string must not be modified while any message refers to it
+      */
+    BodySegment(const boost::shared_ptr<const std::string> &data)
+        : m_data(data->data())
+        , m_len(data->length())
+        , m_owner(data)
+    {}
+
+    /**
+      * Gets the start of the segment
+      */
+    const void *Data() const
+    {
+        return m_data;
+    }
+
+    /**
+      * Gets the length of the segment in bytes
+      */
+    std::size_t Length() const
+    {
+        return m_len;
+    }
+
+private:
+    const void *m_data;
+    std::size_t m_len;
+    boost::shared_ptr<const void> m_owner;
+};
+
 class SIMPLEAMQPCLIENT_EXPORT BasicMessage : boost::noncopyable
 {
 public:
+    friend class Detail::HeaderSchemaWriter;
+
     typedef boost::shared_ptr<BasicMessage> ptr_t;
 
     enum delivery_mode_t
@@ -92,7 +153,7 @@ public:
       * Creates a new BasicMessage object with a given body, properties
       * @param body the message body. The message body is NOT duplicated.
       * Passed in message body is deallocated when: body is set or message is
-      * destructed.
+      * destructed, and no clone of the message still refers to it.
       * @properties the amqp_basic_properties_t struct. Note this makes a deep
       * copy of the properties struct
       * @returns a new BasicMessage object
@@ -102,9 +163,57 @@ public:
         return boost::make_shared<BasicMessage>(body, properties);
     }
 
+    /**
+      * INTERNAL INTERFACE: Create a new BasicMessage object
+      * Creates a new BasicMessage object with a body allocated by something
+      * other than amqp_bytes_malloc
+      * @param body the message body. The message body is NOT duplicated.
+      * @param body_owner keeps the body alive, the body is freed when the
+      * last copy of it is released
+      * @properties the amqp_basic_properties_t struct. Note this makes a deep
+      * copy of the properties struct
+      * @returns a new BasicMessage object
+      */
+    static ptr_t Create(amqp_bytes_t_& body, const boost::shared_ptr<const void> &body_owner,
+                        const amqp_basic_properties_t_* properties)
+    {
+        return boost::make_shared<BasicMessage>(body, body_owner, properties);
+    }
+
+    /**
+      * Create a new BasicMessage object with a body from a file
+      *
+      * The file is memory mapped rather than read, and the body is published
+      * straight from the mapping. The file must not be changed or truncated
+      * while a message refers to it.
+      * @param path the file holding the body
+      * @param offset where the body starts in the file
+      * @param length the length of the body in bytes
+      * @returns a new BasicMessage object. Throws std::runtime_error if the
+      * file cannot be mapped
+      */
+    static ptr_t CreateFromFile(const std::string &path, boost::uint64_t offset, std::size_t length);
+
+    /**
+      * Create a new BasicMessage object with the whole of a file as its body
+      *
+      * As CreateFromFile(path, offset, length)
+      */
+    static ptr_t CreateFromFile(const std::string &path);
+
+    /**
+      * Create a new BasicMessage object with a body from an open file
+      *
+      * As CreateFromFile(path, offset, length). The file descriptor can be
+      * closed once this returns
+      */
+    static ptr_t CreateFromFile(int fd, boost::uint64_t offset, std::size_t length);
+
     BasicMessage();
     BasicMessage(const std::string &body);
     BasicMessage(const amqp_bytes_t_& body, const amqp_basic_properties_t_* properties);
+    BasicMessage(const amqp_bytes_t_& body, const boost::shared_ptr<const void> &body_owner,
+                 const amqp_basic_properties_t_* properties);
 
 public:
     /**
@@ -124,24 +233,75 @@ public:
     /**
       * INTERNAL INTERFACE: Gets the amqp_bytes_t representation of the message body
       *
-      * @returns the message body. Note this is owned by the message and will
-      * be freed when the BasicMessage is destructed
+      * @returns the message body. Note this is owned by the message, and any
+      * clones of it, and will be freed when the last of them is destructed.
+      * If the body was set as segments they are joined in to a new buffer
+      * the first time this is called
       */
     const amqp_bytes_t_ &getAmqpBody() const;
 
+    /**
+      * INTERNAL INTERFACE: Gets the body segments set with BodySegments
+      *
+      * @returns the segments, or an empty list if the body was set another
+      * way
+      */
+    const std::vector<BodySegment> &getBodySegments() const;
+
     /**
       * Gets the message body as a std::string
       */
     std::string Body() const;
+    /**
+      * Gets the message body without copying it
+      *
+      * If the body was set as segments they are joined the first time this
+      * is called, as for getAmqpBody.
+      * @returns a reference to the body held by the message. It remains
+      * valid until the body is set again or the message is destroyed
+      */
+    boost::string_ref BodyView() const;
     /**
       * Sets the message body as a std::string
       */
     void Body(const std::string &body);
 
+    /**
+      * Sets the message body, sharing the string rather than copying it
+      *
+      * The string must not be modified while any message refers to it
+      */
+    void Body(const boost::shared_ptr<const std::string> &body);
+
+    /**
+      * Sets the message body as a list of segments
+      *
+      * The body is the segments joined together in order. They are not
+      * joined or copied when the message is set or published, the segments
+      * are written to the socket as they are.
+      * @param segments the pieces of the body
+      */
+    void BodySegments(const std::vector<BodySegment> &segments);
+
+    /**
+      * Create a copy of the message
+      *
+      * The copy shares the body and header table with this message, they
+      * are not copied. Setting either on one of the messages replaces it on
+      * that message only. The other properties are copied and can be
+      * changed independently.
+      * @returns a new BasicMessage object
+      */
+    ptr_t Clone() const;
+
     /**
       * Gets the content type property
       */
     std::string ContentType() const;
+    /**
+      * Gets the content type property without copying it, see BodyView
+      */
+    boost::string_ref ContentTypeView() const;
     /**
       * Sets the content type property
       */
@@ -159,6 +319,10 @@ public:
       * Gets the content encoding property
       */
     std::string ContentEncoding() const;
+    /**
+      * Gets the content encoding property without copying it, see BodyView
+      */
+    boost::string_ref ContentEncodingView() const;
     /**
       * Sets the content encoding property
       */
@@ -210,6 +374,10 @@ public:
       * Gets the correlation id property
       */
     std::string CorrelationId() const;
+    /**
+      * Gets the correlation id property without copying it, see BodyView
+      */
+    boost::string_ref CorrelationIdView() const;
     /**
       * Sets the correlation id property
       */
@@ -227,6 +395,10 @@ public:
       * Gets the reply to property
       */
     std::string ReplyTo() const;
+    /**
+      * Gets the reply to property without copying it, see BodyView
+      */
+    boost::string_ref ReplyToView() const;
     /**
       * Sets the reply to property
       */
@@ -244,6 +416,10 @@ public:
       * Gets the expiration property
       */
     std::string Expiration() const;
+    /**
+      * Gets the expiration property without copying it, see BodyView
+      */
+    boost::string_ref ExpirationView() const;
     /**
       * Sets the expiration property
       */
@@ -261,6 +437,10 @@ public:
       * Gets the message id property
       */
     std::string MessageId() const;
+    /**
+      * Gets the message id property without copying it, see BodyView
+      */
+    boost::string_ref MessageIdView() const;
     /**
       * Sets the message id property
       */
@@ -295,6 +475,10 @@ public:
       * Gets the type property
       */
     std::string Type() const;
+    /**
+      * Gets the type property without copying it, see BodyView
+      */
+    boost::string_ref TypeView() const;
     /**
       * Sets the type property
       */
@@ -312,6 +496,10 @@ public:
       * Gets the user id property
       */
     std::string UserId() const;
+    /**
+      * Gets the user id property without copying it, see BodyView
+      */
+    boost::string_ref UserIdView() const;
     /**
       * Sets the user id property
       */
@@ -329,6 +517,10 @@ public:
       * Gets the app id property
       */
     std::string AppId() const;
+    /**
+      * Gets the app id property without copying it, see BodyView
+      */
+    boost::string_ref AppIdView() const;
     /**
       * Sets the app id property
       */
@@ -346,6 +538,10 @@ public:
       * Gets the cluster id property
       */
     std::string ClusterId() const;
+    /**
+      * Gets the cluster id property without copying it, see BodyView
+      */
+    boost::string_ref ClusterIdView() const;
     /**
       * Sets the custer id property
       */
@@ -367,6 +563,19 @@ public:
       * Sets the custer id property
       */
     void HeaderTable(const Table &header_table);
+    /**
+      * Sets the header table from a pre-encoded table
+      *
+      * The encoded table is shared with the message, not copied
+      */
+    void HeaderTable(const EncodedTable &header_table);
+    /**
+      * Gets a view of the header table
+      *
+      * Reads individual headers without decoding the whole table, the view
+      * is empty if no header table is set
+      */
+    HeaderView HeaderTableView() const;
     /**
       * Is there a header table associated with the message
       */
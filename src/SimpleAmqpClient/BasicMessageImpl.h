@@ -0,0 +1,69 @@
+/* vim:set ft=cpp ts=4 sw=4 sts=4 et cindent: */
+#ifndef BASICMESSAGEIMPL_H_
+#define BASICMESSAGEIMPL_H_
+/*
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MIT
+ *
+ * Copyright (c) 2010-2013 Alan Antonuk
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * ***** END LICENSE BLOCK *****
+ */
+
+// Put these first to avoid warnings about INT#_C macro redefinition
+#include <amqp.h>
+#include <amqp_framing.h>
+
+#include "SimpleAmqpClient/BasicMessage.h"
+#include "SimpleAmqpClient/TableImpl.h"
+
+#include <boost/shared_ptr.hpp>
+
+#include <vector>
+
+namespace AmqpClient
+{
+namespace Detail
+{
+
+class BasicMessageImpl
+{
+public:
+    BasicMessageImpl()
+        : m_properties()
+        , m_body()
+    {}
+    amqp_basic_properties_t m_properties;
+    // m_body points in to the buffer kept alive by m_body_owner, which may
+    // be shared with other messages so is never written to
+    amqp_bytes_t m_body;
+    boost::shared_ptr<const void> m_body_owner;
+    // When set the body is these segments, m_body is only filled in with a
+    // joined copy if it is asked for
+    std::vector<BodySegment> m_body_segments;
+    amqp_pool_ptr_t m_table_pool;
+};
+
+} // namespace Detail
+} // namespace AmqpClient
+
+#endif // BASICMESSAGEIMPL_H_
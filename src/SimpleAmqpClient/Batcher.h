@@ -0,0 +1,253 @@
+/* vim:set ft=cpp ts=4 sw=4 sts=4 et cindent: */
+#ifndef BATCHER_H
+#define BATCHER_H
+/*
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MIT
+ *
+ * Copyright (c) 2010-2013 Alan Antonuk
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * ***** END LICENSE BLOCK *****
+ */
+
+
+#include "SimpleAmqpClient/BasicMessage.h"
+#include "SimpleAmqpClient/Channel.h"
+#include "SimpleAmqpClient/Envelope.h"
+#include "SimpleAmqpClient/Util.h"
+
+#include <boost/chrono.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/utility/string_ref.hpp>
+
+#include <cstddef>
+#include <string>
+
+#ifdef _MSC_VER
+# pragma warning ( push )
+# pragma warning ( disable: 4251 4275 )
+#endif
+
+namespace AmqpClient
+{
+
+/**
+ * Packs many small messages in to each published message
+ *
+ * Every message published costs three frames, a publisher confirm and a
+ * trip through the broker's routing, which for tiny bodies costs far more
+ * than the bodies themselves. A Batcher collects bodies added to it and
+ * publishes them together as the body of one message, each prefixed with
+ * its length, with the number of bodies in the BATCH_HEADER header. Use a
+ * BatchReader to get the bodies back out of a received message.
+ *
+ * A batch is published once it holds max_messages bodies, when adding a
+ * body would take it over max_bytes, or when a body is added or
+ * FlushIfDue is called once the oldest body in it has waited linger. The
+ * Batcher has no thread of its own, so call FlushIfDue regularly (see
+ * MillisecondsUntilDue) or Flush when done, as bodies still held when it
+ * is destroyed are discarded.
+ *
+ * Only bodies are batched: every batch is published with the properties set
+ * with SetProperties, and is acknowledged, rejected and redelivered as a
+ * whole. Like Channel, a Batcher must only be used from one thread at a
+ * time.
+ */
+class SIMPLEAMQPCLIENT_EXPORT Batcher : boost::noncopyable
+{
+public:
+    typedef boost::shared_ptr<Batcher> ptr_t;
+
+    /// Header holding the number of messages in a batch
+    static const std::string BATCH_HEADER;
+
+    /**
+     * Create a new Batcher
+     *
+     * @param channel [in] the channel to publish batches on
+     * @param exchange [in] the exchange to publish batches to
+     * @param routing_key [in] the routing key to publish batches with
+     * @param max_bytes [in] the largest batch body to build. A body larger
+     * than this on its own is published in a batch by itself
+     * @param max_messages [in] the most messages to put in a batch
+     * @param linger [in] the longest time in milliseconds a message waits
+     * to be published
+     * @returns a new Batcher object
+     */
+    static ptr_t Create(const Channel::ptr_t &channel,
+                        const std::string &exchange,
+                        const std::string &routing_key,
+                        std::size_t max_bytes = 64 * 1024,
+                        std::size_t max_messages = 1024,
+                        int linger = 10)
+    {
+        return boost::make_shared<Batcher>(channel, exchange, routing_key, max_bytes, max_messages, linger);
+    }
+
+    Batcher(const Channel::ptr_t &channel,
+            const std::string &exchange,
+            const std::string &routing_key,
+            std::size_t max_bytes,
+            std::size_t max_messages,
+            int linger);
+    virtual ~Batcher();
+
+    /**
+     * Sets the properties batches are published with
+     *
+     * @param properties [in] a message whose properties, but not body, are
+     * copied to each batch. Its BATCH_HEADER header, if any, is replaced
+     */
+    void SetProperties(const BasicMessage::ptr_t &properties);
+
+    /**
+     * Adds a message body to the batch
+     *
+     * May publish the batch, see the class description.
+     *
+     * @param body [in] the body to add, it is copied
+     */
+    void Add(boost::string_ref body);
+
+    /**
+     * Publishes the batch if it has waited long enough
+     *
+     * @returns true if a batch was published
+     */
+    bool FlushIfDue();
+
+    /**
+     * Publishes the batch now, if it holds any messages
+     */
+    void Flush();
+
+    /**
+     * Gets the number of messages waiting to be published
+     */
+    std::size_t PendingMessages() const
+    {
+        return m_count;
+    }
+
+    /**
+     * Gets the number of milliseconds until FlushIfDue will publish the batch
+     *
+     * Suitable as the timeout of BasicConsumeMessage in a loop that also
+     * feeds a Batcher.
+     *
+     * @returns the time in milliseconds, 0 if the batch is already due, or
+     * -1 if it is empty
+     */
+    int MillisecondsUntilDue() const;
+
+private:
+    Channel::ptr_t m_channel;
+    std::string m_exchange;
+    std::string m_routing_key;
+    std::size_t m_max_bytes;
+    std::size_t m_max_messages;
+    boost::chrono::milliseconds m_linger;
+    BasicMessage::ptr_t m_properties;
+
+    boost::shared_ptr<std::string> m_batch;
+    std::size_t m_count;
+    boost::chrono::steady_clock::time_point m_first_added;
+};
+
+/**
+ * Reads the messages packed in to a message by a Batcher
+ *
+ * A message without the Batcher::BATCH_HEADER header is read as a batch of
+ * one, so consumers can handle batched and unbatched messages alike. The
+ * bodies returned refer to the received message's body, which the reader
+ * keeps alive.
+ */
+class SIMPLEAMQPCLIENT_EXPORT BatchReader : boost::noncopyable
+{
+public:
+    typedef boost::shared_ptr<BatchReader> ptr_t;
+
+    /**
+     * Create a new BatchReader
+     *
+     * @param message [in] the message to read
+     * @returns a new BatchReader object
+     * @throws std::runtime_error if the message is not a valid batch
+     */
+    static ptr_t Create(const BasicMessage::ptr_t &message)
+    {
+        return boost::make_shared<BatchReader>(message);
+    }
+
+    /**
+     * Create a new BatchReader
+     *
+     * @param envelope [in] the envelope holding the message to read
+     * @returns a new BatchReader object
+     * @throws std::runtime_error if the message is not a valid batch
+     */
+    static ptr_t Create(const Envelope::ptr_t &envelope)
+    {
+        return boost::make_shared<BatchReader>(envelope->Message());
+    }
+
+    explicit BatchReader(const BasicMessage::ptr_t &message);
+    virtual ~BatchReader();
+
+    /**
+     * Tests whether a message was published by a Batcher
+     */
+    static bool IsBatch(const BasicMessage::ptr_t &message);
+
+    /**
+     * Gets the number of messages in the batch
+     */
+    std::size_t Count() const
+    {
+        return m_count;
+    }
+
+    /**
+     * Gets the next message body in the batch
+     *
+     * @param body [out] the body, valid while the reader exists
+     * @returns true if there was another body, false at the end of the batch
+     */
+    bool Next(boost::string_ref &body);
+
+private:
+    BasicMessage::ptr_t m_message;
+    bool m_batched;
+    boost::string_ref m_remaining;
+    std::size_t m_count;
+    std::size_t m_read;
+};
+
+} // namespace AmqpClient
+
+#ifdef _MSC_VER
+# pragma warning ( pop )
+#endif
+
+#endif // BATCHER_H
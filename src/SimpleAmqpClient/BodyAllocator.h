@@ -0,0 +1,77 @@
+/* vim:set ft=cpp ts=4 sw=4 sts=4 et cindent: */
+#ifndef BODY_ALLOCATOR_H
+#define BODY_ALLOCATOR_H
+/*
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MIT
+ *
+ * Copyright (c) 2010-2013 Alan Antonuk
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * ***** END LICENSE BLOCK *****
+ */
+
+
+#include <boost/shared_ptr.hpp>
+
+#include <cstddef>
+
+namespace AmqpClient
+{
+
+/**
+ * Allocates the memory message bodies are received in to
+ *
+ * Install one on a Channel with Channel::SetBodyAllocator to control where
+ * delivered message bodies live, for instance in huge pages or a pool of
+ * fixed size blocks. By default bodies are allocated with malloc.
+ *
+ * Memory is given back when the last message referring to it is destroyed
+ * or has its body replaced, which may be after the Channel is gone; messages
+ * keep the allocator alive until then.
+ */
+class BodyAllocator
+{
+public:
+    typedef boost::shared_ptr<BodyAllocator> ptr_t;
+
+    virtual ~BodyAllocator() {}
+
+    /**
+     * Allocates memory for a message body
+     *
+     * @param size [in] the size of the body in bytes, never 0
+     * @returns the memory, throws std::bad_alloc if it cannot be allocated
+     */
+    virtual void *Allocate(std::size_t size) = 0;
+
+    /**
+     * Frees memory returned by Allocate
+     *
+     * @param body [in] the memory to free
+     * @param size [in] the size that was passed to Allocate
+     */
+    virtual void Deallocate(void *body, std::size_t size) = 0;
+};
+
+} // namespace AmqpClient
+
+#endif // BODY_ALLOCATOR_H
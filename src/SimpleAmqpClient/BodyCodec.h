@@ -0,0 +1,164 @@
+/* vim:set ft=cpp ts=4 sw=4 sts=4 et cindent: */
+#ifndef BODY_CODEC_H
+#define BODY_CODEC_H
+/*
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MIT
+ *
+ * Copyright (c) 2010-2013 Alan Antonuk
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * ***** END LICENSE BLOCK *****
+ */
+
+
+#include "SimpleAmqpClient/Util.h"
+
+#include <boost/make_shared.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <cstddef>
+#include <string>
+
+#ifdef _MSC_VER
+# pragma warning ( push )
+# pragma warning ( disable: 4251 4275 )
+#endif
+
+namespace AmqpClient
+{
+
+/**
+ * Compresses or otherwise transforms message bodies
+ *
+ * A codec is known by the content encoding it produces. Set one on a Channel
+ * with Channel::SetPublishCodec to encode the bodies it publishes, and
+ * register it with Channel::RegisterBodyCodec to decode received messages
+ * whose content encoding property is its name.
+ *
+ * Codecs may be shared between Channels so must not keep per-call state
+ * unless it is protected from concurrent use.
+ */
+class BodyCodec
+{
+public:
+    typedef boost::shared_ptr<BodyCodec> ptr_t;
+
+    virtual ~BodyCodec() {}
+
+    /**
+     * Gets the content encoding this codec produces, e.g. "deflate"
+     */
+    virtual std::string Name() const = 0;
+
+    /**
+     * Encodes a message body
+     *
+     * @param body [in] the body to encode
+     * @param len [in] the length of the body in bytes
+     * @param out [out] replaced with the encoded body
+     * @throws std::runtime_error if the body cannot be encoded
+     */
+    virtual void Encode(const void *body, std::size_t len, std::string &out) const = 0;
+
+    /**
+     * Decodes a message body produced by Encode
+     *
+     * @param body [in] the body to decode
+     * @param len [in] the length of the body in bytes
+     * @param out [out] replaced with the decoded body
+     * @throws std::runtime_error if the body is not validly encoded
+     */
+    virtual void Decode(const void *body, std::size_t len, std::string &out) const = 0;
+};
+
+/**
+ * A BodyCodec compressing bodies with zlib
+ *
+ * Produces the "deflate" content encoding, the zlib format as used by HTTP.
+ * Throws std::runtime_error on construction if the library was built
+ * without zlib.
+ *
+ * A few bytes of deflate data can inflate to gigabytes, so Decode refuses
+ * to produce more than a maximum decoded size, and a Channel delivers a
+ * body that would exceed it undecoded. Decoded bodies are held in memory
+ * whatever Channel::SetBodySpillThreshold is set to, so keep the maximum
+ * within what a consumer can afford to hold.
+ */
+class SIMPLEAMQPCLIENT_EXPORT DeflateBodyCodec : public BodyCodec, boost::noncopyable
+{
+public:
+    typedef boost::shared_ptr<DeflateBodyCodec> ptr_t;
+
+    /// Content encoding of bodies compressed by this codec
+    static const char *const CONTENT_ENCODING;
+
+    /// The default most bytes Decode produces, 64MiB
+    static const std::size_t DEFAULT_MAX_DECODED_SIZE = 64 * 1024 * 1024;
+
+    /**
+     * Create a new DeflateBodyCodec
+     *
+     * @param level [in] the zlib compression level, from 1 (fastest) to 9
+     * (smallest), or -1 for zlib's default
+     * @param max_decoded_size [in] the largest body Decode produces, larger
+     * ones fail to decode
+     * @returns a new DeflateBodyCodec object
+     */
+    static ptr_t Create(int level = -1, std::size_t max_decoded_size = DEFAULT_MAX_DECODED_SIZE)
+    {
+        return boost::make_shared<DeflateBodyCodec>(level, max_decoded_size);
+    }
+
+    DeflateBodyCodec(int level, std::size_t max_decoded_size);
+    virtual ~DeflateBodyCodec();
+
+    virtual std::string Name() const;
+    virtual void Encode(const void *body, std::size_t len, std::string &out) const;
+    /**
+     * Decodes a message body produced by Encode
+     *
+     * @throws std::runtime_error if the body is not validly encoded, or
+     * decodes to more than the codec's maximum decoded size
+     */
+    virtual void Decode(const void *body, std::size_t len, std::string &out) const;
+
+    /**
+     * Gets the largest body Decode produces
+     */
+    std::size_t MaxDecodedSize() const
+    {
+        return m_max_decoded_size;
+    }
+
+private:
+    int m_level;
+    std::size_t m_max_decoded_size;
+};
+
+} // namespace AmqpClient
+
+#ifdef _MSC_VER
+# pragma warning ( pop )
+#endif
+
+#endif // BODY_CODEC_H
@@ -31,8 +31,12 @@
 
 
 #include "SimpleAmqpClient/BasicMessage.h"
+#include "SimpleAmqpClient/BodyAllocator.h"
+#include "SimpleAmqpClient/BodyCodec.h"
 #include "SimpleAmqpClient/Envelope.h"
+#include "SimpleAmqpClient/LatencyHistogram.h"
 #include "SimpleAmqpClient/Table.h"
+#include "SimpleAmqpClient/TimerWheel.h"
 #include "SimpleAmqpClient/Util.h"
 
 #include <boost/cstdint.hpp>
@@ -40,6 +44,7 @@
 #include <boost/shared_ptr.hpp>
 #include <boost/scoped_ptr.hpp>
 #include <boost/make_shared.hpp>
+#include <cstddef>
 #include <string>
 #include <vector>
 
@@ -70,6 +75,12 @@ public:
     static const std::string EXCHANGE_TYPE_FANOUT;
     static const std::string EXCHANGE_TYPE_TOPIC;
 
+    /// Header carrying the name of a claim checked body, see EnableClaimCheck
+    static const std::string CLAIM_CHECK_HEADER;
+
+    /// RabbitMQ's pseudo-queue for direct reply-to, see BasicPublishOnConsumerChannel
+    static const std::string DIRECT_REPLY_TO_QUEUE;
+
     /**
       * Creates a new channel object
       * Creates a new connection to an AMQP broker using the supplied parameters and opens
@@ -530,6 +541,68 @@ public:
                       bool mandatory = false,
                       bool immediate = false);
 
+    /**
+      * Publishes a Basic message on the same channel as a consumer
+      * Works as BasicPublish, but the message is published on the AMQP
+      * channel the consumer was started on. RabbitMQ's direct reply-to needs
+      * this: consume from DIRECT_REPLY_TO_QUEUE with no_ack set, then publish
+      * requests with their reply to property set to DIRECT_REPLY_TO_QUEUE
+      * through this method. Replies are delivered to the consumer without any
+      * queue being declared.
+      * @param consumer_tag The consumer whose channel to publish on
+      * @param exchange_name The name of the exchange to publish the message to
+      * @param routing_key The routing key to publish with
+      * @param message the BasicMessage object to publish
+      * @param mandatory as for BasicPublish
+      * @param immediate as for BasicPublish
+      * @throws ConsumerTagNotFoundException if the consumer tag is unknown
+      */
+    void BasicPublishOnConsumerChannel(const std::string &consumer_tag,
+                                       const std::string &exchange_name,
+                                       const std::string &routing_key,
+                                       const BasicMessage::ptr_t message,
+                                       bool mandatory = false,
+                                       bool immediate = false);
+
+    /**
+      * Publishes a Basic message to several routing keys
+      * Publishes the same message to an exchange once for each routing key.
+      * The message properties and body are prepared once and sent after a
+      * basic.publish for each routing key, then the confirms for all of them
+      * are waited for together
+      * @param exchange_name The name of the exchange to publish the message to
+      * @param routing_keys The routing keys to publish with, the message is published once for each
+      * @param message the BasicMessage object to publish
+      * @param mandatory requires each message to be delivered to a queue. A MessageReturnedException is thrown
+      *  for the first message that cannot be routed to a queue, after all of them have been confirmed. Defaults to false
+      * @param immediate requires each message to be both routed to a queue, and immediately delivered via a consumer.
+      *  Returned messages are reported as for mandatory. Defaults to false
+      */
+    void BasicPublishMulti(const std::string &exchange_name,
+                           const std::vector<std::string> &routing_keys,
+                           const BasicMessage::ptr_t message,
+                           bool mandatory = false,
+                           bool immediate = false);
+
+    /**
+      * Publishes several Basic messages
+      * Publishes each message to an exchange with the routing key at the same
+      * position in routing_keys. A basic.publish and the content is sent for
+      * every message, then the confirms for all of them are waited for
+      * together
+      * @param exchange_name The name of the exchange to publish the messages to
+      * @param routing_keys The routing key to publish each message with
+      * @param messages the BasicMessage objects to publish
+      * @param mandatory as for BasicPublishMulti
+      * @param immediate as for BasicPublishMulti
+      * @throws std::invalid_argument if routing_keys and messages differ in size
+      */
+    void BasicPublishMulti(const std::string &exchange_name,
+                           const std::vector<std::string> &routing_keys,
+                           const std::vector<BasicMessage::ptr_t> &messages,
+                           bool mandatory = false,
+                           bool immediate = false);
+
     /**
       * Attempts to get a message from a queue in a synchronous manner
       *
@@ -689,6 +762,180 @@ public:
      */
     bool BasicConsumeMessage(Envelope::ptr_t &envelope, int timeout = -1);
 
+    /**
+     * Gets the timers run by this Channel
+     *
+     * Timers scheduled here are run as they expire while the Channel waits
+     * in BasicConsumeMessage, so deadlines for RPC calls, retries and the
+     * like are handled in the same loop that receives messages. A waiting
+     * BasicConsumeMessage carries on waiting after running timers; callbacks
+     * may use the Channel.
+     *
+     * @returns the Channel's timer wheel
+     */
+    TimerWheel &Timers();
+
+    /**
+     * Sets the allocator message bodies are received in to
+     *
+     * Applies to messages delivered after the call, by BasicGet,
+     * BasicConsumeMessage or returned in a MessageReturnedException.
+     *
+     * @param allocator [in] the allocator to use, or an empty pointer to go
+     * back to malloc
+     */
+    void SetBodyAllocator(const BodyAllocator::ptr_t &allocator);
+
+    /**
+     * Receives large message bodies in to temporary files
+     *
+     * Bodies of at least threshold bytes are written to an anonymous
+     * temporary file as they arrive, and the message refers to the file
+     * mapped in to memory, rather than to a heap buffer. The file is removed
+     * when the message is destroyed. Takes precedence over the allocator set
+     * with SetBodyAllocator.
+     *
+     * @param threshold [in] the smallest body size to write to a file, 0
+     * turns this off. Defaults to off
+     * @param directory [in] where to create the files, defaults to the
+     * system temporary directory
+     */
+    void SetBodySpillThreshold(std::size_t threshold, const std::string &directory = std::string());
+
+    /**
+     * Passes large message bodies through shared memory instead of the broker
+     *
+     * For producers and consumers on the same host. BasicPublish writes bodies
+     * of at least threshold bytes to a file in directory and publishes the
+     * message with an empty body and the file name in the CLAIM_CHECK_HEADER
+     * header. When a message with that header is received the file is mapped
+     * in to memory as its body and the header dropped.
+     *
+     * The file is removed once the delivery is settled: on receipt for
+     * deliveries that need no acknowledgement, otherwise when the message is
+     * acknowledged, or rejected or nacked without being requeued. A message
+     * that is requeued, recovered, or redelivered after its consumer's
+     * channel or connection closes keeps its file, so it comes back with its
+     * body. A message routed to more than one queue shares one file, which
+     * the first copy to be settled removes, so only use this where each
+     * message goes to a single queue. Rejecting a message removes its file
+     * even if the queue dead-letters it. Files of messages that are
+     * never consumed, because they were purged, expired, dead-lettered by
+     * the broker or their queue was deleted, are left behind; remove those
+     * with SweepClaimChecks. Received messages whose file cannot be opened,
+     * or whose header does not name a file BasicPublish could have written,
+     * are delivered unchanged, with the header still set. BasicPublishMulti
+     * publishes bodies in full.
+     *
+     * @param threshold [in] the smallest body size to publish by claim check.
+     * Consumers that only receive claim checks can pass a size larger than
+     * any message
+     * @param directory [in] the directory shared by the producers and
+     * consumers. Defaults to /dev/shm on Linux and the system temporary
+     * directory elsewhere
+     */
+    void EnableClaimCheck(std::size_t threshold, const std::string &directory = std::string());
+
+    /**
+     * Stops publishing and claiming message bodies by claim check
+     */
+    void DisableClaimCheck();
+
+    /**
+     * Removes claim check files no message is going to claim
+     *
+     * Removes the files in the claim check directory, of the kind
+     * BasicPublish writes, that were written max_age or more seconds ago.
+     * Meant to be run regularly by a publisher, for example from a timer
+     * (see Timers), with max_age comfortably longer than any message may
+     * wait in a queue, so the files of messages that were purged, expired or
+     * deleted with their queue don't pile up. Files of messages still
+     * queued after max_age are removed too, and those messages then arrive
+     * with an empty body.
+     *
+     * @param max_age [in] the age in seconds beyond which files are removed
+     * @returns the number of files removed, 0 if claim checks are disabled
+     */
+    std::size_t SweepClaimChecks(unsigned int max_age);
+
+    /**
+     * Encodes the bodies of published messages, typically to compress them
+     *
+     * BasicPublish and BasicPublishMulti encode bodies of at least threshold
+     * bytes with codec and set the message's content encoding property to
+     * the codec's name. The message passed in is not changed. Messages that
+     * already have a content encoding, and bodies the codec doesn't make any
+     * smaller, are published as they are. Encoding happens before a body is
+     * claim checked, see EnableClaimCheck.
+     *
+     * The codec is also registered for decoding, see RegisterBodyCodec.
+     *
+     * @param codec [in] the codec to encode with, or an empty pointer to
+     * stop encoding
+     * @param threshold [in] the smallest body size to encode
+     */
+    void SetPublishCodec(const BodyCodec::ptr_t &codec, std::size_t threshold = 0);
+
+    /**
+     * Decodes received message bodies
+     *
+     * Messages delivered after the call, by BasicGet, BasicConsumeMessage or
+     * returned in a MessageReturnedException, whose content encoding is the
+     * name of the codec have their body decoded and the content encoding
+     * property cleared. A codec replaces any registered before it with the
+     * same name. Messages that fail to decode are delivered unchanged.
+     *
+     * @param codec [in] the codec to decode with
+     */
+    void RegisterBodyCodec(const BodyCodec::ptr_t &codec);
+
+    /**
+     * Latencies of the Channel's operations, see EnableStats
+     *
+     * Each is timed inside the Channel, so includes the time spent reading
+     * frames for other channels in to the frame queue while waiting.
+     */
+    struct Stats
+    {
+        /// From starting to send a message with BasicPublish to the broker
+        /// confirming it, or for BasicPublishMulti to every message being
+        /// confirmed
+        LatencyHistogram publish_confirm;
+        /// From sending a synchronous method, such as queue.declare or
+        /// basic.get, to receiving its reply
+        LatencyHistogram rpc;
+        /// BasicConsumeMessage calls that returned a message, from the call
+        /// until the message was ready, including reading its content
+        LatencyHistogram consume_wait;
+        /// Reading the content of a delivered, got or returned message, from
+        /// waiting for its header to the decoded body
+        LatencyHistogram read_content;
+        /// Sending basic.ack in BasicAck
+        LatencyHistogram ack;
+    };
+
+    /**
+     * Starts or stops recording the latency of each operation
+     *
+     * Off by default, as it reads the clock twice for each operation.
+     * Stopping keeps what has been recorded, see ResetStats.
+     *
+     * @param enable [in] true to record latencies, false to stop
+     */
+    void EnableStats(bool enable = true);
+
+    /**
+     * Gets a snapshot of the latencies recorded
+     *
+     * @returns a copy of the histograms, unaffected by later operations
+     */
+    Stats GetStats() const;
+
+    /**
+     * Forgets the latencies recorded so far
+     */
+    void ResetStats();
+
 protected:
     boost::scoped_ptr<Detail::ChannelImpl> m_impl;
 };
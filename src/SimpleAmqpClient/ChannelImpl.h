@@ -35,16 +35,26 @@
 
 #include "SimpleAmqpClient/AmqpException.h"
 #include "SimpleAmqpClient/BasicMessage.h"
+#include "SimpleAmqpClient/BodyAllocator.h"
+#include "SimpleAmqpClient/BodyCodec.h"
 #include "SimpleAmqpClient/ConsumerCancelledException.h"
 #include "SimpleAmqpClient/Envelope.h"
+#include "SimpleAmqpClient/LatencyHistogram.h"
 #include "SimpleAmqpClient/MessageReturnedException.h"
+#include "SimpleAmqpClient/Table.h"
+#include "SimpleAmqpClient/TimerWheel.h"
 
 #include <boost/array.hpp>
 #include <boost/bind.hpp>
 #include <boost/chrono.hpp>
+#include <boost/chrono/ceil.hpp>
+#include <boost/move/move.hpp>
 #include <boost/noncopyable.hpp>
 
+#include <algorithm>
 #include <map>
+#include <set>
+#include <string>
 #include <vector>
 
 namespace AmqpClient
@@ -124,6 +134,9 @@ public:
 
     bool GetNextFrameOnChannel(amqp_channel_t channel, amqp_frame_t &frame,
             boost::chrono::microseconds timeout = boost::chrono::microseconds::max());
+    // Gets the next frame of a message body on channel, throws if the frame
+    // is anything else
+    void GetBodyFrame(amqp_channel_t channel, amqp_frame_t &frame);
 
     static bool is_on_channel(const amqp_frame_t frame, amqp_channel_t channel)
     {
@@ -216,12 +229,14 @@ public:
     template <class ResponseListType>
     amqp_frame_t DoRpcOnChannel(amqp_channel_t channel, boost::uint32_t method_id, void *decoded, const ResponseListType &expected_responses)
     {
+        const timing_t start = StartTiming();
         CheckForError(amqp_send_method(m_connection, channel, method_id, decoded));
 
         amqp_frame_t response;
         boost::array<amqp_channel_t, 1> channels = {{ channel }};
 
         GetMethodOnChannel(channels, response, expected_responses);
+        RecordTiming(m_rpc_latency, start);
         return response;
     }
 
@@ -240,6 +255,54 @@ public:
         return channels.end() != std::find(channels.begin(), channels.end(), envelope->DeliveryChannel());
     }
 
+    // As ConsumeMessageOnChannel, running m_timers as they expire while
+    // waiting. Only call from the top of a public Channel method, timer
+    // callbacks may use the Channel
+    template <class ChannelListType>
+    bool ConsumeMessageRunningTimers(const ChannelListType channels, Envelope::ptr_t &message, int timeout)
+    {
+        const timing_t start = StartTiming();
+        m_timers.Advance();
+        if (0 == m_timers.Size())
+        {
+            if (!ConsumeMessageOnChannel(channels, message, timeout))
+            {
+                return false;
+            }
+            RecordTiming(m_consume_wait_latency, start);
+            return true;
+        }
+
+        const boost::chrono::steady_clock::time_point until =
+            boost::chrono::steady_clock::now() + boost::chrono::milliseconds(std::max(timeout, 0));
+        for (;;)
+        {
+            int wait = timeout;
+            if (timeout > 0)
+            {
+                const boost::chrono::steady_clock::time_point now = boost::chrono::steady_clock::now();
+                wait = now >= until ? 0 : static_cast<int>(
+                           boost::chrono::ceil<boost::chrono::milliseconds>(until - now).count());
+            }
+            const int next_timer = m_timers.MillisecondsUntilNext();
+            if (next_timer >= 0 && (wait < 0 || next_timer < wait))
+            {
+                wait = next_timer;
+            }
+
+            if (ConsumeMessageOnChannel(channels, message, wait))
+            {
+                RecordTiming(m_consume_wait_latency, start);
+                return true;
+            }
+            m_timers.Advance();
+            if (timeout >= 0 && boost::chrono::steady_clock::now() >= until)
+            {
+                return false;
+            }
+        }
+    }
+
     template <class ChannelListType>
     bool ConsumeMessageOnChannel(const ChannelListType channels, Envelope::ptr_t &message, int timeout)
     {
@@ -288,17 +351,20 @@ public:
 
         amqp_basic_deliver_t *deliver_method = reinterpret_cast<amqp_basic_deliver_t *>(deliver.payload.method.decoded);
 
-        const std::string exchange((char *)deliver_method->exchange.bytes, deliver_method->exchange.len);
-        const std::string routing_key((char *)deliver_method->routing_key.bytes, deliver_method->routing_key.len);
-        const std::string in_consumer_tag((char *)deliver_method->consumer_tag.bytes, deliver_method->consumer_tag.len);
+        std::string exchange((char *)deliver_method->exchange.bytes, deliver_method->exchange.len);
+        std::string routing_key((char *)deliver_method->routing_key.bytes, deliver_method->routing_key.len);
+        std::string in_consumer_tag((char *)deliver_method->consumer_tag.bytes, deliver_method->consumer_tag.len);
         const boost::uint64_t delivery_tag = deliver_method->delivery_tag;
         const bool redelivered = (deliver_method->redelivered == 0 ? false : true);
         MaybeReleaseBuffersOnChannel(deliver.channel);
 
-        BasicMessage::ptr_t content = ReadContent(deliver.channel);
+        std::string claimed_path;
+        BasicMessage::ptr_t content = ReadContent(deliver.channel, claimed_path);
         MaybeReleaseBuffersOnChannel(deliver.channel);
+        ClaimDelivered(deliver.channel, delivery_tag, IsNoAckConsumer(in_consumer_tag), claimed_path);
 
-        message = Envelope::Create(content, in_consumer_tag, delivery_tag, exchange, redelivered, routing_key, deliver.channel);
+        message = Envelope::Create(content, boost::move(in_consumer_tag), delivery_tag, boost::move(exchange),
+                                   redelivered, boost::move(routing_key), deliver.channel);
         return true;
     }
 
@@ -313,14 +379,106 @@ public:
     void FinishCloseChannel(amqp_channel_t channel);
     void FinishCloseConnection();
 
-    MessageReturnedException CreateMessageReturnedException(amqp_basic_return_t &return_method, amqp_channel_t channel);
-    AmqpClient::BasicMessage::ptr_t ReadContent(amqp_channel_t channel);
+    // Encodes a table of RPC arguments, the result is only valid until the
+    // next call
+    amqp_table_t CreateAmqpTable(const Table &table);
+
+    // Sends basic.publish and the content of a message whose body is set as
+    // segments, each segment goes out as one or more body frames without
+    // being copied. Returns an amqp_status_enum like amqp_basic_publish
+    int BasicPublishSegments(amqp_channel_t channel, amqp_bytes_t exchange,
+            amqp_bytes_t routing_key, bool mandatory, bool immediate,
+            const amqp_basic_properties_t *properties,
+            const std::vector<BodySegment> &segments);
+    // Sends the basic.publish and content of to_publish on channel without
+    // waiting for it to be confirmed. Returns an amqp_status_enum like
+    // amqp_basic_publish
+    int SendPublish(amqp_channel_t channel,
+                    const std::string &exchange_name,
+                    const std::string &routing_key,
+                    const AmqpClient::BasicMessage::ptr_t &to_publish,
+                    bool mandatory,
+                    bool immediate);
+    // Publishes message on channel and waits for the broker to confirm it,
+    // throws MessageReturnedException if it was returned
+    void PublishOnChannel(amqp_channel_t channel,
+                          const std::string &exchange_name,
+                          const std::string &routing_key,
+                          const AmqpClient::BasicMessage::ptr_t &to_publish,
+                          bool mandatory,
+                          bool immediate);
+    // Sends the content header and body frames that follow a basic.publish
+    int SendContent(amqp_channel_t channel,
+            const amqp_basic_properties_t *properties,
+            const std::vector<BodySegment> &segments);
+
+    // Reserves the delivery tags the broker will confirm the next count
+    // messages published on channel with, returns the first of them
+    boost::uint64_t TakePublishTags(amqp_channel_t channel, boost::uint64_t count = 1);
+    // Waits for the broker to confirm the count messages published on
+    // channel from first_tag, which it may do one at a time or several at
+    // once. Throws MessageReturnedException for the first of them that was
+    // returned, once they are all confirmed so the channel can be reused
+    void WaitForConfirms(amqp_channel_t channel, boost::uint64_t first_tag, boost::uint64_t count);
 
-    void AddConsumer(const std::string &consumer_tag, amqp_channel_t channel);
+    MessageReturnedException CreateMessageReturnedException(amqp_basic_return_t &return_method, amqp_channel_t channel);
+    // Reads the content of a message delivered or returned on channel. If
+    // its body was claimed by claim check the file is named in claimed_path,
+    // see ClaimDelivered
+    AmqpClient::BasicMessage::ptr_t ReadContent(amqp_channel_t channel, std::string &claimed_path);
+    AmqpClient::BasicMessage::ptr_t AssembleContent(amqp_channel_t channel, std::string &claimed_path);
+    AmqpClient::BasicMessage::ptr_t ReadSpilledContent(amqp_channel_t channel,
+            const amqp_basic_properties_t *properties, size_t body_size);
+
+    // Claim checks, see Channel::EnableClaimCheck. CheckInBody returns the
+    // message to publish in place of message, ClaimBody the message to
+    // deliver in place of a received one, setting claimed_path to the file
+    // its body was mapped from
+    AmqpClient::BasicMessage::ptr_t CheckInBody(const AmqpClient::BasicMessage::ptr_t &message);
+    AmqpClient::BasicMessage::ptr_t ClaimBody(const AmqpClient::BasicMessage::ptr_t &message,
+            std::string &claimed_path);
+    // A claimed file is removed once its delivery is settled: straight away
+    // for no_ack deliveries, otherwise when it is acked or rejected without
+    // being requeued. Deliveries the broker requeues are forgotten, leaving
+    // the file for the redelivery to claim
+    void ClaimDelivered(amqp_channel_t channel, boost::uint64_t delivery_tag, bool no_ack,
+                        const std::string &claimed_path);
+    void SettleClaims(amqp_channel_t channel, boost::uint64_t delivery_tag, bool multiple, bool remove);
+    void ForgetClaims(amqp_channel_t channel);
+
+    // Body codecs, see Channel::SetPublishCodec. EncodeBody returns the
+    // message to publish in place of message, DecodeBody the message to
+    // deliver in place of a received one
+    AmqpClient::BasicMessage::ptr_t EncodeBody(const AmqpClient::BasicMessage::ptr_t &message);
+    AmqpClient::BasicMessage::ptr_t DecodeBody(const AmqpClient::BasicMessage::ptr_t &message);
+
+    void AddConsumer(const std::string &consumer_tag, amqp_channel_t channel, bool no_ack = false);
     amqp_channel_t RemoveConsumer(const std::string &consumer_tag);
     amqp_channel_t GetConsumerChannel(const std::string &consumer_tag);
+    bool IsNoAckConsumer(const std::string &consumer_tag) const
+    {
+        return m_no_ack_consumers.end() != m_no_ack_consumers.find(consumer_tag);
+    }
     std::vector<amqp_channel_t> GetAllConsumerChannels() const;
 
+    // Latency stats, see Channel::EnableStats. StartTiming returns a
+    // default time_point when stats are off, which RecordTiming ignores
+    typedef boost::chrono::steady_clock::time_point timing_t;
+
+    timing_t StartTiming() const
+    {
+        return m_stats_enabled ? boost::chrono::steady_clock::now() : timing_t();
+    }
+
+    void RecordTiming(LatencyHistogram &histogram, timing_t start)
+    {
+        if (m_stats_enabled && timing_t() != start)
+        {
+            histogram.Record(boost::chrono::duration_cast<boost::chrono::nanoseconds>(
+                                 boost::chrono::steady_clock::now() - start).count());
+        }
+    }
+
     void MaybeReleaseBuffersOnChannel(amqp_channel_t channel);
     void CheckIsConnected();
     void SetIsConnected(bool state)
@@ -338,17 +496,56 @@ public:
     }
 
     amqp_connection_state_t m_connection;
+    // Timers run while waiting for messages, see Channel::Timers
+    TimerWheel m_timers;
+    // Allocates received message bodies, malloc is used when this is empty
+    BodyAllocator::ptr_t m_body_allocator;
+    // Bodies of at least this many bytes are received in to a memory mapped
+    // temporary file in m_spill_directory, 0 turns this off
+    size_t m_spill_threshold;
+    std::string m_spill_directory;
+    // Bodies of at least m_claim_check_threshold bytes are published through
+    // files in m_claim_check_directory when m_claim_check_enabled
+    bool m_claim_check_enabled;
+    size_t m_claim_check_threshold;
+    std::string m_claim_check_directory;
+    // Bodies of at least m_publish_codec_threshold bytes are encoded with
+    // m_publish_codec when it is set. Received bodies are decoded by the
+    // codec in m_body_codecs named by their content encoding
+    BodyCodec::ptr_t m_publish_codec;
+    size_t m_publish_codec_threshold;
+    std::map<std::string, BodyCodec::ptr_t> m_body_codecs;
+    // Latencies of the operations Channel::Stats describes, only recorded
+    // when m_stats_enabled
+    bool m_stats_enabled;
+    LatencyHistogram m_publish_confirm_latency;
+    LatencyHistogram m_rpc_latency;
+    LatencyHistogram m_consume_wait_latency;
+    LatencyHistogram m_read_content_latency;
+    LatencyHistogram m_ack_latency;
 
 private:
     static boost::uint32_t ComputeBrokerVersion(const amqp_connection_state_t state);
 
     frame_queue_t m_frame_queue;
 
+    // Per-connection pool for encoding RPC argument tables, and the most
+    // recently encoded table which is reused if the same arguments are
+    // passed again
+    amqp_pool_t m_table_pool;
+    amqp_table_t m_last_table;
+
     typedef std::vector<Envelope::ptr_t> envelope_list_t;
     envelope_list_t m_delivered_messages;
 
     typedef std::map<std::string, amqp_channel_t> consumer_map_t;
     consumer_map_t m_consumer_channel_map;
+    // Consumers whose deliveries need no acknowledgement
+    std::set<std::string> m_no_ack_consumers;
+
+    // Files claimed by unsettled deliveries, by channel and delivery tag
+    typedef std::map<boost::uint64_t, std::string> claimed_files_t;
+    std::map<amqp_channel_t, claimed_files_t> m_claimed_files;
 
     enum channel_state_t {
         CS_Closed = 0,
@@ -358,6 +555,9 @@ private:
     typedef std::vector<channel_state_t> channel_state_list_t;
 
     channel_state_list_t m_channels;
+    // Channels are always in confirm mode, so the broker numbers the
+    // messages published on each from 1
+    std::vector<boost::uint64_t> m_next_publish_tag;
     boost::uint32_t m_brokerVersion;
     // A channel that is likely to be an CS_Open state
     amqp_channel_t m_last_used_channel;
@@ -0,0 +1,138 @@
+/* vim:set ft=cpp ts=4 sw=4 sts=4 et cindent: */
+#ifndef ENCODEDTABLE_H
+#define ENCODEDTABLE_H
+/*
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MIT
+ *
+ * Copyright (c) 2010-2013 Alan Antonuk
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "SimpleAmqpClient/HeaderView.h"
+#include "SimpleAmqpClient/Table.h"
+#include "SimpleAmqpClient/Util.h"
+
+#include <boost/make_shared.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <string>
+
+#ifdef _MSC_VER
+# pragma warning ( push )
+# pragma warning ( disable: 4251 4275 )
+#endif
+
+struct amqp_pool_t_;
+struct amqp_table_t_;
+
+namespace AmqpClient
+{
+
+namespace Detail
+{
+class EncodedTableImpl;
+}
+
+/**
+ * An immutable, pre-encoded field table
+ *
+ * Converts a Table once so it can be attached to any number of
+ * BasicMessage objects as their header table. Attaching shares the encoded
+ * table rather than converting or copying it again.
+ */
+class SIMPLEAMQPCLIENT_EXPORT EncodedTable : boost::noncopyable
+{
+public:
+    typedef boost::shared_ptr<EncodedTable> ptr_t;
+
+    /**
+     * Create a new EncodedTable from a Table
+     *
+     * @param table [in] the table to encode
+     * @returns a new EncodedTable object
+     */
+    static ptr_t Create(const Table &table)
+    {
+        return boost::make_shared<EncodedTable>(table);
+    }
+
+    /**
+     * Create a new EncodedTable from AMQP field table wire bytes
+     *
+     * @param wire_bytes [in] an encoded field table, including its 4-byte
+     * length prefix
+     * @returns a new EncodedTable object
+     * @throws AmqpLibraryException if the bytes are not a valid field table
+     */
+    static ptr_t CreateFromWireBytes(const std::string &wire_bytes);
+
+    explicit EncodedTable(const Table &table);
+
+    /**
+     * Destructor
+     */
+    virtual ~EncodedTable();
+
+    /**
+     * Gets the AMQP field table wire bytes
+     *
+     * @returns the encoded field table, including its 4-byte length prefix
+     */
+    const std::string &WireBytes() const;
+
+    /**
+     * Gets a view of the table
+     */
+    HeaderView View() const;
+
+    /**
+     * Decodes the table
+     */
+    Table ToTable() const;
+
+    /**
+     * INTERNAL INTERFACE: Gets the encoded amqp_table_t struct
+     */
+    const amqp_table_t_ &getAmqpTable() const;
+
+    /**
+     * INTERNAL INTERFACE: Gets the pool the amqp_table_t struct is allocated in
+     */
+    const boost::shared_ptr<amqp_pool_t_> &getAmqpPool() const;
+
+private:
+    EncodedTable();
+
+    boost::scoped_ptr<Detail::EncodedTableImpl> m_impl;
+};
+
+} // namespace AmqpClient
+
+#ifdef _MSC_VER
+# pragma warning ( pop )
+#endif
+
+#endif // ENCODEDTABLE_H
@@ -32,12 +32,14 @@
 #include "SimpleAmqpClient/BasicMessage.h"
 #include "SimpleAmqpClient/Util.h"
 
+#include <boost/config.hpp>
 #include <boost/cstdint.hpp>
 #include <boost/make_shared.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/shared_ptr.hpp>
 
 #include <string>
+#include <utility>
 
 #ifdef _MSC_VER
 # pragma warning ( push )
@@ -72,6 +74,27 @@ public:
     explicit Envelope(const BasicMessage::ptr_t message, const std::string &consumer_tag,
                       const boost::uint64_t delivery_tag, const std::string &exchange, bool redelivered, const std::string &routing_key, const boost::uint16_t delivery_channel);
 
+#ifndef BOOST_NO_RVALUE_REFERENCES
+    /**
+      * Creates an new envelope object, taking ownership of the string parameters
+      * @param message the payload
+      * @param consumer_tag the consumer tag the message was delivered to
+      * @param delivery_tag the delivery tag that the broker assigned to the message
+      * @param exchange the name of the exchange that the message was published to
+      * @param redelivered a flag indicating whether the message consumed as a result of a redelivery
+      * @param routing_key the routing key that the message was published with
+      * @returns a boost::shared_ptr to an envelope object
+      */
+    static ptr_t Create(const BasicMessage::ptr_t message, std::string &&consumer_tag,
+                        const boost::uint64_t delivery_tag, std::string &&exchange, bool redelivered, std::string &&routing_key, const boost::uint16_t delivery_channel)
+    {
+        return boost::make_shared<Envelope>(message, std::move(consumer_tag), delivery_tag, std::move(exchange), redelivered, std::move(routing_key), delivery_channel);
+    }
+
+    explicit Envelope(const BasicMessage::ptr_t message, std::string &&consumer_tag,
+                      const boost::uint64_t delivery_tag, std::string &&exchange, bool redelivered, std::string &&routing_key, const boost::uint16_t delivery_channel);
+#endif
+
 public:
     /**
       * destructor
@@ -0,0 +1,207 @@
+/* vim:set ft=cpp ts=4 sw=4 sts=4 et cindent: */
+#ifndef HEADERSCHEMA_H
+#define HEADERSCHEMA_H
+/*
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MIT
+ *
+ * Copyright (c) 2010-2013 Alan Antonuk
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "SimpleAmqpClient/BasicMessage.h"
+#include "SimpleAmqpClient/HeaderView.h"
+#include "SimpleAmqpClient/Util.h"
+
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <cstddef>
+#include <string>
+
+#ifdef _MSC_VER
+# pragma warning ( push )
+# pragma warning ( disable: 4251 )
+#endif
+
+struct amqp_pool_t_;
+struct amqp_table_entry_t_;
+struct amqp_field_value_t_;
+
+/**
+ * Typed header schemas
+ *
+ * A header schema is a struct that lists its header fields in a member
+ * function template named Headers:
+ *
+ * struct TraceHeaders
+ * {
+ *     std::string trace_id;
+ *     boost::int32_t hop_count;
+ *
+ *     template <class Fields>
+ *     void Headers(Fields &fields)
+ *     {
+ *         fields("x-trace-id", trace_id)("x-hop-count", hop_count);
+ *     }
+ * };
+ *
+ * WriteHeaders() encodes the fields directly in to the message's header
+ * table and ReadHeaders() decodes them from a delivered message, neither
+ * goes through a Table.
+ *
+ * Supported field types are bool, boost::int8_t, boost::int16_t,
+ * boost::int32_t, boost::int64_t, float, double and std::string. A schema
+ * that is only written may also have const char * fields, including string
+ * literals, which are written as strings.
+ */
+
+namespace AmqpClient
+{
+
+namespace Detail
+{
+
+class HeaderSchemaCounter
+{
+public:
+    HeaderSchemaCounter() : m_size(0) {}
+
+    template <typename T>
+    HeaderSchemaCounter &operator()(const char *, const T &)
+    {
+        ++m_size;
+        return *this;
+    }
+
+    std::size_t Size() const
+    {
+        return m_size;
+    }
+
+private:
+    std::size_t m_size;
+};
+
+class SIMPLEAMQPCLIENT_EXPORT HeaderSchemaWriter : boost::noncopyable
+{
+public:
+    HeaderSchemaWriter(BasicMessage &message, std::size_t size);
+
+    HeaderSchemaWriter &operator()(const char *key, bool value);
+    HeaderSchemaWriter &operator()(const char *key, boost::int8_t value);
+    HeaderSchemaWriter &operator()(const char *key, boost::int16_t value);
+    HeaderSchemaWriter &operator()(const char *key, boost::int32_t value);
+    HeaderSchemaWriter &operator()(const char *key, boost::int64_t value);
+    HeaderSchemaWriter &operator()(const char *key, float value);
+    HeaderSchemaWriter &operator()(const char *key, double value);
+    HeaderSchemaWriter &operator()(const char *key, const std::string &value);
+    // Without this a string literal or const char * field would convert to
+    // bool rather than std::string
+    HeaderSchemaWriter &operator()(const char *key, const char *value);
+
+    // Sets the encoded fields as the message's header table
+    void Commit();
+
+private:
+    amqp_field_value_t_ &NextValue(const char *key);
+    void WriteString(const char *key, const char *value, std::size_t len);
+
+    BasicMessage &m_message;
+    amqp_pool_t_ *m_pool;
+    amqp_table_entry_t_ *m_entries;
+    std::size_t m_size;
+    std::size_t m_position;
+};
+
+class SIMPLEAMQPCLIENT_EXPORT HeaderSchemaReader : boost::noncopyable
+{
+public:
+    explicit HeaderSchemaReader(const BasicMessage &message);
+
+    HeaderSchemaReader &operator()(const char *key, bool &value);
+    HeaderSchemaReader &operator()(const char *key, boost::int8_t &value);
+    HeaderSchemaReader &operator()(const char *key, boost::int16_t &value);
+    HeaderSchemaReader &operator()(const char *key, boost::int32_t &value);
+    HeaderSchemaReader &operator()(const char *key, boost::int64_t &value);
+    HeaderSchemaReader &operator()(const char *key, float &value);
+    HeaderSchemaReader &operator()(const char *key, double &value);
+    HeaderSchemaReader &operator()(const char *key, std::string &value);
+
+private:
+    const amqp_field_value_t_ &NextValue(const char *key);
+
+    HeaderView m_view;
+    int m_position;
+};
+
+} // namespace Detail
+
+/**
+ * Sets the header table of a message from a header schema
+ *
+ * Replaces any header table already set on the message.
+ *
+ * @param message [in] the message to set the headers on
+ * @param schema [in] the header schema
+ */
+template <class Schema>
+void WriteHeaders(BasicMessage &message, const Schema &schema)
+{
+    // Headers() is non-const so the same function can be used to read
+    // in to the schema, the fields are only read from here
+    Schema &fields = const_cast<Schema &>(schema);
+
+    Detail::HeaderSchemaCounter counter;
+    fields.Headers(counter);
+
+    Detail::HeaderSchemaWriter writer(message, counter.Size());
+    fields.Headers(writer);
+    writer.Commit();
+}
+
+/**
+ * Reads a header schema from the header table of a message
+ *
+ * Fields are fastest to find when the headers were written with the same
+ * schema, otherwise each field is looked up by key.
+ *
+ * @param message [in] the message to read the headers from
+ * @param schema [out] the header schema
+ * @throws std::out_of_range if a field is not in the header table
+ * @throws boost::bad_get if a header does not have the type of its field
+ */
+template <class Schema>
+void ReadHeaders(const BasicMessage &message, Schema &schema)
+{
+    Detail::HeaderSchemaReader reader(message);
+    schema.Headers(reader);
+}
+
+} // namespace AmqpClient
+
+#ifdef _MSC_VER
+# pragma warning ( pop )
+#endif
+
+#endif // HEADERSCHEMA_H
@@ -0,0 +1,176 @@
+/* vim:set ft=cpp ts=4 sw=4 sts=4 et cindent: */
+#ifndef HEADERVIEW_H
+#define HEADERVIEW_H
+/*
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MIT
+ *
+ * Copyright (c) 2010-2013 Alan Antonuk
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "SimpleAmqpClient/Table.h"
+#include "SimpleAmqpClient/Util.h"
+
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/utility/string_ref.hpp>
+
+#include <cstddef>
+
+#ifdef _MSC_VER
+# pragma warning ( push )
+# pragma warning ( disable: 4251 )
+#endif
+
+struct amqp_pool_t_;
+struct amqp_table_t_;
+struct amqp_table_entry_t_;
+struct amqp_field_value_t_;
+
+namespace AmqpClient
+{
+
+namespace Detail
+{
+class HeaderSchemaReader;
+}
+
+/**
+ * A read-only view of an encoded field table
+ *
+ * Looks up keys by scanning the table as it was received (or encoded),
+ * values are decoded on demand and strings are returned as references in
+ * to the encoded table, so no Table is built to read a few headers.
+ *
+ * The view shares ownership of the memory the table lives in, it remains
+ * valid after the BasicMessage it came from is modified or destroyed.
+ *
+ * Lookups are linear in the number of entries in the table. Getters throw
+ * std::out_of_range if the key is not in the table and boost::bad_get if
+ * the value is not of the requested type.
+ */
+class SIMPLEAMQPCLIENT_EXPORT HeaderView
+{
+public:
+    friend class Detail::HeaderSchemaReader;
+
+    /**
+     * Construct an empty view
+     */
+    HeaderView();
+
+    /**
+     * INTERNAL INTERFACE: Construct a view of an encoded table
+     *
+     * @param owner [in] the pool the table is allocated in, kept alive by the view
+     * @param table [in] the encoded table
+     */
+    HeaderView(const boost::shared_ptr<amqp_pool_t_> &owner, const amqp_table_t_ &table);
+
+    /**
+     * Determines whether the table has no entries
+     */
+    bool Empty() const;
+
+    /**
+     * Gets the number of entries in the table
+     */
+    std::size_t Size() const;
+
+    /**
+     * Determines whether the table has an entry with the given key
+     */
+    bool IsSet(boost::string_ref key) const;
+
+    /**
+     * Gets the type of a value
+     *
+     * @returns the type the value would have when converted to a TableValue
+     */
+    TableValue::ValueType GetType(boost::string_ref key) const;
+
+    /**
+     * Gets a boolean value
+     */
+    bool GetBool(boost::string_ref key) const;
+
+    /**
+     * Gets an integral value
+     *
+     * @returns the value if it is an 8, 16, 32 or 64-bit signed integer or
+     * timestamp
+     */
+    boost::int64_t GetInteger(boost::string_ref key) const;
+
+    /**
+     * Gets a floating-point value
+     *
+     * @returns the value if it is a single or double-precision value
+     */
+    double GetReal(boost::string_ref key) const;
+
+    /**
+     * Gets a string value
+     *
+     * @returns a reference to the string in the encoded table, valid for the
+     * lifetime of this view or any copy of it
+     */
+    boost::string_ref GetString(boost::string_ref key) const;
+
+    /**
+     * Gets a nested table
+     *
+     * @returns a view of the nested table, sharing ownership with this view
+     */
+    HeaderView GetTable(boost::string_ref key) const;
+
+    /**
+     * Decodes a single value
+     *
+     * @returns the value as a TableValue, arrays and nested tables are decoded
+     * in full
+     */
+    TableValue GetValue(boost::string_ref key) const;
+
+    /**
+     * Decodes the whole table
+     */
+    Table ToTable() const;
+
+private:
+    const amqp_field_value_t_ &Find(boost::string_ref key) const;
+    const amqp_field_value_t_ *FindInner(boost::string_ref key) const;
+
+    boost::shared_ptr<amqp_pool_t_> m_owner;
+    int m_num_entries;
+    const amqp_table_entry_t_ *m_entries;
+};
+
+} // namespace AmqpClient
+
+#ifdef _MSC_VER
+# pragma warning ( pop )
+#endif
+
+#endif // HEADERVIEW_H
@@ -0,0 +1,137 @@
+/* vim:set ft=cpp ts=4 sw=4 sts=4 et cindent: */
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+/*
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MIT
+ *
+ * Copyright (c) 2010-2013 Alan Antonuk
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * ***** END LICENSE BLOCK *****
+ */
+
+
+#include "SimpleAmqpClient/Util.h"
+
+#include <boost/cstdint.hpp>
+
+#include <vector>
+
+#ifdef _MSC_VER
+# pragma warning ( push )
+# pragma warning ( disable: 4251 4275 )
+#endif
+
+namespace AmqpClient
+{
+
+/**
+ * A high dynamic range histogram of latencies in nanoseconds
+ *
+ * Values are counted in buckets whose width grows with the value, 64 to
+ * each power of two, so any value is reported to within 1/64 of itself
+ * (under 2%) from nanoseconds up to hours, and recording one costs a few
+ * shifts and an increment. Values below 128ns are counted exactly and
+ * values above about 4.9 hours are counted as that. The buckets are only
+ * allocated once a value is recorded.
+ *
+ * Histograms are plain values: copy one to take a snapshot, Merge them to
+ * combine the latencies of several Channels.
+ */
+class SIMPLEAMQPCLIENT_EXPORT LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    /**
+     * Counts a latency
+     *
+     * @param nanoseconds [in] the latency
+     */
+    void Record(boost::uint64_t nanoseconds);
+
+    /**
+     * Adds the latencies counted by another histogram to this one
+     */
+    void Merge(const LatencyHistogram &other);
+
+    /**
+     * Forgets every latency counted
+     */
+    void Reset();
+
+    /**
+     * Gets the number of latencies counted
+     */
+    boost::uint64_t Count() const
+    {
+        return m_count;
+    }
+
+    /**
+     * Gets the smallest latency counted in nanoseconds, 0 if there is none
+     */
+    boost::uint64_t Min() const
+    {
+        return 0 == m_count ? 0 : m_min;
+    }
+
+    /**
+     * Gets the largest latency counted in nanoseconds, 0 if there is none
+     */
+    boost::uint64_t Max() const
+    {
+        return m_max;
+    }
+
+    /**
+     * Gets the mean latency in nanoseconds, 0 if there is none
+     */
+    double Mean() const
+    {
+        return 0 == m_count ? 0.0 : static_cast<double>(m_total) / m_count;
+    }
+
+    /**
+     * Gets the latency below which a given percentage of those counted fall
+     *
+     * @param percentile [in] the percentage, from 0 to 100, for example 99.9
+     * @returns the latency in nanoseconds, the top of its bucket but no more
+     * than Max. 0 if none have been counted
+     */
+    boost::uint64_t Percentile(double percentile) const;
+
+private:
+    std::vector<boost::uint64_t> m_counts;
+    boost::uint64_t m_count;
+    boost::uint64_t m_min;
+    boost::uint64_t m_max;
+    boost::uint64_t m_total;
+};
+
+} // namespace AmqpClient
+
+#ifdef _MSC_VER
+# pragma warning ( pop )
+#endif
+
+#endif // LATENCYHISTOGRAM_H
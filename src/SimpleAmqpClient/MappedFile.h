@@ -0,0 +1,73 @@
+/* vim:set ft=cpp ts=4 sw=4 sts=4 et cindent: */
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+/*
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MIT
+ *
+ * Copyright (c) 2010-2013 Alan Antonuk
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * ***** END LICENSE BLOCK *****
+ */
+
+
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <cstddef>
+#include <string>
+
+namespace AmqpClient
+{
+namespace Detail
+{
+
+#ifdef _WIN32
+typedef void *native_file_t;
+#else
+typedef int native_file_t;
+#endif
+
+// Maps length bytes of an open file starting at offset read-only, offset
+// need not be page aligned. Sets data to the first of the bytes and returns
+// the owner of the mapping, which is unmapped when the last copy of it is
+// released. The file may be closed once this returns. Throws
+// std::runtime_error on failure
+boost::shared_ptr<const void> MapFileRange(native_file_t file, boost::uint64_t offset,
+        std::size_t length, const void *&data);
+
+// As MapFileRange, for a C runtime file descriptor
+boost::shared_ptr<const void> MapFdRange(int fd, boost::uint64_t offset,
+        std::size_t length, const void *&data);
+
+// Passed as the length to MapPathRange to map to the end of the file
+const std::size_t MAP_TO_END = static_cast<std::size_t>(-1);
+
+// As MapFileRange, opening the file at path. If length is MAP_TO_END it is
+// set to the number of bytes mapped
+boost::shared_ptr<const void> MapPathRange(const std::string &path, boost::uint64_t offset,
+        std::size_t &length, const void *&data);
+
+} // namespace Detail
+} // namespace AmqpClient
+
+#endif // MAPPEDFILE_H
@@ -0,0 +1,146 @@
+/* vim:set ft=cpp ts=4 sw=4 sts=4 et cindent: */
+#ifndef POOLEDBODYALLOCATOR_H
+#define POOLEDBODYALLOCATOR_H
+/*
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MIT
+ *
+ * Copyright (c) 2010-2013 Alan Antonuk
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * ***** END LICENSE BLOCK *****
+ */
+
+
+#include "SimpleAmqpClient/BodyAllocator.h"
+#include "SimpleAmqpClient/Util.h"
+
+#include <boost/cstdint.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <cstddef>
+
+#ifdef _MSC_VER
+# pragma warning ( push )
+# pragma warning ( disable: 4251 4275 )
+#endif
+
+namespace AmqpClient
+{
+
+namespace Detail
+{
+class PooledBodyAllocatorImpl;
+}
+
+/**
+ * A BodyAllocator that recycles body buffers
+ *
+ * Sizes are rounded up to one of a fixed set of size classes, four to each
+ * power of two from 64 bytes to 1MiB, so bodies of similar sizes share
+ * buffers; the classes themselves don't change with the sizes received.
+ * Freed buffers are kept on a list per class and handed out again, up to a
+ * limit on the total number of bytes kept. When the limit is reached
+ * buffers of the classes least in demand recently are released first, so
+ * which buffers are kept follows the sizes actually being received. Larger
+ * bodies are allocated and freed directly.
+ *
+ * A PooledBodyAllocator is thread-safe, so messages it allocated bodies
+ * for may be released on any thread, for example by RpcServer's workers.
+ */
+class SIMPLEAMQPCLIENT_EXPORT PooledBodyAllocator : public BodyAllocator, boost::noncopyable
+{
+public:
+    typedef boost::shared_ptr<PooledBodyAllocator> ptr_t;
+
+    /**
+     * Counters describing how well the pool is doing
+     */
+    struct Stats
+    {
+        /// Number of calls to Allocate
+        boost::uint64_t allocations;
+        /// Allocations served from a recycled buffer
+        boost::uint64_t hits;
+        /// Allocations too large for any size class
+        boost::uint64_t oversize;
+        /// Buffers given back to the system rather than kept for reuse
+        boost::uint64_t released;
+        /// Bytes currently held in recycled buffers
+        std::size_t cached_bytes;
+
+        /**
+         * The fraction of allocations served from a recycled buffer
+         */
+        double HitRate() const
+        {
+            return 0 == allocations ? 0.0 : static_cast<double>(hits) / allocations;
+        }
+    };
+
+    /**
+     * Create a new PooledBodyAllocator
+     *
+     * @param cache_limit [in] the most bytes to keep in recycled buffers
+     * @returns a new PooledBodyAllocator object
+     */
+    static ptr_t Create(std::size_t cache_limit = 16 * 1024 * 1024)
+    {
+        return boost::make_shared<PooledBodyAllocator>(cache_limit);
+    }
+
+    explicit PooledBodyAllocator(std::size_t cache_limit);
+    virtual ~PooledBodyAllocator();
+
+    virtual void *Allocate(std::size_t size);
+    virtual void Deallocate(void *body, std::size_t size);
+
+    /**
+     * Gets the counters for the pool
+     */
+    Stats GetStats() const;
+
+    /**
+     * Changes the most bytes to keep in recycled buffers
+     *
+     * Buffers are released straight away if more than this is held.
+     */
+    void SetCacheLimit(std::size_t cache_limit);
+
+    /**
+     * Releases all recycled buffers
+     */
+    void Trim();
+
+private:
+    boost::scoped_ptr<Detail::PooledBodyAllocatorImpl> m_impl;
+};
+
+} // namespace AmqpClient
+
+#ifdef _MSC_VER
+# pragma warning ( pop )
+#endif
+
+#endif // POOLEDBODYALLOCATOR_H
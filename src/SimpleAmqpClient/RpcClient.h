@@ -0,0 +1,357 @@
+/* vim:set ft=cpp ts=4 sw=4 sts=4 et cindent: */
+#ifndef RPCCLIENT_H
+#define RPCCLIENT_H
+/*
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MIT
+ *
+ * Copyright (c) 2010-2013 Alan Antonuk
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * ***** END LICENSE BLOCK *****
+ */
+
+
+#include "SimpleAmqpClient/BasicMessage.h"
+#include "SimpleAmqpClient/Channel.h"
+#include "SimpleAmqpClient/RpcTimeoutException.h"
+#include "SimpleAmqpClient/Util.h"
+
+#include <boost/cstdint.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <cstddef>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#ifdef _MSC_VER
+# pragma warning ( push )
+# pragma warning ( disable: 4251 4275 )
+#endif
+
+namespace AmqpClient
+{
+
+namespace Detail
+{
+class RpcClientImpl;
+}
+
+/**
+ * The pending result of a call made with RpcClient::Call,
+ * RpcClient::ScatterGather or RpcClient::CallStreaming
+ *
+ * Replies are only received while the RpcClient is polled, which Wait and
+ * Get do, so waiting on one call also completes any others whose replies
+ * arrive in the meantime.
+ */
+class SIMPLEAMQPCLIENT_EXPORT RpcCall : boost::noncopyable
+{
+public:
+    typedef boost::shared_ptr<RpcCall> ptr_t;
+
+    enum Status
+    {
+        /// No reply has been received yet
+        PENDING,
+        /// All the expected replies have been received, see Reply and
+        /// Replies, or for a streaming call the end of the stream
+        REPLIED,
+        /// Fewer replies than expected were received before the call's
+        /// timeout, any that were are in Replies
+        TIMED_OUT,
+        /// The RpcClient was destroyed before a reply was received
+        CANCELLED
+    };
+
+    RpcCall(Detail::RpcClientImpl *client, const std::string &correlation_id,
+            std::size_t expected_replies, bool streaming);
+    virtual ~RpcCall();
+
+    /**
+     * Gets the correlation id the request was published with
+     */
+    std::string CorrelationId() const
+    {
+        return m_correlation_id;
+    }
+
+    /**
+     * Gets the status of the call
+     */
+    Status GetStatus() const
+    {
+        return m_status;
+    }
+
+    /**
+     * Tests whether the call has finished, with a reply or otherwise
+     */
+    bool IsReady() const
+    {
+        return PENDING != m_status;
+    }
+
+    /**
+     * Tests whether the call was made with RpcClient::CallStreaming
+     */
+    bool IsStreaming() const
+    {
+        return m_streaming;
+    }
+
+    /**
+     * Gets the number of replies the call finishes after
+     */
+    std::size_t ExpectedReplies() const
+    {
+        return m_expected_replies;
+    }
+
+    /**
+     * Gets the reply
+     *
+     * @returns the first reply received, or an empty pointer if there has
+     * been none
+     */
+    BasicMessage::ptr_t Reply() const
+    {
+        return m_replies.empty() ? BasicMessage::ptr_t() : m_replies.front();
+    }
+
+    /**
+     * Gets the replies received so far
+     *
+     * When a scatter-gather call times out these are its partial results.
+     *
+     * @returns the replies in the order they were received
+     */
+    const std::vector<BasicMessage::ptr_t> &Replies() const
+    {
+        return m_replies;
+    }
+
+    /**
+     * Waits for the call to finish
+     *
+     * @param timeout [in] the longest time to wait in milliseconds, 0 polls
+     * without waiting, -1 waits until the call finishes
+     * @returns true if the call has finished
+     */
+    bool Wait(int timeout = -1);
+
+    /**
+     * Waits for the call to finish and gets the reply
+     *
+     * @returns the first reply
+     * @throws RpcTimeoutException if the call timed out
+     * @throws std::runtime_error if the call was cancelled
+     * @throws std::logic_error if the call is streaming
+     */
+    BasicMessage::ptr_t Get();
+
+    /**
+     * Gets the next part of a streaming call's reply
+     *
+     * Parts are handed out in the order the server sent them, each once,
+     * and are released by the call as they are, so a long stream never has
+     * to be held in memory at once. Parts are not kept in Replies.
+     *
+     * @param part [out] the next part
+     * @param timeout [in] the longest time to wait in milliseconds, 0 polls
+     * without waiting, -1 waits until a part arrives or the call finishes
+     * @returns true if a part was got. false if timeout elapsed or the
+     * call has finished and every part has been got, see GetStatus to tell
+     * whether the stream ended or timed out
+     * @throws std::logic_error if the call is not streaming
+     */
+    bool NextReply(BasicMessage::ptr_t &part, int timeout = -1);
+
+private:
+    friend class Detail::RpcClientImpl;
+
+    Detail::RpcClientImpl *m_client;
+    const std::string m_correlation_id;
+    const std::size_t m_expected_replies;
+    const bool m_streaming;
+    Status m_status;
+    std::vector<BasicMessage::ptr_t> m_replies;
+
+    // Parts of a streaming reply waiting for NextReply
+    std::deque<BasicMessage::ptr_t> m_parts;
+    // Parts received ahead of one before them, by sequence number
+    std::map<boost::uint64_t, BasicMessage::ptr_t> m_early_parts;
+    boost::uint64_t m_next_part;
+};
+
+/**
+ * Makes many concurrent RPC calls over a single reply queue
+ *
+ * Requests are published with a unique correlation id and the reply_to
+ * property set to the client's reply queue, and replies are matched back to
+ * their calls by correlation id. Any number of calls may be outstanding at
+ * once. A server replies by publishing to the reply_to queue through the
+ * default exchange, copying the request's correlation id, or streams its
+ * reply in parts with an RpcReplyStream.
+ *
+ * By default the reply queue is RabbitMQ's direct reply-to pseudo-queue
+ * (Channel::DIRECT_REPLY_TO_QUEUE), so creating a client declares nothing
+ * on the broker. Otherwise an exclusive queue is declared for the client,
+ * also bound to amq.direct for servers that reply through it, as
+ * SimpleRpcServer does.
+ *
+ * The client consumes from its reply queue on the Channel it is given and
+ * only receives replies when it is polled, by Poll or by waiting on a call.
+ * Call timeouts are timers on the Channel's TimerWheel, so they also expire
+ * while the Channel waits in BasicConsumeMessage for other consumers.
+ * Replies that arrive for calls that have already timed out are dropped.
+ * Like Channel, an RpcClient must only be used from one thread at a time.
+ */
+class SIMPLEAMQPCLIENT_EXPORT RpcClient : boost::noncopyable
+{
+public:
+    typedef boost::shared_ptr<RpcClient> ptr_t;
+
+    /**
+     * Create a new RpcClient
+     *
+     * @param channel [in] the channel to publish requests and receive
+     * replies on
+     * @param exchange [in] the exchange to publish requests to, by default
+     * the default exchange which routes by queue name
+     * @param direct_reply_to [in] receive replies through direct reply-to,
+     * which needs RabbitMQ 3.4.0 or later, rather than a declared queue
+     * @returns a new RpcClient object
+     */
+    static ptr_t Create(const Channel::ptr_t &channel, const std::string &exchange = "",
+                        bool direct_reply_to = true)
+    {
+        return boost::make_shared<RpcClient>(channel, exchange, direct_reply_to);
+    }
+
+    RpcClient(const Channel::ptr_t &channel, const std::string &exchange, bool direct_reply_to);
+
+    /**
+     * Destroys the client, cancelling any calls still outstanding
+     */
+    virtual ~RpcClient();
+
+    /**
+     * Gets the name of the queue replies are received on
+     */
+    std::string ReplyQueue() const;
+
+    /**
+     * Publishes a request
+     *
+     * @param routing_key [in] the routing key to publish the request with,
+     * the name of the server's queue when using the default exchange
+     * @param request [in] the request. It is not changed, the correlation id
+     * and reply to properties are set on a copy
+     * @param timeout [in] the time in milliseconds to wait for a reply
+     * before the call times out, -1 to wait indefinitely
+     * @returns the call, to wait for the reply on
+     */
+    RpcCall::ptr_t Call(const std::string &routing_key,
+                        const BasicMessage::ptr_t &request,
+                        int timeout = -1);
+
+    /**
+     * Publishes one request expecting several replies
+     *
+     * For requests published to a fanout exchange, or any other routing
+     * that delivers a request to several servers, such as shards which each
+     * reply with their part of the result. The replies share the request's
+     * correlation id and are collected on the call, which finishes once
+     * replies have been received or timeout elapses, whichever comes first.
+     * Calls made this way share the reply queue with those made by Call and
+     * are waited on together, so many can be outstanding at once.
+     *
+     * @param routing_key [in] the routing key to publish the request with
+     * @param request [in] the request. It is not changed, the correlation id
+     * and reply to properties are set on a copy
+     * @param replies [in] the number of replies to wait for, at least 1
+     * @param timeout [in] the time in milliseconds to wait for the replies
+     * before the call times out, -1 to wait indefinitely
+     * @returns the call. When it times out Replies holds those that were
+     * received
+     */
+    RpcCall::ptr_t ScatterGather(const std::string &routing_key,
+                                 const BasicMessage::ptr_t &request,
+                                 std::size_t replies,
+                                 int timeout);
+
+    /**
+     * Publishes a request whose reply is streamed in parts
+     *
+     * The server replies with an RpcReplyStream, and the parts are read
+     * with RpcCall::NextReply as they arrive, so processing can start
+     * before the whole result has been produced. The call finishes when
+     * the stream ends.
+     *
+     * @param routing_key [in] the routing key to publish the request with,
+     * the name of the server's queue when using the default exchange
+     * @param request [in] the request. It is not changed, the correlation id
+     * and reply to properties are set on a copy
+     * @param timeout [in] the longest time in milliseconds to wait for the
+     * first part of the reply, or between one part and the next, before the
+     * call times out, -1 to wait indefinitely
+     * @returns the call, to read the reply from
+     */
+    RpcCall::ptr_t CallStreaming(const std::string &routing_key,
+                                 const BasicMessage::ptr_t &request,
+                                 int timeout = -1);
+
+    /**
+     * Receives replies and times out calls
+     *
+     * Waits until at least one call finishes, a part of a streaming reply
+     * arrives or timeout elapses, then handles any further replies already
+     * received without waiting.
+     *
+     * @param timeout [in] the longest time to wait in milliseconds, 0 polls
+     * without waiting, -1 waits until a call finishes
+     * @returns the number of calls that finished, 0 straight away if there
+     * are no outstanding calls
+     */
+    std::size_t Poll(int timeout = -1);
+
+    /**
+     * Gets the number of calls waiting for a reply
+     */
+    std::size_t Outstanding() const;
+
+private:
+    boost::scoped_ptr<Detail::RpcClientImpl> m_impl;
+};
+
+} // namespace AmqpClient
+
+#ifdef _MSC_VER
+# pragma warning ( pop )
+#endif
+
+#endif // RPCCLIENT_H
@@ -0,0 +1,142 @@
+/* vim:set ft=cpp ts=4 sw=4 sts=4 et cindent: */
+#ifndef RPCREPLYSTREAM_H
+#define RPCREPLYSTREAM_H
+/*
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MIT
+ *
+ * Copyright (c) 2010-2013 Alan Antonuk
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * ***** END LICENSE BLOCK *****
+ */
+
+
+#include "SimpleAmqpClient/BasicMessage.h"
+#include "SimpleAmqpClient/Channel.h"
+#include "SimpleAmqpClient/Table.h"
+#include "SimpleAmqpClient/Util.h"
+
+#include <boost/cstdint.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <string>
+
+#ifdef _MSC_VER
+# pragma warning ( push )
+# pragma warning ( disable: 4251 4275 )
+#endif
+
+namespace AmqpClient
+{
+
+/**
+ * Sends the reply to an RPC request as a stream of messages
+ *
+ * Rather than building one message holding the whole of a large result, a
+ * server can send it in parts as they are produced, which a client reads
+ * with RpcCall::NextReply as they arrive, made with
+ * RpcClient::CallStreaming. Every part is published to the request's
+ * reply to queue through the default exchange with the request's
+ * correlation id and its position in the stream in the SEQUENCE_HEADER
+ * header. End publishes an empty message with the END_HEADER header set,
+ * which is not itself a part.
+ *
+ * A stream that is never ended leaves the client waiting until its
+ * timeout, so end it even when the rest of the result can't be produced.
+ */
+class SIMPLEAMQPCLIENT_EXPORT RpcReplyStream : boost::noncopyable
+{
+public:
+    typedef boost::shared_ptr<RpcReplyStream> ptr_t;
+
+    /// Header holding the sequence number of a part, counting from 0
+    static const std::string SEQUENCE_HEADER;
+    /// Header set to true on the message ending a stream
+    static const std::string END_HEADER;
+
+    /**
+     * Create a new RpcReplyStream
+     *
+     * @param channel [in] the channel to publish the reply on
+     * @param request [in] the request being replied to
+     * @returns a new RpcReplyStream object
+     * @throws std::invalid_argument if the request has no reply to property
+     */
+    static ptr_t Create(const Channel::ptr_t &channel, const BasicMessage::ptr_t &request)
+    {
+        return boost::make_shared<RpcReplyStream>(channel, request);
+    }
+
+    RpcReplyStream(const Channel::ptr_t &channel, const BasicMessage::ptr_t &request);
+    virtual ~RpcReplyStream();
+
+    /**
+     * Publishes the next part of the reply
+     *
+     * @param part [in] the part. Its correlation id and SEQUENCE_HEADER
+     * header are set, replacing any already set
+     * @throws std::logic_error if the stream has ended
+     */
+    void Send(const BasicMessage::ptr_t &part);
+
+    /**
+     * Ends the stream
+     *
+     * @throws std::logic_error if the stream has already ended
+     */
+    void End();
+
+    /**
+     * Tests whether End has been called
+     */
+    bool IsEnded() const
+    {
+        return m_ended;
+    }
+
+    /**
+     * Gets the number of parts sent
+     */
+    boost::uint64_t PartsSent() const
+    {
+        return m_sequence;
+    }
+
+private:
+    void Publish(const BasicMessage::ptr_t &message, const TableEntry &marker);
+
+    const Channel::ptr_t m_channel;
+    const std::string m_reply_to;
+    const std::string m_correlation_id;
+    boost::uint64_t m_sequence;
+    bool m_ended;
+};
+
+} // namespace AmqpClient
+
+#ifdef _MSC_VER
+# pragma warning ( pop )
+#endif
+
+#endif // RPCREPLYSTREAM_H
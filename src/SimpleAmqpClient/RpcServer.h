@@ -0,0 +1,152 @@
+/* vim:set ft=cpp ts=4 sw=4 sts=4 et cindent: */
+#ifndef RPCSERVER_H
+#define RPCSERVER_H
+/*
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MIT
+ *
+ * Copyright (c) 2010-2013 Alan Antonuk
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * ***** END LICENSE BLOCK *****
+ */
+
+
+#include "SimpleAmqpClient/BasicMessage.h"
+#include "SimpleAmqpClient/Channel.h"
+#include "SimpleAmqpClient/Envelope.h"
+#include "SimpleAmqpClient/Util.h"
+
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <string>
+
+#ifdef _MSC_VER
+# pragma warning ( push )
+# pragma warning ( disable: 4251 4275 )
+#endif
+
+namespace AmqpClient
+{
+
+namespace Detail
+{
+class RpcServerImpl;
+}
+
+/**
+ * Serves RPC requests from a queue with a pool of worker threads
+ *
+ * Run consumes requests from the queue on the calling thread and hands
+ * each to the handler on one of the worker threads. A reply returned by the
+ * handler is published to the request's reply to queue through the
+ * default exchange, with the request's correlation id, by a publisher
+ * thread using its own Channel, so waiting for the broker to confirm
+ * replies never holds up consuming. Replies that queue up while the
+ * publisher waits are published together and their confirms waited for
+ * at once, so a slow confirm doesn't hold up every reply behind it. A
+ * request is acknowledged once its reply has been confirmed, so a request
+ * whose reply is lost with the server is redelivered.
+ *
+ * At most prefetch requests are in progress at once. A handler may return
+ * an empty pointer to send no reply; the request is then acknowledged
+ * straight away, as are requests without a reply to property. Requests
+ * whose handler throws are rejected without being requeued.
+ *
+ * Neither Channel may be used by anything else while Run is running.
+ * Handlers are called concurrently, so must be thread-safe, and requests
+ * are released on the worker threads, so a BodyAllocator set on the
+ * channel must be too.
+ */
+class SIMPLEAMQPCLIENT_EXPORT RpcServer : boost::noncopyable
+{
+public:
+    typedef boost::shared_ptr<RpcServer> ptr_t;
+    typedef boost::function<BasicMessage::ptr_t (const Envelope::ptr_t &)> handler_t;
+
+    /**
+     * Create a new RpcServer
+     *
+     * @param channel [in] the channel to consume and acknowledge requests on
+     * @param reply_channel [in] the channel to publish replies on, which
+     * must be a different Channel object
+     * @param queue [in] the queue to consume requests from
+     * @param handler [in] called with each request, returns the reply
+     * @param workers [in] the number of worker threads
+     * @param prefetch [in] the most requests to have in progress at once,
+     * 0 for twice the number of workers
+     * @returns a new RpcServer object
+     */
+    static ptr_t Create(const Channel::ptr_t &channel,
+                        const Channel::ptr_t &reply_channel,
+                        const std::string &queue,
+                        const handler_t &handler,
+                        unsigned int workers = 4,
+                        boost::uint16_t prefetch = 0)
+    {
+        return boost::make_shared<RpcServer>(channel, reply_channel, queue, handler, workers, prefetch);
+    }
+
+    RpcServer(const Channel::ptr_t &channel,
+              const Channel::ptr_t &reply_channel,
+              const std::string &queue,
+              const handler_t &handler,
+              unsigned int workers,
+              boost::uint16_t prefetch);
+    virtual ~RpcServer();
+
+    /**
+     * Serves requests until Stop is called
+     *
+     * Once stopped, requests already being handled are finished, and their
+     * replies confirmed and requests acknowledged, before returning. Run may
+     * be called again afterwards.
+     *
+     * @throws std::runtime_error or AmqpException if a reply can't be
+     * published, or as BasicConsumeMessage does. Requests in progress are
+     * left unacknowledged
+     */
+    void Run();
+
+    /**
+     * Asks Run to return
+     *
+     * May be called from any thread, including from a handler. If Run
+     * hasn't started yet, the next Run returns as soon as it has started.
+     */
+    void Stop();
+
+private:
+    boost::scoped_ptr<Detail::RpcServerImpl> m_impl;
+};
+
+} // namespace AmqpClient
+
+#ifdef _MSC_VER
+# pragma warning ( pop )
+#endif
+
+#endif // RPCSERVER_H
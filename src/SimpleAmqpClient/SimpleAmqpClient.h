@@ -30,14 +30,28 @@
  */
 
 #include "SimpleAmqpClient/Channel.h"
+#include "SimpleAmqpClient/EncodedTable.h"
 #include "SimpleAmqpClient/Envelope.h"
+#include "SimpleAmqpClient/HeaderSchema.h"
+#include "SimpleAmqpClient/HeaderView.h"
+#include "SimpleAmqpClient/LatencyHistogram.h"
 #include "SimpleAmqpClient/BasicMessage.h"
+#include "SimpleAmqpClient/Batcher.h"
+#include "SimpleAmqpClient/BodyAllocator.h"
+#include "SimpleAmqpClient/BodyCodec.h"
 #include "SimpleAmqpClient/AmqpException.h"
+#include "SimpleAmqpClient/AmqpLibraryException.h"
 #include "SimpleAmqpClient/AmqpResponseLibraryException.h"
 #include "SimpleAmqpClient/ConnectionClosedException.h"
 #include "SimpleAmqpClient/ConsumerCancelledException.h"
 #include "SimpleAmqpClient/ConsumerTagNotFoundException.h"
 #include "SimpleAmqpClient/MessageReturnedException.h"
+#include "SimpleAmqpClient/PooledBodyAllocator.h"
+#include "SimpleAmqpClient/RpcClient.h"
+#include "SimpleAmqpClient/RpcReplyStream.h"
+#include "SimpleAmqpClient/RpcServer.h"
+#include "SimpleAmqpClient/RpcTimeoutException.h"
+#include "SimpleAmqpClient/TimerWheel.h"
 #include "SimpleAmqpClient/Version.h"
 
 #endif // SIMPLEAMQPCLIENT_H
@@ -0,0 +1,95 @@
+/* vim:set ft=cpp ts=4 sw=4 sts=4 et cindent: */
+#ifndef SPILLFILE_H
+#define SPILLFILE_H
+/*
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MIT
+ *
+ * Copyright (c) 2010-2013 Alan Antonuk
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * ***** END LICENSE BLOCK *****
+ */
+
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <cstddef>
+#include <ctime>
+#include <string>
+
+namespace AmqpClient
+{
+namespace Detail
+{
+
+// Gets the system temporary directory
+std::string TemporaryDirectory();
+
+// Tests whether name is one SpillFile could have given a named file, as
+// returned by Keep
+bool IsSpillFileName(const std::string &name);
+
+// Removes the files in directory named as SpillFile names them that were
+// last written max_age or more seconds ago, returns how many were removed
+std::size_t RemoveSpillFilesOlderThan(const std::string &directory, unsigned int max_age);
+
+// A temporary file a large message body is written to, then mapped in to
+// memory so the body does not occupy the heap. An anonymous file is deleted
+// as soon as it is created (or when closed, on Windows), so nothing is left
+// behind if the process dies. A named file is deleted when closed unless
+// Keep is called, so another process can open it.
+class SpillFile : boost::noncopyable
+{
+public:
+    // Creates the file in directory, or the system temporary directory if
+    // that is empty. Throws std::runtime_error on failure
+    SpillFile(const std::string &directory, std::size_t size, bool named = false);
+    ~SpillFile();
+
+    // Leaves a named file in place when closed, returns its name within the
+    // directory
+    std::string Keep();
+
+    // Appends to the file
+    void Write(const void *data, std::size_t len);
+
+    // Maps the whole file read-only. The returned pointer owns the mapping,
+    // which stays valid after the SpillFile is destroyed
+    boost::shared_ptr<const void> Map();
+
+private:
+#ifdef _WIN32
+    void *m_file;
+#else
+    int m_fd;
+#endif
+    std::size_t m_size;
+    std::string m_path;
+    bool m_named;
+    bool m_keep;
+};
+
+} // namespace Detail
+} // namespace AmqpClient
+
+#endif // SPILLFILE_H
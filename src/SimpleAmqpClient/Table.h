@@ -31,6 +31,7 @@
 
 #include "SimpleAmqpClient/Util.h"
 
+#include <boost/config.hpp>
 #include <boost/cstdint.hpp>
 #include <boost/scoped_ptr.hpp>
 
@@ -76,6 +77,10 @@ typedef Table::value_type TableEntry;
 
 /**
  * A variant type for the Table Value
+ *
+ * Scalar values (void, boolean, integer and floating point types) are stored
+ * inline in the TableValue object, only string, array and table values
+ * require a heap allocation.
  */
 class SIMPLEAMQPCLIENT_EXPORT TableValue
 {
@@ -193,6 +198,43 @@ public:
      */
     TableValue &operator=(const TableValue &l);
 
+#ifndef BOOST_NO_RVALUE_REFERENCES
+    /**
+     * Construct a character string value, taking ownership of the string
+     *
+     * @param value [in] the value
+     */
+    TableValue(std::string &&value);
+
+    /**
+     * Construct an array value, taking ownership of the array
+     *
+     * @param values [in] the value
+     */
+    TableValue(std::vector<TableValue> &&values);
+
+    /**
+     * Construct a Table value, taking ownership of the table
+     *
+     * @param value [in] the value
+     */
+    TableValue(Table &&value);
+
+    /**
+     * Move-constructor
+     *
+     * l is left as a VT_void value
+     */
+    TableValue(TableValue &&l) BOOST_NOEXCEPT;
+
+    /**
+     * Move-assignment operator
+     *
+     * l is left as a VT_void value
+     */
+    TableValue &operator=(TableValue &&l) BOOST_NOEXCEPT;
+#endif
+
     /**
      * Equality operator
      */
@@ -379,7 +421,45 @@ public:
      */
     void Set(const Table &value);
 
+#ifndef BOOST_NO_RVALUE_REFERENCES
+    /**
+     * Set the value as a string, taking ownership of the string
+     *
+     * @param value [in] the value
+     */
+    void Set(std::string &&value);
+
+    /**
+     * Set the value as an array, taking ownership of the array
+     *
+     * @param value [in] the value
+     */
+    void Set(std::vector<TableValue> &&value);
+
+    /**
+     * Set the value as a table, taking ownership of the table
+     *
+     * @param value [in] the value
+     */
+    void Set(Table &&value);
+#endif
+
 private:
+    // Storage for the scalar types, valid when m_type is one of them
+    union scalar_t
+    {
+        bool bool_value;
+        boost::int8_t int8_value;
+        boost::int16_t int16_value;
+        boost::int32_t int32_value;
+        boost::int64_t int64_value;
+        float float_value;
+        double double_value;
+    };
+
+    ValueType m_type;
+    scalar_t m_scalar;
+    // Only allocated for VT_string, VT_array and VT_table values
     boost::scoped_ptr<Detail::TableValueImpl> m_impl;
 };
 
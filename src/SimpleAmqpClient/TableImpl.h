@@ -36,6 +36,7 @@
 #include <boost/variant/variant.hpp>
 
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <amqp.h>
@@ -75,19 +76,34 @@ class TableValueImpl
 public:
 
     explicit TableValueImpl(const value_t &v) : m_value(v) {}
+#ifndef BOOST_NO_RVALUE_REFERENCES
+    explicit TableValueImpl(value_t &&v) : m_value(std::move(v)) {}
+#endif
     virtual ~TableValueImpl() {}
 
     value_t m_value;
 
     static amqp_table_t CreateAmqpTable(const Table &table, amqp_pool_ptr_t &pool);
 
+    // Recycles pool if nothing else refers to it, otherwise replaces it
+    // with a new pool
+    static amqp_pool_t &ResetPool(amqp_pool_ptr_t &pool);
+
+    // Encodes table in to memory allocated from a caller-owned pool
+    static amqp_table_t CreateAmqpTable(const Table &table, amqp_pool_t &pool);
+
+    // Checks whether an already encoded table has the same contents as table
+    static bool IsEqual(const Table &table, const amqp_table_t &amqp_table);
+
     static Table CreateTable(const amqp_table_t &table);
+    static TableValue CreateTableValue(const amqp_field_value_t &entry);
 
     static amqp_table_t CopyTable(const amqp_table_t &table, amqp_pool_ptr_t &pool);
 
 private:
     static amqp_table_t CreateAmqpTableInner(const Table &table, amqp_pool_t &pool);
-    static TableValue CreateTableValue(const amqp_field_value_t &entry);
+    static amqp_field_value_t CreateFieldValue(const TableValue &value, amqp_pool_t &pool);
+    static bool IsEqualValue(const TableValue &value, const amqp_field_value_t &field);
     static amqp_table_t CopyTableInner(const amqp_table_t &table, amqp_pool_t &pool);
     static amqp_field_value_t CopyValue(const amqp_field_value_t value, amqp_pool_t &pool);
 
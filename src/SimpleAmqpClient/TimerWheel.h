@@ -0,0 +1,133 @@
+/* vim:set ft=cpp ts=4 sw=4 sts=4 et cindent: */
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+/*
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MIT
+ *
+ * Copyright (c) 2010-2013 Alan Antonuk
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * ***** END LICENSE BLOCK *****
+ */
+
+
+#include "SimpleAmqpClient/Util.h"
+
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include <cstddef>
+
+#ifdef _MSC_VER
+# pragma warning ( push )
+# pragma warning ( disable: 4251 4275 )
+#endif
+
+namespace AmqpClient
+{
+
+namespace Detail
+{
+class TimerWheelImpl;
+}
+
+/**
+ * Runs callbacks after a delay, for many timers at once
+ *
+ * A hierarchical timing wheel with millisecond ticks: timers are kept in
+ * slots by when they expire, 64 slots to a level and four levels, each
+ * level's slot spanning a whole turn of the level below. Scheduling and
+ * cancelling a timer take constant time however many are pending, and
+ * time passing only touches the slots it moves through, so thousands of
+ * deadlines cost no more to track than a few. Timers further off than the
+ * wheel covers (about four and a half hours) wait in its last slot until
+ * they come in to range.
+ *
+ * Every Channel has one, see Channel::Timers, which is advanced while the
+ * Channel waits in BasicConsumeMessage. A TimerWheel may also be used on
+ * its own by calling Advance. Like Channel, it must only be used from one
+ * thread at a time.
+ */
+class SIMPLEAMQPCLIENT_EXPORT TimerWheel : boost::noncopyable
+{
+public:
+    typedef boost::uint64_t timer_id_t;
+    typedef boost::function<void ()> callback_t;
+
+    TimerWheel();
+    virtual ~TimerWheel();
+
+    /**
+     * Schedules a callback
+     *
+     * @param delay [in] the time in milliseconds until the callback is run,
+     * it is run on the first Advance at least this long after this call
+     * @param callback [in] the function to run. It may schedule and cancel
+     * timers, and if it throws the exception is passed on by Advance
+     * @returns an id for cancelling the timer, never 0
+     */
+    timer_id_t Schedule(int delay, const callback_t &callback);
+
+    /**
+     * Cancels a timer that has not run yet
+     *
+     * @returns true if the timer was cancelled, false if it has already run,
+     * been cancelled or never existed
+     */
+    bool Cancel(timer_id_t timer);
+
+    /**
+     * Runs the callbacks of all timers that have expired
+     *
+     * @returns the number of callbacks run
+     */
+    std::size_t Advance();
+
+    /**
+     * Gets how long a caller can wait before calling Advance again
+     *
+     * Exact for timers due in the next 64 milliseconds, otherwise a lower
+     * bound, the time until the wheel next needs to sort its timers.
+     *
+     * @returns the time in milliseconds, 0 if a timer has expired, or -1 if
+     * no timers are pending
+     */
+    int MillisecondsUntilNext() const;
+
+    /**
+     * Gets the number of timers pending
+     */
+    std::size_t Size() const;
+
+private:
+    boost::scoped_ptr<Detail::TimerWheelImpl> m_impl;
+};
+
+} // namespace AmqpClient
+
+#ifdef _MSC_VER
+# pragma warning ( pop )
+#endif
+
+#endif // TIMERWHEEL_H
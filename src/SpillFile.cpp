@@ -0,0 +1,355 @@
+/* vim:set ft=cpp ts=4 sw=4 sts=4 et cindent: */
+/*
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MIT
+ *
+ * Copyright (c) 2010-2013 Alan Antonuk
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * ***** END LICENSE BLOCK *****
+ */
+
+#ifdef _WIN32
+# define NOMINMAX
+# ifndef WIN32_LEAN_AND_MEAN
+#  define WIN32_LEAN_AND_MEAN
+# endif
+# include <windows.h>
+#else
+# include <sys/types.h>
+# include <sys/stat.h>
+# include <dirent.h>
+# include <errno.h>
+# include <stdlib.h>
+# include <string.h>
+# include <unistd.h>
+#endif
+
+#include "SimpleAmqpClient/SpillFile.h"
+#include "SimpleAmqpClient/MappedFile.h"
+
+#include <boost/cstdint.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+#include <vector>
+
+namespace AmqpClient
+{
+namespace Detail
+{
+
+namespace
+{
+
+#ifdef _WIN32
+
+void ThrowLastError(const std::string &what)
+{
+    throw std::runtime_error(what + ": error " + boost::lexical_cast<std::string>(GetLastError()));
+}
+
+#else
+
+void ThrowErrno(const std::string &what)
+{
+    throw std::runtime_error(what + ": " + strerror(errno));
+}
+
+#endif
+
+} // namespace
+
+#ifdef _WIN32
+
+std::string TemporaryDirectory()
+{
+    char temp_dir[MAX_PATH + 1];
+    const DWORD len = GetTempPathA(sizeof(temp_dir), temp_dir);
+    if (0 == len)
+    {
+        ThrowLastError("TemporaryDirectory: GetTempPath failed");
+    }
+    // Drop the trailing separator
+    return std::string(temp_dir, len - 1);
+}
+
+#else
+
+std::string TemporaryDirectory()
+{
+    const char *tmpdir = getenv("TMPDIR");
+    return (NULL == tmpdir || '\0' == *tmpdir) ? "/tmp" : tmpdir;
+}
+
+#endif
+
+#ifdef _WIN32
+
+// GetTempFileName names files the prefix, up to four hex digits and .tmp
+bool IsSpillFileName(const std::string &name)
+{
+    static const std::string PREFIX = "sac";
+    static const std::string SUFFIX = ".tmp";
+    if (name.size() <= PREFIX.size() + SUFFIX.size() ||
+            name.size() > PREFIX.size() + 4 + SUFFIX.size() ||
+            0 != _strnicmp(name.c_str(), PREFIX.c_str(), PREFIX.size()) ||
+            0 != _stricmp(name.c_str() + name.size() - SUFFIX.size(), SUFFIX.c_str()))
+    {
+        return false;
+    }
+    for (std::size_t i = PREFIX.size(); i < name.size() - SUFFIX.size(); ++i)
+    {
+        if (!isxdigit(static_cast<unsigned char>(name[i])))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+#else
+
+// mkstemp replaces the Xs of the template with letters and digits
+bool IsSpillFileName(const std::string &name)
+{
+    static const std::string PREFIX = "SimpleAmqpClient-";
+    if (name.size() != PREFIX.size() + 6 || 0 != name.compare(0, PREFIX.size(), PREFIX))
+    {
+        return false;
+    }
+    for (std::size_t i = PREFIX.size(); i < name.size(); ++i)
+    {
+        if (!isalnum(static_cast<unsigned char>(name[i])))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+#endif
+
+#ifdef _WIN32
+
+std::size_t RemoveSpillFilesOlderThan(const std::string &directory, unsigned int max_age)
+{
+    const std::string dir = directory.empty() ? TemporaryDirectory() : directory;
+
+    // FILETIMEs count 100ns intervals
+    FILETIME now_time;
+    GetSystemTimeAsFileTime(&now_time);
+    ULARGE_INTEGER now;
+    now.LowPart = now_time.dwLowDateTime;
+    now.HighPart = now_time.dwHighDateTime;
+    const boost::uint64_t max_age_intervals = static_cast<boost::uint64_t>(max_age) * 10000000;
+
+    WIN32_FIND_DATAA found;
+    HANDLE search = FindFirstFileA((dir + "\\sac*.tmp").c_str(), &found);
+    if (INVALID_HANDLE_VALUE == search)
+    {
+        return 0;
+    }
+    std::size_t removed = 0;
+    do
+    {
+        ULARGE_INTEGER written;
+        written.LowPart = found.ftLastWriteTime.dwLowDateTime;
+        written.HighPart = found.ftLastWriteTime.dwHighDateTime;
+        if (0 == (found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) &&
+                IsSpillFileName(found.cFileName) &&
+                now.QuadPart >= written.QuadPart &&
+                now.QuadPart - written.QuadPart >= max_age_intervals &&
+                DeleteFileA((dir + "\\" + found.cFileName).c_str()))
+        {
+            ++removed;
+        }
+    }
+    while (FindNextFileA(search, &found));
+    FindClose(search);
+    return removed;
+}
+
+#else
+
+std::size_t RemoveSpillFilesOlderThan(const std::string &directory, unsigned int max_age)
+{
+    const std::string dir = directory.empty() ? TemporaryDirectory() : directory;
+    DIR *listing = opendir(dir.c_str());
+    if (NULL == listing)
+    {
+        return 0;
+    }
+    const std::time_t now = std::time(NULL);
+    std::size_t removed = 0;
+    while (struct dirent *entry = readdir(listing))
+    {
+        if (!IsSpillFileName(entry->d_name))
+        {
+            continue;
+        }
+        const std::string path = dir + "/" + entry->d_name;
+        struct stat info;
+        if (0 == lstat(path.c_str(), &info) && S_ISREG(info.st_mode) &&
+                now - info.st_mtime >= static_cast<std::time_t>(max_age) &&
+                0 == unlink(path.c_str()))
+        {
+            ++removed;
+        }
+    }
+    closedir(listing);
+    return removed;
+}
+
+#endif
+
+std::string SpillFile::Keep()
+{
+    m_keep = true;
+    const std::string::size_type separator = m_path.find_last_of("/\\");
+    return std::string::npos == separator ? m_path : m_path.substr(separator + 1);
+}
+
+#ifdef _WIN32
+
+SpillFile::SpillFile(const std::string &directory, std::size_t size, bool named) :
+    m_file(INVALID_HANDLE_VALUE),
+    m_size(size),
+    m_named(named),
+    m_keep(false)
+{
+    const std::string dir = directory.empty() ? TemporaryDirectory() : directory;
+
+    char path[MAX_PATH + 1];
+    if (0 == GetTempFileNameA(dir.c_str(), "sac", 0, path))
+    {
+        ThrowLastError("SpillFile: GetTempFileName failed");
+    }
+
+    m_path = path;
+
+    const DWORD flags = FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_SEQUENTIAL_SCAN |
+                        (m_named ? 0 : FILE_FLAG_DELETE_ON_CLOSE);
+    m_file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, flags, NULL);
+    if (INVALID_HANDLE_VALUE == m_file)
+    {
+        DeleteFileA(path);
+        ThrowLastError("SpillFile: CreateFile failed");
+    }
+}
+
+SpillFile::~SpillFile()
+{
+    CloseHandle(m_file);
+    if (m_named && !m_keep)
+    {
+        DeleteFileA(m_path.c_str());
+    }
+}
+
+void SpillFile::Write(const void *data, std::size_t len)
+{
+    const char *next = static_cast<const char *>(data);
+    while (len > 0)
+    {
+        DWORD written = 0;
+        const DWORD chunk = static_cast<DWORD>(std::min<std::size_t>(len, 0x40000000));
+        if (!WriteFile(m_file, next, chunk, &written, NULL))
+        {
+            ThrowLastError("SpillFile: WriteFile failed");
+        }
+        next += written;
+        len -= written;
+    }
+}
+
+boost::shared_ptr<const void> SpillFile::Map()
+{
+    const void *data;
+    return MapFileRange(m_file, 0, m_size, data);
+}
+
+#else
+
+SpillFile::SpillFile(const std::string &directory, std::size_t size, bool named) :
+    m_fd(-1),
+    m_size(size),
+    m_named(named),
+    m_keep(false)
+{
+    const std::string dir = directory.empty() ? TemporaryDirectory() : directory;
+
+    std::string path_template = dir + "/SimpleAmqpClient-XXXXXX";
+    std::vector<char> path(path_template.begin(), path_template.end());
+    path.push_back('\0');
+
+    m_fd = mkstemp(&path[0]);
+    if (-1 == m_fd)
+    {
+        ThrowErrno("SpillFile: could not create temporary file in " + dir);
+    }
+    m_path = &path[0];
+    if (!m_named)
+    {
+        unlink(m_path.c_str());
+    }
+}
+
+SpillFile::~SpillFile()
+{
+    close(m_fd);
+    if (m_named && !m_keep)
+    {
+        unlink(m_path.c_str());
+    }
+}
+
+void SpillFile::Write(const void *data, std::size_t len)
+{
+    const char *next = static_cast<const char *>(data);
+    while (len > 0)
+    {
+        const ssize_t written = write(m_fd, next, len);
+        if (-1 == written)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            ThrowErrno("SpillFile: write failed");
+        }
+        next += written;
+        len -= written;
+    }
+}
+
+boost::shared_ptr<const void> SpillFile::Map()
+{
+    const void *data;
+    return MapFileRange(m_fd, 0, m_size, data);
+}
+
+#endif
+
+} // namespace Detail
+} // namespace AmqpClient
@@ -34,71 +34,122 @@
 
 #include <algorithm>
 #include <iterator>
+#include <utility>
 
 namespace AmqpClient
 {
+
+namespace
+{
+template <typename T>
+void AssignHeapValue(boost::scoped_ptr<Detail::TableValueImpl> &impl, const T &value)
+{
+    if (impl)
+    {
+        impl->m_value = value;
+    }
+    else
+    {
+        impl.reset(new Detail::TableValueImpl(value));
+    }
+}
+
+#ifndef BOOST_NO_RVALUE_REFERENCES
+template <typename T>
+void MoveHeapValue(boost::scoped_ptr<Detail::TableValueImpl> &impl, T &&value)
+{
+    if (impl)
+    {
+        impl->m_value = std::move(value);
+    }
+    else
+    {
+        impl.reset(new Detail::TableValueImpl(Detail::value_t(std::move(value))));
+    }
+}
+#endif
+} // namespace
+
 TableValue::TableValue() :
-    m_impl(new Detail::TableValueImpl(Detail::void_t()))
+    m_type(VT_void),
+    m_scalar()
 {
 }
 
 TableValue::TableValue(bool value) :
-    m_impl(new Detail::TableValueImpl(value))
+    m_type(VT_bool)
 {
+    m_scalar.bool_value = value;
 }
 
 TableValue::TableValue(boost::int8_t value) :
-    m_impl(new Detail::TableValueImpl(value))
+    m_type(VT_int8)
 {
+    m_scalar.int8_value = value;
 }
 
 TableValue::TableValue(boost::int16_t value) :
-    m_impl(new Detail::TableValueImpl(value))
+    m_type(VT_int16)
 {
+    m_scalar.int16_value = value;
 }
 
 TableValue::TableValue(boost::int32_t value) :
-    m_impl(new Detail::TableValueImpl(value))
+    m_type(VT_int32)
 {
+    m_scalar.int32_value = value;
 }
 
 TableValue::TableValue(boost::int64_t value) :
-    m_impl(new Detail::TableValueImpl(value))
+    m_type(VT_int64)
 {
+    m_scalar.int64_value = value;
 }
 
 TableValue::TableValue(float value) :
-    m_impl(new Detail::TableValueImpl(value))
+    m_type(VT_float)
 {
+    m_scalar.float_value = value;
 }
 
 TableValue::TableValue(double value) :
-    m_impl(new Detail::TableValueImpl(value))
+    m_type(VT_double)
 {
+    m_scalar.double_value = value;
 }
 
 TableValue::TableValue(const char *value) :
+    m_type(VT_string),
+    m_scalar(),
     m_impl(new Detail::TableValueImpl(std::string(value)))
 {
 }
 
 TableValue::TableValue(const std::string &value) :
+    m_type(VT_string),
+    m_scalar(),
     m_impl(new Detail::TableValueImpl(value))
 {
 }
 
 TableValue::TableValue(const std::vector<TableValue> &values) :
+    m_type(VT_array),
+    m_scalar(),
     m_impl(new Detail::TableValueImpl(values))
 {
 }
 
 TableValue::TableValue(const Table &value) :
+    m_type(VT_table),
+    m_scalar(),
     m_impl(new Detail::TableValueImpl(value))
 {
 }
 
 TableValue::TableValue(const TableValue &l) :
-    m_impl(new Detail::TableValueImpl(l.m_impl->m_value))
+    m_type(l.m_type),
+    m_scalar(l.m_scalar),
+    m_impl(l.m_impl ? new Detail::TableValueImpl(l.m_impl->m_value) : NULL)
 {
 }
 
@@ -109,10 +160,66 @@ TableValue &TableValue::operator=(const TableValue &l)
         return *this;
     }
 
-    m_impl->m_value = l.m_impl->m_value;
+    if (l.m_impl)
+    {
+        AssignHeapValue(m_impl, l.m_impl->m_value);
+    }
+    else
+    {
+        m_impl.reset();
+    }
+    m_type = l.m_type;
+    m_scalar = l.m_scalar;
+
+    return *this;
+}
+
+#ifndef BOOST_NO_RVALUE_REFERENCES
+TableValue::TableValue(std::string &&value) :
+    m_type(VT_string),
+    m_scalar(),
+    m_impl(new Detail::TableValueImpl(Detail::value_t(std::move(value))))
+{
+}
+
+TableValue::TableValue(std::vector<TableValue> &&values) :
+    m_type(VT_array),
+    m_scalar(),
+    m_impl(new Detail::TableValueImpl(Detail::value_t(std::move(values))))
+{
+}
+
+TableValue::TableValue(Table &&value) :
+    m_type(VT_table),
+    m_scalar(),
+    m_impl(new Detail::TableValueImpl(Detail::value_t(std::move(value))))
+{
+}
+
+TableValue::TableValue(TableValue &&l) BOOST_NOEXCEPT :
+    m_type(l.m_type),
+    m_scalar(l.m_scalar)
+{
+    m_impl.swap(l.m_impl);
+    l.m_type = VT_void;
+}
+
+TableValue &TableValue::operator=(TableValue &&l) BOOST_NOEXCEPT
+{
+    if (this == &l)
+    {
+        return *this;
+    }
+
+    m_impl.swap(l.m_impl);
+    l.m_impl.reset();
+    m_type = l.m_type;
+    m_scalar = l.m_scalar;
+    l.m_type = VT_void;
 
     return *this;
 }
+#endif
 
 bool operator==(const Array &l, const Array &r)
 {
@@ -139,17 +246,37 @@ bool TableValue::operator==(const TableValue &l) const
         return true;
     }
 
-    return m_impl->m_value == l.m_impl->m_value;
-}
-
-bool TableValue::operator!=(const TableValue &l) const
-{
-    if (this == &l)
+    if (m_type != l.m_type)
     {
         return false;
     }
 
-    return !(m_impl->m_value == l.m_impl->m_value);
+    switch (m_type)
+    {
+    case VT_void:
+        return true;
+    case VT_bool:
+        return m_scalar.bool_value == l.m_scalar.bool_value;
+    case VT_int8:
+        return m_scalar.int8_value == l.m_scalar.int8_value;
+    case VT_int16:
+        return m_scalar.int16_value == l.m_scalar.int16_value;
+    case VT_int32:
+        return m_scalar.int32_value == l.m_scalar.int32_value;
+    case VT_int64:
+        return m_scalar.int64_value == l.m_scalar.int64_value;
+    case VT_float:
+        return m_scalar.float_value == l.m_scalar.float_value;
+    case VT_double:
+        return m_scalar.double_value == l.m_scalar.double_value;
+    default:
+        return m_impl->m_value == l.m_impl->m_value;
+    }
+}
+
+bool TableValue::operator!=(const TableValue &l) const
+{
+    return !(*this == l);
 }
 
 TableValue::~TableValue()
@@ -158,37 +285,57 @@ TableValue::~TableValue()
 
 TableValue::ValueType TableValue::GetType() const
 {
-    return static_cast<ValueType>(m_impl->m_value.which());
+    return m_type;
 }
 
 bool TableValue::GetBool() const
 {
-    return boost::get<bool>(m_impl->m_value);
+    if (VT_bool != m_type)
+    {
+        throw boost::bad_get();
+    }
+    return m_scalar.bool_value;
 }
 
 boost::int8_t TableValue::GetInt8() const
 {
-    return boost::get<boost::int8_t>(m_impl->m_value);
+    if (VT_int8 != m_type)
+    {
+        throw boost::bad_get();
+    }
+    return m_scalar.int8_value;
 }
 
 boost::int16_t TableValue::GetInt16() const
 {
-    return boost::get<boost::int16_t>(m_impl->m_value);
+    if (VT_int16 != m_type)
+    {
+        throw boost::bad_get();
+    }
+    return m_scalar.int16_value;
 }
 
 boost::int32_t TableValue::GetInt32() const
 {
-    return boost::get<boost::int32_t>(m_impl->m_value);
+    if (VT_int32 != m_type)
+    {
+        throw boost::bad_get();
+    }
+    return m_scalar.int32_value;
 }
 
 boost::int64_t TableValue::GetInt64() const
 {
-    return boost::get<boost::int64_t>(m_impl->m_value);
+    if (VT_int64 != m_type)
+    {
+        throw boost::bad_get();
+    }
+    return m_scalar.int64_value;
 }
 
 boost::int64_t TableValue::GetInteger() const
 {
-    switch (m_impl->m_value.which())
+    switch (m_type)
     {
     case VT_int8:
         return GetInt8();
@@ -205,17 +352,25 @@ boost::int64_t TableValue::GetInteger() const
 
 float TableValue::GetFloat() const
 {
-    return boost::get<float>(m_impl->m_value);
+    if (VT_float != m_type)
+    {
+        throw boost::bad_get();
+    }
+    return m_scalar.float_value;
 }
 
 double TableValue::GetDouble() const
 {
-    return boost::get<double>(m_impl->m_value);
+    if (VT_double != m_type)
+    {
+        throw boost::bad_get();
+    }
+    return m_scalar.double_value;
 }
 
 double TableValue::GetReal() const
 {
-    switch (m_impl->m_value.which())
+    switch (m_type)
     {
     case VT_float:
         return GetFloat();
@@ -228,77 +383,128 @@ double TableValue::GetReal() const
 
 std::string TableValue::GetString() const
 {
+    if (VT_string != m_type)
+    {
+        throw boost::bad_get();
+    }
     return boost::get<std::string>(m_impl->m_value);
 }
 
 std::vector<TableValue> TableValue::GetArray() const
 {
+    if (VT_array != m_type)
+    {
+        throw boost::bad_get();
+    }
     return boost::get<Detail::array_t>(m_impl->m_value);
 }
 
 Table TableValue::GetTable() const
 {
+    if (VT_table != m_type)
+    {
+        throw boost::bad_get();
+    }
     return boost::get<Table>(m_impl->m_value);
 }
 
 void TableValue::Set()
 {
-    m_impl->m_value = Detail::void_t();
+    m_impl.reset();
+    m_type = VT_void;
 }
 
 void TableValue::Set(bool value)
 {
-    m_impl->m_value = value;
+    m_impl.reset();
+    m_type = VT_bool;
+    m_scalar.bool_value = value;
 }
 
 void TableValue::Set(boost::int8_t value)
 {
-    m_impl->m_value = value;
+    m_impl.reset();
+    m_type = VT_int8;
+    m_scalar.int8_value = value;
 }
 
 void TableValue::Set(boost::int16_t value)
 {
-    m_impl->m_value = value;
+    m_impl.reset();
+    m_type = VT_int16;
+    m_scalar.int16_value = value;
 }
 
 void TableValue::Set(boost::int32_t value)
 {
-    m_impl->m_value = value;
+    m_impl.reset();
+    m_type = VT_int32;
+    m_scalar.int32_value = value;
 }
 
 void TableValue::Set(boost::int64_t value)
 {
-    m_impl->m_value = value;
+    m_impl.reset();
+    m_type = VT_int64;
+    m_scalar.int64_value = value;
 }
 
 void TableValue::Set(float value)
 {
-    m_impl->m_value = value;
+    m_impl.reset();
+    m_type = VT_float;
+    m_scalar.float_value = value;
 }
 
 void TableValue::Set(double value)
 {
-    m_impl->m_value = value;
+    m_impl.reset();
+    m_type = VT_double;
+    m_scalar.double_value = value;
 }
 
 void TableValue::Set(const char *value)
 {
-    m_impl->m_value = std::string(value);
+    AssignHeapValue(m_impl, std::string(value));
+    m_type = VT_string;
 }
 
 void TableValue::Set(const std::string &value)
 {
-    m_impl->m_value = value;
+    AssignHeapValue(m_impl, value);
+    m_type = VT_string;
 }
 
 void TableValue::Set(const std::vector<TableValue> &value)
 {
-    m_impl->m_value = value;
+    AssignHeapValue(m_impl, value);
+    m_type = VT_array;
 }
 
 void TableValue::Set(const Table &value)
 {
-    m_impl->m_value = value;
+    AssignHeapValue(m_impl, value);
+    m_type = VT_table;
+}
+
+#ifndef BOOST_NO_RVALUE_REFERENCES
+void TableValue::Set(std::string &&value)
+{
+    MoveHeapValue(m_impl, std::move(value));
+    m_type = VT_string;
+}
+
+void TableValue::Set(std::vector<TableValue> &&value)
+{
+    MoveHeapValue(m_impl, std::move(value));
+    m_type = VT_array;
+}
+
+void TableValue::Set(Table &&value)
+{
+    MoveHeapValue(m_impl, std::move(value));
+    m_type = VT_table;
 }
+#endif
 
 } // namespace AmqpClient
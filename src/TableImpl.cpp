@@ -35,6 +35,7 @@
 
 #include <boost/foreach.hpp>
 #include <boost/variant/apply_visitor.hpp>
+#include <boost/variant/get.hpp>
 #include <boost/variant/static_visitor.hpp>
 
 #include <amqp.h>
@@ -141,8 +142,7 @@ amqp_field_value_t TableValueImpl::generate_field_value::operator()(const array_
     for (array_t::const_iterator it = value.begin();
             it != value.end(); ++it, ++output_iterator)
     {
-        *output_iterator = boost::apply_visitor(generate_field_value(pool),
-                                                it->m_impl->m_value);
+        *output_iterator = CreateFieldValue(*it, pool);
     }
     return v;
 }
@@ -168,10 +168,33 @@ amqp_table_t TableValueImpl::CreateAmqpTable(const Table &table, amqp_pool_ptr_t
         return AMQP_EMPTY_TABLE;
     }
 
-    pool = boost::shared_ptr<amqp_pool_t>(new amqp_pool_t, free_pool);
-    init_amqp_pool(pool.get(), 1024);
+    return CreateAmqpTableInner(table, ResetPool(pool));
+}
+
+amqp_pool_t &TableValueImpl::ResetPool(amqp_pool_ptr_t &pool)
+{
+    if (pool && pool.unique())
+    {
+        // Nothing else refers to what was previously encoded in the pool,
+        // so its memory can be reused rather than allocating a new pool
+        recycle_amqp_pool(pool.get());
+    }
+    else
+    {
+        pool = boost::shared_ptr<amqp_pool_t>(new amqp_pool_t, free_pool);
+        init_amqp_pool(pool.get(), 1024);
+    }
+    return *pool.get();
+}
+
+amqp_table_t TableValueImpl::CreateAmqpTable(const Table &table, amqp_pool_t &pool)
+{
+    if (0 == table.size())
+    {
+        return AMQP_EMPTY_TABLE;
+    }
 
-    return CreateAmqpTableInner(table, *pool.get());
+    return CreateAmqpTableInner(table, pool);
 }
 
 amqp_table_t TableValueImpl::CreateAmqpTableInner(const Table &table, amqp_pool_t &pool)
@@ -201,13 +224,146 @@ amqp_table_t TableValueImpl::CreateAmqpTableInner(const Table &table, amqp_pool_
 
         std::copy(it->first.begin(), it->first.end(), (char *)output_it->key.bytes);
 
-        output_it->value = boost::apply_visitor(TableValueImpl::generate_field_value(pool),
-                                                it->second.m_impl->m_value);
+        output_it->value = CreateFieldValue(it->second, pool);
     }
 
     return new_table;
 }
 
+amqp_field_value_t TableValueImpl::CreateFieldValue(const TableValue &value, amqp_pool_t &pool)
+{
+    // Scalars are stored inline in the TableValue, only the heap allocated
+    // types need to go through the variant
+    amqp_field_value_t v;
+    switch (value.m_type)
+    {
+    case TableValue::VT_void:
+        v.kind = AMQP_FIELD_KIND_VOID;
+        return v;
+    case TableValue::VT_bool:
+        v.kind = AMQP_FIELD_KIND_BOOLEAN;
+        v.value.boolean = value.m_scalar.bool_value;
+        return v;
+    case TableValue::VT_int8:
+        v.kind = AMQP_FIELD_KIND_I8;
+        v.value.i8 = value.m_scalar.int8_value;
+        return v;
+    case TableValue::VT_int16:
+        v.kind = AMQP_FIELD_KIND_I16;
+        v.value.i16 = value.m_scalar.int16_value;
+        return v;
+    case TableValue::VT_int32:
+        v.kind = AMQP_FIELD_KIND_I32;
+        v.value.i32 = value.m_scalar.int32_value;
+        return v;
+    case TableValue::VT_int64:
+        v.kind = AMQP_FIELD_KIND_I64;
+        v.value.i64 = value.m_scalar.int64_value;
+        return v;
+    case TableValue::VT_float:
+        v.kind = AMQP_FIELD_KIND_F32;
+        v.value.f32 = value.m_scalar.float_value;
+        return v;
+    case TableValue::VT_double:
+        v.kind = AMQP_FIELD_KIND_F64;
+        v.value.f64 = value.m_scalar.double_value;
+        return v;
+    default:
+        return boost::apply_visitor(generate_field_value(pool), value.m_impl->m_value);
+    }
+}
+
+namespace
+{
+bool BytesEqual(const std::string &l, const amqp_bytes_t &r)
+{
+    return l.size() == r.len &&
+           (0 == r.len || 0 == memcmp(l.data(), r.bytes, r.len));
+}
+} // namespace
+
+bool TableValueImpl::IsEqual(const Table &table, const amqp_table_t &amqp_table)
+{
+    if (table.size() != static_cast<size_t>(amqp_table.num_entries))
+    {
+        return false;
+    }
+
+    // Tables encoded by CreateAmqpTable are in the same order as the Table,
+    // a table that was encoded some other way may compare unequal, which
+    // just means it will be re-encoded
+    const amqp_table_entry_t *entry = amqp_table.entries;
+    for (Table::const_iterator it = table.begin();
+            it != table.end();
+            ++it, ++entry)
+    {
+        if (!BytesEqual(it->first, entry->key) ||
+                !IsEqualValue(it->second, entry->value))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool TableValueImpl::IsEqualValue(const TableValue &value, const amqp_field_value_t &field)
+{
+    switch (value.m_type)
+    {
+    case TableValue::VT_void:
+        return AMQP_FIELD_KIND_VOID == field.kind;
+    case TableValue::VT_bool:
+        return AMQP_FIELD_KIND_BOOLEAN == field.kind &&
+               value.m_scalar.bool_value == (0 != field.value.boolean);
+    case TableValue::VT_int8:
+        return AMQP_FIELD_KIND_I8 == field.kind &&
+               value.m_scalar.int8_value == field.value.i8;
+    case TableValue::VT_int16:
+        return AMQP_FIELD_KIND_I16 == field.kind &&
+               value.m_scalar.int16_value == field.value.i16;
+    case TableValue::VT_int32:
+        return AMQP_FIELD_KIND_I32 == field.kind &&
+               value.m_scalar.int32_value == field.value.i32;
+    case TableValue::VT_int64:
+        return AMQP_FIELD_KIND_I64 == field.kind &&
+               value.m_scalar.int64_value == field.value.i64;
+    case TableValue::VT_float:
+        return AMQP_FIELD_KIND_F32 == field.kind &&
+               value.m_scalar.float_value == field.value.f32;
+    case TableValue::VT_double:
+        return AMQP_FIELD_KIND_F64 == field.kind &&
+               value.m_scalar.double_value == field.value.f64;
+    case TableValue::VT_string:
+        return AMQP_FIELD_KIND_UTF8 == field.kind &&
+               BytesEqual(boost::get<std::string>(value.m_impl->m_value), field.value.bytes);
+    case TableValue::VT_array:
+    {
+        if (AMQP_FIELD_KIND_ARRAY != field.kind)
+        {
+            return false;
+        }
+        const array_t &array = boost::get<array_t>(value.m_impl->m_value);
+        if (array.size() != static_cast<size_t>(field.value.array.num_entries))
+        {
+            return false;
+        }
+        for (size_t i = 0; i < array.size(); ++i)
+        {
+            if (!IsEqualValue(array[i], field.value.array.entries[i]))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+    case TableValue::VT_table:
+        return AMQP_FIELD_KIND_TABLE == field.kind &&
+               IsEqual(boost::get<Table>(value.m_impl->m_value), field.value.table);
+    default:
+        return false;
+    }
+}
+
 Table TableValueImpl::CreateTable(const amqp_table_t &table)
 {
     Table new_table;
@@ -251,17 +407,25 @@ TableValue TableValueImpl::CreateTableValue(const amqp_field_value_t &entry)
     case AMQP_FIELD_KIND_ARRAY:
     {
         amqp_array_t array = entry.value.array;
-        Detail::array_t new_array;
+        // Build the array in place, avoids copying it in to the TableValue
+        TableValue value((Detail::array_t()));
+        Detail::array_t &new_array = boost::get<Detail::array_t>(value.m_impl->m_value);
+        new_array.reserve(array.num_entries);
 
         for (int i = 0; i < array.num_entries; ++i)
         {
             new_array.push_back(CreateTableValue(array.entries[i]));
         }
 
-        return TableValue(new_array);
+        return value;
     }
     case AMQP_FIELD_KIND_TABLE:
-        return TableValue(CreateTable(entry.value.table));
+    {
+        TableValue value((Table()));
+        Table new_table = CreateTable(entry.value.table);
+        boost::get<Table>(value.m_impl->m_value).swap(new_table);
+        return value;
+    }
     case AMQP_FIELD_KIND_DECIMAL:
     default:
         return TableValue();
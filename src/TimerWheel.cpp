@@ -0,0 +1,353 @@
+/* vim:set ft=cpp ts=4 sw=4 sts=4 et cindent: */
+/*
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MIT
+ *
+ * Copyright (c) 2010-2013 Alan Antonuk
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "SimpleAmqpClient/TimerWheel.h"
+
+#include <boost/chrono.hpp>
+#include <boost/unordered_map.hpp>
+
+#include <algorithm>
+#include <limits>
+#include <list>
+
+namespace AmqpClient
+{
+
+namespace Detail
+{
+
+class TimerWheelImpl
+{
+public:
+    typedef boost::chrono::steady_clock clock;
+
+    static const int SLOT_BITS = 6;
+    static const unsigned int SLOTS = 1u << SLOT_BITS;
+    static const int LEVELS = 4;
+    // The level of timers that have expired but not yet run
+    static const int DUE = -1;
+
+    struct Timer
+    {
+        TimerWheel::timer_id_t id;
+        // In ticks since m_start
+        boost::uint64_t deadline;
+        TimerWheel::callback_t callback;
+    };
+    typedef std::list<Timer> slot_t;
+
+    struct Location
+    {
+        int level;
+        unsigned int slot;
+        slot_t::iterator timer;
+    };
+    typedef boost::unordered_map<TimerWheel::timer_id_t, Location> index_t;
+
+    TimerWheelImpl()
+        : m_start(clock::now())
+        , m_now(0)
+        , m_next_id(1)
+    {
+        for (int level = 0; level < LEVELS; ++level)
+        {
+            m_level_counts[level] = 0;
+        }
+    }
+
+    boost::uint64_t ElapsedTicks() const
+    {
+        return boost::chrono::duration_cast<boost::chrono::milliseconds>(clock::now() - m_start).count();
+    }
+
+    TimerWheel::timer_id_t Schedule(int delay, const TimerWheel::callback_t &callback)
+    {
+        // The extra tick rounds up the part of a millisecond already gone
+        const boost::uint64_t deadline = ElapsedTicks() + (delay > 0 ? delay : 0) + 1;
+
+        slot_t pending;
+        Timer timer;
+        timer.id = m_next_id++;
+        timer.deadline = deadline > m_now ? deadline : m_now + 1;
+        timer.callback = callback;
+        pending.push_back(timer);
+
+        Location location = { DUE, 0, pending.begin() };
+        m_index.insert(std::make_pair(timer.id, location));
+        Place(pending, pending.begin());
+        return timer.id;
+    }
+
+    bool Cancel(TimerWheel::timer_id_t id)
+    {
+        index_t::iterator it = m_index.find(id);
+        if (it == m_index.end())
+        {
+            return false;
+        }
+        Location &location = it->second;
+        if (DUE == location.level)
+        {
+            m_due.erase(location.timer);
+        }
+        else
+        {
+            m_slots[location.level][location.slot].erase(location.timer);
+            --m_level_counts[location.level];
+        }
+        m_index.erase(it);
+        return true;
+    }
+
+    std::size_t Advance()
+    {
+        AdvanceTo(ElapsedTicks());
+
+        // Timers are taken off the due list one at a time, so if a callback
+        // throws the rest are still run by the next Advance
+        std::size_t run = 0;
+        while (!m_due.empty())
+        {
+            TimerWheel::callback_t callback;
+            callback.swap(m_due.front().callback);
+            m_index.erase(m_due.front().id);
+            m_due.pop_front();
+            ++run;
+            callback();
+        }
+        return run;
+    }
+
+    int MillisecondsUntilNext() const
+    {
+        if (!m_due.empty())
+        {
+            return 0;
+        }
+        if (m_index.empty())
+        {
+            return -1;
+        }
+
+        // The earliest of the first occupied slot in the lowest level and
+        // the next cascade of a higher level holding timers
+        boost::uint64_t next = std::numeric_limits<boost::uint64_t>::max();
+        for (unsigned int i = 1; 0 != m_level_counts[0] && i < SLOTS; ++i)
+        {
+            if (!m_slots[0][(m_now + i) & (SLOTS - 1)].empty())
+            {
+                next = m_now + i;
+                break;
+            }
+        }
+        for (int level = 1; level < LEVELS; ++level)
+        {
+            if (0 != m_level_counts[level])
+            {
+                next = std::min(next, NextCascade(level));
+                break;
+            }
+        }
+
+        const boost::uint64_t elapsed = ElapsedTicks();
+        if (next <= elapsed)
+        {
+            return 0;
+        }
+        return static_cast<int>(std::min<boost::uint64_t>(next - elapsed, std::numeric_limits<int>::max()));
+    }
+
+    std::size_t Size() const
+    {
+        return m_index.size();
+    }
+
+private:
+    int LowestOccupiedLevel() const
+    {
+        int level = 0;
+        while (level < LEVELS && 0 == m_level_counts[level])
+        {
+            ++level;
+        }
+        return level;
+    }
+
+    // The next tick at which level's current slot is cascaded
+    boost::uint64_t NextCascade(int level) const
+    {
+        const boost::uint64_t span = static_cast<boost::uint64_t>(1) << (SLOT_BITS * level);
+        return (m_now | (span - 1)) + 1;
+    }
+
+    // Moves timer from the list it's in to where its deadline belongs: the
+    // due list if it has passed, otherwise the lowest level with a slot for
+    // it. Slots at each level are relative to m_now, and never the current
+    // one, which has already been cascaded
+    void Place(slot_t &from, slot_t::iterator timer)
+    {
+        Location &location = m_index.find(timer->id)->second;
+        const boost::uint64_t deadline = timer->deadline;
+        if (deadline <= m_now)
+        {
+            m_due.splice(m_due.end(), from, timer);
+            location.level = DUE;
+            location.timer = --m_due.end();
+            return;
+        }
+
+        for (int level = 0; level < LEVELS; ++level)
+        {
+            const int shift = SLOT_BITS * level;
+            boost::uint64_t slot_tick = deadline >> shift;
+            const boost::uint64_t now_tick = m_now >> shift;
+            if (slot_tick - now_tick >= SLOTS)
+            {
+                if (level != LEVELS - 1)
+                {
+                    continue;
+                }
+                // Beyond the wheel, park it in the slot furthest away
+                slot_tick = now_tick + SLOTS - 1;
+            }
+
+            slot_t &slot = m_slots[level][slot_tick & (SLOTS - 1)];
+            slot.splice(slot.end(), from, timer);
+            ++m_level_counts[level];
+            location.level = level;
+            location.slot = static_cast<unsigned int>(slot_tick & (SLOTS - 1));
+            location.timer = --slot.end();
+            return;
+        }
+    }
+
+    void AdvanceTo(boost::uint64_t target)
+    {
+        while (m_now < target)
+        {
+            // Skip straight to the next tick where anything can happen
+            const int level = LowestOccupiedLevel();
+            if (LEVELS == level)
+            {
+                m_now = target;
+                break;
+            }
+            if (0 != level)
+            {
+                const boost::uint64_t next = NextCascade(level);
+                if (next > target)
+                {
+                    m_now = target;
+                    break;
+                }
+                m_now = next - 1;
+            }
+
+            ++m_now;
+            Cascade(1);
+            slot_t &slot = m_slots[0][m_now & (SLOTS - 1)];
+            while (!slot.empty())
+            {
+                --m_level_counts[0];
+                Place(slot, slot.begin());
+            }
+        }
+    }
+
+    // At the start of each turn of a level, redistributes the timers in the
+    // next level up's current slot in to it, or lower
+    void Cascade(int level)
+    {
+        if (LEVELS == level)
+        {
+            return;
+        }
+        const int shift = SLOT_BITS * level;
+        if (0 != (m_now & ((static_cast<boost::uint64_t>(1) << shift) - 1)))
+        {
+            return;
+        }
+        Cascade(level + 1);
+
+        slot_t &slot = m_slots[level][(m_now >> shift) & (SLOTS - 1)];
+        while (!slot.empty())
+        {
+            --m_level_counts[level];
+            Place(slot, slot.begin());
+        }
+    }
+
+    const clock::time_point m_start;
+    // The last tick advanced to
+    boost::uint64_t m_now;
+    TimerWheel::timer_id_t m_next_id;
+
+    slot_t m_slots[LEVELS][SLOTS];
+    std::size_t m_level_counts[LEVELS];
+    slot_t m_due;
+    index_t m_index;
+};
+
+} // namespace Detail
+
+TimerWheel::TimerWheel() :
+    m_impl(new Detail::TimerWheelImpl)
+{
+}
+
+TimerWheel::~TimerWheel()
+{
+}
+
+TimerWheel::timer_id_t TimerWheel::Schedule(int delay, const callback_t &callback)
+{
+    return m_impl->Schedule(delay, callback);
+}
+
+bool TimerWheel::Cancel(timer_id_t timer)
+{
+    return m_impl->Cancel(timer);
+}
+
+std::size_t TimerWheel::Advance()
+{
+    return m_impl->Advance();
+}
+
+int TimerWheel::MillisecondsUntilNext() const
+{
+    return m_impl->MillisecondsUntilNext();
+}
+
+std::size_t TimerWheel::Size() const
+{
+    return m_impl->Size();
+}
+
+} // namespace AmqpClient
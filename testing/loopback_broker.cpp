@@ -0,0 +1,1933 @@
+/* vim:set ft=cpp ts=4 sw=4 sts=4 et cindent: */
+/*
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MIT
+ *
+ * Copyright (c) 2010-2013 Alan Antonuk
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * ***** END LICENSE BLOCK *****
+ */
+
+#ifdef _WIN32
+# define NOMINMAX
+# ifndef WIN32_LEAN_AND_MEAN
+#  define WIN32_LEAN_AND_MEAN
+# endif
+# include <winsock2.h>
+# include <ws2tcpip.h>
+#else
+# include <arpa/inet.h>
+# include <errno.h>
+# include <netinet/in.h>
+# include <netinet/tcp.h>
+# include <sys/select.h>
+# include <sys/socket.h>
+# include <unistd.h>
+#endif
+
+#include "loopback_broker.h"
+
+#include <amqp.h>
+#include <amqp_framing.h>
+
+#include <boost/bind.hpp>
+#include <boost/chrono.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+typedef boost::chrono::steady_clock clock;
+
+#ifdef _WIN32
+
+typedef SOCKET socket_t;
+const socket_t NO_SOCKET = INVALID_SOCKET;
+const int SHUTDOWN_BOTH = SD_BOTH;
+const int SEND_FLAGS = 0;
+
+void CloseSocket(socket_t s)
+{
+    closesocket(s);
+}
+
+bool Interrupted()
+{
+    return false;
+}
+
+#else
+
+typedef int socket_t;
+const socket_t NO_SOCKET = -1;
+const int SHUTDOWN_BOTH = SHUT_RDWR;
+# ifdef MSG_NOSIGNAL
+const int SEND_FLAGS = MSG_NOSIGNAL;
+# else
+const int SEND_FLAGS = 0;
+# endif
+
+void CloseSocket(socket_t s)
+{
+    close(s);
+}
+
+bool Interrupted()
+{
+    return EINTR == errno;
+}
+
+#endif
+
+// The largest frame the broker accepts, beyond any frame_max it negotiates
+const boost::uint32_t MAX_FRAME_SIZE = 1 << 24;
+const boost::uint32_t FRAME_MAX = 131072;
+const boost::uint16_t CHANNEL_MAX = 2047;
+// Frame type, channel and payload size, and the frame end octet
+const std::size_t FRAME_OVERHEAD = 8;
+
+bool SendAll(socket_t s, const char *data, std::size_t len)
+{
+    while (len > 0)
+    {
+        const int sent = send(s, data, static_cast<int>(std::min<std::size_t>(len, 1 << 30)), SEND_FLAGS);
+        if (sent < 0 && Interrupted())
+        {
+            continue;
+        }
+        if (sent <= 0)
+        {
+            return false;
+        }
+        data += sent;
+        len -= sent;
+    }
+    return true;
+}
+
+bool ReceiveAll(socket_t s, char *data, std::size_t len)
+{
+    while (len > 0)
+    {
+        const int received = recv(s, data, static_cast<int>(std::min<std::size_t>(len, 1 << 30)), 0);
+        if (received < 0 && Interrupted())
+        {
+            continue;
+        }
+        if (received <= 0)
+        {
+            return false;
+        }
+        data += received;
+        len -= received;
+    }
+    return true;
+}
+
+// Waits up to timeout for data to read on s, returns false if none came.
+// Errors count as readable, so the read that follows reports them
+bool WaitReadable(socket_t s, boost::chrono::milliseconds timeout)
+{
+    const clock::time_point deadline = clock::now() + timeout;
+    for (;;)
+    {
+        const boost::chrono::microseconds left =
+            boost::chrono::duration_cast<boost::chrono::microseconds>(deadline - clock::now());
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(s, &readable);
+        timeval wait;
+        wait.tv_sec = static_cast<long>(std::max<boost::int64_t>(left.count(), 0) / 1000000);
+        wait.tv_usec = static_cast<long>(std::max<boost::int64_t>(left.count(), 0) % 1000000);
+        const int ready = select(static_cast<int>(s + 1), &readable, NULL, NULL, &wait);
+        if (ready < 0 && Interrupted())
+        {
+            continue;
+        }
+        return 0 != ready;
+    }
+}
+
+void AppendUint8(std::string &out, boost::uint8_t value)
+{
+    out += static_cast<char>(value);
+}
+
+void AppendUint16(std::string &out, boost::uint16_t value)
+{
+    out += static_cast<char>(value >> 8);
+    out += static_cast<char>(value);
+}
+
+void AppendUint32(std::string &out, boost::uint32_t value)
+{
+    AppendUint16(out, static_cast<boost::uint16_t>(value >> 16));
+    AppendUint16(out, static_cast<boost::uint16_t>(value));
+}
+
+void AppendUint64(std::string &out, boost::uint64_t value)
+{
+    AppendUint32(out, static_cast<boost::uint32_t>(value >> 32));
+    AppendUint32(out, static_cast<boost::uint32_t>(value));
+}
+
+void PatchUint32(std::string &out, std::size_t offset, boost::uint32_t value)
+{
+    out[offset] = static_cast<char>(value >> 24);
+    out[offset + 1] = static_cast<char>(value >> 16);
+    out[offset + 2] = static_cast<char>(value >> 8);
+    out[offset + 3] = static_cast<char>(value);
+}
+
+boost::uint16_t ReadUint16(const char *data)
+{
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(data);
+    return static_cast<boost::uint16_t>((bytes[0] << 8) | bytes[1]);
+}
+
+boost::uint32_t ReadUint32(const char *data)
+{
+    return (static_cast<boost::uint32_t>(ReadUint16(data)) << 16) | ReadUint16(data + 2);
+}
+
+boost::uint64_t ReadUint64(const char *data)
+{
+    return (static_cast<boost::uint64_t>(ReadUint32(data)) << 32) | ReadUint32(data + 4);
+}
+
+std::string ToString(const amqp_bytes_t &bytes)
+{
+    if (0 == bytes.len)
+    {
+        return std::string();
+    }
+    return std::string(static_cast<const char *>(bytes.bytes), bytes.len);
+}
+
+amqp_bytes_t Bytes(const std::string &value)
+{
+    amqp_bytes_t bytes;
+    bytes.len = value.size();
+    bytes.bytes = const_cast<char *>(value.data());
+    return bytes;
+}
+
+bool MatchWords(const std::vector<std::string> &pattern, std::size_t p,
+                const std::vector<std::string> &key, std::size_t k)
+{
+    if (p == pattern.size())
+    {
+        return k == key.size();
+    }
+    if ("#" == pattern[p])
+    {
+        // Matches zero or more words
+        for (std::size_t skip = k; skip <= key.size(); ++skip)
+        {
+            if (MatchWords(pattern, p + 1, key, skip))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+    if (k == key.size())
+    {
+        return false;
+    }
+    return ("*" == pattern[p] || pattern[p] == key[k]) && MatchWords(pattern, p + 1, key, k + 1);
+}
+
+std::vector<std::string> SplitWords(const std::string &value)
+{
+    std::vector<std::string> words;
+    std::string::size_type start = 0;
+    for (;;)
+    {
+        const std::string::size_type dot = value.find('.', start);
+        words.push_back(value.substr(start, dot - start));
+        if (std::string::npos == dot)
+        {
+            return words;
+        }
+        start = dot + 1;
+    }
+}
+
+bool TopicMatches(const std::string &pattern, const std::string &routing_key)
+{
+    return MatchWords(SplitWords(pattern), 0, SplitWords(routing_key), 0);
+}
+
+// Closes the channel the frame arrived on
+class ChannelError : public std::runtime_error
+{
+public:
+    ChannelError(boost::uint16_t code, const std::string &text)
+        : std::runtime_error(text), code(code)
+    {}
+
+    boost::uint16_t code;
+};
+
+// Closes the connection the frame arrived on
+class ConnectionError : public std::runtime_error
+{
+public:
+    ConnectionError(boost::uint16_t code, const std::string &text)
+        : std::runtime_error(text), code(code)
+    {}
+
+    boost::uint16_t code;
+};
+
+struct Message
+{
+    std::string exchange;
+    std::string routing_key;
+    // The content header payload after the body size, the property flags
+    // and properties, which are passed on to consumers as they are
+    std::string properties;
+    std::string body;
+};
+typedef boost::shared_ptr<Message> message_ptr;
+
+struct QueuedMessage
+{
+    QueuedMessage(const message_ptr &message, bool redelivered)
+        : message(message), redelivered(redelivered)
+    {}
+
+    message_ptr message;
+    bool redelivered;
+};
+
+class Connection;
+
+struct Consumer
+{
+    Connection *connection;
+    amqp_channel_t channel;
+    std::string tag;
+    std::string queue;
+    bool no_ack;
+    bool exclusive;
+    boost::uint16_t prefetch;
+    std::size_t unacked;
+};
+typedef boost::shared_ptr<Consumer> consumer_ptr;
+
+struct Queue
+{
+    Queue()
+        : owner(0), durable(false), auto_delete(false), next_consumer(0)
+    {}
+
+    std::deque<QueuedMessage> messages;
+    std::vector<consumer_ptr> consumers;
+    // The id of the connection an exclusive queue belongs to, otherwise 0
+    boost::uint64_t owner;
+    bool durable;
+    bool auto_delete;
+    // Deliveries go round the consumers in turn
+    std::size_t next_consumer;
+};
+
+struct Binding
+{
+    std::string queue;
+    std::string key;
+
+    bool operator==(const Binding &other) const
+    {
+        return queue == other.queue && key == other.key;
+    }
+};
+
+struct Exchange
+{
+    Exchange()
+        : durable(false), auto_delete(false)
+    {}
+
+    std::string type;
+    bool durable;
+    bool auto_delete;
+    std::vector<Binding> bindings;
+};
+
+struct Unacked
+{
+    message_ptr message;
+    std::string queue;
+    // Empty for messages got with basic.get
+    consumer_ptr consumer;
+};
+
+struct ChannelState
+{
+    ChannelState()
+        : closing(false)
+        , confirm(false)
+        , next_publish(1)
+        , next_delivery(1)
+        , prefetch(0)
+        , publishing(false)
+        , mandatory(false)
+        , have_header(false)
+        , body_size(0)
+    {}
+
+    // The broker has closed the channel and is waiting for close-ok
+    bool closing;
+    bool confirm;
+    boost::uint64_t next_publish;
+    boost::uint64_t next_delivery;
+    boost::uint16_t prefetch;
+    std::map<boost::uint64_t, Unacked> unacked;
+    std::map<std::string, consumer_ptr> consumers;
+
+    // A message being published, until its content has arrived
+    bool publishing;
+    bool mandatory;
+    bool have_header;
+    boost::uint64_t body_size;
+    message_ptr message;
+};
+
+struct Pending
+{
+    clock::time_point due;
+    std::string frames;
+};
+
+} // namespace
+
+class LoopbackBrokerImpl;
+
+namespace
+{
+
+/*
+ * The sockets and threads of a client connection
+ *
+ * Frames are read and handled on the reader thread, and sent by the writer
+ * thread once the configured latency has passed. Everything but the outgoing
+ * frames is guarded by the broker's mutex.
+ */
+class Connection : boost::noncopyable
+{
+public:
+    Connection(LoopbackBrokerImpl &broker, socket_t socket, boost::uint64_t id,
+               boost::uint32_t latency, boost::uint64_t bandwidth)
+        : id(id)
+        , frame_max(FRAME_MAX)
+        , closing(false)
+        , cleaned_up(false)
+        , encode_buffer(FRAME_MAX)
+        , m_broker(broker)
+        , m_socket(socket)
+        , m_latency(latency)
+        , m_bandwidth(bandwidth)
+        , m_heartbeat(0)
+        , m_close_after_sending(false)
+        , m_shutdown(false)
+        , m_reader_done(false)
+        , m_writer_done(false)
+    {
+        init_amqp_pool(&pool, 4096);
+    }
+
+    ~Connection()
+    {
+        empty_amqp_pool(&pool);
+        CloseSocket(m_socket);
+    }
+
+    void Start()
+    {
+        m_reader = boost::thread(boost::bind(&Connection::ReadLoop, this));
+        m_writer = boost::thread(boost::bind(&Connection::WriteLoop, this));
+    }
+
+    // Queues frames to be sent once the latency has passed
+    void Send(std::string &frames)
+    {
+        const clock::time_point due = clock::now() + boost::chrono::microseconds(m_latency);
+
+        boost::lock_guard<boost::mutex> lock(m_out_mutex);
+        m_out.push_back(Pending());
+        m_out.back().due = due;
+        m_out.back().frames.swap(frames);
+        m_out_ready.notify_one();
+    }
+
+    void SetHeartbeat(boost::uint16_t heartbeat)
+    {
+        boost::lock_guard<boost::mutex> lock(m_out_mutex);
+        m_heartbeat = heartbeat;
+        m_out_ready.notify_one();
+    }
+
+    boost::uint16_t Heartbeat()
+    {
+        boost::lock_guard<boost::mutex> lock(m_out_mutex);
+        return m_heartbeat;
+    }
+
+    // Closes the socket once everything queued has been sent
+    void CloseAfterSending()
+    {
+        boost::lock_guard<boost::mutex> lock(m_out_mutex);
+        m_close_after_sending = true;
+        m_out_ready.notify_one();
+    }
+
+    // Drops the connection straight away
+    void Shutdown()
+    {
+        {
+            boost::lock_guard<boost::mutex> lock(m_out_mutex);
+            m_shutdown = true;
+            m_out_ready.notify_one();
+        }
+        shutdown(m_socket, SHUTDOWN_BOTH);
+    }
+
+    bool Finished()
+    {
+        boost::lock_guard<boost::mutex> lock(m_out_mutex);
+        return m_reader_done && m_writer_done;
+    }
+
+    void Join()
+    {
+        m_reader.join();
+        m_writer.join();
+    }
+
+    // Guarded by the broker's mutex
+    const boost::uint64_t id;
+    boost::uint32_t frame_max;
+    // The broker has sent connection.close and is waiting for close-ok
+    bool closing;
+    bool cleaned_up;
+    std::map<amqp_channel_t, ChannelState> channels;
+    amqp_pool_t pool;
+    std::vector<char> encode_buffer;
+    // Frames built while handling a frame, sent once it has been handled
+    std::string pending;
+
+private:
+    void ReadLoop();
+    void WriteLoop();
+    void Throttle(clock::time_point &next, std::size_t bytes);
+
+    LoopbackBrokerImpl &m_broker;
+    const socket_t m_socket;
+    const boost::uint32_t m_latency;
+    const boost::uint64_t m_bandwidth;
+    boost::thread m_reader;
+    boost::thread m_writer;
+
+    boost::mutex m_out_mutex;
+    boost::condition_variable m_out_ready;
+    std::deque<Pending> m_out;
+    boost::uint16_t m_heartbeat;
+    bool m_close_after_sending;
+    bool m_shutdown;
+    bool m_reader_done;
+    bool m_writer_done;
+};
+
+typedef boost::shared_ptr<Connection> connection_ptr;
+
+} // namespace
+
+class LoopbackBrokerImpl : boost::noncopyable
+{
+public:
+    typedef std::map<std::string, Exchange> exchanges_t;
+    typedef std::map<std::string, Queue> queues_t;
+
+    LoopbackBrokerImpl(boost::uint32_t latency, boost::uint64_t bandwidth, boost::uint16_t heartbeat)
+        : m_latency(latency)
+        , m_bandwidth(bandwidth)
+        , m_heartbeat(heartbeat)
+        , m_listener(NO_SOCKET)
+        , m_port(0)
+        , m_stopping(false)
+        , m_next_connection_id(0)
+        , m_next_name(0)
+        , m_heartbeats_received(0)
+    {
+#ifdef _WIN32
+        WSADATA data;
+        WSAStartup(MAKEWORD(2, 2), &data);
+#endif
+        m_exchanges["amq.direct"].type = "direct";
+        m_exchanges["amq.fanout"].type = "fanout";
+        m_exchanges["amq.topic"].type = "topic";
+        for (exchanges_t::iterator it = m_exchanges.begin(); it != m_exchanges.end(); ++it)
+        {
+            it->second.durable = true;
+        }
+
+        Listen();
+        m_acceptor = boost::thread(boost::bind(&LoopbackBrokerImpl::AcceptLoop, this));
+    }
+
+    ~LoopbackBrokerImpl()
+    {
+        {
+            boost::lock_guard<boost::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_acceptor.join();
+        CloseSocket(m_listener);
+
+        std::vector<connection_ptr> connections;
+        {
+            boost::lock_guard<boost::mutex> lock(m_mutex);
+            connections.swap(m_connections);
+        }
+        for (std::vector<connection_ptr>::iterator it = connections.begin(); it != connections.end(); ++it)
+        {
+            (*it)->Shutdown();
+        }
+        for (std::vector<connection_ptr>::iterator it = connections.begin(); it != connections.end(); ++it)
+        {
+            (*it)->Join();
+        }
+#ifdef _WIN32
+        WSACleanup();
+#endif
+    }
+
+    int Port() const
+    {
+        return m_port;
+    }
+
+    boost::uint64_t HeartbeatsReceived()
+    {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        return m_heartbeats_received;
+    }
+
+    // Sends connection.start, once the client has sent the protocol header
+    void Greet(Connection &c)
+    {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+
+        amqp_table_entry_t capabilities[3];
+        capabilities[0].key = amqp_cstring_bytes("publisher_confirms");
+        capabilities[1].key = amqp_cstring_bytes("basic.nack");
+        capabilities[2].key = amqp_cstring_bytes("consumer_cancel_notify");
+        for (int i = 0; i < 3; ++i)
+        {
+            capabilities[i].value.kind = AMQP_FIELD_KIND_BOOLEAN;
+            capabilities[i].value.value.boolean = 1;
+        }
+
+        amqp_table_entry_t properties[3];
+        properties[0].key = amqp_cstring_bytes("product");
+        properties[0].value.kind = AMQP_FIELD_KIND_UTF8;
+        properties[0].value.value.bytes = amqp_cstring_bytes("LoopbackBroker");
+        // Claim to be a recent enough RabbitMQ for Channel to use its
+        // prefetch semantics
+        properties[1].key = amqp_cstring_bytes("version");
+        properties[1].value.kind = AMQP_FIELD_KIND_UTF8;
+        properties[1].value.value.bytes = amqp_cstring_bytes("3.6.0");
+        properties[2].key = amqp_cstring_bytes("capabilities");
+        properties[2].value.kind = AMQP_FIELD_KIND_TABLE;
+        properties[2].value.value.table.num_entries = 3;
+        properties[2].value.value.table.entries = capabilities;
+
+        amqp_connection_start_t start;
+        start.version_major = AMQP_PROTOCOL_VERSION_MAJOR;
+        start.version_minor = AMQP_PROTOCOL_VERSION_MINOR;
+        start.server_properties.num_entries = 3;
+        start.server_properties.entries = properties;
+        start.mechanisms = amqp_cstring_bytes("PLAIN");
+        start.locales = amqp_cstring_bytes("en_US");
+        AppendMethod(c, 0, AMQP_CONNECTION_START_METHOD, &start);
+        FlushDirty();
+    }
+
+    // Handles a frame from a client, returns false once the connection is
+    // finished with
+    bool HandleFrame(Connection &c, boost::uint8_t type, amqp_channel_t channel, const std::string &payload)
+    {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        bool open = true;
+        amqp_method_number_t method = 0;
+        try
+        {
+            void *decoded = NULL;
+            if (AMQP_FRAME_METHOD == type)
+            {
+                if (payload.size() < 4)
+                {
+                    throw ConnectionError(AMQP_FRAME_ERROR, "method frame too short");
+                }
+                method = ReadUint32(payload.data());
+                amqp_bytes_t arguments;
+                arguments.len = payload.size() - 4;
+                arguments.bytes = const_cast<char *>(payload.data() + 4);
+                if (amqp_decode_method(method, &c.pool, arguments, &decoded) < 0)
+                {
+                    throw ConnectionError(AMQP_SYNTAX_ERROR, "could not decode method");
+                }
+            }
+
+            if (AMQP_FRAME_HEARTBEAT == type)
+            {
+                // Nothing else to do, the client is alive
+                ++m_heartbeats_received;
+            }
+            else if (c.closing)
+            {
+                // Everything but the reply to connection.close is ignored
+                if (AMQP_CONNECTION_CLOSE_OK_METHOD == method)
+                {
+                    c.CloseAfterSending();
+                    open = false;
+                }
+            }
+            else if (0 == channel)
+            {
+                open = HandleConnectionMethod(c, type, method, decoded);
+            }
+            else
+            {
+                HandleChannelFrame(c, type, channel, method, decoded, payload);
+            }
+        }
+        catch (ConnectionError &e)
+        {
+            CloseConnection(c, e.code, e.what(), method);
+        }
+        FlushDirty();
+        recycle_amqp_pool(&c.pool);
+        return open;
+    }
+
+    // The client has gone, with or without closing the connection
+    void Disconnected(Connection &c)
+    {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        CleanUpConnection(c);
+        FlushDirty();
+    }
+
+private:
+    void Listen()
+    {
+        m_listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (NO_SOCKET == m_listener)
+        {
+            throw std::runtime_error("LoopbackBroker: could not create a socket");
+        }
+
+        sockaddr_in address;
+        std::memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = 0;
+        socklen_t length = sizeof(address);
+        if (0 != bind(m_listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) ||
+                0 != listen(m_listener, 64) ||
+                0 != getsockname(m_listener, reinterpret_cast<sockaddr *>(&address), &length))
+        {
+            CloseSocket(m_listener);
+            throw std::runtime_error("LoopbackBroker: could not listen on 127.0.0.1");
+        }
+        m_port = ntohs(address.sin_port);
+    }
+
+    void AcceptLoop()
+    {
+        for (;;)
+        {
+            {
+                boost::lock_guard<boost::mutex> lock(m_mutex);
+                if (m_stopping)
+                {
+                    return;
+                }
+                ReapConnections();
+            }
+
+            // Wake up regularly to notice being stopped
+            fd_set readable;
+            FD_ZERO(&readable);
+            FD_SET(m_listener, &readable);
+            timeval timeout;
+            timeout.tv_sec = 0;
+            timeout.tv_usec = 50000;
+            if (select(static_cast<int>(m_listener + 1), &readable, NULL, NULL, &timeout) <= 0)
+            {
+                continue;
+            }
+
+            const socket_t s = accept(m_listener, NULL, NULL);
+            if (NO_SOCKET == s)
+            {
+                continue;
+            }
+            int on = 1;
+            setsockopt(s, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char *>(&on), sizeof(on));
+#ifdef SO_NOSIGPIPE
+            setsockopt(s, SOL_SOCKET, SO_NOSIGPIPE, reinterpret_cast<const char *>(&on), sizeof(on));
+#endif
+
+            boost::lock_guard<boost::mutex> lock(m_mutex);
+            connection_ptr connection = boost::make_shared<Connection>(boost::ref(*this), s,
+                                        ++m_next_connection_id, m_latency, m_bandwidth);
+            m_connections.push_back(connection);
+            connection->Start();
+        }
+    }
+
+    // Forgets connections whose threads have finished
+    void ReapConnections()
+    {
+        for (std::vector<connection_ptr>::iterator it = m_connections.begin(); it != m_connections.end();)
+        {
+            if ((*it)->Finished())
+            {
+                (*it)->Join();
+                it = m_connections.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+
+    // Frames are built in the connection's pending buffer, and sent by
+    // FlushDirty once the frame being handled has been
+    std::string &Out(Connection &c)
+    {
+        m_dirty.insert(&c);
+        return c.pending;
+    }
+
+    void FlushDirty()
+    {
+        for (std::set<Connection *>::iterator it = m_dirty.begin(); it != m_dirty.end(); ++it)
+        {
+            if (!(*it)->pending.empty())
+            {
+                (*it)->Send((*it)->pending);
+                (*it)->pending.clear();
+            }
+        }
+        m_dirty.clear();
+    }
+
+    void AppendMethod(Connection &c, amqp_channel_t channel, amqp_method_number_t method, void *decoded)
+    {
+        std::string &out = Out(c);
+        const std::size_t start = out.size();
+        AppendUint8(out, AMQP_FRAME_METHOD);
+        AppendUint16(out, channel);
+        AppendUint32(out, 0);
+        AppendUint32(out, method);
+
+        amqp_bytes_t buffer;
+        buffer.len = c.encode_buffer.size();
+        buffer.bytes = &c.encode_buffer[0];
+        const int length = amqp_encode_method(method, decoded, buffer);
+        if (length < 0)
+        {
+            throw std::runtime_error(std::string("LoopbackBroker: could not encode ") + amqp_method_name(method));
+        }
+        out.append(&c.encode_buffer[0], length);
+        PatchUint32(out, start + 3, static_cast<boost::uint32_t>(out.size() - start - 7));
+        AppendUint8(out, AMQP_FRAME_END);
+    }
+
+    void AppendContent(Connection &c, amqp_channel_t channel, const Message &message)
+    {
+        std::string &out = Out(c);
+        AppendUint8(out, AMQP_FRAME_HEADER);
+        AppendUint16(out, channel);
+        AppendUint32(out, static_cast<boost::uint32_t>(12 + message.properties.size()));
+        AppendUint16(out, AMQP_BASIC_CLASS);
+        AppendUint16(out, 0);
+        AppendUint64(out, message.body.size());
+        out += message.properties;
+        AppendUint8(out, AMQP_FRAME_END);
+
+        const std::size_t max_payload = c.frame_max - FRAME_OVERHEAD;
+        for (std::size_t offset = 0; offset < message.body.size(); offset += max_payload)
+        {
+            const std::size_t length = std::min(max_payload, message.body.size() - offset);
+            AppendUint8(out, AMQP_FRAME_BODY);
+            AppendUint16(out, channel);
+            AppendUint32(out, static_cast<boost::uint32_t>(length));
+            out.append(message.body, offset, length);
+            AppendUint8(out, AMQP_FRAME_END);
+        }
+    }
+
+    bool HandleConnectionMethod(Connection &c, boost::uint8_t type, amqp_method_number_t method, void *decoded)
+    {
+        if (AMQP_FRAME_METHOD != type)
+        {
+            throw ConnectionError(AMQP_COMMAND_INVALID, "content frame on channel 0");
+        }
+
+        switch (method)
+        {
+        case AMQP_CONNECTION_START_OK_METHOD:
+        {
+            // Any credentials will do
+            amqp_connection_tune_t tune;
+            tune.channel_max = CHANNEL_MAX;
+            tune.frame_max = FRAME_MAX;
+            tune.heartbeat = m_heartbeat;
+            AppendMethod(c, 0, AMQP_CONNECTION_TUNE_METHOD, &tune);
+            return true;
+        }
+        case AMQP_CONNECTION_TUNE_OK_METHOD:
+        {
+            amqp_connection_tune_ok_t *tune_ok = static_cast<amqp_connection_tune_ok_t *>(decoded);
+            if (0 != tune_ok->frame_max)
+            {
+                c.frame_max = std::min(tune_ok->frame_max, FRAME_MAX);
+            }
+            c.SetHeartbeat(tune_ok->heartbeat);
+            return true;
+        }
+        case AMQP_CONNECTION_OPEN_METHOD:
+        {
+            amqp_connection_open_ok_t open_ok;
+            open_ok.known_hosts = amqp_empty_bytes;
+            AppendMethod(c, 0, AMQP_CONNECTION_OPEN_OK_METHOD, &open_ok);
+            return true;
+        }
+        case AMQP_CONNECTION_CLOSE_METHOD:
+        {
+            CleanUpConnection(c);
+            amqp_connection_close_ok_t close_ok;
+            AppendMethod(c, 0, AMQP_CONNECTION_CLOSE_OK_METHOD, &close_ok);
+            c.CloseAfterSending();
+            return false;
+        }
+        default:
+            throw ConnectionError(AMQP_NOT_IMPLEMENTED, std::string(amqp_method_name(method)) + " is not supported");
+        }
+    }
+
+    void CloseConnection(Connection &c, boost::uint16_t code, const std::string &text, amqp_method_number_t method)
+    {
+        CleanUpConnection(c);
+        c.closing = true;
+        amqp_connection_close_t close;
+        close.reply_code = code;
+        close.reply_text = Bytes(text);
+        close.class_id = static_cast<boost::uint16_t>(method >> 16);
+        close.method_id = static_cast<boost::uint16_t>(method & 0xffff);
+        AppendMethod(c, 0, AMQP_CONNECTION_CLOSE_METHOD, &close);
+    }
+
+    void HandleChannelFrame(Connection &c, boost::uint8_t type, amqp_channel_t channel,
+                            amqp_method_number_t method, void *decoded, const std::string &payload)
+    {
+        std::map<amqp_channel_t, ChannelState>::iterator it = c.channels.find(channel);
+        if (AMQP_CHANNEL_OPEN_METHOD == method)
+        {
+            if (it != c.channels.end() || channel > CHANNEL_MAX)
+            {
+                throw ConnectionError(AMQP_CHANNEL_ERROR, "channel " + boost::lexical_cast<std::string>(channel) +
+                                      " cannot be opened");
+            }
+            c.channels[channel];
+            amqp_channel_open_ok_t open_ok;
+            open_ok.channel_id = amqp_empty_bytes;
+            AppendMethod(c, channel, AMQP_CHANNEL_OPEN_OK_METHOD, &open_ok);
+            return;
+        }
+        if (it == c.channels.end())
+        {
+            throw ConnectionError(AMQP_CHANNEL_ERROR, "channel " + boost::lexical_cast<std::string>(channel) +
+                                  " is not open");
+        }
+
+        ChannelState &state = it->second;
+        if (state.closing)
+        {
+            // Everything but the reply to channel.close is ignored, or the
+            // client closing the channel at the same time
+            if (AMQP_CHANNEL_CLOSE_OK_METHOD == method)
+            {
+                c.channels.erase(it);
+            }
+            else if (AMQP_CHANNEL_CLOSE_METHOD == method)
+            {
+                amqp_channel_close_ok_t close_ok;
+                AppendMethod(c, channel, AMQP_CHANNEL_CLOSE_OK_METHOD, &close_ok);
+            }
+            return;
+        }
+
+        try
+        {
+            switch (type)
+            {
+            case AMQP_FRAME_METHOD:
+                if (state.publishing)
+                {
+                    throw ConnectionError(AMQP_UNEXPECTED_FRAME, "expected the content of a published message");
+                }
+                HandleChannelMethod(c, channel, state, method, decoded);
+                break;
+            case AMQP_FRAME_HEADER:
+                HandleContentHeader(c, channel, state, payload);
+                break;
+            case AMQP_FRAME_BODY:
+                HandleContentBody(c, channel, state, payload);
+                break;
+            default:
+                throw ConnectionError(AMQP_FRAME_ERROR, "unknown frame type");
+            }
+        }
+        catch (ChannelError &e)
+        {
+            CleanUpChannel(state);
+            state.closing = true;
+            amqp_channel_close_t close;
+            close.reply_code = e.code;
+            close.reply_text = Bytes(e.what());
+            close.class_id = static_cast<boost::uint16_t>(method >> 16);
+            close.method_id = static_cast<boost::uint16_t>(method & 0xffff);
+            AppendMethod(c, channel, AMQP_CHANNEL_CLOSE_METHOD, &close);
+        }
+    }
+
+    void HandleChannelMethod(Connection &c, amqp_channel_t channel, ChannelState &state,
+                             amqp_method_number_t method, void *decoded)
+    {
+        switch (method)
+        {
+        case AMQP_CHANNEL_CLOSE_METHOD:
+        {
+            CleanUpChannel(state);
+            c.channels.erase(channel);
+            amqp_channel_close_ok_t close_ok;
+            AppendMethod(c, channel, AMQP_CHANNEL_CLOSE_OK_METHOD, &close_ok);
+            return;
+        }
+        case AMQP_CONFIRM_SELECT_METHOD:
+        {
+            state.confirm = true;
+            if (!static_cast<amqp_confirm_select_t *>(decoded)->nowait)
+            {
+                amqp_confirm_select_ok_t select_ok;
+                AppendMethod(c, channel, AMQP_CONFIRM_SELECT_OK_METHOD, &select_ok);
+            }
+            return;
+        }
+        case AMQP_EXCHANGE_DECLARE_METHOD:
+            DeclareExchange(c, channel, *static_cast<amqp_exchange_declare_t *>(decoded));
+            return;
+        case AMQP_EXCHANGE_DELETE_METHOD:
+            DeleteExchange(c, channel, *static_cast<amqp_exchange_delete_t *>(decoded));
+            return;
+        case AMQP_QUEUE_DECLARE_METHOD:
+            DeclareQueue(c, channel, *static_cast<amqp_queue_declare_t *>(decoded));
+            return;
+        case AMQP_QUEUE_BIND_METHOD:
+        {
+            amqp_queue_bind_t *bind = static_cast<amqp_queue_bind_t *>(decoded);
+            Bind(c, ToString(bind->queue), ToString(bind->exchange), ToString(bind->routing_key), true);
+            if (!bind->nowait)
+            {
+                amqp_queue_bind_ok_t bind_ok;
+                AppendMethod(c, channel, AMQP_QUEUE_BIND_OK_METHOD, &bind_ok);
+            }
+            return;
+        }
+        case AMQP_QUEUE_UNBIND_METHOD:
+        {
+            amqp_queue_unbind_t *unbind = static_cast<amqp_queue_unbind_t *>(decoded);
+            Bind(c, ToString(unbind->queue), ToString(unbind->exchange), ToString(unbind->routing_key), false);
+            amqp_queue_unbind_ok_t unbind_ok;
+            AppendMethod(c, channel, AMQP_QUEUE_UNBIND_OK_METHOD, &unbind_ok);
+            return;
+        }
+        case AMQP_QUEUE_PURGE_METHOD:
+        {
+            amqp_queue_purge_t *purge = static_cast<amqp_queue_purge_t *>(decoded);
+            Queue &queue = FindQueue(c, ToString(purge->queue));
+            amqp_queue_purge_ok_t purge_ok;
+            purge_ok.message_count = static_cast<boost::uint32_t>(queue.messages.size());
+            queue.messages.clear();
+            if (!purge->nowait)
+            {
+                AppendMethod(c, channel, AMQP_QUEUE_PURGE_OK_METHOD, &purge_ok);
+            }
+            return;
+        }
+        case AMQP_QUEUE_DELETE_METHOD:
+        {
+            amqp_queue_delete_t *del = static_cast<amqp_queue_delete_t *>(decoded);
+            const std::string name = ToString(del->queue);
+            Queue &queue = FindQueue(c, name);
+            if (del->if_unused && !queue.consumers.empty())
+            {
+                throw ChannelError(AMQP_PRECONDITION_FAILED, "queue '" + name + "' in use");
+            }
+            if (del->if_empty && !queue.messages.empty())
+            {
+                throw ChannelError(AMQP_PRECONDITION_FAILED, "queue '" + name + "' not empty");
+            }
+            amqp_queue_delete_ok_t delete_ok;
+            delete_ok.message_count = static_cast<boost::uint32_t>(DeleteQueue(name));
+            if (!del->nowait)
+            {
+                AppendMethod(c, channel, AMQP_QUEUE_DELETE_OK_METHOD, &delete_ok);
+            }
+            return;
+        }
+        case AMQP_BASIC_QOS_METHOD:
+        {
+            // Channel sets a channel wide limit, with one consumer per
+            // channel, so applying it to each consumer is close enough
+            state.prefetch = static_cast<amqp_basic_qos_t *>(decoded)->prefetch_count;
+            for (std::map<std::string, consumer_ptr>::iterator it = state.consumers.begin();
+                    it != state.consumers.end(); ++it)
+            {
+                it->second->prefetch = state.prefetch;
+                Dispatch(it->second->queue);
+            }
+            amqp_basic_qos_ok_t qos_ok;
+            AppendMethod(c, channel, AMQP_BASIC_QOS_OK_METHOD, &qos_ok);
+            return;
+        }
+        case AMQP_BASIC_CONSUME_METHOD:
+            Consume(c, channel, state, *static_cast<amqp_basic_consume_t *>(decoded));
+            return;
+        case AMQP_BASIC_CANCEL_METHOD:
+        {
+            amqp_basic_cancel_t *cancel = static_cast<amqp_basic_cancel_t *>(decoded);
+            const std::string tag = ToString(cancel->consumer_tag);
+            std::map<std::string, consumer_ptr>::iterator it = state.consumers.find(tag);
+            if (it != state.consumers.end())
+            {
+                consumer_ptr consumer = it->second;
+                state.consumers.erase(it);
+                RemoveConsumer(consumer);
+            }
+            if (!cancel->nowait)
+            {
+                amqp_basic_cancel_ok_t cancel_ok;
+                cancel_ok.consumer_tag = Bytes(tag);
+                AppendMethod(c, channel, AMQP_BASIC_CANCEL_OK_METHOD, &cancel_ok);
+            }
+            return;
+        }
+        case AMQP_BASIC_PUBLISH_METHOD:
+        {
+            amqp_basic_publish_t *publish = static_cast<amqp_basic_publish_t *>(decoded);
+            const std::string exchange = ToString(publish->exchange);
+            if (!exchange.empty() && m_exchanges.end() == m_exchanges.find(exchange))
+            {
+                throw ChannelError(AMQP_NOT_FOUND, "no exchange '" + exchange + "'");
+            }
+            state.publishing = true;
+            state.have_header = false;
+            state.mandatory = 0 != publish->mandatory;
+            state.message = boost::make_shared<Message>();
+            state.message->exchange = exchange;
+            state.message->routing_key = ToString(publish->routing_key);
+            return;
+        }
+        case AMQP_BASIC_GET_METHOD:
+            Get(c, channel, state, *static_cast<amqp_basic_get_t *>(decoded));
+            return;
+        case AMQP_BASIC_ACK_METHOD:
+        {
+            amqp_basic_ack_t *ack = static_cast<amqp_basic_ack_t *>(decoded);
+            Settle(state, ack->delivery_tag, 0 != ack->multiple, false);
+            return;
+        }
+        case AMQP_BASIC_NACK_METHOD:
+        {
+            amqp_basic_nack_t *nack = static_cast<amqp_basic_nack_t *>(decoded);
+            Settle(state, nack->delivery_tag, 0 != nack->multiple, 0 != nack->requeue);
+            return;
+        }
+        case AMQP_BASIC_REJECT_METHOD:
+        {
+            amqp_basic_reject_t *reject = static_cast<amqp_basic_reject_t *>(decoded);
+            Settle(state, reject->delivery_tag, false, 0 != reject->requeue);
+            return;
+        }
+        case AMQP_BASIC_RECOVER_METHOD:
+        {
+            Settle(state, 0, true, true);
+            amqp_basic_recover_ok_t recover_ok;
+            AppendMethod(c, channel, AMQP_BASIC_RECOVER_OK_METHOD, &recover_ok);
+            return;
+        }
+        default:
+            throw ChannelError(AMQP_NOT_IMPLEMENTED, std::string(amqp_method_name(method)) + " is not supported");
+        }
+    }
+
+    void DeclareExchange(Connection &c, amqp_channel_t channel, const amqp_exchange_declare_t &declare)
+    {
+        const std::string name = ToString(declare.exchange);
+        const std::string type = ToString(declare.type);
+        exchanges_t::iterator it = m_exchanges.find(name);
+        if (declare.passive)
+        {
+            if (it == m_exchanges.end())
+            {
+                throw ChannelError(AMQP_NOT_FOUND, "no exchange '" + name + "'");
+            }
+        }
+        else if (it == m_exchanges.end())
+        {
+            if (name.empty() || 0 == name.compare(0, 4, "amq."))
+            {
+                throw ChannelError(AMQP_ACCESS_REFUSED, "exchange name '" + name + "' is reserved");
+            }
+            if ("direct" != type && "fanout" != type && "topic" != type)
+            {
+                throw ChannelError(AMQP_NOT_IMPLEMENTED, "exchange type '" + type + "' is not supported");
+            }
+            Exchange &exchange = m_exchanges[name];
+            exchange.type = type;
+            exchange.durable = 0 != declare.durable;
+            exchange.auto_delete = 0 != declare.auto_delete;
+        }
+        else if (it->second.type != type || it->second.durable != (0 != declare.durable) ||
+                 it->second.auto_delete != (0 != declare.auto_delete))
+        {
+            throw ChannelError(AMQP_PRECONDITION_FAILED, "exchange '" + name + "' exists with other properties");
+        }
+
+        if (!declare.nowait)
+        {
+            amqp_exchange_declare_ok_t declare_ok;
+            AppendMethod(c, channel, AMQP_EXCHANGE_DECLARE_OK_METHOD, &declare_ok);
+        }
+    }
+
+    void DeleteExchange(Connection &c, amqp_channel_t channel, const amqp_exchange_delete_t &del)
+    {
+        const std::string name = ToString(del.exchange);
+        exchanges_t::iterator it = m_exchanges.find(name);
+        if (it == m_exchanges.end())
+        {
+            throw ChannelError(AMQP_NOT_FOUND, "no exchange '" + name + "'");
+        }
+        if (0 == name.compare(0, 4, "amq."))
+        {
+            throw ChannelError(AMQP_ACCESS_REFUSED, "exchange '" + name + "' cannot be deleted");
+        }
+        if (del.if_unused && !it->second.bindings.empty())
+        {
+            throw ChannelError(AMQP_PRECONDITION_FAILED, "exchange '" + name + "' in use");
+        }
+        m_exchanges.erase(it);
+
+        if (!del.nowait)
+        {
+            amqp_exchange_delete_ok_t delete_ok;
+            AppendMethod(c, channel, AMQP_EXCHANGE_DELETE_OK_METHOD, &delete_ok);
+        }
+    }
+
+    void DeclareQueue(Connection &c, amqp_channel_t channel, const amqp_queue_declare_t &declare)
+    {
+        std::string name = ToString(declare.queue);
+        if (name.empty() && !declare.passive)
+        {
+            name = "amq.gen-" + boost::lexical_cast<std::string>(++m_next_name);
+        }
+        else if (!declare.passive && 0 == name.compare(0, 4, "amq.") && m_queues.end() == m_queues.find(name))
+        {
+            throw ChannelError(AMQP_ACCESS_REFUSED, "queue name '" + name + "' is reserved");
+        }
+
+        queues_t::iterator it = m_queues.find(name);
+        if (declare.passive)
+        {
+            FindQueue(c, name);
+        }
+        else if (it == m_queues.end())
+        {
+            Queue &queue = m_queues[name];
+            queue.owner = declare.exclusive ? c.id : 0;
+            queue.durable = 0 != declare.durable;
+            queue.auto_delete = 0 != declare.auto_delete;
+        }
+        else
+        {
+            Queue &queue = FindQueue(c, name);
+            if (queue.durable != (0 != declare.durable) || (0 != queue.owner) != (0 != declare.exclusive) ||
+                    queue.auto_delete != (0 != declare.auto_delete))
+            {
+                throw ChannelError(AMQP_PRECONDITION_FAILED, "queue '" + name + "' exists with other properties");
+            }
+        }
+
+        if (!declare.nowait)
+        {
+            const Queue &queue = m_queues[name];
+            amqp_queue_declare_ok_t declare_ok;
+            declare_ok.queue = Bytes(name);
+            declare_ok.message_count = static_cast<boost::uint32_t>(queue.messages.size());
+            declare_ok.consumer_count = static_cast<boost::uint32_t>(queue.consumers.size());
+            AppendMethod(c, channel, AMQP_QUEUE_DECLARE_OK_METHOD, &declare_ok);
+        }
+    }
+
+    Queue &FindQueue(const Connection &c, const std::string &name)
+    {
+        queues_t::iterator it = m_queues.find(name);
+        if (it == m_queues.end())
+        {
+            throw ChannelError(AMQP_NOT_FOUND, "no queue '" + name + "'");
+        }
+        if (0 != it->second.owner && c.id != it->second.owner)
+        {
+            throw ChannelError(AMQP_RESOURCE_LOCKED, "queue '" + name + "' is exclusive to another connection");
+        }
+        return it->second;
+    }
+
+    void Bind(const Connection &c, const std::string &queue, const std::string &exchange,
+              const std::string &routing_key, bool bind)
+    {
+        FindQueue(c, queue);
+        if (exchange.empty())
+        {
+            throw ChannelError(AMQP_ACCESS_REFUSED, "the default exchange cannot be bound to");
+        }
+        exchanges_t::iterator it = m_exchanges.find(exchange);
+        if (it == m_exchanges.end())
+        {
+            throw ChannelError(AMQP_NOT_FOUND, "no exchange '" + exchange + "'");
+        }
+
+        Binding binding;
+        binding.queue = queue;
+        binding.key = routing_key;
+        std::vector<Binding> &bindings = it->second.bindings;
+        std::vector<Binding>::iterator existing = std::find(bindings.begin(), bindings.end(), binding);
+        if (bind && existing == bindings.end())
+        {
+            bindings.push_back(binding);
+        }
+        else if (!bind)
+        {
+            if (existing == bindings.end())
+            {
+                throw ChannelError(AMQP_NOT_FOUND, "no binding '" + routing_key + "' from '" + exchange +
+                                   "' to '" + queue + "'");
+            }
+            bindings.erase(existing);
+        }
+    }
+
+    // Deletes a queue, cancelling its consumers, returns the number of
+    // messages that were in it
+    std::size_t DeleteQueue(const std::string &name)
+    {
+        queues_t::iterator it = m_queues.find(name);
+        if (it == m_queues.end())
+        {
+            return 0;
+        }
+
+        for (exchanges_t::iterator ex = m_exchanges.begin(); ex != m_exchanges.end(); ++ex)
+        {
+            std::vector<Binding> &bindings = ex->second.bindings;
+            for (std::vector<Binding>::iterator b = bindings.begin(); b != bindings.end();)
+            {
+                b = name == b->queue ? bindings.erase(b) : b + 1;
+            }
+        }
+
+        // The client asked to be told about consumers cancelled by the broker
+        for (std::vector<consumer_ptr>::iterator con = it->second.consumers.begin();
+                con != it->second.consumers.end(); ++con)
+        {
+            Connection &c = *(*con)->connection;
+            std::map<amqp_channel_t, ChannelState>::iterator state = c.channels.find((*con)->channel);
+            if (state != c.channels.end() && !state->second.closing)
+            {
+                state->second.consumers.erase((*con)->tag);
+                amqp_basic_cancel_t cancel;
+                cancel.consumer_tag = Bytes((*con)->tag);
+                cancel.nowait = 1;
+                AppendMethod(c, (*con)->channel, AMQP_BASIC_CANCEL_METHOD, &cancel);
+            }
+        }
+
+        const std::size_t messages = it->second.messages.size();
+        m_queues.erase(it);
+        return messages;
+    }
+
+    void Consume(Connection &c, amqp_channel_t channel, ChannelState &state, const amqp_basic_consume_t &consume)
+    {
+        const std::string queue_name = ToString(consume.queue);
+        Queue &queue = FindQueue(c, queue_name);
+        if (!queue.consumers.empty() && (consume.exclusive || queue.consumers.front()->exclusive))
+        {
+            throw ChannelError(AMQP_ACCESS_REFUSED, "queue '" + queue_name + "' has an exclusive consumer");
+        }
+
+        std::string tag = ToString(consume.consumer_tag);
+        if (tag.empty())
+        {
+            tag = "amq.ctag-" + boost::lexical_cast<std::string>(++m_next_name);
+        }
+        if (state.consumers.end() != state.consumers.find(tag))
+        {
+            throw ChannelError(AMQP_NOT_ALLOWED, "consumer tag '" + tag + "' is in use");
+        }
+
+        consumer_ptr consumer = boost::make_shared<Consumer>();
+        consumer->connection = &c;
+        consumer->channel = channel;
+        consumer->tag = tag;
+        consumer->queue = queue_name;
+        consumer->no_ack = 0 != consume.no_ack;
+        consumer->exclusive = 0 != consume.exclusive;
+        consumer->prefetch = state.prefetch;
+        consumer->unacked = 0;
+        state.consumers[tag] = consumer;
+        queue.consumers.push_back(consumer);
+
+        if (!consume.nowait)
+        {
+            amqp_basic_consume_ok_t consume_ok;
+            consume_ok.consumer_tag = Bytes(tag);
+            AppendMethod(c, channel, AMQP_BASIC_CONSUME_OK_METHOD, &consume_ok);
+        }
+        Dispatch(queue_name);
+    }
+
+    void RemoveConsumer(const consumer_ptr &consumer)
+    {
+        queues_t::iterator it = m_queues.find(consumer->queue);
+        if (it == m_queues.end())
+        {
+            return;
+        }
+        std::vector<consumer_ptr> &consumers = it->second.consumers;
+        consumers.erase(std::remove(consumers.begin(), consumers.end(), consumer), consumers.end());
+        it->second.next_consumer = 0;
+        if (consumers.empty() && it->second.auto_delete)
+        {
+            DeleteQueue(consumer->queue);
+        }
+    }
+
+    void HandleContentHeader(Connection &c, amqp_channel_t channel, ChannelState &state, const std::string &payload)
+    {
+        if (!state.publishing || state.have_header)
+        {
+            throw ConnectionError(AMQP_UNEXPECTED_FRAME, "unexpected content header");
+        }
+        if (payload.size() < 14 || AMQP_BASIC_CLASS != ReadUint16(payload.data()))
+        {
+            throw ConnectionError(AMQP_FRAME_ERROR, "malformed content header");
+        }
+        state.have_header = true;
+        state.body_size = ReadUint64(payload.data() + 4);
+        state.message->properties.assign(payload, 12, std::string::npos);
+        state.message->body.reserve(static_cast<std::size_t>(state.body_size));
+        if (0 == state.body_size)
+        {
+            CompletePublish(c, channel, state);
+        }
+    }
+
+    void HandleContentBody(Connection &c, amqp_channel_t channel, ChannelState &state, const std::string &payload)
+    {
+        if (!state.publishing || !state.have_header)
+        {
+            throw ConnectionError(AMQP_UNEXPECTED_FRAME, "unexpected content body");
+        }
+        state.message->body += payload;
+        if (state.message->body.size() > state.body_size)
+        {
+            throw ConnectionError(AMQP_FRAME_ERROR, "content body longer than its header said");
+        }
+        if (state.message->body.size() == state.body_size)
+        {
+            CompletePublish(c, channel, state);
+        }
+    }
+
+    void CompletePublish(Connection &c, amqp_channel_t channel, ChannelState &state)
+    {
+        message_ptr message;
+        message.swap(state.message);
+        state.publishing = false;
+
+        const std::set<std::string> queues = Route(*message);
+        if (queues.empty() && state.mandatory)
+        {
+            amqp_basic_return_t ret;
+            ret.reply_code = AMQP_NO_ROUTE;
+            ret.reply_text = amqp_cstring_bytes("NO_ROUTE");
+            ret.exchange = Bytes(message->exchange);
+            ret.routing_key = Bytes(message->routing_key);
+            AppendMethod(c, channel, AMQP_BASIC_RETURN_METHOD, &ret);
+            AppendContent(c, channel, *message);
+        }
+        for (std::set<std::string>::const_iterator it = queues.begin(); it != queues.end(); ++it)
+        {
+            m_queues[*it].messages.push_back(QueuedMessage(message, false));
+        }
+        if (state.confirm)
+        {
+            amqp_basic_ack_t ack;
+            ack.delivery_tag = state.next_publish++;
+            ack.multiple = 0;
+            AppendMethod(c, channel, AMQP_BASIC_ACK_METHOD, &ack);
+        }
+        for (std::set<std::string>::const_iterator it = queues.begin(); it != queues.end(); ++it)
+        {
+            Dispatch(*it);
+        }
+    }
+
+    std::set<std::string> Route(const Message &message)
+    {
+        std::set<std::string> queues;
+        if (message.exchange.empty())
+        {
+            if (m_queues.end() != m_queues.find(message.routing_key))
+            {
+                queues.insert(message.routing_key);
+            }
+            return queues;
+        }
+
+        const Exchange &exchange = m_exchanges[message.exchange];
+        for (std::vector<Binding>::const_iterator it = exchange.bindings.begin(); it != exchange.bindings.end(); ++it)
+        {
+            if ("fanout" == exchange.type ||
+                    ("direct" == exchange.type && it->key == message.routing_key) ||
+                    ("topic" == exchange.type && TopicMatches(it->key, message.routing_key)))
+            {
+                queues.insert(it->queue);
+            }
+        }
+        return queues;
+    }
+
+    void Get(Connection &c, amqp_channel_t channel, ChannelState &state, const amqp_basic_get_t &get)
+    {
+        const std::string name = ToString(get.queue);
+        Queue &queue = FindQueue(c, name);
+        if (queue.messages.empty())
+        {
+            amqp_basic_get_empty_t get_empty;
+            get_empty.cluster_id = amqp_empty_bytes;
+            AppendMethod(c, channel, AMQP_BASIC_GET_EMPTY_METHOD, &get_empty);
+            return;
+        }
+
+        const QueuedMessage next = queue.messages.front();
+        queue.messages.pop_front();
+        amqp_basic_get_ok_t get_ok;
+        get_ok.delivery_tag = state.next_delivery++;
+        get_ok.redelivered = next.redelivered;
+        get_ok.exchange = Bytes(next.message->exchange);
+        get_ok.routing_key = Bytes(next.message->routing_key);
+        get_ok.message_count = static_cast<boost::uint32_t>(queue.messages.size());
+        if (!get.no_ack)
+        {
+            Unacked &unacked = state.unacked[get_ok.delivery_tag];
+            unacked.message = next.message;
+            unacked.queue = name;
+        }
+        AppendMethod(c, channel, AMQP_BASIC_GET_OK_METHOD, &get_ok);
+        AppendContent(c, channel, *next.message);
+    }
+
+    // Delivers messages from a queue to its consumers, as far as their
+    // prefetch limits allow
+    void Dispatch(const std::string &name)
+    {
+        queues_t::iterator it = m_queues.find(name);
+        if (it == m_queues.end())
+        {
+            return;
+        }
+        Queue &queue = it->second;
+        while (!queue.messages.empty() && !queue.consumers.empty())
+        {
+            consumer_ptr consumer;
+            const std::size_t count = queue.consumers.size();
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                const std::size_t index = (queue.next_consumer + i) % count;
+                const consumer_ptr &candidate = queue.consumers[index];
+                if (candidate->no_ack || 0 == candidate->prefetch || candidate->unacked < candidate->prefetch)
+                {
+                    consumer = candidate;
+                    queue.next_consumer = (index + 1) % count;
+                    break;
+                }
+            }
+            if (!consumer)
+            {
+                return;
+            }
+
+            const QueuedMessage next = queue.messages.front();
+            queue.messages.pop_front();
+
+            Connection &c = *consumer->connection;
+            ChannelState &state = c.channels[consumer->channel];
+            amqp_basic_deliver_t deliver;
+            deliver.consumer_tag = Bytes(consumer->tag);
+            deliver.delivery_tag = state.next_delivery++;
+            deliver.redelivered = next.redelivered;
+            deliver.exchange = Bytes(next.message->exchange);
+            deliver.routing_key = Bytes(next.message->routing_key);
+            if (!consumer->no_ack)
+            {
+                Unacked &unacked = state.unacked[deliver.delivery_tag];
+                unacked.message = next.message;
+                unacked.queue = name;
+                unacked.consumer = consumer;
+                ++consumer->unacked;
+            }
+            AppendMethod(c, consumer->channel, AMQP_BASIC_DELIVER_METHOD, &deliver);
+            AppendContent(c, consumer->channel, *next.message);
+        }
+    }
+
+    // Acknowledges, or rejects and possibly requeues, one delivery or with
+    // multiple every delivery up to and including delivery_tag, all of
+    // them if it is 0
+    void Settle(ChannelState &state, boost::uint64_t delivery_tag, bool multiple, bool requeue)
+    {
+        typedef std::map<boost::uint64_t, Unacked>::iterator unacked_iterator;
+        unacked_iterator begin = state.unacked.begin();
+        unacked_iterator end = state.unacked.end();
+        if (multiple)
+        {
+            if (0 != delivery_tag)
+            {
+                end = state.unacked.upper_bound(delivery_tag);
+            }
+        }
+        else
+        {
+            begin = state.unacked.find(delivery_tag);
+            if (begin == state.unacked.end())
+            {
+                throw ChannelError(AMQP_PRECONDITION_FAILED, "unknown delivery tag " +
+                                   boost::lexical_cast<std::string>(delivery_tag));
+            }
+            end = begin;
+            ++end;
+        }
+
+        // Requeued messages go back to the head of their queues in the order
+        // they were delivered
+        std::vector<unacked_iterator> settled;
+        for (unacked_iterator it = begin; it != end; ++it)
+        {
+            settled.push_back(it);
+        }
+        std::set<std::string> to_dispatch;
+        for (std::vector<unacked_iterator>::reverse_iterator it = settled.rbegin(); it != settled.rend(); ++it)
+        {
+            const Unacked &unacked = (*it)->second;
+            if (unacked.consumer)
+            {
+                --unacked.consumer->unacked;
+                to_dispatch.insert(unacked.consumer->queue);
+            }
+            queues_t::iterator queue = m_queues.find(unacked.queue);
+            if (requeue && queue != m_queues.end())
+            {
+                queue->second.messages.push_front(QueuedMessage(unacked.message, true));
+                to_dispatch.insert(unacked.queue);
+            }
+        }
+        state.unacked.erase(begin, end);
+
+        for (std::set<std::string>::const_iterator it = to_dispatch.begin(); it != to_dispatch.end(); ++it)
+        {
+            Dispatch(*it);
+        }
+    }
+
+    // Requeues a channel's unacknowledged messages and cancels its consumers
+    void CleanUpChannel(ChannelState &state)
+    {
+        std::map<std::string, consumer_ptr> consumers;
+        consumers.swap(state.consumers);
+        for (std::map<std::string, consumer_ptr>::iterator it = consumers.begin(); it != consumers.end(); ++it)
+        {
+            RemoveConsumer(it->second);
+        }
+        Settle(state, 0, true, true);
+        state.publishing = false;
+        state.message.reset();
+    }
+
+    void CleanUpConnection(Connection &c)
+    {
+        if (c.cleaned_up)
+        {
+            return;
+        }
+        c.cleaned_up = true;
+
+        for (std::map<amqp_channel_t, ChannelState>::iterator it = c.channels.begin(); it != c.channels.end(); ++it)
+        {
+            CleanUpChannel(it->second);
+        }
+        c.channels.clear();
+
+        std::vector<std::string> exclusive;
+        for (queues_t::iterator it = m_queues.begin(); it != m_queues.end(); ++it)
+        {
+            if (c.id == it->second.owner)
+            {
+                exclusive.push_back(it->first);
+            }
+        }
+        for (std::vector<std::string>::iterator it = exclusive.begin(); it != exclusive.end(); ++it)
+        {
+            DeleteQueue(*it);
+        }
+    }
+
+    const boost::uint32_t m_latency;
+    const boost::uint64_t m_bandwidth;
+    const boost::uint16_t m_heartbeat;
+    socket_t m_listener;
+    int m_port;
+    boost::thread m_acceptor;
+
+    // Guards everything below, and the protocol state of every connection
+    boost::mutex m_mutex;
+    bool m_stopping;
+    std::vector<connection_ptr> m_connections;
+    std::set<Connection *> m_dirty;
+    boost::uint64_t m_next_connection_id;
+    // Counter for generated queue names and consumer tags
+    boost::uint64_t m_next_name;
+    exchanges_t m_exchanges;
+    queues_t m_queues;
+    boost::uint64_t m_heartbeats_received;
+};
+
+namespace
+{
+
+void Connection::ReadLoop()
+{
+    char header[8];
+    if (ReceiveAll(m_socket, header, sizeof(header)))
+    {
+        if (0 == std::memcmp(header, "AMQP\0\0\x09\x01", sizeof(header)))
+        {
+            m_broker.Greet(*this);
+
+            clock::time_point next_read = clock::now();
+            std::string payload;
+            for (;;)
+            {
+                // Drop a client that has sent nothing, not even a heartbeat,
+                // for two heartbeat intervals, as RabbitMQ does
+                const boost::uint16_t heartbeat = Heartbeat();
+                if (0 != heartbeat && !WaitReadable(m_socket, boost::chrono::milliseconds(heartbeat * 2000)))
+                {
+                    break;
+                }
+                char frame_header[7];
+                if (!ReceiveAll(m_socket, frame_header, sizeof(frame_header)))
+                {
+                    break;
+                }
+                const boost::uint8_t type = static_cast<boost::uint8_t>(frame_header[0]);
+                const amqp_channel_t channel = ReadUint16(frame_header + 1);
+                const boost::uint32_t size = ReadUint32(frame_header + 3);
+                if (size > MAX_FRAME_SIZE)
+                {
+                    break;
+                }
+                payload.resize(size + 1);
+                if (!ReceiveAll(m_socket, &payload[0], size + 1) ||
+                        AMQP_FRAME_END != static_cast<unsigned char>(payload[size]))
+                {
+                    break;
+                }
+                payload.resize(size);
+                Throttle(next_read, size + FRAME_OVERHEAD);
+                if (!m_broker.HandleFrame(*this, type, channel, payload))
+                {
+                    break;
+                }
+            }
+        }
+        else
+        {
+            // Tell the client which protocol is spoken here
+            std::string supported("AMQP\0\0\x09\x01", 8);
+            Send(supported);
+        }
+    }
+
+    m_broker.Disconnected(*this);
+    CloseAfterSending();
+    boost::lock_guard<boost::mutex> lock(m_out_mutex);
+    m_reader_done = true;
+}
+
+void Connection::WriteLoop()
+{
+    static const char HEARTBEAT[] = { AMQP_FRAME_HEARTBEAT, 0, 0, 0, 0, 0, 0, static_cast<char>(AMQP_FRAME_END) };
+
+    clock::time_point last_sent = clock::now();
+    clock::time_point next_write = clock::now();
+    boost::unique_lock<boost::mutex> lock(m_out_mutex);
+    while (!m_shutdown)
+    {
+        const clock::time_point now = clock::now();
+        std::string frames;
+        if (m_out.empty())
+        {
+            if (m_close_after_sending)
+            {
+                break;
+            }
+            if (0 == m_heartbeat)
+            {
+                m_out_ready.wait(lock);
+                continue;
+            }
+            // Send heartbeats twice as often as the interval, as RabbitMQ does
+            const clock::time_point heartbeat_due = last_sent + boost::chrono::milliseconds(m_heartbeat * 500);
+            if (now < heartbeat_due)
+            {
+                m_out_ready.wait_until(lock, heartbeat_due);
+                continue;
+            }
+            frames.assign(HEARTBEAT, sizeof(HEARTBEAT));
+        }
+        else if (now < m_out.front().due)
+        {
+            m_out_ready.wait_until(lock, m_out.front().due);
+            continue;
+        }
+        else
+        {
+            // Send everything that is due in one go
+            frames.swap(m_out.front().frames);
+            m_out.pop_front();
+            while (!m_out.empty() && m_out.front().due <= now)
+            {
+                frames += m_out.front().frames;
+                m_out.pop_front();
+            }
+        }
+
+        lock.unlock();
+        Throttle(next_write, frames.size());
+        const bool sent = SendAll(m_socket, frames.data(), frames.size());
+        lock.lock();
+        if (!sent)
+        {
+            break;
+        }
+        last_sent = clock::now();
+    }
+
+    m_writer_done = true;
+    lock.unlock();
+    shutdown(m_socket, SHUTDOWN_BOTH);
+}
+
+// Waits long enough to keep the bytes moved under the bandwidth limit
+void Connection::Throttle(clock::time_point &next, std::size_t bytes)
+{
+    if (0 == m_bandwidth)
+    {
+        return;
+    }
+    const clock::time_point now = clock::now();
+    if (next < now)
+    {
+        next = now;
+    }
+    boost::this_thread::sleep_until(next);
+    next += boost::chrono::nanoseconds(static_cast<boost::int64_t>(bytes * 1000000000.0 / m_bandwidth));
+}
+
+} // namespace
+
+LoopbackBroker::LoopbackBroker(boost::uint32_t latency, boost::uint64_t bandwidth, boost::uint16_t heartbeat) :
+    m_impl(new LoopbackBrokerImpl(latency, bandwidth, heartbeat))
+{
+}
+
+LoopbackBroker::~LoopbackBroker()
+{
+}
+
+int LoopbackBroker::Port() const
+{
+    return m_impl->Port();
+}
+
+boost::uint64_t LoopbackBroker::HeartbeatsReceived() const
+{
+    return m_impl->HeartbeatsReceived();
+}
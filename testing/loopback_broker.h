@@ -0,0 +1,106 @@
+/* vim:set ft=cpp ts=4 sw=4 sts=4 et cindent: */
+#ifndef LOOPBACK_BROKER_H
+#define LOOPBACK_BROKER_H
+/*
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MIT
+ *
+ * Copyright (c) 2010-2013 Alan Antonuk
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include <string>
+
+class LoopbackBrokerImpl;
+
+/**
+ * A minimal AMQP 0-9-1 broker that runs inside the process
+ *
+ * Listens on an ephemeral port on 127.0.0.1, so tests and benchmarks can run
+ * without a RabbitMQ server and without a network between client and broker.
+ * It supports what Channel needs for the common paths: connection and channel
+ * open and close, confirm.select, direct, fanout and topic exchanges, queue
+ * declare, bind, unbind, purge and delete, basic.publish including mandatory
+ * returns, basic.consume and basic.cancel, basic.get, basic.ack, basic.nack,
+ * basic.reject, basic.recover, basic.qos as a per consumer prefetch limit, and
+ * heartbeats, dropping a client that sends nothing for two heartbeat
+ * intervals. Anything else, such as exchange to exchange bindings, headers
+ * exchanges, direct reply-to, message TTLs or transactions, closes the
+ * channel with NOT_IMPLEMENTED. Nothing is persisted and any user name,
+ * password and vhost are accepted.
+ *
+ * To make timing-sensitive measurements repeatable a fixed latency can be
+ * added to every frame the broker sends, which adds it to the round trip of
+ * every synchronous operation, and the bytes sent in each direction on a
+ * connection can be limited to a given rate.
+ */
+class LoopbackBroker : boost::noncopyable
+{
+public:
+    /**
+     * Starts the broker
+     *
+     * @param latency [in] microseconds added to the round trip time of each
+     * connection
+     * @param bandwidth [in] the most bytes per second sent in each direction
+     * on a connection, 0 for no limit
+     * @param heartbeat [in] the heartbeat interval in seconds to offer
+     * clients, 0 to offer none
+     * @throws std::runtime_error if the broker could not listen
+     */
+    explicit LoopbackBroker(boost::uint32_t latency = 0,
+                            boost::uint64_t bandwidth = 0,
+                            boost::uint16_t heartbeat = 60);
+
+    /**
+     * Stops the broker, dropping every connection
+     */
+    ~LoopbackBroker();
+
+    /**
+     * Gets the host to connect to
+     */
+    std::string Host() const
+    {
+        return "127.0.0.1";
+    }
+
+    /**
+     * Gets the port to connect to
+     */
+    int Port() const;
+
+    /**
+     * Gets the number of heartbeat frames received from clients
+     */
+    boost::uint64_t HeartbeatsReceived() const;
+
+private:
+    boost::scoped_ptr<LoopbackBrokerImpl> m_impl;
+};
+
+#endif // LOOPBACK_BROKER_H
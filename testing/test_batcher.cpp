@@ -0,0 +1,126 @@
+/* vim:set ft=cpp ts=4 sw=4 sts=4 et cindent: */
+/*
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MIT
+ *
+ * Copyright (c) 2010-2013 Alan Antonuk
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "connected_test.h"
+
+using namespace AmqpClient;
+
+TEST(batch_reader, unbatched_message)
+{
+    BasicMessage::ptr_t message = BasicMessage::Create("Message Body");
+    EXPECT_FALSE(BatchReader::IsBatch(message));
+
+    BatchReader::ptr_t reader = BatchReader::Create(message);
+    EXPECT_EQ(1u, reader->Count());
+    boost::string_ref body;
+    ASSERT_TRUE(reader->Next(body));
+    EXPECT_EQ("Message Body", body);
+    EXPECT_FALSE(reader->Next(body));
+}
+
+TEST(batch_reader, invalid_batch)
+{
+    Table headers;
+    headers.insert(TableEntry(Batcher::BATCH_HEADER, static_cast<boost::int64_t>(2)));
+
+    // The second message is shorter than its length says
+    BasicMessage::ptr_t truncated = BasicMessage::Create(std::string("\x02" "ab" "\x05" "cd", 5));
+    truncated->HeaderTable(headers);
+    ASSERT_TRUE(BatchReader::IsBatch(truncated));
+    EXPECT_THROW(BatchReader::Create(truncated), std::runtime_error);
+
+    BasicMessage::ptr_t trailing = BasicMessage::Create(std::string("\x01" "a" "\x01" "b" "c", 5));
+    trailing->HeaderTable(headers);
+    EXPECT_THROW(BatchReader::Create(trailing), std::runtime_error);
+}
+
+TEST_F(connected_test, batch_round_trip)
+{
+    std::string queue = channel->DeclareQueue("");
+    Batcher::ptr_t batcher = Batcher::Create(channel, "", queue, 64 * 1024, 3, 60000);
+    BasicMessage::ptr_t properties = BasicMessage::Create();
+    properties->ContentType("text/plain");
+    batcher->SetProperties(properties);
+
+    // Long enough to need more than one byte for its length
+    const std::string long_body(300, 'x');
+    batcher->Add("first");
+    batcher->Add("");
+    EXPECT_EQ(2u, batcher->PendingMessages());
+    EXPECT_LT(0, batcher->MillisecondsUntilDue());
+    batcher->Add(long_body);
+    EXPECT_EQ(0u, batcher->PendingMessages());
+    EXPECT_EQ(-1, batcher->MillisecondsUntilDue());
+
+    Envelope::ptr_t envelope;
+    ASSERT_TRUE(channel->BasicGet(envelope, queue));
+    EXPECT_EQ("text/plain", envelope->Message()->ContentType());
+    EXPECT_TRUE(BatchReader::IsBatch(envelope->Message()));
+
+    BatchReader::ptr_t reader = BatchReader::Create(envelope);
+    EXPECT_EQ(3u, reader->Count());
+    boost::string_ref body;
+    ASSERT_TRUE(reader->Next(body));
+    EXPECT_EQ("first", body);
+    ASSERT_TRUE(reader->Next(body));
+    EXPECT_TRUE(body.empty());
+    ASSERT_TRUE(reader->Next(body));
+    EXPECT_EQ(long_body, body);
+    EXPECT_FALSE(reader->Next(body));
+}
+
+TEST_F(connected_test, batch_flush)
+{
+    std::string queue = channel->DeclareQueue("");
+    Batcher::ptr_t batcher = Batcher::Create(channel, "", queue, 64 * 1024, 1024, 60000);
+
+    batcher->Add("first");
+    batcher->Add("second");
+    Envelope::ptr_t envelope;
+    EXPECT_FALSE(channel->BasicGet(envelope, queue));
+
+    batcher->Flush();
+    ASSERT_TRUE(channel->BasicGet(envelope, queue));
+    EXPECT_EQ(2u, BatchReader::Create(envelope)->Count());
+}
+
+TEST_F(connected_test, batch_max_bytes)
+{
+    std::string queue = channel->DeclareQueue("");
+    Batcher::ptr_t batcher = Batcher::Create(channel, "", queue, 16, 1024, 60000);
+
+    // The second body doesn't fit, so the first is published on its own
+    batcher->Add("0123456789");
+    batcher->Add("0123456789");
+    EXPECT_EQ(1u, batcher->PendingMessages());
+
+    Envelope::ptr_t envelope;
+    ASSERT_TRUE(channel->BasicGet(envelope, queue));
+    EXPECT_EQ(1u, BatchReader::Create(envelope)->Count());
+}
@@ -0,0 +1,140 @@
+/* vim:set ft=cpp ts=4 sw=4 sts=4 et cindent: */
+/*
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MIT
+ *
+ * Copyright (c) 2010-2013 Alan Antonuk
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "connected_test.h"
+
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
+using namespace AmqpClient;
+
+TEST(pooled_body_allocator, recycles_similar_sizes)
+{
+    PooledBodyAllocator::ptr_t allocator = PooledBodyAllocator::Create();
+
+    void *first = allocator->Allocate(1000);
+    allocator->Deallocate(first, 1000);
+
+    // 1000 and 1010 fall in the same size class
+    void *second = allocator->Allocate(1010);
+    EXPECT_EQ(first, second);
+    allocator->Deallocate(second, 1010);
+
+    PooledBodyAllocator::Stats stats = allocator->GetStats();
+    EXPECT_EQ(2u, stats.allocations);
+    EXPECT_EQ(1u, stats.hits);
+    EXPECT_DOUBLE_EQ(0.5, stats.HitRate());
+    EXPECT_LE(1010u, stats.cached_bytes);
+}
+
+TEST(pooled_body_allocator, oversize)
+{
+    PooledBodyAllocator::ptr_t allocator = PooledBodyAllocator::Create();
+
+    const std::size_t size = 4 * 1024 * 1024;
+    void *body = allocator->Allocate(size);
+    allocator->Deallocate(body, size);
+
+    PooledBodyAllocator::Stats stats = allocator->GetStats();
+    EXPECT_EQ(1u, stats.oversize);
+    EXPECT_EQ(0u, stats.cached_bytes);
+}
+
+TEST(pooled_body_allocator, cache_limit)
+{
+    PooledBodyAllocator::ptr_t allocator = PooledBodyAllocator::Create(4096);
+
+    void *bodies[8];
+    for (int i = 0; i < 8; ++i)
+    {
+        bodies[i] = allocator->Allocate(1024);
+    }
+    for (int i = 0; i < 8; ++i)
+    {
+        allocator->Deallocate(bodies[i], 1024);
+    }
+    EXPECT_EQ(4096u, allocator->GetStats().cached_bytes);
+    EXPECT_EQ(4u, allocator->GetStats().released);
+
+    allocator->SetCacheLimit(1024);
+    EXPECT_EQ(1024u, allocator->GetStats().cached_bytes);
+
+    allocator->Trim();
+    EXPECT_EQ(0u, allocator->GetStats().cached_bytes);
+}
+
+namespace
+{
+
+void AllocateAndFree(const PooledBodyAllocator::ptr_t &allocator)
+{
+    for (int i = 0; i < 10000; ++i)
+    {
+        const std::size_t size = 64 + (i % 64) * 100;
+        void *body = allocator->Allocate(size);
+        allocator->Deallocate(body, size);
+    }
+}
+
+} // namespace
+
+TEST(pooled_body_allocator, concurrent_use)
+{
+    PooledBodyAllocator::ptr_t allocator = PooledBodyAllocator::Create(64 * 1024);
+
+    boost::thread_group threads;
+    for (int i = 0; i < 4; ++i)
+    {
+        threads.create_thread(boost::bind(&AllocateAndFree, allocator));
+    }
+    threads.join_all();
+
+    PooledBodyAllocator::Stats stats = allocator->GetStats();
+    EXPECT_EQ(40000u, stats.allocations);
+    EXPECT_GE(64u * 1024, stats.cached_bytes);
+}
+
+TEST_F(connected_test, get_with_pooled_allocator)
+{
+    PooledBodyAllocator::ptr_t allocator = PooledBodyAllocator::Create();
+    channel->SetBodyAllocator(allocator);
+
+    std::string queue = channel->DeclareQueue("");
+    BasicMessage::ptr_t message = BasicMessage::Create("Message Body");
+    for (int i = 0; i < 2; ++i)
+    {
+        channel->BasicPublish("", queue, message);
+        Envelope::ptr_t envelope;
+        ASSERT_TRUE(channel->BasicGet(envelope, queue));
+        EXPECT_EQ(message->Body(), envelope->Message()->Body());
+    }
+
+    EXPECT_EQ(2u, allocator->GetStats().allocations);
+    EXPECT_EQ(1u, allocator->GetStats().hits);
+}
@@ -0,0 +1,163 @@
+/* vim:set ft=cpp ts=4 sw=4 sts=4 et cindent: */
+/*
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MIT
+ *
+ * Copyright (c) 2010-2013 Alan Antonuk
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "connected_test.h"
+
+using namespace AmqpClient;
+
+namespace
+{
+
+std::string CompressibleBody()
+{
+    std::string body;
+    for (int i = 0; i < 200; ++i)
+    {
+        body += "{\"key\": \"value\", \"number\": 12345}";
+    }
+    return body;
+}
+
+} // namespace
+
+TEST(deflate_body_codec, round_trip)
+{
+    DeflateBodyCodec::ptr_t codec = DeflateBodyCodec::Create();
+    EXPECT_EQ("deflate", codec->Name());
+
+    const std::string body = CompressibleBody();
+    std::string encoded;
+    codec->Encode(body.data(), body.size(), encoded);
+    EXPECT_GT(body.size(), encoded.size());
+
+    std::string decoded;
+    codec->Decode(encoded.data(), encoded.size(), decoded);
+    EXPECT_EQ(body, decoded);
+}
+
+TEST(deflate_body_codec, empty_body)
+{
+    DeflateBodyCodec::ptr_t codec = DeflateBodyCodec::Create(9);
+
+    std::string encoded;
+    codec->Encode("", 0, encoded);
+    std::string decoded("not empty");
+    codec->Decode(encoded.data(), encoded.size(), decoded);
+    EXPECT_TRUE(decoded.empty());
+}
+
+TEST(deflate_body_codec, invalid_body)
+{
+    DeflateBodyCodec::ptr_t codec = DeflateBodyCodec::Create();
+
+    const std::string body = CompressibleBody();
+    std::string encoded;
+    codec->Encode(body.data(), body.size(), encoded);
+
+    std::string decoded;
+    EXPECT_THROW(codec->Decode(encoded.data(), encoded.size() / 2, decoded), std::runtime_error);
+    EXPECT_THROW(codec->Decode("garbage", 7, decoded), std::runtime_error);
+}
+
+TEST(deflate_body_codec, max_decoded_size)
+{
+    // A megabyte of zeros compresses to about a kilobyte
+    const std::string body(1024 * 1024, '\0');
+    std::string encoded;
+    DeflateBodyCodec::Create()->Encode(body.data(), body.size(), encoded);
+    ASSERT_GT(4096u, encoded.size());
+
+    std::string decoded;
+    DeflateBodyCodec::ptr_t limited = DeflateBodyCodec::Create(-1, 64 * 1024);
+    EXPECT_EQ(64u * 1024, limited->MaxDecodedSize());
+    EXPECT_THROW(limited->Decode(encoded.data(), encoded.size(), decoded), std::runtime_error);
+
+    // A body of exactly the limit is fine
+    DeflateBodyCodec::ptr_t exact = DeflateBodyCodec::Create(-1, body.size());
+    exact->Decode(encoded.data(), encoded.size(), decoded);
+    EXPECT_EQ(body, decoded);
+}
+
+TEST_F(connected_test, publish_with_codec)
+{
+    channel->SetPublishCodec(DeflateBodyCodec::Create(), 1024);
+
+    std::string queue = channel->DeclareQueue("");
+    BasicMessage::ptr_t small_message = BasicMessage::Create("Message Body");
+    BasicMessage::ptr_t large_message = BasicMessage::Create(CompressibleBody());
+    channel->BasicPublish("", queue, small_message);
+    channel->BasicPublish("", queue, large_message);
+    EXPECT_FALSE(large_message->ContentEncodingIsSet());
+
+    // A channel without the codec sees the compressed body
+    Channel::ptr_t plain_channel = Channel::Create(GetBrokerHost());
+    Envelope::ptr_t envelope;
+    ASSERT_TRUE(plain_channel->BasicGet(envelope, queue));
+    EXPECT_EQ(small_message->Body(), envelope->Message()->Body());
+    EXPECT_FALSE(envelope->Message()->ContentEncodingIsSet());
+
+    ASSERT_TRUE(plain_channel->BasicGet(envelope, queue));
+    EXPECT_EQ("deflate", envelope->Message()->ContentEncoding());
+    EXPECT_GT(large_message->Body().size(), envelope->Message()->Body().size());
+
+    // A channel with the codec registered sees the original
+    channel->BasicPublish("", queue, large_message);
+    ASSERT_TRUE(channel->BasicGet(envelope, queue));
+    EXPECT_EQ(large_message->Body(), envelope->Message()->Body());
+    EXPECT_FALSE(envelope->Message()->ContentEncodingIsSet());
+}
+
+TEST_F(connected_test, get_undecodable_body)
+{
+    channel->RegisterBodyCodec(DeflateBodyCodec::Create());
+
+    std::string queue = channel->DeclareQueue("");
+    BasicMessage::ptr_t message = BasicMessage::Create("not compressed");
+    message->ContentEncoding("deflate");
+    channel->BasicPublish("", queue, message);
+
+    Envelope::ptr_t envelope;
+    ASSERT_TRUE(channel->BasicGet(envelope, queue));
+    EXPECT_EQ(message->Body(), envelope->Message()->Body());
+    EXPECT_EQ("deflate", envelope->Message()->ContentEncoding());
+}
+
+TEST_F(connected_test, get_body_over_max_decoded_size)
+{
+    channel->SetPublishCodec(DeflateBodyCodec::Create(), 1024);
+    std::string queue = channel->DeclareQueue("");
+    channel->BasicPublish("", queue, BasicMessage::Create(std::string(1024 * 1024, '\0')));
+
+    // Too large to decode, so delivered as it was sent
+    channel->RegisterBodyCodec(DeflateBodyCodec::Create(-1, 64 * 1024));
+    Envelope::ptr_t envelope;
+    ASSERT_TRUE(channel->BasicGet(envelope, queue));
+    EXPECT_EQ("deflate", envelope->Message()->ContentEncoding());
+    EXPECT_GT(4096u, envelope->Message()->Body().size());
+}
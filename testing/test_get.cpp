@@ -29,6 +29,10 @@
 
 #include "connected_test.h"
 
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+
 using namespace AmqpClient;
 
 TEST_F(connected_test, get_ok)
@@ -42,6 +46,51 @@ TEST_F(connected_test, get_ok)
     EXPECT_EQ(message->Body(), new_message->Message()->Body());
 }
 
+namespace
+{
+
+class CountingAllocator : public BodyAllocator
+{
+public:
+    CountingAllocator() : allocated(0), deallocated(0) {}
+
+    virtual void *Allocate(std::size_t size)
+    {
+        allocated += size;
+        return std::malloc(size);
+    }
+
+    virtual void Deallocate(void *body, std::size_t size)
+    {
+        deallocated += size;
+        std::free(body);
+    }
+
+    std::size_t allocated;
+    std::size_t deallocated;
+};
+
+} // namespace
+
+TEST_F(connected_test, get_with_body_allocator)
+{
+    boost::shared_ptr<CountingAllocator> allocator = boost::make_shared<CountingAllocator>();
+    channel->SetBodyAllocator(allocator);
+
+    BasicMessage::ptr_t message = BasicMessage::Create("Message Body");
+    std::string queue = channel->DeclareQueue("");
+    channel->BasicPublish("", queue, message, true);
+
+    Envelope::ptr_t new_message;
+    ASSERT_TRUE(channel->BasicGet(new_message, queue));
+    EXPECT_EQ(message->Body(), new_message->Message()->Body());
+    EXPECT_EQ(message->Body().length(), allocator->allocated);
+    EXPECT_EQ(0u, allocator->deallocated);
+
+    new_message.reset();
+    EXPECT_EQ(message->Body().length(), allocator->deallocated);
+}
+
 TEST_F(connected_test, get_empty)
 {
     BasicMessage::ptr_t message = BasicMessage::Create("Message Body");
@@ -82,3 +131,189 @@ TEST_F(connected_test, ack_message)
     channel->BasicAck(new_message);
     EXPECT_FALSE(channel->BasicGet(new_message, queue, false));
 }
+
+TEST_F(connected_test, get_spilled_to_file)
+{
+    channel->SetBodySpillThreshold(1024);
+
+    BasicMessage::ptr_t message = BasicMessage::Create(std::string(300000, 's'));
+    message->ContentType("application/octet-stream");
+    std::string queue = channel->DeclareQueue("");
+    channel->BasicPublish("", queue, message, true);
+
+    Envelope::ptr_t new_message;
+    ASSERT_TRUE(channel->BasicGet(new_message, queue));
+    EXPECT_EQ(message->Body(), new_message->Message()->Body());
+    EXPECT_EQ("application/octet-stream", new_message->Message()->ContentType());
+}
+
+TEST_F(connected_test, get_claim_check)
+{
+    channel->EnableClaimCheck(1024);
+
+    BasicMessage::ptr_t message = BasicMessage::Create(std::string(5000, 'c'));
+    Table headers;
+    headers.insert(TableEntry("key", "value"));
+    message->HeaderTable(headers);
+    std::string queue = channel->DeclareQueue("");
+    channel->BasicPublish("", queue, message, true);
+
+    // Without claim checks the message arrives as it was sent through the broker
+    channel->DisableClaimCheck();
+    Envelope::ptr_t claim_check;
+    ASSERT_TRUE(channel->BasicGet(claim_check, queue, false));
+    EXPECT_TRUE(claim_check->Message()->Body().empty());
+    EXPECT_TRUE(claim_check->Message()->HeaderTableView().IsSet(Channel::CLAIM_CHECK_HEADER));
+    channel->BasicReject(claim_check, true);
+
+    channel->EnableClaimCheck(1024);
+    Envelope::ptr_t new_message;
+    ASSERT_TRUE(channel->BasicGet(new_message, queue));
+    EXPECT_EQ(message->Body(), new_message->Message()->Body());
+    EXPECT_EQ(headers, new_message->Message()->HeaderTable());
+}
+
+TEST_F(connected_test, claim_check_ignores_other_files)
+{
+    // A file the publisher didn't write must not be mapped or removed
+    {
+        std::ofstream victim("claim_check_victim");
+        victim << "private";
+    }
+    channel->EnableClaimCheck(1024, ".");
+
+    BasicMessage::ptr_t message = BasicMessage::Create("");
+    Table headers;
+    headers.insert(TableEntry(Channel::CLAIM_CHECK_HEADER, "claim_check_victim"));
+    message->HeaderTable(headers);
+    std::string queue = channel->DeclareQueue("");
+    channel->BasicPublish("", queue, message, true);
+
+    Envelope::ptr_t received;
+    ASSERT_TRUE(channel->BasicGet(received, queue));
+    EXPECT_TRUE(received->Message()->Body().empty());
+    EXPECT_TRUE(received->Message()->HeaderTableView().IsSet(Channel::CLAIM_CHECK_HEADER));
+    EXPECT_TRUE(std::ifstream("claim_check_victim").good());
+    std::remove("claim_check_victim");
+}
+
+namespace
+{
+
+// Gets the name of the file the next claim check on queue names, leaving
+// the message on the queue
+std::string PeekClaimCheckFile(const Channel::ptr_t &channel, const std::string &queue)
+{
+    channel->DisableClaimCheck();
+    Envelope::ptr_t claim_check;
+    if (!channel->BasicGet(claim_check, queue, false))
+    {
+        ADD_FAILURE() << "no claim check on " << queue;
+        return std::string();
+    }
+    const std::string name = claim_check->Message()->HeaderTableView().GetString(Channel::CLAIM_CHECK_HEADER).to_string();
+    channel->BasicReject(claim_check, true);
+    channel->EnableClaimCheck(1024, ".");
+    return name;
+}
+
+} // namespace
+
+TEST_F(connected_test, claim_check_survives_requeue)
+{
+    channel->EnableClaimCheck(1024, ".");
+
+    BasicMessage::ptr_t message = BasicMessage::Create(std::string(5000, 'c'));
+    std::string queue = channel->DeclareQueue("");
+    channel->BasicPublish("", queue, message, true);
+    const std::string name = PeekClaimCheckFile(channel, queue);
+
+    Envelope::ptr_t first;
+    ASSERT_TRUE(channel->BasicGet(first, queue, false));
+    EXPECT_EQ(message->Body(), first->Message()->Body());
+    channel->BasicReject(first, true);
+    EXPECT_TRUE(std::ifstream(name.c_str()).good());
+
+    // The requeued message comes back with its body, the file goes once it
+    // has been acked
+    Envelope::ptr_t redelivered;
+    ASSERT_TRUE(channel->BasicGet(redelivered, queue, false));
+    EXPECT_TRUE(redelivered->Redelivered());
+    EXPECT_EQ(message->Body(), redelivered->Message()->Body());
+    EXPECT_TRUE(std::ifstream(name.c_str()).good());
+    channel->BasicAck(redelivered);
+    EXPECT_FALSE(std::ifstream(name.c_str()).good());
+    EXPECT_EQ(message->Body(), redelivered->Message()->Body());
+}
+
+TEST_F(connected_test, claim_check_settled_on_receipt_without_ack)
+{
+    channel->EnableClaimCheck(1024, ".");
+
+    BasicMessage::ptr_t message = BasicMessage::Create(std::string(5000, 'c'));
+    std::string queue = channel->DeclareQueue("");
+    channel->BasicPublish("", queue, message, true);
+    const std::string name = PeekClaimCheckFile(channel, queue);
+
+    Envelope::ptr_t received;
+    ASSERT_TRUE(channel->BasicGet(received, queue, true));
+    EXPECT_EQ(message->Body(), received->Message()->Body());
+    EXPECT_FALSE(std::ifstream(name.c_str()).good());
+}
+
+TEST_F(connected_test, claim_check_removed_on_reject)
+{
+    channel->EnableClaimCheck(1024, ".");
+
+    BasicMessage::ptr_t message = BasicMessage::Create(std::string(5000, 'c'));
+    std::string queue = channel->DeclareQueue("");
+    channel->BasicPublish("", queue, message, true);
+    const std::string name = PeekClaimCheckFile(channel, queue);
+
+    Envelope::ptr_t received;
+    ASSERT_TRUE(channel->BasicGet(received, queue, false));
+    EXPECT_TRUE(std::ifstream(name.c_str()).good());
+    channel->BasicReject(received, false);
+    EXPECT_FALSE(std::ifstream(name.c_str()).good());
+}
+
+TEST_F(connected_test, claim_check_kept_for_redelivery_after_channel_close)
+{
+    channel->EnableClaimCheck(1024, ".");
+
+    BasicMessage::ptr_t message = BasicMessage::Create(std::string(5000, 'c'));
+    std::string queue = channel->DeclareQueue("", false, false, false, false);
+    channel->BasicPublish("", queue, message, true);
+
+    {
+        Channel::ptr_t consumer_channel = Channel::Create(GetBrokerHost());
+        consumer_channel->EnableClaimCheck(1024, ".");
+        Envelope::ptr_t received;
+        ASSERT_TRUE(consumer_channel->BasicGet(received, queue, false));
+        EXPECT_EQ(message->Body(), received->Message()->Body());
+        // Gone without acking
+    }
+
+    Envelope::ptr_t redelivered;
+    ASSERT_TRUE(channel->BasicGet(redelivered, queue));
+    EXPECT_TRUE(redelivered->Redelivered());
+    EXPECT_EQ(message->Body(), redelivered->Message()->Body());
+    channel->DeleteQueue(queue);
+}
+
+TEST_F(connected_test, claim_check_sweep)
+{
+    channel->EnableClaimCheck(1024, ".");
+
+    BasicMessage::ptr_t message = BasicMessage::Create(std::string(5000, 'c'));
+    std::string queue = channel->DeclareQueue("");
+    channel->BasicPublish("", queue, message, true);
+    const std::string name = PeekClaimCheckFile(channel, queue);
+
+    // Nothing will claim the file of a purged message
+    channel->PurgeQueue(queue);
+    channel->SweepClaimChecks(3600);
+    EXPECT_TRUE(std::ifstream(name.c_str()).good());
+    EXPECT_LE(1u, channel->SweepClaimChecks(0));
+    EXPECT_FALSE(std::ifstream(name.c_str()).good());
+}
@@ -0,0 +1,134 @@
+/* vim:set ft=cpp ts=4 sw=4 sts=4 et cindent: */
+/*
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MIT
+ *
+ * Copyright (c) 2010-2013 Alan Antonuk
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "loopback_broker.h"
+
+#include <SimpleAmqpClient/SimpleAmqpClient.h>
+#include <gtest/gtest.h>
+
+using namespace AmqpClient;
+
+TEST(test_latency_histogram, empty)
+{
+    LatencyHistogram histogram;
+    EXPECT_EQ(0u, histogram.Count());
+    EXPECT_EQ(0u, histogram.Min());
+    EXPECT_EQ(0u, histogram.Max());
+    EXPECT_EQ(0.0, histogram.Mean());
+    EXPECT_EQ(0u, histogram.Percentile(99));
+}
+
+TEST(test_latency_histogram, percentiles)
+{
+    LatencyHistogram histogram;
+    for (boost::uint64_t i = 1; i <= 100000; ++i)
+    {
+        histogram.Record(i * 1000);
+    }
+
+    EXPECT_EQ(100000u, histogram.Count());
+    EXPECT_EQ(1000u, histogram.Min());
+    EXPECT_EQ(100000000u, histogram.Max());
+    EXPECT_DOUBLE_EQ(50000500.0, histogram.Mean());
+    // Within a bucket's width, 1/64 of the value
+    EXPECT_NEAR(50000000.0, static_cast<double>(histogram.Percentile(50)), 50000000.0 / 64);
+    EXPECT_NEAR(99000000.0, static_cast<double>(histogram.Percentile(99)), 99000000.0 / 64);
+    EXPECT_EQ(100000000u, histogram.Percentile(100));
+}
+
+TEST(test_latency_histogram, small_values_exact)
+{
+    LatencyHistogram histogram;
+    for (boost::uint64_t i = 0; i < 100; ++i)
+    {
+        histogram.Record(i);
+    }
+    EXPECT_EQ(49u, histogram.Percentile(50));
+    EXPECT_EQ(89u, histogram.Percentile(90));
+}
+
+TEST(test_latency_histogram, merge_and_reset)
+{
+    LatencyHistogram a;
+    LatencyHistogram b;
+    a.Record(10);
+    b.Record(1000000);
+    b.Record(2000000);
+
+    a.Merge(b);
+    EXPECT_EQ(3u, a.Count());
+    EXPECT_EQ(10u, a.Min());
+    EXPECT_EQ(2000000u, a.Max());
+
+    a.Reset();
+    EXPECT_EQ(0u, a.Count());
+    EXPECT_EQ(0u, a.Percentile(50));
+    EXPECT_EQ(2u, b.Count());
+}
+
+TEST(test_latency_histogram, channel_stats_off_by_default)
+{
+    LoopbackBroker broker;
+    Channel::ptr_t channel = Channel::Create(broker.Host(), broker.Port());
+    std::string queue = channel->DeclareQueue("");
+    channel->BasicPublish("", queue, BasicMessage::Create("message"));
+
+    Channel::Stats stats = channel->GetStats();
+    EXPECT_EQ(0u, stats.rpc.Count());
+    EXPECT_EQ(0u, stats.publish_confirm.Count());
+}
+
+TEST(test_latency_histogram, channel_stats)
+{
+    // Every round trip to the broker takes at least 2ms
+    LoopbackBroker broker(2000);
+    Channel::ptr_t channel = Channel::Create(broker.Host(), broker.Port());
+    channel->EnableStats();
+
+    std::string queue = channel->DeclareQueue("");
+    std::string consumer = channel->BasicConsume(queue, "", true, false);
+    channel->BasicPublish("", queue, BasicMessage::Create("message"));
+    Envelope::ptr_t envelope;
+    ASSERT_TRUE(channel->BasicConsumeMessage(consumer, envelope, 1000));
+    channel->BasicAck(envelope);
+
+    Channel::Stats stats = channel->GetStats();
+    EXPECT_LE(2u, stats.rpc.Count());
+    EXPECT_LE(2000000u, stats.rpc.Min());
+    EXPECT_EQ(1u, stats.publish_confirm.Count());
+    EXPECT_LE(2000000u, stats.publish_confirm.Min());
+    EXPECT_EQ(1u, stats.consume_wait.Count());
+    EXPECT_EQ(1u, stats.read_content.Count());
+    EXPECT_EQ(1u, stats.ack.Count());
+
+    // The snapshot is unaffected by what the channel does next
+    channel->ResetStats();
+    EXPECT_EQ(0u, channel->GetStats().ack.Count());
+    EXPECT_EQ(1u, stats.ack.Count());
+}
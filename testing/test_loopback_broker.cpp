@@ -0,0 +1,221 @@
+/* vim:set ft=cpp ts=4 sw=4 sts=4 et cindent: */
+/*
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MIT
+ *
+ * Copyright (c) 2010-2013 Alan Antonuk
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include <amqp.h>
+#include <amqp_tcp_socket.h>
+
+#include "loopback_broker.h"
+
+#include <SimpleAmqpClient/SimpleAmqpClient.h>
+#include <gtest/gtest.h>
+
+#include <boost/chrono.hpp>
+#include <boost/thread/thread.hpp>
+
+using namespace AmqpClient;
+
+class loopback_test : public ::testing::Test
+{
+public:
+    virtual void SetUp()
+    {
+        channel = Channel::Create(broker.Host(), broker.Port());
+    }
+
+    LoopbackBroker broker;
+    Channel::ptr_t channel;
+};
+
+TEST_F(loopback_test, publish_get)
+{
+    BasicMessage::ptr_t message = BasicMessage::Create("Message Body");
+    message->ContentType("text/plain");
+    std::string queue = channel->DeclareQueue("");
+    channel->BasicPublish("", queue, message, true);
+
+    Envelope::ptr_t envelope;
+    ASSERT_TRUE(channel->BasicGet(envelope, queue));
+    EXPECT_EQ(message->Body(), envelope->Message()->Body());
+    EXPECT_EQ("text/plain", envelope->Message()->ContentType());
+    EXPECT_FALSE(channel->BasicGet(envelope, queue));
+}
+
+TEST_F(loopback_test, publish_consume_large_message)
+{
+    // Larger than a frame, so split into several body frames both ways
+    BasicMessage::ptr_t message = BasicMessage::Create(std::string(300000, 'a'));
+    std::string queue = channel->DeclareQueue("");
+    std::string consumer = channel->BasicConsume(queue, "");
+    channel->BasicPublish("", queue, message);
+
+    Envelope::ptr_t envelope;
+    ASSERT_TRUE(channel->BasicConsumeMessage(consumer, envelope, 1000));
+    EXPECT_EQ(message->Body(), envelope->Message()->Body());
+}
+
+TEST_F(loopback_test, reject_requeue)
+{
+    std::string queue = channel->DeclareQueue("");
+    std::string consumer = channel->BasicConsume(queue, "", true, false);
+    channel->BasicPublish("", queue, BasicMessage::Create("message"));
+
+    Envelope::ptr_t envelope;
+    ASSERT_TRUE(channel->BasicConsumeMessage(consumer, envelope, 1000));
+    EXPECT_FALSE(envelope->Redelivered());
+    channel->BasicReject(envelope, true);
+
+    ASSERT_TRUE(channel->BasicConsumeMessage(consumer, envelope, 1000));
+    EXPECT_TRUE(envelope->Redelivered());
+    channel->BasicAck(envelope);
+    EXPECT_FALSE(channel->BasicConsumeMessage(consumer, envelope, 100));
+}
+
+TEST_F(loopback_test, qos_limits_unacked)
+{
+    std::string queue = channel->DeclareQueue("");
+    std::string consumer = channel->BasicConsume(queue, "", true, false, true, 1);
+    channel->BasicPublish("", queue, BasicMessage::Create("one"));
+    channel->BasicPublish("", queue, BasicMessage::Create("two"));
+
+    Envelope::ptr_t first;
+    ASSERT_TRUE(channel->BasicConsumeMessage(consumer, first, 1000));
+    Envelope::ptr_t second;
+    EXPECT_FALSE(channel->BasicConsumeMessage(consumer, second, 100));
+
+    channel->BasicAck(first);
+    ASSERT_TRUE(channel->BasicConsumeMessage(consumer, second, 1000));
+    EXPECT_EQ("two", second->Message()->Body());
+}
+
+TEST_F(loopback_test, exchange_routing)
+{
+    channel->DeclareExchange("loopback_topic", Channel::EXCHANGE_TYPE_TOPIC);
+    channel->DeclareExchange("loopback_fanout", Channel::EXCHANGE_TYPE_FANOUT);
+    std::string topic_queue = channel->DeclareQueue("");
+    std::string fanout_queue = channel->DeclareQueue("");
+    std::string direct_queue = channel->DeclareQueue("");
+    channel->BindQueue(topic_queue, "loopback_topic", "a.*.c");
+    channel->BindQueue(topic_queue, "loopback_topic", "x.#");
+    channel->BindQueue(fanout_queue, "loopback_fanout", "ignored");
+    channel->BindQueue(direct_queue, "amq.direct", "key");
+
+    BasicMessage::ptr_t message = BasicMessage::Create("routed");
+    channel->BasicPublish("loopback_topic", "a.b.c", message);
+    channel->BasicPublish("loopback_topic", "x", message);
+    channel->BasicPublish("loopback_topic", "a.b.d", message);
+    channel->BasicPublish("loopback_fanout", "anything", message);
+    channel->BasicPublish("amq.direct", "key", message);
+    channel->BasicPublish("amq.direct", "other", message);
+
+    Envelope::ptr_t envelope;
+    EXPECT_TRUE(channel->BasicGet(envelope, topic_queue));
+    EXPECT_EQ("a.b.c", envelope->RoutingKey());
+    EXPECT_TRUE(channel->BasicGet(envelope, topic_queue));
+    EXPECT_EQ("x", envelope->RoutingKey());
+    EXPECT_FALSE(channel->BasicGet(envelope, topic_queue));
+    EXPECT_TRUE(channel->BasicGet(envelope, fanout_queue));
+    EXPECT_FALSE(channel->BasicGet(envelope, fanout_queue));
+    EXPECT_TRUE(channel->BasicGet(envelope, direct_queue));
+    EXPECT_FALSE(channel->BasicGet(envelope, direct_queue));
+
+    channel->UnbindQueue(direct_queue, "amq.direct", "key");
+    EXPECT_THROW(channel->BasicPublish("amq.direct", "key", message, true), MessageReturnedException);
+}
+
+TEST_F(loopback_test, channel_errors)
+{
+    EXPECT_THROW(channel->DeclareQueue("loopback_notexist", true), NotFoundException);
+    EXPECT_THROW(channel->DeclareExchange("loopback_notexist", Channel::EXCHANGE_TYPE_DIRECT, true),
+                 NotFoundException);
+    EXPECT_THROW(channel->BasicPublish("loopback_notexist", "key", BasicMessage::Create("message")),
+                 ChannelException);
+
+    // The channel recovers from each error
+    std::string queue = channel->DeclareQueue("");
+    EXPECT_EQ(queue, channel->DeclareQueue(queue, true));
+}
+
+TEST_F(loopback_test, exclusive_queue_is_private)
+{
+    std::string queue = channel->DeclareQueue("");
+    Channel::ptr_t other = Channel::Create(broker.Host(), broker.Port());
+    EXPECT_THROW(other->DeclareQueue(queue, true), ResourceLockedException);
+}
+
+TEST(test_loopback_broker, latency_is_added)
+{
+    LoopbackBroker broker(20000);
+    Channel::ptr_t channel = Channel::Create(broker.Host(), broker.Port());
+
+    boost::chrono::steady_clock::time_point start = boost::chrono::steady_clock::now();
+    channel->DeclareQueue("");
+    boost::chrono::steady_clock::duration elapsed = boost::chrono::steady_clock::now() - start;
+    EXPECT_GE(elapsed, boost::chrono::milliseconds(20));
+}
+
+TEST(test_loopback_broker, heartbeats_keep_idle_connection_open)
+{
+    LoopbackBroker broker(0, 0, 1);
+    Channel::ptr_t channel = Channel::Create(broker.Host(), broker.Port());
+    std::string queue = channel->DeclareQueue("");
+    std::string consumer = channel->BasicConsume(queue, "");
+
+    // Idle for longer than the two intervals the broker waits, the
+    // connection stays open because the client sent heartbeats meanwhile
+    Envelope::ptr_t envelope;
+    EXPECT_FALSE(channel->BasicConsumeMessage(consumer, envelope, 3000));
+    EXPECT_LT(0u, broker.HeartbeatsReceived());
+    channel->BasicPublish("", queue, BasicMessage::Create("message"));
+    EXPECT_TRUE(channel->BasicConsumeMessage(consumer, envelope, 1000));
+}
+
+TEST(test_loopback_broker, silent_client_is_dropped)
+{
+    LoopbackBroker broker(0, 0, 1);
+    amqp_connection_state_t connection = amqp_new_connection();
+    amqp_socket_t *socket = amqp_tcp_socket_new(connection);
+    ASSERT_EQ(AMQP_STATUS_OK, amqp_socket_open(socket, broker.Host().c_str(), broker.Port()));
+    amqp_rpc_reply_t login = amqp_login(connection, "/", 0, 131072, 1, AMQP_SASL_METHOD_PLAIN, "guest", "guest");
+    ASSERT_EQ(AMQP_RESPONSE_NORMAL, login.reply_type);
+
+    // Nothing is sent, and so no heartbeats, for over two intervals
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(3000));
+    EXPECT_EQ(0u, broker.HeartbeatsReceived());
+
+    // Heartbeats the broker sent beforehand are skipped, then the
+    // connection is found to be closed
+    amqp_frame_t frame;
+    timeval timeout;
+    timeout.tv_sec = 1;
+    timeout.tv_usec = 0;
+    const int status = amqp_simple_wait_frame_noblock(connection, &frame, &timeout);
+    EXPECT_NE(AMQP_STATUS_OK, status);
+    EXPECT_NE(AMQP_STATUS_TIMEOUT, status);
+    amqp_destroy_connection(connection);
+}
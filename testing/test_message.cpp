@@ -34,6 +34,8 @@
 #include <boost/array.hpp>
 
 #include <algorithm>
+#include <cstdio>
+#include <fstream>
 #include <iostream>
 
 using namespace AmqpClient;
@@ -132,6 +134,132 @@ TEST(basic_message, embedded_nulls)
     EXPECT_TRUE(std::equal(message_data2.begin(), message_data2.end(), reinterpret_cast<char *>(amqp_body2.bytes)));
 }
 
+TEST(basic_message, property_views)
+{
+    BasicMessage::ptr_t message = BasicMessage::Create("Message Body");
+    message->ContentType("text/plain");
+    message->CorrelationId("correlation");
+    message->ReplyTo("reply");
+
+    EXPECT_EQ("Message Body", message->BodyView());
+    EXPECT_EQ(message->getAmqpBody().bytes, message->BodyView().data());
+    EXPECT_EQ("text/plain", message->ContentTypeView());
+    EXPECT_EQ("correlation", message->CorrelationIdView());
+    EXPECT_EQ("reply", message->ReplyToView());
+    EXPECT_TRUE(message->MessageIdView().empty());
+    EXPECT_TRUE(BasicMessage::Create()->BodyView().empty());
+}
+
+TEST(basic_message, shared_body)
+{
+    boost::shared_ptr<const std::string> body =
+        boost::make_shared<std::string>("Shared body");
+
+    BasicMessage::ptr_t message = BasicMessage::Create();
+    message->Body(body);
+    EXPECT_EQ(*body, message->Body());
+    EXPECT_EQ(body->data(), message->getAmqpBody().bytes);
+
+    message.reset();
+    EXPECT_TRUE(body.unique());
+}
+
+TEST(basic_message, clone)
+{
+    Table headers;
+    headers.insert(TableEntry("key", "value"));
+
+    BasicMessage::ptr_t message = BasicMessage::Create("Message Body");
+    message->ContentType("text/plain");
+    message->CorrelationId("original");
+    message->HeaderTable(headers);
+
+    BasicMessage::ptr_t clone = message->Clone();
+    EXPECT_EQ(message->getAmqpBody().bytes, clone->getAmqpBody().bytes);
+    EXPECT_EQ("text/plain", clone->ContentType());
+    EXPECT_EQ("original", clone->CorrelationId());
+    EXPECT_EQ(headers, clone->HeaderTable());
+
+    clone->CorrelationId("clone");
+    clone->Body("Clone Body");
+    EXPECT_EQ("original", message->CorrelationId());
+    EXPECT_EQ("Message Body", message->Body());
+    EXPECT_EQ("Clone Body", clone->Body());
+
+    message.reset();
+    EXPECT_EQ(headers, clone->HeaderTable());
+    EXPECT_EQ("text/plain", clone->ContentType());
+}
+
+TEST(basic_message, body_segments)
+{
+    const std::string header("header:");
+    boost::shared_ptr<const std::string> payload =
+        boost::make_shared<std::string>("payload");
+
+    std::vector<BodySegment> segments;
+    segments.push_back(BodySegment(header.data(), header.length()));
+    segments.push_back(BodySegment(payload));
+    segments.push_back(BodySegment(":trailer", 8));
+
+    BasicMessage::ptr_t message = BasicMessage::Create();
+    message->BodySegments(segments);
+    EXPECT_EQ(3u, message->getBodySegments().size());
+    EXPECT_EQ(payload->data(), message->getBodySegments()[1].Data());
+    EXPECT_EQ("header:payload:trailer", message->Body());
+
+    const amqp_bytes_t &amqp_body = message->getAmqpBody();
+    EXPECT_EQ("header:payload:trailer",
+              std::string(reinterpret_cast<char *>(amqp_body.bytes), amqp_body.len));
+
+    message->Body("replaced");
+    EXPECT_TRUE(message->getBodySegments().empty());
+    EXPECT_EQ("replaced", message->Body());
+}
+
+TEST(basic_message, create_from_file)
+{
+    const char *path = "test_message_create_from_file.tmp";
+    {
+        std::ofstream file(path, std::ios::binary);
+        file << std::string(5000, 'h') << "Message Body";
+    }
+
+    BasicMessage::ptr_t whole = BasicMessage::CreateFromFile(path);
+    EXPECT_EQ(5012u, whole->getAmqpBody().len);
+
+    // The offset doesn't have to be page aligned
+    BasicMessage::ptr_t part = BasicMessage::CreateFromFile(path, 5000, 7);
+    EXPECT_EQ("Message", part->Body());
+
+    EXPECT_THROW(BasicMessage::CreateFromFile(path, 5000, 100), std::runtime_error);
+    whole.reset();
+    part.reset();
+    std::remove(path);
+    EXPECT_THROW(BasicMessage::CreateFromFile(path), std::runtime_error);
+}
+
+TEST_F(connected_test, publish_body_segments)
+{
+    const std::string queue = channel->DeclareQueue("");
+
+    const std::string header("header:");
+    const std::string payload(5000, 'p');
+    std::vector<BodySegment> segments;
+    segments.push_back(BodySegment(header.data(), header.length()));
+    segments.push_back(BodySegment(payload.data(), payload.length()));
+
+    BasicMessage::ptr_t out_message = BasicMessage::Create();
+    out_message->BodySegments(segments);
+    out_message->ContentType("text/plain");
+    channel->BasicPublish("", queue, out_message);
+
+    Envelope::ptr_t envelope;
+    ASSERT_TRUE(channel->BasicGet(envelope, queue));
+    EXPECT_EQ(header + payload, envelope->Message()->Body());
+    EXPECT_EQ("text/plain", envelope->Message()->ContentType());
+}
+
 TEST_F(connected_test, replaced_received_body)
 {
     const std::string queue = channel->DeclareQueue("");
@@ -29,6 +29,10 @@
 
 #include "connected_test.h"
 
+#include <boost/lexical_cast.hpp>
+
+#include <stdexcept>
+
 using namespace AmqpClient;
 
 TEST_F(connected_test, publish_success)
@@ -103,3 +107,60 @@ TEST_F(connected_test, publish_immediate_success)
 
     channel->BasicPublish("", queue, message, true);
 }
+
+TEST_F(connected_test, publish_multi)
+{
+    BasicMessage::ptr_t message = BasicMessage::Create("message body");
+    std::vector<std::string> queues;
+    queues.push_back(channel->DeclareQueue(""));
+    queues.push_back(channel->DeclareQueue(""));
+    queues.push_back(channel->DeclareQueue(""));
+
+    channel->BasicPublishMulti("", queues, message, true);
+
+    for (std::vector<std::string>::const_iterator it = queues.begin(); it != queues.end(); ++it)
+    {
+        Envelope::ptr_t envelope;
+        ASSERT_TRUE(channel->BasicGet(envelope, *it));
+        EXPECT_EQ(message->Body(), envelope->Message()->Body());
+    }
+}
+
+TEST_F(connected_test, publish_multi_mandatory_fail)
+{
+    BasicMessage::ptr_t message = BasicMessage::Create("message body");
+    std::vector<std::string> routing_keys;
+    routing_keys.push_back(channel->DeclareQueue(""));
+    routing_keys.push_back("test_publish_notexist");
+
+    EXPECT_THROW(channel->BasicPublishMulti("", routing_keys, message, true), MessageReturnedException);
+    channel->BasicPublish("", routing_keys[0], message);
+}
+
+TEST_F(connected_test, publish_multi_messages)
+{
+    std::vector<std::string> queues;
+    std::vector<BasicMessage::ptr_t> messages;
+    for (int i = 0; i < 3; ++i)
+    {
+        queues.push_back(channel->DeclareQueue(""));
+        messages.push_back(BasicMessage::Create("message body " + boost::lexical_cast<std::string>(i)));
+    }
+
+    channel->BasicPublishMulti("", queues, messages, true);
+
+    for (std::size_t i = 0; i < queues.size(); ++i)
+    {
+        Envelope::ptr_t envelope;
+        ASSERT_TRUE(channel->BasicGet(envelope, queues[i]));
+        EXPECT_EQ(messages[i]->Body(), envelope->Message()->Body());
+    }
+}
+
+TEST_F(connected_test, publish_multi_messages_size_mismatch)
+{
+    std::vector<std::string> routing_keys(2, "test_publish_notexist");
+    std::vector<BasicMessage::ptr_t> messages(1, BasicMessage::Create("message body"));
+
+    EXPECT_THROW(channel->BasicPublishMulti("", routing_keys, messages), std::invalid_argument);
+}
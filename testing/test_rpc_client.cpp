@@ -0,0 +1,256 @@
+/* vim:set ft=cpp ts=4 sw=4 sts=4 et cindent: */
+/*
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MIT
+ *
+ * Copyright (c) 2010-2013 Alan Antonuk
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "connected_test.h"
+
+#include <boost/lexical_cast.hpp>
+
+using namespace AmqpClient;
+
+TEST_F(connected_test, rpc_many_calls_in_flight)
+{
+    Channel::ptr_t server = Channel::Create(GetBrokerHost());
+    std::string queue = server->DeclareQueue("");
+    std::string consumer = server->BasicConsume(queue, "", true, true, true, 100);
+
+    RpcClient::ptr_t client = RpcClient::Create(channel);
+    std::vector<RpcCall::ptr_t> calls;
+    for (int i = 0; i < 100; ++i)
+    {
+        BasicMessage::ptr_t request = BasicMessage::Create(boost::lexical_cast<std::string>(i));
+        calls.push_back(client->Call(queue, request, 60000));
+        EXPECT_FALSE(request->ReplyToIsSet());
+    }
+    EXPECT_EQ(100u, client->Outstanding());
+
+    // Reply in the opposite order to the requests
+    std::vector<BasicMessage::ptr_t> requests;
+    for (int i = 0; i < 100; ++i)
+    {
+        Envelope::ptr_t envelope;
+        ASSERT_TRUE(server->BasicConsumeMessage(consumer, envelope, 5000));
+        requests.push_back(envelope->Message());
+    }
+    for (std::vector<BasicMessage::ptr_t>::reverse_iterator it = requests.rbegin(); it != requests.rend(); ++it)
+    {
+        BasicMessage::ptr_t reply = BasicMessage::Create("reply to " + (*it)->Body());
+        reply->CorrelationId((*it)->CorrelationId());
+        server->BasicPublish("", (*it)->ReplyTo(), reply);
+    }
+
+    for (int i = 0; i < 100; ++i)
+    {
+        EXPECT_EQ("reply to " + boost::lexical_cast<std::string>(i), calls[i]->Get()->Body());
+        EXPECT_EQ(RpcCall::REPLIED, calls[i]->GetStatus());
+    }
+    EXPECT_EQ(0u, client->Outstanding());
+}
+
+TEST_F(connected_test, rpc_call_timeout)
+{
+    std::string queue = channel->DeclareQueue("");
+    RpcClient::ptr_t client = RpcClient::Create(channel);
+
+    RpcCall::ptr_t call = client->Call(queue, BasicMessage::Create("request"), 10);
+    EXPECT_FALSE(call->Wait(0));
+    EXPECT_THROW(call->Get(), RpcTimeoutException);
+    EXPECT_EQ(RpcCall::TIMED_OUT, call->GetStatus());
+    EXPECT_EQ(0u, client->Outstanding());
+}
+
+TEST_F(connected_test, rpc_call_cancelled)
+{
+    std::string queue = channel->DeclareQueue("");
+    RpcClient::ptr_t client = RpcClient::Create(channel);
+
+    RpcCall::ptr_t call = client->Call(queue, BasicMessage::Create("request"));
+    client.reset();
+    EXPECT_EQ(RpcCall::CANCELLED, call->GetStatus());
+    EXPECT_THROW(call->Get(), std::runtime_error);
+}
+
+TEST_F(connected_test, rpc_reply_queue_types)
+{
+    Channel::ptr_t server = Channel::Create(GetBrokerHost());
+    std::string queue = server->DeclareQueue("");
+    std::string consumer = server->BasicConsume(queue);
+
+    RpcClient::ptr_t direct_client = RpcClient::Create(channel);
+    EXPECT_EQ(Channel::DIRECT_REPLY_TO_QUEUE, direct_client->ReplyQueue());
+    RpcClient::ptr_t queue_client = RpcClient::Create(channel, "", false);
+    EXPECT_NE(Channel::DIRECT_REPLY_TO_QUEUE, queue_client->ReplyQueue());
+
+    RpcClient::ptr_t clients[] = { direct_client, queue_client };
+    for (int i = 0; i < 2; ++i)
+    {
+        RpcCall::ptr_t call = clients[i]->Call(queue, BasicMessage::Create("request"), 5000);
+
+        Envelope::ptr_t envelope;
+        ASSERT_TRUE(server->BasicConsumeMessage(consumer, envelope, 5000));
+        BasicMessage::ptr_t request = envelope->Message();
+        // The broker gives each direct reply-to consumer its own address
+        EXPECT_EQ(0u, request->ReplyTo().find(clients[i]->ReplyQueue()));
+
+        BasicMessage::ptr_t reply = BasicMessage::Create("reply");
+        reply->CorrelationId(request->CorrelationId());
+        server->BasicPublish("", request->ReplyTo(), reply);
+        EXPECT_EQ("reply", call->Get()->Body());
+    }
+}
+
+TEST_F(connected_test, rpc_scatter_gather)
+{
+    Channel::ptr_t server = Channel::Create(GetBrokerHost());
+    const std::string exchange = "rpc_scatter_gather";
+    server->DeclareExchange(exchange, Channel::EXCHANGE_TYPE_FANOUT);
+    std::vector<std::string> consumers;
+    for (int i = 0; i < 3; ++i)
+    {
+        std::string queue = server->DeclareQueue("");
+        server->BindQueue(queue, exchange);
+        consumers.push_back(server->BasicConsume(queue));
+    }
+
+    RpcClient::ptr_t client = RpcClient::Create(channel, exchange);
+    RpcCall::ptr_t all = client->ScatterGather("", BasicMessage::Create("all"), 3, 5000);
+    RpcCall::ptr_t partial = client->ScatterGather("", BasicMessage::Create("partial"), 3, 100);
+    EXPECT_EQ(3u, all->ExpectedReplies());
+
+    // Every shard gets both requests, only two of them answer the second
+    for (int i = 0; i < 3; ++i)
+    {
+        for (int j = 0; j < 2; ++j)
+        {
+            Envelope::ptr_t envelope;
+            ASSERT_TRUE(server->BasicConsumeMessage(consumers[i], envelope, 5000));
+            BasicMessage::ptr_t request = envelope->Message();
+            if ("partial" == request->Body() && 2 == i)
+            {
+                continue;
+            }
+            BasicMessage::ptr_t reply = BasicMessage::Create(boost::lexical_cast<std::string>(i));
+            reply->CorrelationId(request->CorrelationId());
+            server->BasicPublish("", request->ReplyTo(), reply);
+        }
+    }
+
+    EXPECT_TRUE(all->Wait(5000));
+    EXPECT_EQ(RpcCall::REPLIED, all->GetStatus());
+    EXPECT_EQ(3u, all->Replies().size());
+
+    EXPECT_TRUE(partial->Wait(5000));
+    EXPECT_EQ(RpcCall::TIMED_OUT, partial->GetStatus());
+    EXPECT_EQ(2u, partial->Replies().size());
+    EXPECT_THROW(partial->Get(), RpcTimeoutException);
+
+    EXPECT_THROW(client->ScatterGather("", BasicMessage::Create("none"), 0, 100), std::invalid_argument);
+    server->DeleteExchange(exchange);
+}
+
+TEST_F(connected_test, rpc_streaming_reply)
+{
+    Channel::ptr_t server = Channel::Create(GetBrokerHost());
+    std::string queue = server->DeclareQueue("");
+    std::string consumer = server->BasicConsume(queue);
+
+    RpcClient::ptr_t client = RpcClient::Create(channel);
+    RpcCall::ptr_t call = client->CallStreaming(queue, BasicMessage::Create("request"), 5000);
+    EXPECT_TRUE(call->IsStreaming());
+    EXPECT_THROW(call->Get(), std::logic_error);
+
+    Envelope::ptr_t envelope;
+    ASSERT_TRUE(server->BasicConsumeMessage(consumer, envelope, 5000));
+    RpcReplyStream::ptr_t stream = RpcReplyStream::Create(server, envelope->Message());
+
+    // Each part can be read as soon as it has been sent
+    BasicMessage::ptr_t part;
+    for (int i = 0; i < 10; ++i)
+    {
+        stream->Send(BasicMessage::Create(boost::lexical_cast<std::string>(i)));
+        ASSERT_TRUE(call->NextReply(part, 5000));
+        EXPECT_EQ(boost::lexical_cast<std::string>(i), part->Body());
+    }
+    EXPECT_FALSE(call->NextReply(part, 0));
+    EXPECT_FALSE(call->IsReady());
+
+    stream->End();
+    EXPECT_THROW(stream->Send(BasicMessage::Create("late")), std::logic_error);
+    EXPECT_FALSE(call->NextReply(part, 5000));
+    EXPECT_EQ(RpcCall::REPLIED, call->GetStatus());
+    EXPECT_EQ(0u, client->Outstanding());
+}
+
+TEST_F(connected_test, rpc_streaming_reply_out_of_order)
+{
+    Channel::ptr_t server = Channel::Create(GetBrokerHost());
+    std::string queue = server->DeclareQueue("");
+    std::string consumer = server->BasicConsume(queue);
+
+    RpcClient::ptr_t client = RpcClient::Create(channel);
+    RpcCall::ptr_t call = client->CallStreaming(queue, BasicMessage::Create("request"), 5000);
+
+    Envelope::ptr_t envelope;
+    ASSERT_TRUE(server->BasicConsumeMessage(consumer, envelope, 5000));
+    BasicMessage::ptr_t request = envelope->Message();
+
+    // The end marker and parts published by hand in reverse order
+    for (int i = 2; i >= 0; --i)
+    {
+        BasicMessage::ptr_t part = BasicMessage::Create(boost::lexical_cast<std::string>(i));
+        Table headers;
+        headers.insert(TableEntry(RpcReplyStream::SEQUENCE_HEADER, static_cast<boost::int64_t>(i)));
+        if (2 == i)
+        {
+            headers.insert(TableEntry(RpcReplyStream::END_HEADER, true));
+        }
+        part->HeaderTable(headers);
+        part->CorrelationId(request->CorrelationId());
+        server->BasicPublish("", request->ReplyTo(), part);
+    }
+
+    EXPECT_TRUE(call->Wait(5000));
+    EXPECT_EQ(RpcCall::REPLIED, call->GetStatus());
+    BasicMessage::ptr_t part;
+    ASSERT_TRUE(call->NextReply(part, 0));
+    EXPECT_EQ("0", part->Body());
+    ASSERT_TRUE(call->NextReply(part, 0));
+    EXPECT_EQ("1", part->Body());
+    EXPECT_FALSE(call->NextReply(part, 0));
+}
+
+TEST_F(connected_test, rpc_streaming_reply_timeout)
+{
+    std::string queue = channel->DeclareQueue("");
+    RpcClient::ptr_t client = RpcClient::Create(channel);
+
+    RpcCall::ptr_t call = client->CallStreaming(queue, BasicMessage::Create("request"), 10);
+    BasicMessage::ptr_t part;
+    EXPECT_FALSE(call->NextReply(part));
+    EXPECT_EQ(RpcCall::TIMED_OUT, call->GetStatus());
+}
@@ -0,0 +1,130 @@
+/* vim:set ft=cpp ts=4 sw=4 sts=4 et cindent: */
+/*
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MIT
+ *
+ * Copyright (c) 2010-2013 Alan Antonuk
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "connected_test.h"
+
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/thread.hpp>
+
+using namespace AmqpClient;
+
+namespace
+{
+
+BasicMessage::ptr_t Echo(const Envelope::ptr_t &request)
+{
+    return BasicMessage::Create("reply to " + request->Message()->Body());
+}
+
+BasicMessage::ptr_t Fail(const Envelope::ptr_t &)
+{
+    throw std::runtime_error("handler failed");
+}
+
+class rpc_server_test : public connected_test
+{
+public:
+    void StartServer(const RpcServer::handler_t &handler)
+    {
+        // Not exclusive, the server consumes on its own connection
+        queue = channel->DeclareQueue("", false, false, false, false);
+        server = RpcServer::Create(Channel::Create(GetBrokerHost()), Channel::Create(GetBrokerHost()),
+                                   queue, handler, 4);
+        server_thread = boost::thread(boost::bind(&RpcServer::Run, server.get()));
+    }
+
+    virtual void TearDown()
+    {
+        if (server)
+        {
+            server->Stop();
+            server_thread.join();
+        }
+        if (!queue.empty())
+        {
+            channel->DeleteQueue(queue);
+        }
+    }
+
+    std::string queue;
+    RpcServer::ptr_t server;
+    boost::thread server_thread;
+};
+
+} // namespace
+
+TEST_F(rpc_server_test, concurrent_requests)
+{
+    StartServer(&Echo);
+
+    RpcClient::ptr_t client = RpcClient::Create(channel);
+    std::vector<RpcCall::ptr_t> calls;
+    for (int i = 0; i < 100; ++i)
+    {
+        calls.push_back(client->Call(queue, BasicMessage::Create(boost::lexical_cast<std::string>(i)), 10000));
+    }
+    for (int i = 0; i < 100; ++i)
+    {
+        EXPECT_EQ("reply to " + boost::lexical_cast<std::string>(i), calls[i]->Get()->Body());
+    }
+
+    // Every request was acknowledged once its reply was sent
+    server->Stop();
+    server_thread.join();
+    server.reset();
+    Envelope::ptr_t envelope;
+    EXPECT_FALSE(channel->BasicGet(envelope, queue));
+}
+
+TEST_F(rpc_server_test, handler_throws)
+{
+    StartServer(&Fail);
+
+    RpcClient::ptr_t client = RpcClient::Create(channel);
+    RpcCall::ptr_t call = client->Call(queue, BasicMessage::Create("request"), 500);
+    EXPECT_THROW(call->Get(), RpcTimeoutException);
+
+    // The request was rejected rather than requeued
+    Envelope::ptr_t envelope;
+    EXPECT_FALSE(channel->BasicGet(envelope, queue));
+}
+
+TEST_F(rpc_server_test, stop_before_run)
+{
+    // Not exclusive, the server consumes on its own connection
+    queue = channel->DeclareQueue("", false, false, false, false);
+    server = RpcServer::Create(Channel::Create(GetBrokerHost()), Channel::Create(GetBrokerHost()),
+                               queue, &Echo, 1);
+
+    // A Stop made before Run starts isn't lost, Run returns straight away
+    server->Stop();
+    server->Run();
+    server.reset();
+}
@@ -32,6 +32,8 @@
 #include <boost/variant/get.hpp>
 
 #include <algorithm>
+#include <stdexcept>
+#include <type_traits>
 
 using namespace AmqpClient;
 
@@ -527,6 +529,78 @@ TEST(table_value, equality)
     EXPECT_NE(table_val1, table_val3);
 }
 
+TEST(table_value, assign_changes_type)
+{
+    TableValue value(int32_t(32));
+    TableValue string_value("string");
+    TableValue bool_value(true);
+
+    value = string_value;
+    EXPECT_EQ(TableValue::VT_string, value.GetType());
+    EXPECT_EQ("string", value.GetString());
+    EXPECT_THROW(value.GetInt32(), boost::bad_get);
+
+    value = bool_value;
+    EXPECT_EQ(TableValue::VT_bool, value.GetType());
+    EXPECT_TRUE(value.GetBool());
+    EXPECT_THROW(value.GetString(), boost::bad_get);
+
+    value.Set("another string");
+    EXPECT_EQ(TableValue::VT_string, value.GetType());
+    EXPECT_EQ("another string", value.GetString());
+    EXPECT_EQ("string", string_value.GetString());
+}
+
+#ifndef BOOST_NO_RVALUE_REFERENCES
+TEST(table_value, move_construct)
+{
+    TableValue string_value(std::string("A string value"));
+    TableValue moved_string(std::move(string_value));
+    EXPECT_EQ(TableValue::VT_string, moved_string.GetType());
+    EXPECT_EQ("A string value", moved_string.GetString());
+    EXPECT_EQ(TableValue::VT_void, string_value.GetType());
+
+    TableValue int_value(int64_t(64));
+    TableValue moved_int(std::move(int_value));
+    EXPECT_EQ(TableValue::VT_int64, moved_int.GetType());
+    EXPECT_EQ(64, moved_int.GetInt64());
+
+    Table table;
+    table.insert(TableEntry("key", "value"));
+    TableValue table_value(std::move(table));
+    EXPECT_EQ(TableValue::VT_table, table_value.GetType());
+    EXPECT_EQ(1, table_value.GetTable().size());
+}
+
+TEST(table_value, move_assign)
+{
+    Array array;
+    array.push_back(TableValue(int8_t(1)));
+    array.push_back(TableValue("two"));
+
+    TableValue value;
+    value = TableValue(std::move(array));
+    EXPECT_EQ(TableValue::VT_array, value.GetType());
+    EXPECT_EQ(2, value.GetArray().size());
+
+    TableValue other(true);
+    other = std::move(value);
+    EXPECT_EQ(TableValue::VT_array, other.GetType());
+    EXPECT_EQ(TableValue::VT_void, value.GetType());
+
+    other.Set(std::string("string"));
+    EXPECT_EQ(TableValue::VT_string, other.GetType());
+    EXPECT_EQ("string", other.GetString());
+}
+
+TEST(table_value, move_is_noexcept)
+{
+    // Lets std::vector move rather than copy Array elements when it grows
+    EXPECT_TRUE(std::is_nothrow_move_constructible<TableValue>::value);
+    EXPECT_TRUE(std::is_nothrow_move_assignable<TableValue>::value);
+}
+#endif
+
 TEST(table, convert_to_rabbitmq)
 {
     Table table_in;
@@ -573,6 +647,305 @@ TEST(table, convert_to_rabbitmq_empty)
     EXPECT_EQ(0, table_out.size());
 }
 
+TEST(table, convert_to_rabbitmq_replace)
+{
+    Table table1;
+    table1.insert(TableEntry("string_key", "A string!"));
+    table1.insert(TableEntry("int_key", int32_t(32)));
+
+    Table table2(table1);
+    table2["int_key"] = int32_t(64);
+
+    BasicMessage::ptr_t message = BasicMessage::Create();
+    message->HeaderTable(table1);
+    message->HeaderTable(table1);
+
+    Table table_out = message->HeaderTable();
+    EXPECT_EQ(table1.size(), table_out.size());
+    EXPECT_TRUE(std::equal(table1.begin(), table1.end(), table_out.begin()));
+
+    message->HeaderTable(table2);
+    table_out = message->HeaderTable();
+    EXPECT_EQ(table2.size(), table_out.size());
+    EXPECT_TRUE(std::equal(table2.begin(), table2.end(), table_out.begin()));
+}
+
+TEST(header_view, lookup)
+{
+    Table table_inner;
+    table_inner.insert(TableEntry("inner_string", "An inner table"));
+
+    Table table_in;
+    table_in.insert(TableEntry("bool_key", true));
+    table_in.insert(TableEntry("int16_key", int16_t(16)));
+    table_in.insert(TableEntry("double_key", double(2.25)));
+    table_in.insert(TableEntry("x-trace-id", "abc123"));
+    table_in.insert(TableEntry("table_key", table_inner));
+
+    BasicMessage::ptr_t message = BasicMessage::Create();
+    message->HeaderTable(table_in);
+
+    HeaderView view = message->HeaderTableView();
+    EXPECT_EQ(table_in.size(), view.Size());
+    EXPECT_TRUE(view.IsSet("x-trace-id"));
+    EXPECT_FALSE(view.IsSet("x-trace"));
+
+    EXPECT_EQ(TableValue::VT_string, view.GetType("x-trace-id"));
+    EXPECT_EQ("abc123", view.GetString("x-trace-id"));
+    EXPECT_TRUE(view.GetBool("bool_key"));
+    EXPECT_EQ(16, view.GetInteger("int16_key"));
+    EXPECT_EQ(2.25, view.GetReal("double_key"));
+    EXPECT_EQ("An inner table", view.GetTable("table_key").GetString("inner_string"));
+    EXPECT_EQ(TableValue(table_inner), view.GetValue("table_key"));
+
+    EXPECT_THROW(view.GetInteger("x-trace-id"), boost::bad_get);
+    EXPECT_THROW(view.GetString("missing"), std::out_of_range);
+
+    Table table_out = view.ToTable();
+    EXPECT_TRUE(std::equal(table_in.begin(), table_in.end(), table_out.begin()));
+}
+
+TEST(header_view, outlives_message_headers)
+{
+    Table table_in;
+    table_in.insert(TableEntry("x-trace-id", "abc123"));
+
+    BasicMessage::ptr_t message = BasicMessage::Create();
+    message->HeaderTable(table_in);
+    HeaderView view = message->HeaderTableView();
+
+    table_in["x-trace-id"] = "def456";
+    message->HeaderTable(table_in);
+    message.reset();
+
+    EXPECT_EQ("abc123", view.GetString("x-trace-id"));
+}
+
+TEST(header_view, empty)
+{
+    BasicMessage::ptr_t message = BasicMessage::Create();
+    HeaderView view = message->HeaderTableView();
+    EXPECT_TRUE(view.Empty());
+    EXPECT_FALSE(view.IsSet("x-trace-id"));
+}
+
+namespace
+{
+
+struct TestHeaders
+{
+    TestHeaders()
+        : bool_field(false), int8_field(0), int16_field(0), int32_field(0),
+          int64_field(0), float_field(0.f), double_field(0.)
+    {}
+
+    bool bool_field;
+    boost::int8_t int8_field;
+    boost::int16_t int16_field;
+    boost::int32_t int32_field;
+    boost::int64_t int64_field;
+    float float_field;
+    double double_field;
+    std::string string_field;
+
+    template <class Fields>
+    void Headers(Fields &fields)
+    {
+        fields("bool_key", bool_field)
+        ("int8_key", int8_field)
+        ("int16_key", int16_field)
+        ("int32_key", int32_field)
+        ("int64_key", int64_field)
+        ("float_key", float_field)
+        ("double_key", double_field)
+        ("string_key", string_field);
+    }
+};
+
+struct PartialHeaders
+{
+    PartialHeaders() : int64_field(0) {}
+
+    std::string string_field;
+    boost::int64_t int64_field;
+
+    template <class Fields>
+    void Headers(Fields &fields)
+    {
+        fields("string_key", string_field)("int32_key", int64_field);
+    }
+};
+
+struct LiteralHeaders
+{
+    const char *type;
+
+    template <class Fields>
+    void Headers(Fields &fields)
+    {
+        fields("type", type)("format", "pdf");
+    }
+};
+
+} // namespace
+
+TEST(header_schema, write_string_literals)
+{
+    LiteralHeaders headers_in;
+    headers_in.type = "order";
+
+    BasicMessage::ptr_t message = BasicMessage::Create();
+    WriteHeaders(*message, headers_in);
+
+    Table table = message->HeaderTable();
+    EXPECT_EQ(TableValue("order"), table["type"]);
+    EXPECT_EQ(TableValue("pdf"), table["format"]);
+}
+
+TEST(header_schema, roundtrip)
+{
+    TestHeaders headers_in;
+    headers_in.bool_field = true;
+    headers_in.int8_field = 8;
+    headers_in.int16_field = 16;
+    headers_in.int32_field = 32;
+    headers_in.int64_field = 64;
+    headers_in.float_field = 1.5;
+    headers_in.double_field = 2.25;
+    headers_in.string_field = "A string!";
+
+    BasicMessage::ptr_t message = BasicMessage::Create();
+    WriteHeaders(*message, headers_in);
+    EXPECT_TRUE(message->HeaderTableIsSet());
+
+    TestHeaders headers_out;
+    ReadHeaders(*message, headers_out);
+    EXPECT_EQ(headers_in.bool_field, headers_out.bool_field);
+    EXPECT_EQ(headers_in.int8_field, headers_out.int8_field);
+    EXPECT_EQ(headers_in.int16_field, headers_out.int16_field);
+    EXPECT_EQ(headers_in.int32_field, headers_out.int32_field);
+    EXPECT_EQ(headers_in.int64_field, headers_out.int64_field);
+    EXPECT_EQ(headers_in.float_field, headers_out.float_field);
+    EXPECT_EQ(headers_in.double_field, headers_out.double_field);
+    EXPECT_EQ(headers_in.string_field, headers_out.string_field);
+
+    Table table = message->HeaderTable();
+    EXPECT_EQ(8u, table.size());
+    EXPECT_EQ(TableValue(int32_t(32)), table["int32_key"]);
+    EXPECT_EQ(TableValue("A string!"), table["string_key"]);
+}
+
+TEST(header_schema, read_from_table)
+{
+    Table table_in;
+    table_in.insert(TableEntry("int32_key", int32_t(32)));
+    table_in.insert(TableEntry("other_key", true));
+    table_in.insert(TableEntry("string_key", "A string!"));
+
+    BasicMessage::ptr_t message = BasicMessage::Create();
+    message->HeaderTable(table_in);
+
+    PartialHeaders headers_out;
+    ReadHeaders(*message, headers_out);
+    EXPECT_EQ("A string!", headers_out.string_field);
+    EXPECT_EQ(32, headers_out.int64_field);
+}
+
+TEST(header_schema, read_errors)
+{
+    BasicMessage::ptr_t message = BasicMessage::Create();
+    PartialHeaders headers_out;
+    EXPECT_THROW(ReadHeaders(*message, headers_out), std::out_of_range);
+
+    Table table_in;
+    table_in.insert(TableEntry("int32_key", "not an integer"));
+    table_in.insert(TableEntry("string_key", "A string!"));
+    message->HeaderTable(table_in);
+    EXPECT_THROW(ReadHeaders(*message, headers_out), boost::bad_get);
+}
+
+TEST(encoded_table, attach_to_messages)
+{
+    Table table_in;
+    table_in.insert(TableEntry("format", "pdf"));
+    table_in.insert(TableEntry("type", "report"));
+    table_in.insert(TableEntry("int32_key", int32_t(32)));
+
+    EncodedTable::ptr_t encoded = EncodedTable::Create(table_in);
+
+    BasicMessage::ptr_t message1 = BasicMessage::Create();
+    BasicMessage::ptr_t message2 = BasicMessage::Create();
+    message1->HeaderTable(*encoded);
+    message2->HeaderTable(*encoded);
+    encoded.reset();
+
+    EXPECT_TRUE(message1->HeaderTableIsSet());
+    Table table_out = message1->HeaderTable();
+    EXPECT_EQ(table_in.size(), table_out.size());
+    EXPECT_TRUE(std::equal(table_in.begin(), table_in.end(), table_out.begin()));
+
+    // Replacing the headers of one message leaves the other's alone
+    Table table_other;
+    table_other.insert(TableEntry("format", "zip"));
+    message1->HeaderTable(table_other);
+    EXPECT_EQ("pdf", message2->HeaderTableView().GetString("format"));
+}
+
+TEST(encoded_table, wire_bytes_roundtrip)
+{
+    Table table_in;
+    table_in.insert(TableEntry("bool_key", true));
+    table_in.insert(TableEntry("string_key", "A string!"));
+
+    EncodedTable::ptr_t encoded = EncodedTable::Create(table_in);
+    EncodedTable::ptr_t decoded = EncodedTable::CreateFromWireBytes(encoded->WireBytes());
+
+    EXPECT_EQ(encoded->WireBytes(), decoded->WireBytes());
+    Table table_out = decoded->ToTable();
+    EXPECT_EQ(table_in.size(), table_out.size());
+    EXPECT_TRUE(std::equal(table_in.begin(), table_in.end(), table_out.begin()));
+}
+
+TEST(encoded_table, wire_bytes_from_temporary)
+{
+    Table table_in;
+    table_in.insert(TableEntry("string_key", "A string!"));
+    const std::string wire_bytes = EncodedTable::Create(table_in)->WireBytes();
+
+    // The table must not refer to the buffer it was decoded from, overwrite
+    // the temporary's storage before reading the table back
+    EncodedTable::ptr_t decoded = EncodedTable::CreateFromWireBytes(std::string(wire_bytes));
+    std::string clobber(wire_bytes.size(), 'x');
+    HeaderView view = decoded->View();
+
+    EXPECT_EQ("A string!", view.GetString("string_key").to_string());
+    Table table_out = decoded->ToTable();
+    EXPECT_TRUE(std::equal(table_in.begin(), table_in.end(), table_out.begin()));
+}
+
+TEST_F(connected_test, encoded_table_from_temporary_publish)
+{
+    Table table_in;
+    table_in.insert(TableEntry("string_key", "A string!"));
+    const std::string wire_bytes = EncodedTable::Create(table_in)->WireBytes();
+
+    BasicMessage::ptr_t message = BasicMessage::Create("body");
+    message->HeaderTable(*EncodedTable::CreateFromWireBytes(std::string(wire_bytes)));
+    std::string clobber(wire_bytes.size(), 'x');
+
+    std::string queue = channel->DeclareQueue("");
+    channel->BasicPublish("", queue, message);
+    Envelope::ptr_t envelope;
+    ASSERT_TRUE(channel->BasicGet(envelope, queue));
+    Table table_out = envelope->Message()->HeaderTable();
+    EXPECT_TRUE(std::equal(table_in.begin(), table_in.end(), table_out.begin()));
+}
+
+TEST(encoded_table, invalid_wire_bytes)
+{
+    EXPECT_THROW(EncodedTable::CreateFromWireBytes(std::string("\0\0\0\x10", 4)), AmqpLibraryException);
+}
+
 TEST_F(connected_test, basic_message_header_roundtrip)
 {
     Table table_in;
@@ -0,0 +1,123 @@
+/* vim:set ft=cpp ts=4 sw=4 sts=4 et cindent: */
+/*
+ * ***** BEGIN LICENSE BLOCK *****
+ * Version: MIT
+ *
+ * Copyright (c) 2010-2013 Alan Antonuk
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * ***** END LICENSE BLOCK *****
+ */
+
+#include "connected_test.h"
+
+#include <boost/bind.hpp>
+#include <boost/chrono.hpp>
+#include <boost/thread/thread.hpp>
+
+using namespace AmqpClient;
+
+namespace
+{
+
+void Count(int *count)
+{
+    ++*count;
+}
+
+void SleepFor(int milliseconds)
+{
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(milliseconds));
+}
+
+} // namespace
+
+TEST(timer_wheel, expires_in_order)
+{
+    TimerWheel timers;
+    EXPECT_EQ(-1, timers.MillisecondsUntilNext());
+
+    int soon = 0;
+    int later = 0;
+    timers.Schedule(5, boost::bind(&Count, &soon));
+    timers.Schedule(150, boost::bind(&Count, &later));
+    EXPECT_EQ(2u, timers.Size());
+    EXPECT_EQ(0u, timers.Advance());
+    EXPECT_GE(6, timers.MillisecondsUntilNext());
+
+    SleepFor(20);
+    EXPECT_EQ(1u, timers.Advance());
+    EXPECT_EQ(1, soon);
+    EXPECT_EQ(0, later);
+    // The later timer is on a higher level of the wheel, it mustn't be
+    // waited for past its deadline
+    EXPECT_LT(0, timers.MillisecondsUntilNext());
+    EXPECT_GE(131, timers.MillisecondsUntilNext());
+
+    SleepFor(150);
+    EXPECT_EQ(1u, timers.Advance());
+    EXPECT_EQ(1, later);
+    EXPECT_EQ(0u, timers.Size());
+}
+
+TEST(timer_wheel, cancel)
+{
+    TimerWheel timers;
+    int count = 0;
+    TimerWheel::timer_id_t timer = timers.Schedule(0, boost::bind(&Count, &count));
+    EXPECT_TRUE(timers.Cancel(timer));
+    EXPECT_FALSE(timers.Cancel(timer));
+
+    SleepFor(5);
+    EXPECT_EQ(0u, timers.Advance());
+    EXPECT_EQ(0, count);
+}
+
+TEST(timer_wheel, many_timers)
+{
+    TimerWheel timers;
+    int count = 0;
+    std::vector<TimerWheel::timer_id_t> ids;
+    for (int i = 0; i < 10000; ++i)
+    {
+        ids.push_back(timers.Schedule(i % 100, boost::bind(&Count, &count)));
+    }
+    for (int i = 0; i < 10000; i += 2)
+    {
+        timers.Cancel(ids[i]);
+    }
+
+    SleepFor(110);
+    EXPECT_EQ(5000u, timers.Advance());
+    EXPECT_EQ(5000, count);
+}
+
+TEST_F(connected_test, timers_run_while_consuming)
+{
+    std::string queue = channel->DeclareQueue("");
+    std::string consumer = channel->BasicConsume(queue);
+
+    int count = 0;
+    channel->Timers().Schedule(10, boost::bind(&Count, &count));
+    Envelope::ptr_t envelope;
+    EXPECT_FALSE(channel->BasicConsumeMessage(consumer, envelope, 100));
+    EXPECT_EQ(1, count);
+}